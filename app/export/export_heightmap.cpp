@@ -96,7 +96,7 @@ void ExportHeightmapWorker::async()
         d16_rows[i] = &d16[r.ni * i];
 
     memset(d16, 0, r.ni * r.nj * sizeof(uint16_t));
-    render16(shape.tree.get(), r, d16_rows, &halt, NULL);
+    render16_parallel(shape.getTree().get(), r, d16_rows, &halt, NULL, 0, NULL);
 
     // These bounds will be stored to give the .png real-world units.
     float bounds[6] = {
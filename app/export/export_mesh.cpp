@@ -83,7 +83,12 @@ void ExportMeshWorker::async()
             &r, bounds.xmin, bounds.ymin, bounds.zmin,
                 bounds.xmax, bounds.ymax, bounds.zmax);
 
-    triangulate(shape.tree.get(), r, _detect_features, &halt, &verts, &count);
+    if (dual)
+        triangulate_dual(shape.getTree().get(), r, &halt,
+                         &verts, &count, tolerance);
+    else
+        triangulate_parallel(shape.getTree().get(), r, _detect_features,
+                             &halt, &verts, &count, 0, tolerance);
 
     save_stl(verts, count, _filename.toStdString().c_str());
     free_arrays(&r);
@@ -10,8 +10,10 @@
 class ExportMeshWorker : public ExportWorker
 {
 public:
-    explicit ExportMeshWorker(Shape s, Bounds b, QString f, float r, bool d)
-        : ExportWorker(s, b, f, r), detect_features(d) {}
+    explicit ExportMeshWorker(Shape s, Bounds b, QString f, float r, bool d,
+                              float t, bool dual)
+        : ExportWorker(s, b, f, r), detect_features(d), tolerance(t),
+          dual(dual) {}
 
     /*
      *  Top-level function that accepts user input and start the export
@@ -28,6 +30,8 @@ protected:
      *  Call-time settings
      */
     const bool detect_features;
+    const float tolerance;
+    const bool dual;
 
     /*
      *  Run-time, set by dialogs
@@ -71,9 +71,19 @@ object ScriptExportHooks::stl(tuple args, dict kwargs)
             get_object("filename", kwargs, ""));
     const float resolution = get_object("resolution", kwargs, -1);
     const bool detect_features = get_object("detect_features", kwargs, false);
+    const float tolerance = get_object<float>("tolerance", kwargs, 0);
+    if (tolerance < 0)
+        throw AppHooks::Exception("tolerance cannot be negative.");
+
+    const std::string mesher = get_object<std::string>(
+            "mesher", kwargs, "tetrahedra");
+    if (mesher != "tetrahedra" && mesher != "dual")
+        throw AppHooks::Exception(
+                "mesher must be 'tetrahedra' or 'dual'.");
 
     self->proxy->setExportWorker(new ExportMeshWorker(
-                shape, bounds, filename, resolution, detect_features));
+                shape, bounds, filename, resolution, detect_features,
+                tolerance, mesher == "dual"));
     return object();
 }
 
@@ -49,7 +49,8 @@ BOOST_PYTHON_MODULE(_AppHooks)
     class_<ScriptExportHooks>("ScriptExportHooks", init<>())
         .def("stl", raw_function(&ScriptExportHooks::stl),
                 "stl(shape, bounds=None, pad=True, filename=None,\n"
-                "    resolution=None, detect_features=False)\n"
+                "    resolution=None, detect_features=False, tolerance=0,\n"
+                "    mesher='tetrahedra')\n"
                 "    Registers a .stl exporter for the given shape.\n"
                 "    Valid kwargs:\n"
                 "    bounds is either a fab.types.Bounds object or None.\n"
@@ -60,7 +61,15 @@ BOOST_PYTHON_MODULE(_AppHooks)
                 "      If None, a dialog will open to select a file.\n"
                 "    resolution sets the resolution.\n"
                 "      If None, a dialog will open to select the resolution.\n"
-                "    detect_features enables feature detection (experimental)"
+                "    detect_features enables feature detection (experimental)\n"
+                "    tolerance sets how close vertices are placed to the\n"
+                "      surface (in the shape's units).  If it is 0, vertices\n"
+                "      are placed with a fixed binary search instead.\n"
+                "    mesher is 'tetrahedra' or 'dual'.  The dual contouring\n"
+                "      mesher keeps sharp features on its own (ignoring\n"
+                "      detect_features) and merges voxels on flat or smooth\n"
+                "      surfaces, where tolerance is how far vertices may be\n"
+                "      from the surface."
                 )
         .def("heightmap", raw_function(&ScriptExportHooks::heightmap),
                 "heightmap(shape, bounds=None, pad=True, filename=None,\n"
@@ -1,5 +1,4 @@
 #include <boost/python.hpp>
-#include <boost/format.hpp>
 
 #include "viewport/render/task.h"
 #include "viewport/render/instance.h"
@@ -9,11 +8,20 @@
 #include "fab/tree/render.h"
 
 RenderTask::RenderTask(RenderInstance* parent, PyObject* s, QMatrix4x4 M,
-                       QVector2D clip, int refinement)
+                       QVector2D clip, int refinement,
+                       const RenderTask* previous)
     : shape(s), M(M), clip(clip), refinement(refinement)
 {
     Py_INCREF(shape);
 
+    // Keep the previous pass's depth map to seed this render
+    if (previous)
+    {
+        depth16 = previous->depth16;
+        depth16_width = previous->depth16_width;
+        depth16_height = previous->depth16_height;
+    }
+
     future = QtConcurrent::run(this, &RenderTask::async);
     watcher.setFuture(future);
 
@@ -34,7 +42,7 @@ void RenderTask::halt()
 RenderTask* RenderTask::getNext(RenderInstance* parent) const
 {
     return refinement > 1
-        ? new RenderTask(parent, shape, M, clip, refinement - 1)
+        ? new RenderTask(parent, shape, M, clip, refinement - 1, this)
         : NULL;
 }
 
@@ -76,10 +84,10 @@ void RenderTask::async()
 
 void RenderTask::render3d(const Shape& s)
 {
-    Transform T = getTransform(M);
-    Shape transformed = s.map(T);
+    float T[16];
+    getTransform(M, T);
 
-    Bounds b = render(&transformed, transformed.bounds, 1.0 / refinement);
+    Bounds b = render(s, T, mapBounds(s.bounds, M), 1.0 / refinement);
 
     {   // Apply a transform-less mapping to the bounds
         auto m = M;
@@ -106,19 +114,15 @@ void RenderTask::render2d(const Shape& s)
     matrix_flat(2, 1) = 0;
     matrix_flat(2, 2) = 1;
 
-    Shape s_flat(s.math, Bounds(s.bounds.xmin, s.bounds.ymin, 0,
-                                s.bounds.xmax, s.bounds.ymax, 0));
-
-    Transform T_flat = getTransform(matrix_flat);
-    Shape transformed = s_flat.map(T_flat);
+    float T_flat[16];
+    getTransform(matrix_flat, T_flat);
 
     // Render the flattened shape, but with bounds equivalent to the shape's
     // position in a 3D bounding box.
-    Bounds b3d_ = Bounds(s.bounds.xmin, s.bounds.ymin, 0,
-                         s.bounds.xmax, s.bounds.ymax, 0.0001).
-                 map(getTransform(M));
+    Bounds b3d_ = mapBounds(Bounds(s.bounds.xmin, s.bounds.ymin, 0,
+                                   s.bounds.xmax, s.bounds.ymax, 0.0001), M);
 
-    Bounds b3d = render(&transformed, b3d_, 1.0 / refinement);
+    Bounds b3d = render(s, T_flat, b3d_, 1.0 / refinement);
 
     {   // Apply a transform-less mapping to the bounds
         auto m = M;
@@ -167,31 +171,58 @@ void RenderTask::render2d(const Shape& s)
     flat = true;
 }
 
-Transform RenderTask::getTransform(QMatrix4x4 m)
+void RenderTask::getTransform(QMatrix4x4 m, float T[16])
 {
+    // Screen-space translation is handled by clipping in render,
+    // so only the linear part of the inverse matrix is used.
     QMatrix4x4 mf = m.inverted();
-    QMatrix4x4 mi = mf.inverted();
-
-    Transform T = Transform(
-                (boost::format("++*Xf%g*Yf%g*Zf%g") %
-                    mf(0,0) % mf(0,1) % mf(0,2)).str(),
-                (boost::format("++*Xf%g*Yf%g*Zf%g") %
-                    mf(1,0) % mf(1,1) % mf(1,2)).str(),
-                (boost::format("++*Xf%g*Yf%g*Zf%g") %
-                    mf(2,0) % mf(2,1) % mf(2,2)).str(),
-                (boost::format("++*Xf%g*Yf%g*Zf%g") %
-                    mi(0,0) % mi(0,1) % mi(0,2)).str(),
-                (boost::format("++*Xf%g*Yf%g*Zf%g") %
-                    mi(1,0) % mi(1,1) % mi(1,2)).str(),
-                (boost::format("++*Xf%g*Yf%g*Zf%g") %
-                    mi(2,0) % mi(2,1) % mi(2,2)).str());
-
-    return T;
+
+    for (int i=0; i < 3; ++i)
+    {
+        for (int j=0; j < 3; ++j)
+            T[i*4 + j] = mf(i, j);
+        T[i*4 + 3] = 0;
+    }
+    T[12] = 0;
+    T[13] = 0;
+    T[14] = 0;
+    T[15] = 1;
+}
+
+Bounds RenderTask::mapBounds(const Bounds& b, QMatrix4x4 m)
+{
+    const float lower[3] = {b.xmin, b.ymin, b.zmin};
+    const float upper[3] = {b.xmax, b.ymax, b.zmax};
+    float out_lower[3] = {0, 0, 0};
+    float out_upper[3] = {0, 0, 0};
+
+    // Interval arithmetic on the linear part of the matrix
+    for (int i=0; i < 3; ++i)
+    {
+        for (int j=0; j < 3; ++j)
+        {
+            const float k = m(i, j);
+            if (k > 0)
+            {
+                out_lower[i] += k * lower[j];
+                out_upper[i] += k * upper[j];
+            }
+            else if (k < 0)
+            {
+                out_lower[i] += k * upper[j];
+                out_upper[i] += k * lower[j];
+            }
+        }
+    }
+
+    return Bounds(out_lower[0], out_lower[1], out_lower[2],
+                  out_upper[0], out_upper[1], out_upper[2]);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-Bounds RenderTask::render(Shape* shape, Bounds b_, float scale)
+Bounds RenderTask::render(const Shape& s, const float T[16],
+                          Bounds b_, float scale)
 {
     // Screen-space clipping:
     // x and y are clipped to the window;
@@ -221,9 +252,30 @@ Bounds RenderTask::render(Shape* shape, Bounds b_, float scale)
         d16_rows[i] = &d16[depth.width() * i];
         s8_rows[i] = &s8[depth.width() * i];
     }
-    memset(d16, 0, depth.width() * depth.height() * 2);
     memset(s8, 0, depth.width() * depth.height() * 3);
 
+    // Upsample the previous pass's depth map (if there is one) to use as
+    // a guess; the seeded renderer checks every guess, so the result is
+    // the same as a render from scratch.
+    const bool seeded = !depth16.empty() &&
+                        depth16_width && depth16_height;
+    if (seeded)
+    {
+        for (int j=0; j < depth.height(); ++j)
+        {
+            const int y = j * depth16_height / depth.height();
+            for (int i=0; i < depth.width(); ++i)
+            {
+                const int x = i * depth16_width / depth.width();
+                d16_rows[j][i] = depth16[y * depth16_width + x];
+            }
+        }
+    }
+    else
+    {
+        memset(d16, 0, depth.width() * depth.height() * 2);
+    }
+
     Region r = (Region) {
             .imin=0, .jmin=0, .kmin=0,
             .ni=(uint32_t)depth.width(), .nj=(uint32_t)depth.height(),
@@ -232,11 +284,22 @@ Bounds RenderTask::render(Shape* shape, Bounds b_, float scale)
 
     build_arrays(&r, b.xmin, b.ymin, b.zmin,
                      b.xmax, b.ymax, b.zmax);
-    render16(shape->tree.get(), r, d16_rows, &halt_flag, nullptr);
-    shaded8(shape->tree.get(), r, d16_rows, s8_rows, &halt_flag, nullptr);
+    auto tree = s.getTree();
+    if (seeded)
+        render16_seeded_parallel(tree.get(), r, d16_rows, &halt_flag,
+                                 nullptr, 0, T);
+    else
+        render16_parallel(tree.get(), r, d16_rows, &halt_flag,
+                          nullptr, 0, T);
+    shaded8(tree.get(), r, d16_rows, s8_rows, &halt_flag, nullptr, T);
 
     free_arrays(&r);
 
+    // Save the depth map to seed the next pass
+    depth16.assign(d16, d16 + depth.width() * depth.height());
+    depth16_width = depth.width();
+    depth16_height = depth.height();
+
     // Copy from bitmap arrays into a QImage
     for (int j=0; j < depth.height(); ++j)
     {
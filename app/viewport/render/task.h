@@ -9,7 +9,8 @@
 #include <QVector2D>
 #include <QColor>
 
-#include "fab/types/transform.h"
+#include <vector>
+
 #include "fab/types/bounds.h"
 
 class RenderInstance;
@@ -20,7 +21,8 @@ class RenderTask : public QObject
 Q_OBJECT
 public:
     RenderTask(RenderInstance* parent, PyObject* s, QMatrix4x4 M,
-               QVector2D clip, int refinement=1);
+               QVector2D clip, int refinement=1,
+               const RenderTask* previous=NULL);
     ~RenderTask();
 
     /*
@@ -48,14 +50,21 @@ protected:
 
     /*
      *  Renders a shape, storing results in depth and shaded
-     *  Returns screen-clipped bounds
+     *  T maps screen coordinates into the shape's coordinates
+     *  (as a row-major 4x4 matrix).  Returns screen-clipped bounds
      */
-    Bounds render(Shape* shape, Bounds b, float scale);
+    Bounds render(const Shape& s, const float T[16], Bounds b, float scale);
 
     /*
-     *  Converts the given matrix into a Transform
+     *  Converts the given matrix into a row-major matrix that maps
+     *  screen coordinates into model coordinates
      */
-    static Transform getTransform(QMatrix4x4 m);
+    static void getTransform(QMatrix4x4 m, float T[16]);
+
+    /*
+     *  Maps model-space bounds into screen space
+     */
+    static Bounds mapBounds(const Bounds& b, QMatrix4x4 m);
 
     PyObject* shape;
     QMatrix4x4 M;
@@ -79,6 +88,12 @@ protected:
     /*  Flag used to abort rendering asynchronously  */
     int halt_flag=0;
 
+    /*  16-bit depth map from this render (or the previous pass's map,
+     *  which seeds this render if it isn't empty)  */
+    std::vector<uint16_t> depth16;
+    int depth16_width=0;
+    int depth16_height=0;
+
     /*  Render time (used to decide how to adjust starting refinement  */
     int render_time=-1;
 
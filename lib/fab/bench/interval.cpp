@@ -0,0 +1,147 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "fab/tree/tree.h"
+#include "fab/tree/tape.h"
+#include "fab/tree/context.h"
+#include "fab/tree/eval.h"
+#include "fab/tree/parser.h"
+#include "fab/tree/render.h"
+#include "fab/util/region.h"
+
+#include "saved_shapes.h"
+
+/*
+ *  Compares interval and affine arithmetic on the shapes saved in .sb
+ *  files (such as the examples directory), reporting how many boxes an octree
+ *  subdivision evaluates before it reaches the surface and how long a
+ *  full render takes with each mode.
+ */
+
+// Subdivides a box into octants (or quadrants for flat shapes), counting
+// every evaluation, until the box is unambiguous or the depth runs out.
+static unsigned long subdivide(EvalContext* ctx, const float* b,
+                               bool flat, unsigned depth)
+{
+    const Interval r = eval_i(ctx, {b[0], b[3]}, {b[1], b[4]},
+                                   {b[2], b[5]});
+    if (r.lower > 0 || r.upper < 0 || depth == 0)
+        return 1;
+
+    unsigned long count = 1;
+    disable_nodes(ctx);
+    const float mid[3] = {(b[0] + b[3]) / 2, (b[1] + b[4]) / 2,
+                          (b[2] + b[5]) / 2};
+    for (int q=0; q < (flat ? 4 : 8); ++q)
+    {
+        float sub[6];
+        for (int a=0; a < 3; ++a)
+        {
+            const bool upper = q & (1 << a);
+            sub[a] = upper ? mid[a] : b[a];
+            sub[a + 3] = upper ? b[a + 3] : mid[a];
+        }
+        if (flat)
+        {
+            sub[2] = b[2];
+            sub[5] = b[5];
+        }
+        count += subdivide(ctx, sub, flat, depth - 1);
+    }
+    enable_nodes(ctx);
+    return count;
+}
+
+// Renders the shape's bounds with the given context, returning the
+// time taken in milliseconds.
+static double render(EvalContext* ctx, const SavedShape& s, unsigned res)
+{
+    const float size = fmax(s.bounds[3] - s.bounds[0],
+                            s.bounds[4] - s.bounds[1]);
+    Region r;
+    memset(&r, 0, sizeof(r));
+    r.ni = fmax(1, res * (s.bounds[3] - s.bounds[0]) / size);
+    r.nj = fmax(1, res * (s.bounds[4] - s.bounds[1]) / size);
+    r.nk = s.flat ? 1 : fmax(1, res * (s.bounds[5] - s.bounds[2]) / size);
+    build_arrays(&r, s.bounds[0], s.bounds[1], s.bounds[2],
+                     s.bounds[3], s.bounds[4], s.bounds[5]);
+
+    std::vector<uint16_t> img(r.ni * r.nj, 0);
+    std::vector<uint16_t*> rows(r.nj);
+    for (unsigned j=0; j < r.nj; ++j)
+        rows[j] = &img[j * r.ni];
+
+    int halt = 0;
+    const auto start = std::chrono::steady_clock::now();
+    render16_ctx(ctx, r, rows.data(), &halt, NULL);
+    const auto end = std::chrono::steady_clock::now();
+
+    free_arrays(&r);
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s [--res N] [--depth N] file.sb ...\n",
+                argv[0]);
+        return 1;
+    }
+
+    unsigned res = 512, depth = 7;
+    printf("%-14s %8s %12s %12s %10s %10s\n", "shape", "clauses",
+           "boxes (i)", "boxes (a)", "ms (i)", "ms (a)");
+
+    for (int arg=1; arg < argc; ++arg)
+    {
+        if (!strcmp(argv[arg], "--res") && arg + 1 < argc)
+        {
+            res = atoi(argv[++arg]);
+            continue;
+        }
+        else if (!strcmp(argv[arg], "--depth") && arg + 1 < argc)
+        {
+            depth = atoi(argv[++arg]);
+            continue;
+        }
+
+        const char* name = strrchr(argv[arg], '/');
+        name = name ? name + 1 : argv[arg];
+
+        const auto shapes = load_shapes(argv[arg]);
+        for (unsigned i=0; i < shapes.size(); ++i)
+        {
+            MathTree* tree = parse(shapes[i].math.c_str());
+            if (tree == NULL)
+            {
+                fprintf(stderr, "%s: failed to parse shape %u\n", name, i);
+                continue;
+            }
+
+            unsigned long boxes[2];
+            double ms[2];
+            for (int mode=0; mode < 2; ++mode)
+            {
+                EvalContext* ctx = new_context(tree);
+                ctx->affine = mode;
+                boxes[mode] = subdivide(ctx, shapes[i].bounds,
+                                        shapes[i].flat, depth);
+                ms[mode] = render(ctx, shapes[i], res);
+                free_context(ctx);
+            }
+
+            char label[64];
+            snprintf(label, sizeof(label), "%s:%u", name, i);
+            printf("%-14s %8u %12lu %12lu %10.1f %10.1f\n", label,
+                   tree->tape->num_clauses, boxes[0], boxes[1], ms[0], ms[1]);
+            free_tree(tree);
+        }
+    }
+
+    return 0;
+}
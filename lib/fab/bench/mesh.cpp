@@ -0,0 +1,178 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "fab/tree/tree.h"
+#include "fab/tree/parser.h"
+#include "fab/tree/triangulate.h"
+#include "fab/util/region.h"
+
+#include "saved_shapes.h"
+
+/*
+ *  Meshes a sphere and the 3D shapes saved in .sb files (such as the
+ *  text in examples/label.sb), reporting the time taken and the peak
+ *  memory use of each.  Every shape is meshed in its own process, so
+ *  that peak RSS isn't carried over from one shape to the next.
+ */
+
+struct Result
+{
+    unsigned triangles;
+    double ms;
+};
+
+static Result mesh(const SavedShape& s, unsigned res, bool detect_edges,
+                   bool dual, unsigned threads, float tolerance)
+{
+    MathTree* tree = parse(s.math.c_str());
+    if (tree == NULL)
+        return {0, 0};
+
+    const float size = fmax(fmax(s.bounds[3] - s.bounds[0],
+                                 s.bounds[4] - s.bounds[1]),
+                            s.bounds[5] - s.bounds[2]);
+    Region r;
+    memset(&r, 0, sizeof(r));
+    r.ni = fmax(1, res * (s.bounds[3] - s.bounds[0]) / size);
+    r.nj = fmax(1, res * (s.bounds[4] - s.bounds[1]) / size);
+    r.nk = fmax(1, res * (s.bounds[5] - s.bounds[2]) / size);
+    r.voxels = (uint64_t)r.ni * r.nj * r.nk;
+    build_arrays(&r, s.bounds[0], s.bounds[1], s.bounds[2],
+                     s.bounds[3], s.bounds[4], s.bounds[5]);
+
+    int halt = 0;
+    float* verts;
+    unsigned count;
+    const auto start = std::chrono::steady_clock::now();
+    if (dual)
+        triangulate_dual(tree, r, &halt, &verts, &count, tolerance);
+    else if (threads > 1)
+        triangulate_parallel(tree, r, detect_edges, &halt, &verts, &count,
+                             threads, tolerance);
+    else
+        triangulate(tree, r, detect_edges, &halt, &verts, &count, tolerance);
+    const auto end = std::chrono::steady_clock::now();
+
+    free(verts);
+    free_arrays(&r);
+    free_tree(tree);
+    return {count / 9,
+            std::chrono::duration<double, std::milli>(end - start).count()};
+}
+
+// Meshes a shape in a child process, returning false if it failed.
+// The child's peak resident set size (in kilobytes) is stored in rss.
+static bool run(const SavedShape& s, unsigned res, bool detect_edges,
+                bool dual, unsigned threads, float tolerance,
+                Result* result, long* rss)
+{
+    int fds[2];
+    if (pipe(fds))
+        return false;
+
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        const Result r = mesh(s, res, detect_edges, dual, threads,
+                              tolerance);
+        const ssize_t n = write(fds[1], &r, sizeof(r));
+        _exit(n == sizeof(r) ? 0 : 1);
+    }
+    close(fds[1]);
+
+    const bool ok = pid > 0 && read(fds[0], result, sizeof(*result)) ==
+                               sizeof(*result);
+    close(fds[0]);
+
+    int status = 0;
+    struct rusage usage;
+    if (pid > 0 && wait4(pid, &status, 0, &usage) == pid)
+        *rss = usage.ru_maxrss;
+    return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned res = 256, threads = 1;
+    bool detect_edges = false, dual = false;
+    float tolerance = 0;
+
+    SavedShape sphere;
+    sphere.math = "-r++qXqYqZf1";
+    const float b[6] = {-1.2, -1.2, -1.2, 1.2, 1.2, 1.2};
+    memcpy(sphere.bounds, b, sizeof(b));
+    sphere.flat = false;
+
+    std::vector<std::pair<std::string, SavedShape>> shapes;
+    shapes.push_back(std::make_pair("sphere", sphere));
+
+    for (int arg=1; arg < argc; ++arg)
+    {
+        if (!strcmp(argv[arg], "--res") && arg + 1 < argc)
+        {
+            res = atoi(argv[++arg]);
+            continue;
+        }
+        else if (!strcmp(argv[arg], "--threads") && arg + 1 < argc)
+        {
+            threads = atoi(argv[++arg]);
+            continue;
+        }
+        else if (!strcmp(argv[arg], "--tolerance") && arg + 1 < argc)
+        {
+            tolerance = atof(argv[++arg]);
+            continue;
+        }
+        else if (!strcmp(argv[arg], "--edges"))
+        {
+            detect_edges = true;
+            continue;
+        }
+        else if (!strcmp(argv[arg], "--dual"))
+        {
+            dual = true;
+            continue;
+        }
+
+        const char* name = strrchr(argv[arg], '/');
+        name = name ? name + 1 : argv[arg];
+
+        const auto saved = load_shapes(argv[arg]);
+        for (unsigned i=0; i < saved.size(); ++i)
+        {
+            if (saved[i].flat)
+                continue;
+            shapes.push_back(std::make_pair(
+                        std::string(name) + ":" + std::to_string(i),
+                        saved[i]));
+        }
+    }
+
+    printf("%-14s %12s %12s %14s\n", "shape", "triangles", "ms",
+           "peak RSS (MB)");
+    for (const auto& s : shapes)
+    {
+        Result result;
+        long rss = 0;
+        if (!run(s.second, res, detect_edges, dual, threads, tolerance,
+                 &result, &rss))
+        {
+            fprintf(stderr, "%s: meshing failed\n", s.first.c_str());
+            continue;
+        }
+        printf("%-14s %12u %12.1f %14.1f\n", s.first.c_str(),
+               result.triangles, result.ms, rss / 1024.0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,55 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "fab/tree/tree.h"
+#include "fab/tree/parser.h"
+
+/*
+ *  Builds the union of a grid of n spheres, similar to the output of
+ *  fab.shapes.iterate3d or a long text label: many near-identical
+ *  subtrees that differ only in their constants.
+ */
+static std::string spheres(unsigned n)
+{
+    std::string out;
+    for (unsigned i=1; i < n; ++i)
+        out += "i";
+
+    char buf[128];
+    for (unsigned i=0; i < n; ++i)
+    {
+        snprintf(buf, sizeof(buf), "-r++q-Xf%.3fq-Yf%.3fqZf0.4",
+                 (i % 100) * 1.0, (i / 100) * 1.0);
+        out += buf;
+    }
+    return out;
+}
+
+int main(int argc, char** argv)
+{
+    const unsigned max_count = argc > 1 ? atoi(argv[1]) : 20000;
+
+    printf("%10s %10s %12s\n", "shapes", "chars", "parse (ms)");
+    for (unsigned n=100; n <= max_count; n *= 2)
+    {
+        const std::string math = spheres(n);
+
+        const auto start = std::chrono::steady_clock::now();
+        MathTree* tree = parse(math.c_str());
+        const auto end = std::chrono::steady_clock::now();
+
+        if (tree == NULL)
+        {
+            fprintf(stderr, "Parse failed\n");
+            return 1;
+        }
+        free_tree(tree);
+
+        printf("%10u %10zu %12.2f\n", n, math.size(),
+               std::chrono::duration<double, std::milli>(end - start).count());
+    }
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+#ifndef BENCH_SAVED_SHAPES_H
+#define BENCH_SAVED_SHAPES_H
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct SavedShape
+{
+    std::string math;
+    float bounds[6];
+    bool flat;
+};
+
+// Pulls the math string and bounds out of each fab.types.Shape(...)
+// call in a saved file, skipping duplicates and unbounded shapes.
+static inline std::vector<SavedShape> load_shapes(const char* filename)
+{
+    std::ifstream in(filename);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    const std::string text = ss.str();
+
+    std::vector<SavedShape> out;
+    std::set<std::string> seen;
+    const std::string tag = "fab.types.Shape('";
+
+    for (size_t pos = text.find(tag); pos != std::string::npos;
+         pos = text.find(tag, pos + 1))
+    {
+        const size_t start = pos + tag.size();
+        const size_t end = text.find('\'', start);
+        if (end == std::string::npos)
+            break;
+
+        SavedShape s;
+        s.math = text.substr(start, end - start);
+        if (s.math.find('%') != std::string::npos || seen.count(s.math))
+            continue;
+
+        // Bounds follow as float('...') arguments
+        float v[6];
+        unsigned count = 0;
+        for (const char* c = text.c_str() + end + 1;
+             count < 6 && !strncmp(c, ",float('", 8);
+             c = strchr(c, ')') + 1)
+        {
+            c += 8;
+            v[count++] = strtof(c, NULL);
+        }
+
+        // 2D shapes are stored as xmin, ymin, xmax, ymax (or with
+        // infinite Z bounds), and are evaluated on the z = 0 plane.
+        s.flat = count == 4 || (count == 6 && std::isinf(v[2]) &&
+                                              std::isinf(v[5]));
+        if (count == 4)
+        {
+            const float b[6] = {v[0], v[1], 0, v[2], v[3], 0};
+            memcpy(s.bounds, b, sizeof(b));
+        }
+        else if (count == 6)
+        {
+            memcpy(s.bounds, v, sizeof(v));
+            if (s.flat)     s.bounds[2] = s.bounds[5] = 0;
+        }
+        else
+        {
+            continue;
+        }
+
+        bool finite = true;
+        for (int a=0; a < 6; ++a)
+            finite &= std::isfinite(s.bounds[a]) != 0;
+        if (!finite)    continue;
+
+        seen.insert(s.math);
+        out.push_back(s);
+    }
+    return out;
+}
+
+#endif
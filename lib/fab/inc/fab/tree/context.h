@@ -0,0 +1,210 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fab/tree/tape.h"
+#include "fab/util/interval.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct MathTree_;
+struct derivative_;
+struct aform_;
+struct ibatch_;
+
+/** @struct TapeFrame_
+    @brief A contiguous run of clauses in a context's arena.
+*/
+typedef struct TapeFrame_ {
+    size_t offset;
+    unsigned count;
+} TapeFrame;
+
+/** @struct EvalContext_
+    @brief Storage used while evaluating a MathTree.
+
+    @details A context holds every intermediate result and the stack of
+    pruned clause lists, so the tree itself is never modified during
+    evaluation.  Each thread should use its own context; any number of
+    contexts may share one tree.
+*/
+typedef struct EvalContext_ {
+    /** @var tree
+    @var tape
+    Tree being evaluated and its (shared) tape */
+    const struct MathTree_* tree;
+    const Tape* tape;
+
+    /** @var f
+    @var i
+    Scalar and interval slots */
+    float* f;
+    Interval* i;
+
+    /** @var a
+    Affine form slots (used by eval_a) */
+    struct aform_* a;
+
+    /** @var affine
+    If set, eval_i uses affine arithmetic (see eval_a).  Initialized
+    from get_affine_eval when the context is created. */
+    bool affine;
+
+    /** @var r
+    Working array registers, each MIN_VOLUME floats
+    (or MIN_VOLUME/4 derivatives) */
+    float* r;
+
+    /** @var r_ptr
+    @var g_ptr
+    Per-register pointers for array and derivative evaluation.
+    Constant registers point into the tape's read-only storage. */
+    float** r_ptr;
+    struct derivative_** g_ptr;
+
+    /** @var arena
+    Storage for pruned clause lists */
+    Clause* arena;
+    size_t arena_size;
+    size_t arena_capacity;
+
+    /** @var frames
+    Stack of pruned clause lists; when empty, the full tape is active */
+    TapeFrame* frames;
+    unsigned num_frames;
+    unsigned frame_capacity;
+
+    /** @var marks
+    Per-slot scratch space used while pruning */
+    unsigned char* marks;
+
+    /** @var ib
+    Per-slot scratch space for eval_i_batch (allocated on first use) */
+    struct ibatch_* ib;
+
+    /** @var batches
+    Stack of results from eval_i_batch.  Each entry is three batches
+    holding the boxes (in the tree's coordinates), followed by one batch
+    per clause in the clause list that was active at the time. */
+    struct ibatch_* batches;
+    size_t batches_size;
+    size_t batches_capacity;
+
+    /** @var batch_frames
+    Offset of each entry in batches */
+    size_t* batch_frames;
+    unsigned num_batch_frames;
+    unsigned batch_frame_capacity;
+
+    /** @var transform
+    @var has_transform
+    Row-major 3x4 affine transform from evaluation coordinates
+    to the tree's coordinates (used if has_transform is set) */
+    float transform[12];
+    bool has_transform;
+
+    /** @var region
+    Region passed to the most recent eval_i call, in the tree's
+    coordinates (used to prune bounded nodes) */
+    Interval region[3];
+
+    /** @var xyz
+    Transformed X, Y, Z arrays for eval_r and eval_g
+    (3 * MIN_VOLUME floats, allocated by set_transform) */
+    float* xyz;
+} EvalContext;
+
+
+/** @brief Creates a new evaluation context for the given tree.
+    @details The tree must outlive the context.
+*/
+EvalContext* new_context(const struct MathTree_* tree);
+
+
+/** @brief Frees a context and all of its storage. */
+void free_context(EvalContext* ctx);
+
+
+/** @brief Sets an affine transform that is applied to coordinates
+    before they're passed into the tree.
+
+    @details M is a row-major 4x4 affine matrix mapping evaluation
+    coordinates to the tree's coordinates (its bottom row is ignored),
+    or NULL to clear the transform.  All evaluators apply it, so derivatives
+    from eval_g are with respect to the evaluation coordinates.  This lets
+    one parsed tree be rendered from any view without rebuilding it.
+*/
+void set_transform(EvalContext* ctx, const float* M);
+
+
+/** @brief Returns the active clause list. */
+const Clause* context_clauses(const EvalContext* ctx, unsigned* count);
+
+
+/** @brief Pushes a shortened clause list based on the most recent
+    interval evaluation, disabling nodes whose values will not matter
+    upon further spatial subdivision.
+
+    @details Branches of min and max clauses that can't affect the result
+    are dropped, as are bounded subtrees whose boxes don't overlap the
+    region.  Dropped values that are still read by other clauses are
+    replaced with OP_CONST clauses holding the upper bound of their interval.
+ */
+void disable_nodes(EvalContext* ctx);
+
+
+/** @brief Disables nodes that won't affect the output truth value
+    (i.e. whether it is larger or smaller than zero)
+
+    @details Must be called after disable_nodes, as it shortens the
+    clause list that disable_nodes pushed.  The interval slots must still
+    hold the results of the preceding eval_i call.
+*/
+void disable_nodes_binary(EvalContext* ctx);
+
+
+/** @brief Enables nodes that were disabled on the most recent call to
+    disable_nodes, restoring the previous clause list.
+*/
+void enable_nodes(EvalContext* ctx);
+
+
+/** @brief Reserves room for the results of a batched evaluation.
+    @details Returns space for count batches at the top of the context's
+    batch stack (which is freed by pop_batch).  Used by eval_i_batch.
+*/
+struct ibatch_* push_batch(EvalContext* ctx, unsigned count);
+
+
+/** @brief Loads one box's results from the most recent eval_i_batch
+    into the interval slots, as if eval_i had been called on that box.
+
+    @details The active clause list must be the same as it was when
+    eval_i_batch was called (i.e. every disable_nodes since then must
+    have been undone).  Afterwards, disable_nodes prunes for that box.
+*/
+void select_batch(EvalContext* ctx, unsigned lane);
+
+
+/** @brief Frees the results of the most recent eval_i_batch. */
+void pop_batch(EvalContext* ctx);
+
+
+/** @brief Returns a bit mask containing active axes in the current
+    clause list.
+    @details
+    The bit mask is of the form (x_active << 2) | (y_active << 1) | (z_active)
+    and refers to evaluation coordinates (i.e. after any transform).
+*/
+uint8_t active_axes(const EvalContext* ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef EVAL_H
 #define EVAL_H
 
+#include <stdbool.h>
+
 #include "fab/util/interval.h"
 #include "fab/util/region.h"
 #include "fab/util/switches.h"
@@ -10,31 +12,73 @@ extern "C" {
 #endif
 
 // Forward declarations
-struct MathTree_;
+struct EvalContext_;
 struct derivative_;
 
 
 /** @brief Evaluates a math expression at a given floating-point position.
-    @details Results are stored in n->head->results.f
+    @details Intermediate results are stored in the context.
 */
-float  eval_f(struct MathTree_* n, const float x, const float y, const float z);
+float  eval_f(struct EvalContext_* ctx,
+              const float x, const float y, const float z);
 
 
 /** @brief Evaluates a math expression over an interval region
-    @details Results are stored in n->head->results.i
+    @details Intermediate results are stored in the context,
+    where disable_nodes uses them to prune the tree.  If the context's
+    affine flag is set, this calls eval_a instead.
+*/
+Interval  eval_i(struct EvalContext_* ctx, const Interval X,
+                                           const Interval Y,
+                                           const Interval Z);
+
+/** @brief Evaluates a math expression over an interval region
+    using affine arithmetic.
+    @details Each clause's value is tracked as a linear function of X, Y,
+    and Z over the region plus an error term, which keeps correlations
+    that interval arithmetic loses (e.g. in x*x - 2*x*y, or in rotated
+    coordinates).  The interval slots are filled in as with eval_i
+    (each is the tighter of the interval and affine bounds), so
+    disable_nodes works the same way afterwards.
+*/
+Interval  eval_a(struct EvalContext_* ctx, const Interval X,
+                                           const Interval Y,
+                                           const Interval Z);
+
+/** @brief Evaluates a math expression over up to IBATCH interval regions
+    in a single pass through the clause list.
+    @details Region q is (X[q], Y[q], Z[q]); its result is stored in out[q].
+    Each clause's results for every region are pushed onto the context's
+    batch stack, so select_batch can load one region's results before
+    calling disable_nodes.  Every call must be matched by pop_batch.
+
+    A guarded subtree is only skipped if every region is outside of its
+    bounds, so results match eval_i.
 */
-Interval  eval_i(struct MathTree_* n, const Interval X,
-                                        const Interval Y,
-                                        const Interval Z);
+void eval_i_batch(struct EvalContext_* ctx, const Interval* X,
+                  const Interval* Y, const Interval* Z,
+                  unsigned count, Interval* out);
+
+/** @brief Sets whether contexts created after this call use affine
+    arithmetic in eval_i (it is disabled by default).
+    @details Each context's choice is stored in its affine field, which
+    may also be changed directly.
+*/
+void set_affine_eval(bool enable);
+
+/** @brief Returns true if new contexts will use affine arithmetic. */
+bool get_affine_eval(void);
 
 /** @brief Evaluates a math expression over a set of many positions
-    @details Results are stored in n->head->results.r
+    @details r.voxels must be at most MIN_VOLUME.  The returned array
+    is owned by the context and valid until the next evaluation.
 */
-float*  eval_r(struct MathTree_* n, const Region r);
+float*  eval_r(struct EvalContext_* ctx, const Region r);
 
 /** @brief Evaluates partial derivatives over a set of many position.
+    @details r.voxels must be at most MIN_VOLUME/4.
 */
-struct derivative_* eval_g(struct MathTree_* tree, const Region r);
+struct derivative_* eval_g(struct EvalContext_* ctx, const Region r);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,64 @@
+#ifndef MATH_A_H
+#define MATH_A_H
+
+#include "fab/tree/math/math_defines.h"
+
+#include "fab/util/interval.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @file tree/math/math_a.h
+    @brief Functions for doing math on reduced affine forms
+    @details An affine form tracks a value over a box as a linear function
+    of the box's X, Y, and Z (each rescaled to the range [-1, 1]), plus an
+    error term that collects everything nonlinear.  Since correlations
+    between values are kept, expressions like x*x - 2*x*y or rotated
+    coordinates get much tighter bounds than with interval arithmetic.
+
+    These functions take in input forms A and B and return the result.
+*/
+
+typedef struct aform_
+{
+    float v;    // Central value
+    float dx;   // Partial deviations with respect to
+    float dy;   //  each of the box's (rescaled) axes
+    float dz;
+    float err;  // Radius of the accumulated error (non-negative)
+} aform;
+
+// Conversions to and from intervals
+Interval aform_range(aform A);
+aform aform_from_i(Interval I);
+
+// Binary functions
+aform add_a(aform A, aform B);
+aform sub_a(aform A, aform B);
+aform mul_a(aform A, aform B);
+aform div_a(aform A, aform B);
+
+aform min_a(aform A, aform B);
+aform max_a(aform A, aform B);
+
+// Unary functions
+aform abs_a(aform A);
+aform square_a(aform A);
+aform sqrt_a(aform A);
+aform neg_a(aform A);
+aform exp_a(aform A);
+
+// Variables: the axis of a box, with rescaled deviation along that axis
+aform X_a(Interval X);
+aform Y_a(Interval Y);
+aform Z_a(Interval Z);
+
+// Affine combination of three forms, with coefficients k = {a, b, c, d}.
+aform affine_a(const float* k, aform X, aform Y, aform Z);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -24,6 +24,17 @@ inline float min_f(float A, float B) { return fmin(A, B); }
 inline float max_f(float A, float B) { return fmax(A, B); }
 inline float pow_f(float A, float B) { return pow(A, B); }
 
+// Floored modulo: the result has the same sign as B
+inline float mod_f(float A, float B)
+{
+    const float r = fmod(A, B);
+    return (r != 0 && (r < 0) != (B < 0)) ? r + B : r;
+}
+
+// Clamped repetition: A's offset from the nearest integer in [0, B]
+inline float repeat_f(float A, float B)
+{ return A - fmin(fmax(floor(A + 0.5f), 0), B); }
+
 ////////////////////////////////////////////////////////////////////////////////
 
 inline float abs_f(float A) { return fabs(A); }
@@ -58,6 +69,19 @@ inline float X_f(float X) { return X; }
 inline float Y_f(float Y) { return Y; }
 inline float Z_f(float Z) { return Z; }
 
+// Affine combination, with coefficients k = {a, b, c, d}
+inline float affine_f(const float* k, float X, float Y, float Z)
+{ return k[0]*X + k[1]*Y + k[2]*Z + k[3]; }
+
+// Distance from an axis-aligned box b = {xmin, ymin, zmin, xmax, ymax, zmax},
+// measured along the axis where it's largest (so it's positive outside the
+// box and zero or negative inside it)
+inline float box_f(const float* b, float X, float Y, float Z)
+{
+    return fmax(fmax(fmax(b[0] - X, X - b[3]), fmax(b[1] - Y, Y - b[4])),
+                fmax(b[2] - Z, Z - b[5]));
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -32,6 +32,9 @@ derivative* max_g(const derivative* A, const derivative* B, derivative* R, int c
 
 derivative* pow_g(const derivative* A, const derivative* B, derivative* R, int c);
 
+derivative* mod_g(const derivative* A, const derivative* B, derivative* R, int c);
+derivative* repeat_g(const derivative* A, const derivative* B, derivative* R, int c);
+
 derivative* atan2_g(const derivative* A, const derivative* B, derivative* R, int c);
 
 // Unary functions
@@ -52,6 +55,10 @@ derivative* X_g(const float* X, derivative* R, int c);
 derivative* Y_g(const float* Y, derivative* R, int c);
 derivative* Z_g(const float* Z, derivative* R, int c);
 
+// Affine combination, with coefficients k = {a, b, c, d}
+derivative* affine_g(const float* k, const float* X, const float* Y,
+                     const float* Z, derivative* R, int c);
+
 #ifdef __cplusplus
 }
 #endif
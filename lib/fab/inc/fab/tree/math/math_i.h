@@ -26,6 +26,9 @@ Interval max_i(Interval A, Interval B);
 
 Interval pow_i(Interval A, Interval B);
 
+Interval mod_i(Interval A, Interval B);
+Interval repeat_i(Interval A, Interval B);
+
 Interval atan2_i(Interval A, Interval B);
 
 // Unary functions
@@ -46,6 +49,13 @@ Interval X_i(Interval X);
 Interval Y_i(Interval Y);
 Interval Z_i(Interval Z);
 
+// Affine combination, with coefficients k = {a, b, c, d}.
+// The result is exact (up to rounding), since each axis appears once.
+Interval affine_i(const float* k, Interval X, Interval Y, Interval Z);
+
+// Distance from an axis-aligned box (see box_f in math_f.h)
+Interval box_i(const float* b, Interval X, Interval Y, Interval Z);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,61 @@
+#ifndef MATH_IB_H
+#define MATH_IB_H
+
+#include "fab/tree/math/math_defines.h"
+
+#include "fab/util/interval.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @file tree/math/math_ib.h
+    @brief Functions for doing interval math on batches of boxes
+    @details Each batch holds one interval per box, with the lower and
+    upper bounds in separate arrays so that the loops over lanes can be
+    vectorized.  Results are stored in R, which may alias A or B.
+*/
+
+#define IBATCH  8   // Number of boxes in a batch
+
+typedef struct ibatch_
+{
+    float lower[IBATCH];
+    float upper[IBATCH];
+} ibatch;
+
+// Binary functions
+void add_ib(const ibatch* A, const ibatch* B, ibatch* R);
+void sub_ib(const ibatch* A, const ibatch* B, ibatch* R);
+void mul_ib(const ibatch* A, const ibatch* B, ibatch* R);
+
+void min_ib(const ibatch* A, const ibatch* B, ibatch* R);
+void max_ib(const ibatch* A, const ibatch* B, ibatch* R);
+
+// Unary functions
+void abs_ib(const ibatch* A, ibatch* R);
+void square_ib(const ibatch* A, ibatch* R);
+void sqrt_ib(const ibatch* A, ibatch* R);
+void neg_ib(const ibatch* A, ibatch* R);
+
+// Fallbacks for functions without a batched form, applied lane by lane
+void binary_ib(Interval (*f)(Interval, Interval),
+               const ibatch* A, const ibatch* B, ibatch* R);
+void unary_ib(Interval (*f)(Interval), const ibatch* A, ibatch* R);
+
+// Constant value in every lane
+void const_ib(float v, ibatch* R);
+
+// Affine combination, with coefficients k = {a, b, c, d}
+void affine_ib(const float* k, const ibatch* X, const ibatch* Y,
+               const ibatch* Z, ibatch* R);
+
+// Lane access
+Interval get_ib(const ibatch* A, unsigned lane);
+void set_ib(ibatch* A, unsigned lane, Interval I);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
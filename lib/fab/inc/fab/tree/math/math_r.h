@@ -24,6 +24,9 @@ float* max_r(const float* A, const float* B, float* R, int c);
 
 float* pow_r(const float* A, const float* B, float* R, int c);
 
+float* mod_r(const float* A, const float* B, float* R, int c);
+float* repeat_r(const float* A, const float* B, float* R, int c);
+
 float* atan2_r(const float* A, const float* B, float* R, int c);
 
 // Unary functions
@@ -44,6 +47,14 @@ float* X_r(const float* X, float* R, int c);
 float* Y_r(const float* Y, float* R, int c);
 float* Z_r(const float* Z, float* R, int c);
 
+// Affine combination, with coefficients k = {a, b, c, d}
+float* affine_r(const float* k, const float* X, const float* Y,
+                const float* Z, float* R, int c);
+
+// Distance from an axis-aligned box (see box_f in math_f.h)
+float* box_r(const float* b, const float* X, const float* Y,
+             const float* Z, float* R, int c);
+
 #ifdef __cplusplus
 }
 #endif
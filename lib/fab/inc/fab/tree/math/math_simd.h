@@ -0,0 +1,119 @@
+#ifndef MATH_SIMD_H
+#define MATH_SIMD_H
+
+#include <stdbool.h>
+
+#include "fab/tree/math/math_g.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @file tree/math/math_simd.h
+    @brief Runtime dispatch between scalar and SIMD array kernels.
+    @details The functions in math_r.h and math_g.h forward to whichever
+    kernel table is active.  The best table supported by the CPU is chosen
+    once at startup; simd_select may be used to override it (e.g. in tests
+    that compare backends against each other).
+*/
+
+typedef enum SimdBackend_ {
+    SIMD_SCALAR,
+    SIMD_SSE42,
+    SIMD_AVX2,
+    SIMD_AVX512,
+    LAST_SIMD_BACKEND
+} SimdBackend;
+
+typedef float* (*dual_r)(const float* A, const float* B, float* R, int c);
+typedef float* (*single_r)(const float* A, float* R, int c);
+typedef derivative* (*dual_g)(const derivative* A, const derivative* B,
+                              derivative* R, int c);
+typedef derivative* (*single_g)(const derivative* A, derivative* R, int c);
+
+/*  A MathKernels struct is a table of array functions for eval_r and eval_g.
+ *  Every backend provides a complete table.
+ */
+typedef struct MathKernels_ {
+    SimdBackend backend;
+
+    dual_r add_r, sub_r, mul_r, div_r, min_r, max_r, pow_r, atan2_r;
+    single_r abs_r, square_r, sqrt_r, sin_r, cos_r, tan_r,
+             asin_r, acos_r, atan_r, neg_r, exp_r;
+
+    dual_g add_g, sub_g, mul_g, div_g, min_g, max_g, pow_g, atan2_g;
+    single_g abs_g, square_g, sqrt_g, sin_g, cos_g, tan_g,
+             asin_g, acos_g, atan_g, neg_g, exp_g;
+} MathKernels;
+
+/*  The active kernel table.  Never NULL. */
+extern const MathKernels* math_kernels;
+
+/** @brief Returns the fastest backend that this build and CPU support. */
+SimdBackend simd_detect(void);
+
+/** @brief Checks whether a backend was compiled in and is supported
+    by the running CPU.
+*/
+bool simd_available(SimdBackend b);
+
+/** @brief Switches the active kernel table.
+    @returns false (and leaves the table unchanged) if the backend
+    isn't available.
+*/
+bool simd_select(SimdBackend b);
+
+/** @brief Returns the backend of the active kernel table. */
+SimdBackend simd_backend(void);
+
+/** @brief Returns a human-readable name for a backend. */
+const char* simd_backend_name(SimdBackend b);
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Scalar reference kernels (defined in math_r.c and math_g.c)
+float* add_r_scalar(const float* A, const float* B, float* R, int c);
+float* sub_r_scalar(const float* A, const float* B, float* R, int c);
+float* mul_r_scalar(const float* A, const float* B, float* R, int c);
+float* div_r_scalar(const float* A, const float* B, float* R, int c);
+float* min_r_scalar(const float* A, const float* B, float* R, int c);
+float* max_r_scalar(const float* A, const float* B, float* R, int c);
+float* pow_r_scalar(const float* A, const float* B, float* R, int c);
+float* atan2_r_scalar(const float* A, const float* B, float* R, int c);
+float* abs_r_scalar(const float* A, float* R, int c);
+float* square_r_scalar(const float* A, float* R, int c);
+float* sqrt_r_scalar(const float* A, float* R, int c);
+float* sin_r_scalar(const float* A, float* R, int c);
+float* cos_r_scalar(const float* A, float* R, int c);
+float* tan_r_scalar(const float* A, float* R, int c);
+float* asin_r_scalar(const float* A, float* R, int c);
+float* acos_r_scalar(const float* A, float* R, int c);
+float* atan_r_scalar(const float* A, float* R, int c);
+float* neg_r_scalar(const float* A, float* R, int c);
+float* exp_r_scalar(const float* A, float* R, int c);
+
+derivative* add_g_scalar(const derivative* A, const derivative* B, derivative* R, int c);
+derivative* sub_g_scalar(const derivative* A, const derivative* B, derivative* R, int c);
+derivative* mul_g_scalar(const derivative* A, const derivative* B, derivative* R, int c);
+derivative* div_g_scalar(const derivative* A, const derivative* B, derivative* R, int c);
+derivative* min_g_scalar(const derivative* A, const derivative* B, derivative* R, int c);
+derivative* max_g_scalar(const derivative* A, const derivative* B, derivative* R, int c);
+derivative* pow_g_scalar(const derivative* A, const derivative* B, derivative* R, int c);
+derivative* atan2_g_scalar(const derivative* A, const derivative* B, derivative* R, int c);
+derivative* abs_g_scalar(const derivative* A, derivative* R, int c);
+derivative* square_g_scalar(const derivative* A, derivative* R, int c);
+derivative* sqrt_g_scalar(const derivative* A, derivative* R, int c);
+derivative* sin_g_scalar(const derivative* A, derivative* R, int c);
+derivative* cos_g_scalar(const derivative* A, derivative* R, int c);
+derivative* tan_g_scalar(const derivative* A, derivative* R, int c);
+derivative* asin_g_scalar(const derivative* A, derivative* R, int c);
+derivative* acos_g_scalar(const derivative* A, derivative* R, int c);
+derivative* atan_g_scalar(const derivative* A, derivative* R, int c);
+derivative* neg_g_scalar(const derivative* A, derivative* R, int c);
+derivative* exp_g_scalar(const derivative* A, derivative* R, int c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -3,15 +3,12 @@
 
 #include <stdbool.h>
 
-#include "fab/tree/node/results.h"
 #include "fab/tree/node/opcodes.h"
 #include "fab/util/interval.h"
 #include "fab/util/region.h"
 
 #define NODE_CONSTANT   1
-#define NODE_IGNORED    2
-#define NODE_BOOLEAN    4
-#define NODE_IN_TREE    8
+#define NODE_IN_TREE    2
 
 #ifdef __cplusplus
 extern "C" {
@@ -25,17 +22,26 @@ typedef struct Node_ {
     Node operation */
     Opcode opcode;
 
-    /** @var results
-    Saved results from most recent evaluation */
-    Results  results;
+    /** @var value
+    Value of a constant node (unused otherwise) */
+    float value;
+
+    /** @var affine
+    @var box
+    Coefficients {a, b, c, d} of an OP_AFFINE node, which evaluates
+    to a*X + b*Y + c*Z + d, or the box {xmin, ymin, zmin, xmax, ymax, zmax}
+    of an OP_BOUNDS node (unused otherwise) */
+    union {
+        float affine[4];
+        float box[6];
+    };
 
     /** @var rank
     Rank of the node in the tree. */
     int rank;
 
     /** @var flags
-    Flags (combination of be NODE_CONSTANT, NODE_IGNORED,
-    NODE_BOOLEAN, and NODE_IN_TREE) */
+    Flags (combination of NODE_CONSTANT and NODE_IN_TREE) */
     uint8_t flags;
 
     /** @var lhs
@@ -52,6 +58,11 @@ typedef struct Node_ {
     Most recent place to which this node was cloned
     */
     struct Node_* clone_address;
+
+    /** @var slot
+    Index of this node's slot in its tree's tape
+    */
+    unsigned slot;
 } Node;
 
 
@@ -77,6 +88,16 @@ Node* min_n(Node* left, Node* right);
 Node* max_n(Node* left, Node* right);
 Node* pow_n(Node* left, Node* right);
 
+// Domain repetition (see mod_f and repeat_f in math_f.h)
+Node* mod_n(Node* left, Node* right);
+Node* repeat_n(Node* left, Node* right);
+
+/*  A shape that is known to be empty outside of an axis-aligned box
+ *  {xmin, ymin, zmin, xmax, ymax, zmax}.  The node evaluates to its child
+ *  inside the box and to the (positive) distance from the box outside of
+ *  it, so the child can be skipped when the box is out of range.  */
+Node* bounds_n(Node* n, const float* box);
+
 Node* atan2_n(Node* a, Node* b);
 
 // Unary arithmetic operators
@@ -95,6 +116,9 @@ Node* exp_n(Node* n);
 // Constants
 Node* constant_n(float value);
 
+// Affine combination of X, Y, and Z (with coefficients {a, b, c, d})
+Node* affine_n(const float* k);
+
 // Variables
 Node* X_n(void);
 Node* Y_n(void);
@@ -16,6 +16,8 @@ typedef enum Opcode_ {
     OP_MIN,
     OP_MAX,
     OP_POW,
+    OP_MOD,
+    OP_REPEAT,
 
     OP_ABS,
     OP_SQUARE,
@@ -33,6 +35,8 @@ typedef enum Opcode_ {
     OP_X,
     OP_Y,
     OP_Z,
+    OP_AFFINE,
+    OP_BOUNDS,
     OP_CONST,
 
     LAST_OP
@@ -51,6 +55,9 @@ const char* dot_color(Opcode op);
 /** @returns Node font size for a dot graph */
 int dot_fontsize(Opcode op);
 
+/** @returns Number of operands taken by an operation */
+int opcode_arity(Opcode op);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,6 +1,8 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stdbool.h>
+
 #include "fab/tree/tree.h"
 #include "fab/tree/node/node.h"
 #include "fab/tree/node/opcodes.h"
@@ -11,19 +13,22 @@ extern "C" {
 
 struct MathTree_;
 
-/* Linked list of Nodes */
-typedef struct NodeList_
-{
-    Node* node;
-    struct NodeList_* next;
-} NodeList;
-
-/* Cache storing multiple lists of NodeLists */
+/* Hash-consing cache used to deduplicate nodes while parsing */
 typedef struct NodeCache_
 {
-    int levels;
-    NodeList* (*nodes)[LAST_OP]; // indexed by [level][opcode]
-    NodeList* constants;
+    int levels;         // One more than the highest non-constant rank
+
+    Node** nodes;       // Every cached node, in insertion order
+    unsigned count;
+    unsigned capacity;
+
+    /*  Open-addressing hash table of indices into nodes (offset by one,
+     *  so that zero marks an empty slot).  Its size is a power of two.  */
+    unsigned* table;
+    unsigned table_size;
+
+    bool simplify;          // Apply simplify_node to new nodes
+    unsigned simplified;    // Number of nodes removed by simplification
 } NodeCache;
 
 /** @brief Parses a prefix-notation math string
@@ -32,6 +37,22 @@ typedef struct NodeCache_
 */
 struct MathTree_* parse(const char* input);
 
+/** @brief Creates an empty node cache */
+NodeCache* new_node_cache(void);
+
+/** @brief Frees a node cache and every node stored in it */
+void free_node_cache(NodeCache* const cache);
+
+/** @brief Builds a MathTree from nodes stored in a cache.
+    @details head must have been returned by get_cached_node.  The cache
+    is freed, along with any of its nodes that aren't used by the tree.
+
+    If the cache simplifies nodes, chains of min, max, add, and mul nodes
+    (e.g. from reducing a list of shapes with operator.or_) are rebuilt
+    as balanced trees when that reduces the tree's depth.
+*/
+struct MathTree_* build_tree(NodeCache* const cache, Node* head);
+
 /*  Looks up a node in the cache.  If not found, it is appended to the
  *  appropriate cache slot; if found, the original node is freed and
  *  the cached node pointer is returned.
@@ -39,7 +60,7 @@ struct MathTree_* parse(const char* input);
  *  The input node's children should be deduplicated and cached; we check
  *  by comparing their pointer values.  Nodes are considered equal if they
  *  have the same opcode and same child pointers, or if they are OP_CONST
- *  and have the same values.
+ *  (or OP_AFFINE) and have the same values (or coefficients).
  */
 Node* get_cached_node(NodeCache* const cache, Node* const n);
 
@@ -14,5 +14,6 @@ typedef struct env_
 	Node* Znode;
 	NodeCache* cache;
 	Node *tempX, *tempY, *tempZ;
+	Node *rootX, *rootY, *rootZ;
 	std::stack<Node*> *nodestack;
 } Env;
@@ -10,6 +10,7 @@ extern "C" {
 #endif
 
 struct MathTree_;
+struct EvalContext_;
 
 /** @brief Recursively renders a tree
     @param tree Target tree
@@ -21,9 +22,13 @@ void render8(struct MathTree_* tree, Region region,
              uint8_t** img, volatile int* halt,
              void (*callback)());
 
+/** @brief Finds surface normals for a rendered depth map
+    @param M Row-major 4x4 affine transform from region coordinates to
+    tree coordinates (or NULL), as in set_transform
+*/
 void shaded8(struct MathTree_* tree, Region region, uint16_t** depth,
              uint8_t (**out)[3], volatile int* halt,
-             void (*callback)());
+             void (*callback)(), const float* M);
 
 /** @brief Recursively renders a tree
     @param tree Target tree
@@ -35,6 +40,59 @@ void render16(struct MathTree_* tree, Region region,
               uint16_t** img, volatile int* halt,
               void (*callback)());
 
+/** @brief Recursively renders a region using an existing context
+    @details The context's active clause list must be valid for the region
+    (i.e. the full tree, or one pruned over a region containing it).
+    Only the region's rectangle of the image is read and written; subregions
+    that are hidden behind lit pixels are culled using a min-depth pyramid
+    over that rectangle.
+*/
+void render8_ctx(struct EvalContext_* ctx, Region region,
+                 uint8_t** img, volatile int* halt,
+                 void (*callback)());
+void render16_ctx(struct EvalContext_* ctx, Region region,
+                  uint16_t** img, volatile int* halt,
+                  void (*callback)());
+
+/** @brief Renders a region, starting from a guessed depth map
+    @details img should be blank except for guesses at each pixel's depth
+    (e.g. a lower-resolution render, scaled up).  Each guess is checked
+    by sampling the voxels around it; pixels below which a filled voxel
+    is found, and above which the space is proven to be empty, are
+    skipped by the renderer.  The result is identical to render16_ctx on
+    a blank image, but arrives sooner when the guesses are good.
+*/
+void render16_seeded_ctx(struct EvalContext_* ctx, Region region,
+                         uint16_t** img, volatile int* halt,
+                         void (*callback)());
+
+/** @brief Renders a tree on multiple threads
+    @details The region is split into tiles along X and Y, which are
+    rendered by a work-stealing pool with one evaluation context per
+    worker.  The result is identical to render8 / render16.
+    @param threads Number of worker threads (0 for one per core)
+    @param callback Called from worker threads (so must be thread-safe)
+    @param M Row-major 4x4 affine transform from region coordinates to
+    tree coordinates (or NULL), as in set_transform
+*/
+void render8_parallel(struct MathTree_* tree, Region region,
+                      uint8_t** img, volatile int* halt,
+                      void (*callback)(), unsigned threads,
+                      const float* M);
+void render16_parallel(struct MathTree_* tree, Region region,
+                       uint16_t** img, volatile int* halt,
+                       void (*callback)(), unsigned threads,
+                       const float* M);
+
+/** @brief Renders a region from a guessed depth map on multiple threads
+    @details Tiles are rendered with render16_seeded_ctx; otherwise, this
+    is the same as render16_parallel.
+*/
+void render16_seeded_parallel(struct MathTree_* tree, Region region,
+                              uint16_t** img, volatile int* halt,
+                              void (*callback)(), unsigned threads,
+                              const float* M);
+
 
 #ifdef __cplusplus
 }
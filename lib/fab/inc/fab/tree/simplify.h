@@ -0,0 +1,47 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <stdbool.h>
+
+#include "fab/tree/node/node.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Applies a single algebraic simplification to a node.
+    @details Removes identities (x+0, x-0, x*1, x/1, x^1, min(x,x),
+    max(x,x)) and collapses nested unary operations (neg(neg(x)),
+    sqrt(square(x)), abs(abs(x)), square(neg(x)), etc).  Chains of
+    +, -, neg, and scaling by constants over X, Y, and Z are fused into a
+    single OP_AFFINE node.  Constant subexpressions are already folded
+    when nodes are constructed.
+
+    The node's children must be fully simplified.  Returns n if no rule
+    applies; otherwise, returns either one of n's descendants or a newly
+    allocated node (which should itself be passed to get_cached_node).
+    n is never modified or freed.
+*/
+Node* simplify_node(Node* n);
+
+/** @brief Enables or disables simplification of trees built after this
+    call (it is enabled by default).
+*/
+void set_simplify(bool enable);
+
+/** @brief Returns true if simplification is enabled. */
+bool get_simplify(void);
+
+/** @brief Returns the number of nodes removed by simplification
+    (summed over every tree built since the program started).
+*/
+unsigned long simplified_nodes(void);
+
+/** @brief Adds to the count returned by simplified_nodes (thread-safe). */
+void add_simplified_nodes(unsigned count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef TAPE_H
+#define TAPE_H
+
+#include <stdbool.h>
+
+#include "fab/tree/node/opcodes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct MathTree_;
+struct derivative_;
+
+/** @struct Clause_
+    @brief A single instruction in a Tape.
+
+    @details An OP_BOUNDS node produces two clauses with the same slot
+    and register.  The guard comes before the clauses that only the node
+    uses; it writes the distance to the node's box and skips those clauses
+    (and the node's own clause) if the query is entirely outside of it.
+    The node's own clause then picks its child's value inside the box.
+*/
+typedef struct Clause_ {
+    /** @var op
+    Operation (OP_CONST for values fixed by pruning) */
+    Opcode op;
+
+    /** @var id
+    Slot written by this clause in scalar and interval evaluation.
+    Every node in the tree has its own slot. */
+    unsigned id;
+
+    /** @var a
+    @var b
+    Operand slots (for unary and variable clauses, equal to id).
+    A guard clause has a equal to id, and b is the number of clauses
+    that it skips. */
+    unsigned a, b;
+
+    /** @var out
+    Register written by this clause in array and derivative evaluation.
+    Registers are recycled once their value is no longer needed. */
+    unsigned out;
+
+    /** @var ra
+    @var rb
+    Operand registers */
+    unsigned ra, rb;
+
+    /** @var value
+    @var row
+    Value written by an OP_CONST clause, or the index of an OP_AFFINE
+    (or OP_BOUNDS) clause's coefficients (or box) in the tape's affine
+    (or boxes) array */
+    union {
+        float value;
+        unsigned row;
+    };
+} Clause;
+
+/** @struct Tape_
+    @brief A MathTree flattened into a linear list of clauses.
+
+    @details Constants occupy the first slots and registers; the remaining
+    clauses are in dependency order, so evaluation is a single pass through
+    the clause list.
+
+    A tape is immutable once built.  Per-evaluation storage lives in an
+    EvalContext, so many contexts may share a single tape.
+*/
+typedef struct Tape_ {
+    /** @var num_slots
+    Number of scalar / interval slots (one per node) */
+    unsigned num_slots;
+
+    /** @var num_registers
+    Number of array registers */
+    unsigned num_registers;
+
+    /** @var num_constants
+    Number of constant slots and registers at the start of each array */
+    unsigned num_constants;
+
+    /** @var root
+    @var root_reg
+    Slot and register holding the tree's result */
+    unsigned root, root_reg;
+
+    /** @var clauses
+    @var num_clauses
+    Full list of clauses */
+    Clause* clauses;
+    unsigned num_clauses;
+
+    /** @var constants
+    Values of constant slots */
+    float* constants;
+
+    /** @var affine
+    Coefficients of OP_AFFINE clauses (four per clause) */
+    float* affine;
+
+    /** @var boxes
+    Boxes of OP_BOUNDS nodes (six floats per node) */
+    float* boxes;
+
+    /** @var r_const
+    @var g_const
+    Array and derivative registers for constants, filled in when the tape
+    is built.  They are never written during evaluation, so every context
+    points at the same storage. */
+    float* r_const;
+    struct derivative_* g_const;
+} Tape;
+
+
+/** @brief Checks whether a clause is the guard of an OP_BOUNDS node. */
+static inline bool is_guard(const Clause* c)
+{
+    return c->op == OP_BOUNDS && c->a == c->id;
+}
+
+
+/** @brief Flattens a tree into a new tape.
+    @details The tree's nodes are left untouched apart from their slot field.
+*/
+Tape* build_tape(const struct MathTree_* tree);
+
+
+/** @brief Frees a tape and all of its storage. */
+void free_tape(Tape* tape);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,8 +8,51 @@
 
 #include "fab/util/region.h"
 
+/*
+ *  Meshes the given region, storing an array of vertices (as x,y,z float
+ *  triplets, three per triangle) in verts and the number of floats in count.
+ *
+ *  If tolerance is greater than zero, vertices are placed to within that
+ *  distance of the surface along voxel edges, with a root-finding method
+ *  that stops early on smooth surfaces; otherwise, they're placed with a
+ *  fixed eight-step binary search along each edge.
+ */
 void triangulate(struct MathTree_* tree, Region r,
                  bool detect_edges, volatile int* halt,
-                 float** const verts, unsigned* const count);
+                 float** const verts, unsigned* const count,
+                 float tolerance=0);
+
+/*
+ *  Multithreaded version of triangulate.
+ *
+ *  The region is split into blocks along the same octree walk used by the
+ *  serial mesher, each block is meshed on a worker thread, and the block
+ *  meshes are merged back together in walk order.  Vertices on the faces
+ *  between blocks are found by both blocks, and are snapped to the first
+ *  block's copy (by the voxel edge that they're on), so the mesh is closed
+ *  across block boundaries.  The output has the same triangles as
+ *  triangulate, though vertices may differ in the last few bits (since
+ *  points may be evaluated in different SIMD lanes).
+ *
+ *  threads is the number of worker threads (0 for one per core).
+ */
+void triangulate_parallel(struct MathTree_* tree, Region r,
+                          bool detect_edges, volatile int* halt,
+                          float** const verts, unsigned* const count,
+                          unsigned threads, float tolerance=0);
+
+/*
+ *  Meshes the given region with dual contouring, which places one vertex
+ *  in each voxel (or group of voxels) that the surface passes through,
+ *  keeping sharp edges and corners and using far fewer triangles on
+ *  smooth or flat surfaces.  Output is the same as triangulate.
+ *
+ *  Voxels are merged into a single vertex when that vertex's RMS distance
+ *  to their surface planes is at most tolerance (or 1% of a voxel, if
+ *  tolerance is zero).
+ */
+void triangulate_dual(struct MathTree_* tree, Region r, volatile int* halt,
+                      float** const verts, unsigned* const count,
+                      float tolerance=0);
 
 #endif
@@ -0,0 +1,187 @@
+#ifndef DUAL_MESHER_H
+#define DUAL_MESHER_H
+
+#include <array>
+#include <vector>
+#include <unordered_map>
+
+#include "fab/tree/triangulate/triangle.h"
+
+#include "fab/util/region.h"
+
+// Forward declarations of MathTree and EvalContext
+struct MathTree_;
+struct EvalContext_;
+
+/*
+ *  Quadratic error function: the sum of squared distances from a point
+ *  to a set of planes (each given by a surface position and normal).
+ */
+struct Qef {
+    Qef();
+
+    /*
+     *  Adds the plane through p with (unit) normal n.
+     */
+    void add(const Vec3f& p, const Vec3f& n);
+
+    /*
+     *  Adds every plane from another QEF.
+     */
+    Qef& operator+=(const Qef& other);
+
+    /*
+     *  Finds the point that minimizes the error, with directions that
+     *  aren't well-constrained by the planes (e.g. along an edge or across
+     *  a flat face) pinned to the average of the plane positions.
+     */
+    Vec3f solve() const;
+
+    /*
+     *  Returns the sum of squared distances from p to the planes.
+     */
+    double error(const Vec3f& p) const;
+
+    Eigen::Matrix3d ata;
+    Eigen::Vector3d atb;
+    double btb;
+
+    // Sum of the plane positions
+    Vec3f mass;
+    unsigned count;
+};
+
+/*
+ *  Meshes a shape with dual contouring (after "Dual Contouring of Hermite
+ *  Data", Ju, Losasso, Schaefer, and Warren, SIGGRAPH 2002).
+ *
+ *  Every voxel that the surface passes through gets a single vertex,
+ *  placed by minimizing a QEF built from the positions and normals of the
+ *  surface crossings on its edges (so sharp features are kept without a
+ *  separate pass), and each voxel edge that the surface crosses becomes
+ *  a quad between the four voxels around it.
+ *
+ *  Within each packed block of voxels, neighbouring voxels are collapsed
+ *  into one vertex when a single vertex fits all of their planes and the
+ *  collapse can't change the mesh's topology.
+ */
+class DualMesher {
+public:
+    /*
+     *  Voxels are collapsed together if the resulting vertex's RMS
+     *  distance to their planes is within tolerance (or within 1% of a
+     *  voxel, if tolerance is zero).
+     */
+    DualMesher(struct MathTree_* tree, volatile int* halt, float tolerance=0);
+    ~DualMesher();
+
+    /*
+     *  Finds the vertices of every voxel in the given region that
+     *  contains part of the surface.
+     */
+    void triangulate_region(const Region& r);
+
+    /*
+     *  Connects vertices into triangles, then allocates memory (using
+     *  malloc) and returns a flat set of vertices.  count is set to the
+     *  number of floats allocated (i.e. number of vertices * 3)
+     */
+    float* get_verts(unsigned* count);
+
+protected:
+    // A cluster of voxels that share a vertex
+    struct Cluster {
+        Qef qef;
+        std::vector<std::array<uint32_t, 3>> voxels;
+    };
+
+    // A voxel that contains part of the surface
+    struct Cell {
+        uint32_t vertex;    // Index into vertices
+        uint8_t inside;     // Corners that are inside (from corners)
+    };
+
+    /*
+     *  Recursively subdivides a region that may contain the surface,
+     *  meshing it once it's small enough to evaluate in one pass.
+     */
+    void triangulate_ambiguous(const Region& r);
+
+    /*
+     *  Evaluates every corner of the given region then finds its voxels'
+     *  vertices, collapsing voxels where possible.
+     */
+    void mesh_block(const Region& r);
+
+    /*
+     *  Finds the surface crossings (positions and normals) on the
+     *  given edges of the current block, where edge e runs from corner
+     *  index e / 3 along axis e % 3.
+     */
+    void find_crossings(const std::vector<unsigned>& edges,
+                        std::vector<Vec3f>* pos, std::vector<Vec3f>* norm);
+
+    /*
+     *  Collapses the voxels in the given part of the current block,
+     *  returning true if they've all been gathered into one cluster
+     *  (stored in out).  Clusters that can't be collapsed any further
+     *  are given vertices.
+     */
+    bool collapse(const Region& r, Cluster* out);
+
+    /*
+     *  Checks whether replacing the voxels in the given part of the
+     *  current block with a single vertex would keep the mesh's topology
+     *  (using the sign tests from Ju et al.).
+     */
+    bool is_simple(const Region& r) const;
+
+    /*
+     *  Assigns a vertex (inside of the given region) to a cluster.
+     */
+    void add_vertex(const Region& r, const Cluster& c);
+
+    /*
+     *  Returns true if the given lattice point of the current block
+     *  is inside of the shape.
+     */
+    bool inside(uint32_t i, uint32_t j, uint32_t k) const;
+
+    /*
+     *  Returns a bitmask of the corners of the given voxel (in the current
+     *  block) that are inside of the shape, where corner bits 4, 2, and 1
+     *  are set for the upper end of the x, y, and z axes.
+     */
+    uint8_t corners(uint32_t i, uint32_t j, uint32_t k) const;
+
+    // MathTree that we're evaluating
+    struct MathTree_* tree;
+
+    // Evaluation context (owned by this DualMesher)
+    struct EvalContext_* ctx;
+
+    volatile int* halt;
+
+    // Maximum RMS distance from a collapsed vertex to its planes
+    // (as passed to the constructor, then as used)
+    float tolerance;
+    float max_error;
+
+    // Current block, its corner values, and the QEF of each of its voxels
+    Region block;
+    float* data;
+    std::vector<Qef> qefs;
+
+    // Buffers used for eval_r and eval_g
+    float* X;
+    float* Y;
+    float* Z;
+
+    // Every vertex, and the voxels that contain part of the surface
+    // (in the order in which they were found)
+    std::vector<Vec3f> vertices;
+    std::vector<std::array<uint32_t, 3>> order;
+    std::unordered_map<std::array<uint32_t, 3>, Cell, KeyHash> cells;
+};
+
+#endif
@@ -2,27 +2,57 @@
 #define MESHER_H
 
 #include <list>
-#include <map>
 #include <array>
 #include <vector>
+#include <utility>
+#include <unordered_map>
 
 #include "fab/tree/triangulate/triangle.h"
 
 #include "fab/util/region.h"
 
-// Forward declaration of MathTree
+// Forward declarations of MathTree and EvalContext
 struct MathTree_;
+struct EvalContext_;
+
+/*
+ *  Lattice coordinates of the two ends of a voxel edge, with the smaller
+ *  end first (so that an edge has the same key in every voxel).
+ */
+typedef std::array<uint32_t, 6> EdgeKey;
+
+/*
+ *  A zero crossing on a voxel edge, shared between the voxels that have
+ *  that edge.  pos is filled in when the queue is flushed.
+ */
+struct EdgeCrossing {
+    Vec3f pos = Vec3f::Zero();
+    uint8_t uses = 0;   // Number of voxels that have yet to look it up
+};
 
 struct InterpolateCommand {
-    enum {INTERPOLATE, CACHED, END_OF_VOXEL} cmd;
+    enum {VERTEX, END_OF_VOXEL} cmd;
+    const EdgeCrossing* crossing;
+};
+
+struct PendingCrossing {
+    EdgeCrossing* crossing;
     Vec3f v0;
     Vec3f v1;
-    unsigned cached;
+    float d0;   // Function value at v0 (negative)
+    float d1;   // Function value at v1 (non-negative)
 };
 
 class Mesher {
 public:
-    Mesher(struct MathTree_* tree, bool detect_edges, volatile int* halt);
+    /*
+     *  If tolerance is greater than zero, vertices are placed to within
+     *  that distance of the surface along each edge (with the root-finding
+     *  in eval_zero_crossings_illinois); otherwise, they're placed with a
+     *  fixed eight-step binary search.
+     */
+    Mesher(struct MathTree_* tree, bool detect_edges, volatile int* halt,
+           float tolerance=0);
     ~Mesher();
 
     /*
@@ -37,12 +67,32 @@ public:
      */
     float* get_verts(unsigned* count);
 
+    /*
+     *  Moves another Mesher's triangles onto the end of this one's,
+     *  leaving it empty.  other must have meshed a region that the serial
+     *  walk would visit after this Mesher's regions; swappable edges
+     *  between the two are matched up as the serial walk would have done.
+     *
+     *  Zero crossings on the faces between the two regions are found
+     *  separately by each Mesher (and may differ in the last few bits),
+     *  so other's copies are snapped to the ones that we found.
+     */
+    void append(Mesher& other);
+
 protected:
     /*
-     *  Finds the normals of each vertex on the triangle.
-     *  Returns a Triangle with the corners as the new normals.
+     *  Triangulates a region whose interval evaluation has already been
+     *  found to be ambiguous (with its results in the context's slots).
+     *  Regions that don't depend on Z are evaluated as prisms (then
+     *  triangulated one layer of the lattice at a time).
+     */
+    void triangulate_ambiguous(const Region& r);
+
+    /*
+     *  Finds the surface normal at each of the given points from the
+     *  gradients found by eval_g (MIN_VOLUME/4 points at a time).
      */
-     std::list<Vec3f> get_normals(const std::list<Vec3f>& t);
+    std::vector<Vec3f> get_normals(const std::vector<Vec3f>& points);
 
     /*
      *  Records another vertex.
@@ -70,6 +120,15 @@ protected:
      */
     void eval_zero_crossings(Vec3f* v0, Vec3f* v1, unsigned count);
 
+    /*
+     *  Finds zero crossings to within the Mesher's tolerance using the
+     *  Illinois variant of regula falsi, stopping early for edges that
+     *  have converged.  d0 and d1 are the function's values at v0 and v1.
+     *  Found x, y, z values are stored in ex, ey, ez.
+     */
+    void eval_zero_crossings_illinois(Vec3f* v0, Vec3f* v1,
+                                      float* d0, float* d1, unsigned count);
+
     /*
      *  Flushes the command queue.
      *  This will involve calculating a set of interpolated positions
@@ -78,9 +137,26 @@ protected:
     void flush_queue();
 
     /*
-     *  Schedules an interpolation command in the command queue.
+     *  Schedules a vertex on the edge between corners v0 and v1 of the
+     *  given voxel (where v0 is inside the shape) in the command queue.
+     *  d is the voxel's corner values.
+     *  The edge's zero crossing is looked up in the edge cache, and is
+     *  only calculated if no other voxel has asked for it.
      */
-    void interpolate_between(const Vec3f& v0, const Vec3f& v1);
+    void interpolate_between(const Region& r, const float* const d,
+                             uint8_t v0, uint8_t v1);
+
+    /*
+     *  Returns the number of voxels in the meshed region that have
+     *  the given edge.
+     */
+    uint8_t edge_users(const EdgeKey& k) const;
+
+    /*
+     *  Returns true if the given edge is on a face of the meshed region
+     *  (and so may be shared with a neighbouring region).
+     */
+    bool on_face(const EdgeKey& k) const;
 
     /*
      *  Evaluates the given voxel.
@@ -104,21 +180,34 @@ protected:
     void push_swappable_triangle(Triangle t);
 
     /*
-     *  Check the most recent fan (from voxel_start to triangles.end())
-     *  for features and process them if they are found.
+     *  Extracts every fan from the current voxel (between voxel_start
+     *  and voxel_end), finds the normals of all of their contours at
+     *  once, then checks each fan for features.
      */
-    void check_feature();
+    void check_features();
+
+    /*
+     *  Checks a fan (stored in triangles between start and end, with the
+     *  given contour and normals) for a feature, replacing it with a
+     *  new fan if one is found.
+     */
+    void check_feature(std::list<Vec3f> contour,
+                       const std::list<Vec3f>& normals,
+                       size_t start, size_t end);
 
     /*
      *  Removes duplicates from the triangle list.
+     *  ids holds each triangle's vertex IDs (from vertex_ids), and is
+     *  filtered along with the triangles.
      */
-    void remove_dupes();
+    void remove_dupes(std::vector<std::array<uint32_t, 3>>* ids);
 
     /*
      *  Removes triangles with edges that aren't connected to the
      *  rest of the mesh (which happens sometimes when refining geometry).
+     *  ids holds each triangle's vertex IDs (from vertex_ids).
      */
-    void prune_flags();
+    void prune_flags(const std::vector<std::array<uint32_t, 3>>& ids);
 
     /*
      *  Returns a closed contour that traces the most recent fan.
@@ -128,16 +217,51 @@ protected:
      */
     std::list<Vec3f> get_contour();
 
+    /*
+     *  Moves the triangle at index i to the end of the current fan
+     *  (just before voxel_start), keeping other triangles in order.
+     */
+    void move_to_fan(size_t i);
+
+    /*
+     *  Drops the triangles in erased, updating indices in swappable.
+     */
+    void compact();
+
+    /*
+     *  Assigns an ID to each distinct vertex, returning the IDs of each
+     *  triangle's corners.  Vertices are compared as floats.
+     */
+    std::vector<std::array<uint32_t, 3>> vertex_ids() const;
+
     // MathTree that we're evaluating
     struct MathTree_* tree;
+
+    // Evaluation context (owned by this Mesher)
+    struct EvalContext_* ctx;
+
     bool detect_edges;
     volatile int* halt;
 
+    // Distance from the surface to which vertices are placed
+    // (or zero for a fixed binary search)
+    float tolerance;
+
     // Cached region and data from an eval_r call
     Region packed;
     float* data;
     bool has_data;
 
+    // Set while meshing a flattened extrusion, where each voxel
+    // spans the full height of the region (and is split back into
+    // layers when it's triangulated)
+    bool prism;
+
+    // Lattice index of the top of the prisms, and the Z coordinates of
+    // the lattice from their bottom up (valid while prism is set)
+    uint32_t prism_top;
+    float* prism_z;
+
     // Buffers used for eval_r
     float* X;
     float* Y;
@@ -153,19 +277,50 @@ protected:
     float* ny;
     float* nz;
 
-    // Queue of interpolation commands to be run soon
-    std::list<InterpolateCommand> queue;
+    // Lattice bounds of the region passed to triangulate_region
+    // (lower corner, then upper corner)
+    std::array<uint32_t, 6> lattice;
+
+    // Queue of commands to be run on the next flush, and the zero
+    // crossings that will need to be found first
+    std::vector<InterpolateCommand> queue;
+    std::vector<PendingCrossing> pending;
+
+    // Zero crossings that some voxels have yet to look up, keyed by edge.
+    // Crossings whose last voxel has looked them up are listed in retired
+    // and dropped at the next flush.
+    std::unordered_map<EdgeKey, EdgeCrossing, KeyHash> edges;
+    std::vector<EdgeKey> retired;
+
+    // Crossings on the faces of the meshed region that have been requested
+    // since the last flush, and the positions of the ones that have been
+    // found (as stored in triangles), which are used by append.
+    std::vector<std::pair<EdgeKey, const EdgeCrossing*>> new_face_crossings;
+    std::unordered_map<EdgeKey, std::array<float, 3>, KeyHash> face_crossings;
+
+    // Crossings that the current voxel has looked up, by corner pair
+    EdgeCrossing* voxel_edges[8][8];
 
     // Triangle that's being constructed
     std::vector<Vec3f> triangle;
 
-    // List of existing triangles
-    std::list<Triangle> triangles;
-
-    std::list<Triangle>::iterator voxel_start;
-    std::list<Triangle>::iterator voxel_end;
-    std::list<Triangle>::iterator fan_start;
-    std::map<std::array<float, 6>, std::list<Triangle>::iterator> swappable;
+    // List of existing triangles.  Triangle fans that are replaced
+    // during feature detection stay in place (with their index ranges
+    // stored in erased) until compact is called.
+    std::vector<Triangle> triangles;
+    std::vector<std::pair<size_t, size_t>> erased;
+
+    // Indices into triangles: the current voxel's triangles are in
+    // [voxel_start, voxel_end), and the fan being extracted is in
+    // [fan_start, voxel_start).  voxel_start is equal to the number of
+    // triangles when it has been cleared.
+    size_t voxel_start;
+    size_t voxel_end;
+    size_t fan_start;
+
+    // Unmatched swappable triangles, keyed by the edge their partner
+    // will have (i.e. their first edge, reversed)
+    std::unordered_map<std::array<float, 6>, size_t, KeyHash> swappable;
 };
 
 #endif
@@ -4,6 +4,8 @@
 #include "Eigen/Dense"
 
 #include <array>
+#include <cstdint>
+#include <cstring>
 
 typedef Eigen::Vector3d Vec3f;
 
@@ -37,4 +39,40 @@ struct Triangle {
     Vec3f c;
 };
 
+/*
+ *  Hash function for vertex and edge keys (arrays of float coordinates
+ *  or integer vertex IDs), for use in unordered maps and sets.
+ *  Coordinates are compared as floats, so 0 and -0 hash the same way.
+ */
+struct KeyHash {
+    template <std::size_t N>
+    std::size_t operator()(const std::array<float, N>& k) const
+    {
+        std::size_t h = 0;
+        for (float f : k)
+        {
+            if (f == 0)
+                f = 0;
+            uint32_t bits;
+            memcpy(&bits, &f, sizeof(bits));
+            h = combine(h, bits);
+        }
+        return h;
+    }
+
+    template <std::size_t N>
+    std::size_t operator()(const std::array<uint32_t, N>& k) const
+    {
+        std::size_t h = 0;
+        for (uint32_t i : k)
+            h = combine(h, i);
+        return h;
+    }
+
+    static std::size_t combine(std::size_t h, uint32_t v)
+    {
+        return h ^ (v + 0x9e3779b9 + (h << 6) + (h >> 2));
+    }
+};
+
 #endif // TRIANGLE_H
@@ -0,0 +1,86 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <array>
+#include <memory>
+
+#include "fab/tree/node/opcodes.h"
+
+struct MathTree_;
+
+/*
+ *  An immutable math expression, stored as a hash-consed DAG.
+ *
+ *  Every node is interned in a process-wide table, so structurally
+ *  identical expressions share a single node (and can be compared by
+ *  pointer).  Combining expressions is constant-time, and subexpressions
+ *  that are shared between many shapes are only stored once.
+ */
+class Expr : public std::enable_shared_from_this<Expr>
+{
+public:
+    typedef std::shared_ptr<const Expr> Ptr;
+
+    /*
+     *  Node constructors (which return an existing node if possible)
+     */
+    static Ptr constant(float value);
+    static Ptr axis(Opcode op);
+    static Ptr unary(Opcode op, Ptr arg);
+    static Ptr binary(Opcode op, Ptr lhs, Ptr rhs);
+
+    /*
+     *  Marks an expression as empty (i.e. positive) outside of the box
+     *  {xmin, ymin, zmin, xmax, ymax, zmax}, so that evaluation can skip it
+     *  there.  Returns arg if the box is infinite; nested boxes are merged.
+     */
+    static Ptr bounded(Ptr arg, const float* box);
+
+    /*
+     *  Converts a MathTree's nodes into an expression.
+     *  Affine nodes are expanded back into sums of scaled axes.
+     */
+    static Ptr fromTree(const struct MathTree_* tree);
+
+    /*
+     *  Builds a new MathTree from this expression.
+     *  The caller takes ownership of the tree.
+     *
+     *  If the expression contains bounded subexpressions, each cluster of
+     *  unions is rebuilt as a bounding volume hierarchy (a balanced tree of
+     *  bounded unions), so that evaluation only visits the operands whose
+     *  boxes overlap the region of interest.
+     */
+    struct MathTree_* toTree() const;
+
+    /*
+     *  Returns this expression with X, Y, and Z replaced by the given
+     *  expressions (or left alone if an argument is null).
+     *
+     *  Boxes of bounded subexpressions are in the old coordinates, so
+     *  they're dropped if any axis is replaced.
+     */
+    Ptr remap(Ptr x, Ptr y, Ptr z) const;
+
+    ~Expr();
+
+    const Opcode op;
+    const float value;
+    const Ptr lhs;
+    const Ptr rhs;
+
+    /*  Box of an OP_BOUNDS node (infinite otherwise)  */
+    const std::array<float, 6> box;
+
+protected:
+    Expr(Opcode op, float value, const float* box, Ptr lhs, Ptr rhs);
+
+    /*
+     *  Looks up a node in the intern table, creating it if necessary.
+     *  box is only used by OP_BOUNDS nodes.
+     */
+    static Ptr intern(Opcode op, float value, const float* box,
+                      Ptr lhs, Ptr rhs);
+};
+
+#endif
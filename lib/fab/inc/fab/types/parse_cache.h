@@ -0,0 +1,89 @@
+#ifndef PARSE_CACHE_H
+#define PARSE_CACHE_H
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "fab/types/expr.h"
+
+struct MathTree_;
+
+/*
+ *  A process-wide, thread-safe cache of parsed math strings.
+ *
+ *  Entries are evicted in least-recently-used order once their
+ *  (approximate) memory usage exceeds the cache's capacity.  Cached trees
+ *  are shared by every Shape built from the same string, so they must be
+ *  treated as read-only (evaluation state lives in an EvalContext).
+ */
+class ParseCache
+{
+public:
+    struct Entry
+    {
+        Expr::Ptr expr;
+        std::shared_ptr<struct MathTree_> tree;
+    };
+
+    /*
+     *  Returns the global cache.
+     */
+    static ParseCache& instance();
+
+    /*
+     *  Looks up a math string, parsing it on a miss.
+     *  Throws fab::ParseError if parsing fails.
+     */
+    Entry get(const std::string& math);
+
+    /*
+     *  Sets the memory cap (in bytes), evicting entries if needed.
+     */
+    void setCapacity(size_t bytes);
+
+    /*
+     *  Removes every entry (without resetting the hit / miss counters).
+     */
+    void clear();
+
+    size_t capacity() const;
+    size_t size() const;
+    size_t entries() const;
+    unsigned long hits() const;
+    unsigned long misses() const;
+
+    /*  Default memory cap, in bytes  */
+    static const size_t DEFAULT_CAPACITY = 64 << 20;
+
+protected:
+    ParseCache();
+
+    /*
+     *  Drops least-recently-used entries until we're under capacity.
+     *  Must be called with the mutex locked.
+     */
+    void evict();
+
+    struct Item
+    {
+        const std::string* math;
+        Entry entry;
+        size_t bytes;
+    };
+
+    /*  Items are stored most-recently-used first, and indexed by string  */
+    std::list<Item> items;
+    std::unordered_map<std::string, std::list<Item>::iterator> index;
+
+    size_t cap;
+    size_t used;
+    unsigned long num_hits;
+    unsigned long num_misses;
+
+    mutable std::mutex mutex;
+};
+
+#endif // PARSE_CACHE_H
@@ -7,13 +7,26 @@
 #include <memory>
 
 #include "fab/types/bounds.h"
+#include "fab/types/expr.h"
 #include "fab/types/transform.h"
 
 #include "fab/tree/tree.h"
 
 typedef std::tuple<int,int,int> int3;
 
-/** Represents a math expression and a set of bounds. */
+/** Represents a math expression and a set of bounds.
+ *
+ *  The expression is stored as a shared, immutable DAG, so combining
+ *  shapes doesn't copy or re-parse their math.  The math string and the
+ *  MathTree used for evaluation are built on first use.
+ *
+ *  The bounds are trusted to enclose the shape: in unions and
+ *  intersections, each operand is treated as empty outside of its own
+ *  bounds (see operator| and operator&), so any part of its math that
+ *  lies outside of them is cut off.  The operands' boxes are written into
+ *  the math string, so a shape rebuilt from its string is cut off in the
+ *  same way.  Mapping a shape drops the boxes inside of it.
+ */
 struct Shape
 {
     /* Constructor throws fab::ParseError if parsing fails. */
@@ -40,11 +53,33 @@ struct Shape
     /** Returns a new shape with re-mapped coordinates and bounds. */
     Shape map(Transform t) const;
 
-    std::string math;
-    Bounds bounds;
+    /** Returns the shape's math string. */
+    std::string getMath() const;
+
+    /** Returns a tree for evaluating the shape (shared between copies). */
+    std::shared_ptr<MathTree> getTree() const;
 
-    std::shared_ptr<MathTree> tree;
+    Expr::Ptr expr;
+    Bounds bounds;
     int r, g, b;
+
+protected:
+    struct Lazy;
+
+    /*  Builds a shape from an expression, whose math string is the
+     *  concatenation of prefix and the math strings of parts  */
+    Shape(Expr::Ptr expr, Bounds bounds, std::string prefix,
+          std::initializer_list<const Shape*> parts);
+
+    /*  Returns this shape, marked as empty outside of its bounds
+     *  (or the shape itself if its bounds are infinite)  */
+    Shape bounded() const;
+
+    std::shared_ptr<Lazy> lazy;
+
+    friend Shape operator~(const Shape& a);
+    friend Shape operator|(const Shape& a, const Shape& b);
+    friend Shape operator&(const Shape& a, const Shape& b);
 };
 
 Shape operator~(const Shape& a);
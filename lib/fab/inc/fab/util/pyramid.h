@@ -0,0 +1,110 @@
+#ifndef UTIL_PYRAMID_H
+#define UTIL_PYRAMID_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*  A min-depth pyramid (hierarchical Z buffer) over a rectangle of pixels.
+ *
+ *  Level 0 stores one depth per pixel; each block in level n+1 stores the
+ *  minimum of its (up to four) children in level n, so that asking whether
+ *  a region is entirely at or above some depth rarely needs to look past
+ *  the first few levels.
+ *
+ *  Filling a rectangle only touches the blocks along its edges: blocks
+ *  that are entirely covered record the fill in their 'fill' value, which
+ *  is pushed down to the pixels when the pyramid is stored.  A block's
+ *  depth includes its own fill, but not the fills of its ancestors.
+ */
+typedef struct DepthPyramid_ {
+    // Image coordinates of the base level's corner, and its size
+    uint32_t imin, jmin;
+    uint32_t ni, nj;
+
+    // Number of levels, and the width and height of each level
+    unsigned levels;
+    uint32_t *w, *h;
+
+    // Per-level minimum depths and pending fills (fill[0] is NULL)
+    uint16_t **depth, **fill;
+} DepthPyramid;
+
+
+/*  new_pyramid
+ *
+ *  Allocates a pyramid covering ni by nj pixels, starting at (imin, jmin).
+ *  Every pixel starts at zero depth.
+ */
+DepthPyramid* new_pyramid(uint32_t imin, uint32_t jmin,
+                          uint32_t ni, uint32_t nj);
+
+
+/*  free_pyramid
+ *
+ *  Frees a pyramid and all of its levels.
+ */
+void free_pyramid(DepthPyramid* p);
+
+
+/*  pyramid_load{8,16}
+ *
+ *  Copies the pyramid's rectangle of an image into its base level
+ *  and rebuilds the levels above it.
+ */
+void pyramid_load8(DepthPyramid* p, uint8_t** img);
+void pyramid_load16(DepthPyramid* p, uint16_t** img);
+
+
+/*  pyramid_store{8,16}
+ *
+ *  Pushes pending fills down to the base level, then copies
+ *  it back into the pyramid's rectangle of an image.
+ */
+void pyramid_store8(DepthPyramid* p, uint8_t** img);
+void pyramid_store16(DepthPyramid* p, uint16_t** img);
+
+
+/*  pyramid_covered
+ *
+ *  Returns true if every pixel in the given rectangle (in image
+ *  coordinates) has a depth of at least L.
+ */
+bool pyramid_covered(const DepthPyramid* p, uint32_t imin, uint32_t jmin,
+                     uint32_t ni, uint32_t nj, uint16_t L);
+
+
+/*  pyramid_fill
+ *
+ *  Raises every pixel in the given rectangle to a depth of at least L.
+ */
+void pyramid_fill(DepthPyramid* p, uint32_t imin, uint32_t jmin,
+                  uint32_t ni, uint32_t nj, uint16_t L);
+
+
+/*  pyramid_write_rect
+ *
+ *  Raises every pixel in the given rectangle (in image coordinates) to
+ *  a depth of at least the matching value in Ls, which is stored row by
+ *  row with ni values per row.
+ */
+void pyramid_write_rect(DepthPyramid* p, uint32_t imin, uint32_t jmin,
+                        uint32_t ni, uint32_t nj, const uint16_t* Ls);
+
+
+/*  pyramid_read
+ *
+ *  Copies the depths of every pixel in the given rectangle (in image
+ *  coordinates) into out, which must have room for ni * nj values.
+ */
+void pyramid_read(const DepthPyramid* p, uint32_t imin, uint32_t jmin,
+                  uint32_t ni, uint32_t nj, uint16_t* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
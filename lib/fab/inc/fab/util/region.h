@@ -7,7 +7,7 @@
 extern "C" {
 #endif
 
-struct MathTree_;
+struct EvalContext_;
 
 typedef struct Region_ {
     uint32_t imin, jmin, kmin;
@@ -55,10 +55,11 @@ int bisect(const Region r, Region* const A, Region* const B);
 uint8_t octsect(const Region R, Region* const out);
 
 
-/** @brief Splits a region along each active axis of the given MathTree
+/** @brief Splits a region along each axis that is active in the given
+    context's current clause list
     @returns Bit mask of newly populated regions.
 */
-int octsect_active(const Region r, const struct MathTree_* tree,
+int octsect_active(const Region r, const struct EvalContext_* ctx,
        Region* const out);
 
 
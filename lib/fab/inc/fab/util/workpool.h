@@ -0,0 +1,40 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <functional>
+
+/*
+ *  A small work-stealing scheduler for fixed batches of tasks.
+ *
+ *  Tasks are dealt out to workers in contiguous blocks; each worker takes
+ *  tasks from the back of its own block, and once that runs dry it steals
+ *  from the front of another worker's block.
+ */
+class WorkPool
+{
+public:
+    /*
+     *  Constructs a pool with the given number of workers
+     *  (or one per hardware thread if workers is 0).
+     */
+    explicit WorkPool(unsigned workers=0);
+
+    /*
+     *  Runs f(task, worker) for every task in [0, count), blocking until
+     *  all tasks are done.  The worker index is in [0, size()) and is
+     *  unique among concurrently-running calls, so it can be used to
+     *  index per-worker state.  The calling thread acts as worker 0.
+     */
+    void run(unsigned count,
+             const std::function<void(unsigned, unsigned)>& f) const;
+
+    /*
+     *  Returns the number of workers.
+     */
+    unsigned size() const { return workers; }
+
+protected:
+    unsigned workers;
+};
+
+#endif
@@ -3,6 +3,9 @@
 
 #include "fab/fab.h"
 #include "fab/types/shape.h"
+#include "fab/types/parse_cache.h"
+#include "fab/tree/simplify.h"
+#include "fab/tree/eval.h"
 #include "fab/types/transform.h"
 
 using namespace boost::python;
@@ -19,6 +22,43 @@ void fab::onShapeError(const fab::ShapeError& e)
     PyErr_SetString(PyExc_RuntimeError, "Could not construct Shape object.");
 }
 
+static dict parse_cache_stats()
+{
+    ParseCache& cache = ParseCache::instance();
+
+    dict out;
+    out["hits"] = cache.hits();
+    out["misses"] = cache.misses();
+    out["entries"] = cache.entries();
+    out["size"] = cache.size();
+    out["capacity"] = cache.capacity();
+    return out;
+}
+
+static void set_parse_cache_capacity(size_t bytes)
+{
+    ParseCache::instance().setCapacity(bytes);
+}
+
+static void clear_parse_cache()
+{
+    ParseCache::instance().clear();
+}
+
+static void set_simplify_trees(bool enable)
+{
+    // Cached trees were built with the old setting, so drop them
+    set_simplify(enable);
+    ParseCache::instance().clear();
+}
+
+// Copies share the shape's expression and tree, so they don't need
+// to be re-parsed (and keep any bounds inside the expression)
+static Shape copy_shape(const Shape& s)
+{
+    return s;
+}
+
 BOOST_PYTHON_MODULE(_fabtypes)
 {
     class_<Bounds>("Bounds", init<>())
@@ -39,13 +79,14 @@ BOOST_PYTHON_MODULE(_fabtypes)
     class_<Shape>("Shape", no_init)
             .def("__init__", raw_function(&Shape::init), "raw constructor")
             .def(init<std::string, Bounds, int, int, int>())
-            .def_readonly("math", &Shape::math)
+            .add_property("math", &Shape::getMath)
             .def_readonly("bounds", &Shape::bounds)
             .def_readwrite("_r", &Shape::r)
             .def_readwrite("_g", &Shape::g)
             .def_readwrite("_b", &Shape::b)
             .def("map", &Shape::map)
             .def("__repr__", &Shape::repr)
+            .def("__copy__", &copy_shape)
             .def(self & self)
             .def(self | self)
             .def(~self);
@@ -62,6 +103,25 @@ BOOST_PYTHON_MODULE(_fabtypes)
             .def_readonly("y_reverse", &Transform::y_reverse)
             .def_readonly("z_reverse", &Transform::z_reverse);
 
+    def("parse_cache_stats", &parse_cache_stats,
+        "Returns a dict with the math string cache's hit and miss counts,\n"
+        "number of entries, and memory usage and capacity (in bytes).");
+    def("set_parse_cache_capacity", &set_parse_cache_capacity,
+        "Sets the math string cache's memory cap (in bytes).");
+    def("clear_parse_cache", &clear_parse_cache,
+        "Removes every entry from the math string cache.");
+
+    def("set_simplify", &set_simplify_trees,
+        "Enables or disables algebraic simplification of parsed math\n"
+        "(enabled by default).  Clears the math string cache.");
+    def("simplified_nodes", &simplified_nodes,
+        "Returns the number of nodes removed by simplification so far.");
+
+    def("set_affine_eval", &set_affine_eval,
+        "Enables or disables affine arithmetic when bounding shapes over\n"
+        "regions (disabled by default).  It gives tighter bounds on\n"
+        "correlated expressions, but each evaluation costs more.");
+
     register_exception_translator<fab::ParseError>(fab::onParseError);
     register_exception_translator<fab::ShapeError>(fab::onShapeError);
 }
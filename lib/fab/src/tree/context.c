@@ -0,0 +1,354 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <math.h>
+
+#include "fab/tree/context.h"
+#include "fab/tree/eval.h"
+#include "fab/tree/tree.h"
+#include "fab/tree/node/opcodes.h"
+#include "fab/tree/math/math_a.h"
+#include "fab/tree/math/math_g.h"
+#include "fab/tree/math/math_i.h"
+#include "fab/tree/math/math_ib.h"
+#include "fab/util/switches.h"
+
+// Flags used while pruning, stored per slot in ctx->marks
+#define MARK_REFERENCED 1   // Some surviving clause reads this value
+#define MARK_NEEDED     2   // The value must actually be computed
+#define MARK_NONBINARY  4   // Some reader cares about more than the sign
+
+#define NO_GUARD UINT_MAX
+
+EvalContext* new_context(const MathTree* tree)
+{
+    const Tape* tape = tree->tape;
+    const unsigned ns = tape->num_slots,
+                   nr = tape->num_registers,
+                   nc = tape->num_constants;
+
+    EvalContext* ctx = malloc(sizeof(EvalContext));
+    *ctx = (EvalContext){
+        .tree = tree,
+        .tape = tape,
+        .f = malloc((ns ? ns : 1) * sizeof(float)),
+        .i = malloc((ns ? ns : 1) * sizeof(Interval)),
+        .a = malloc((ns ? ns : 1) * sizeof(aform)),
+        .affine = get_affine_eval(),
+        .r = malloc((size_t)(nr - nc) * MIN_VOLUME * sizeof(float)),
+        .r_ptr = malloc((nr ? nr : 1) * sizeof(float*)),
+        .g_ptr = malloc((nr ? nr : 1) * sizeof(derivative*)),
+        .arena = malloc((tape->num_clauses ? tape->num_clauses : 1)
+                        * sizeof(Clause)),
+        .arena_capacity = tape->num_clauses ? tape->num_clauses : 1,
+        .frames = malloc(16 * sizeof(TapeFrame)),
+        .frame_capacity = 16,
+        .marks = calloc(ns ? ns : 1, 1),
+    };
+
+    // Constant registers are shared with the tape; the rest are ours.
+    for (unsigned r=0; r < nc; ++r) {
+        ctx->r_ptr[r] = tape->r_const + (size_t)r*MIN_VOLUME;
+        ctx->g_ptr[r] = tape->g_const + (size_t)r*MIN_VOLUME/4;
+    }
+    for (unsigned r=nc; r < nr; ++r) {
+        ctx->r_ptr[r] = ctx->r + (size_t)(r - nc)*MIN_VOLUME;
+        ctx->g_ptr[r] = (derivative*)ctx->r_ptr[r];
+    }
+
+    for (unsigned c=0; c < nc; ++c) {
+        const float v = tape->constants[c];
+        ctx->f[c] = v;
+        ctx->i[c] = (Interval){ .lower=v, .upper=v };
+        ctx->a[c] = (aform){ .v=v, .dx=0, .dy=0, .dz=0, .err=0 };
+    }
+
+    return ctx;
+}
+
+void free_context(EvalContext* ctx)
+{
+    if (ctx == NULL)    return;
+
+    free(ctx->f);
+    free(ctx->i);
+    free(ctx->a);
+    free(ctx->r);
+    free(ctx->r_ptr);
+    free(ctx->g_ptr);
+    free(ctx->arena);
+    free(ctx->frames);
+    free(ctx->marks);
+    free(ctx->ib);
+    free(ctx->batches);
+    free(ctx->batch_frames);
+    free(ctx->xyz);
+    free(ctx);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void set_transform(EvalContext* ctx, const float* M)
+{
+    if (M == NULL) {
+        ctx->has_transform = false;
+        return;
+    }
+
+    for (int i=0; i < 12; ++i)
+        ctx->transform[i] = M[i];
+    ctx->has_transform = true;
+
+    if (ctx->xyz == NULL)
+        ctx->xyz = malloc(3 * MIN_VOLUME * sizeof(float));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+const Clause* context_clauses(const EvalContext* ctx, unsigned* count)
+{
+    if (ctx->num_frames == 0) {
+        *count = ctx->tape->num_clauses;
+        return ctx->tape->clauses;
+    }
+
+    const TapeFrame* top = &ctx->frames[ctx->num_frames - 1];
+    *count = top->count;
+    return ctx->arena + top->offset;
+}
+
+/*  Prunes the n clauses in src, writing survivors to dst (which may be
+ *  the same as src) and returning the number written.
+ *
+ *  A backwards pass marks which values are read and which must be
+ *  computed, then a forwards pass copies clauses that are needed and
+ *  replaces ones that are only read with OP_CONST clauses.  Replacements
+ *  keep their original position and register, so register lifetimes from
+ *  the full tape remain valid.
+ *
+ *  A bounded node's guard is kept along with the node, and its skip count
+ *  is updated to match the surviving clauses.  If the region is entirely
+ *  outside of the node's box, its subtree is dropped (since the guard
+ *  will always skip it).
+ */
+static unsigned prune(EvalContext* ctx, const Clause* src, unsigned n,
+                      Clause* dst, bool minmax, bool binary)
+{
+    unsigned char* const marks = ctx->marks;
+    const Interval* const I = ctx->i;
+    const unsigned root = ctx->tape->root;
+
+    for (unsigned k=0; k < n; ++k)
+        marks[src[k].id] = 0;
+    marks[root] = MARK_REFERENCED | MARK_NEEDED;
+
+    for (int k=n - 1; k >= 0; --k) {
+        const Clause* c = &src[k];
+        const unsigned char m = marks[c->id];
+        if (!(m & MARK_NEEDED) || is_guard(c))  continue;
+
+        // If only the sign of this value matters and it's already known,
+        // then it can be replaced with a constant.
+        if (binary && !(m & MARK_NONBINARY) &&
+            (I[c->id].lower >= 0 || I[c->id].upper < 0))
+        {
+            marks[c->id] &= ~MARK_NEEDED;
+            continue;
+        }
+
+        const int arity = opcode_arity(c->op);
+        if (arity == 0)  continue;
+
+        // Min and max clauses may only need one of their branches
+        bool need_a = true, need_b = true;
+        if (minmax && c->op == OP_MAX) {
+            if (I[c->a].lower >= I[c->b].upper)         need_b = false;
+            else if (I[c->b].lower >= I[c->a].upper)    need_a = false;
+        } else if (minmax && c->op == OP_MIN) {
+            if (I[c->a].upper <= I[c->b].lower)         need_b = false;
+            else if (I[c->b].upper <= I[c->a].lower)    need_a = false;
+        } else if (c->op == OP_BOUNDS) {
+            const Interval* const R = ctx->region;
+            need_a = box_i(ctx->tape->boxes + 6*c->row,
+                           R[0], R[1], R[2]).lower <= 0;
+        }
+
+        // Min, max, negation, and bounds preserve the binary-ness
+        // of their input
+        const bool passes_sign = !(m & MARK_NONBINARY) &&
+            (c->op == OP_MIN || c->op == OP_MAX || c->op == OP_NEG ||
+             c->op == OP_BOUNDS);
+        const unsigned char child = MARK_REFERENCED |
+                                    (passes_sign ? 0 : MARK_NONBINARY);
+
+        marks[c->a] |= child | (need_a ? MARK_NEEDED : 0);
+        if (arity == 2)
+            marks[c->b] |= child | (need_b ? MARK_NEEDED : 0);
+    }
+
+    // Open guards are chained through their skip counts, which are
+    // filled in when the matching bounds clause is written.
+    unsigned count = 0;
+    unsigned guard = NO_GUARD;
+    for (unsigned k=0; k < n; ++k) {
+        Clause c = src[k];
+        const unsigned char m = marks[c.id];
+
+        if (is_guard(&c)) {
+            if (m & MARK_NEEDED) {
+                c.b = guard;
+                guard = count;
+                dst[count++] = c;
+            }
+        } else if (m & MARK_NEEDED) {
+            if (c.op == OP_BOUNDS) {
+                const unsigned g = guard;
+                guard = dst[g].b;
+                dst[g].b = count - g;
+            }
+            dst[count++] = c;
+        } else if (m & MARK_REFERENCED) {
+            c.op = OP_CONST;
+            c.value = I[c.id].upper;
+            c.a = c.b = c.id;
+            c.ra = c.rb = c.out;
+            dst[count++] = c;
+        }
+    }
+    return count;
+}
+
+void disable_nodes(EvalContext* ctx)
+{
+    unsigned n;
+    const Clause* src = context_clauses(ctx, &n);
+
+    // Make sure there's room for a full copy of the active list
+    if (ctx->arena_size + n > ctx->arena_capacity) {
+        const bool in_arena = ctx->num_frames != 0;
+        const size_t offset = in_arena ? (size_t)(src - ctx->arena) : 0;
+
+        ctx->arena_capacity = 2*(ctx->arena_size + n);
+        ctx->arena = realloc(ctx->arena,
+                             ctx->arena_capacity * sizeof(Clause));
+        if (in_arena)   src = ctx->arena + offset;
+    }
+    if (ctx->num_frames == ctx->frame_capacity) {
+        ctx->frame_capacity *= 2;
+        ctx->frames = realloc(ctx->frames,
+                              ctx->frame_capacity * sizeof(TapeFrame));
+    }
+
+    const unsigned count = prune(ctx, src, n, ctx->arena + ctx->arena_size,
+                                 true, false);
+
+    ctx->frames[ctx->num_frames++] = (TapeFrame){
+        .offset=ctx->arena_size, .count=count};
+    ctx->arena_size += count;
+}
+
+void disable_nodes_binary(EvalContext* ctx)
+{
+    // The full tape is shared and never modified
+    if (ctx->num_frames == 0)   return;
+
+    TapeFrame* top = &ctx->frames[ctx->num_frames - 1];
+    Clause* clauses = ctx->arena + top->offset;
+    top->count = prune(ctx, clauses, top->count, clauses, false, true);
+    ctx->arena_size = top->offset + top->count;
+}
+
+void enable_nodes(EvalContext* ctx)
+{
+    if (ctx->num_frames == 0)   return;
+
+    ctx->num_frames--;
+    ctx->arena_size = ctx->frames[ctx->num_frames].offset;
+}
+
+ibatch* push_batch(EvalContext* ctx, unsigned count)
+{
+    if (ctx->batches_size + count > ctx->batches_capacity) {
+        ctx->batches_capacity = 2*(ctx->batches_size + count);
+        ctx->batches = realloc(ctx->batches,
+                               ctx->batches_capacity * sizeof(ibatch));
+    }
+    if (ctx->num_batch_frames == ctx->batch_frame_capacity) {
+        ctx->batch_frame_capacity = ctx->batch_frame_capacity
+                                  ? 2*ctx->batch_frame_capacity : 16;
+        ctx->batch_frames = realloc(ctx->batch_frames,
+                                    ctx->batch_frame_capacity
+                                    * sizeof(size_t));
+    }
+
+    ibatch* const out = ctx->batches + ctx->batches_size;
+    ctx->batch_frames[ctx->num_batch_frames++] = ctx->batches_size;
+    ctx->batches_size += count;
+    return out;
+}
+
+void select_batch(EvalContext* ctx, unsigned lane)
+{
+    const ibatch* const b = ctx->batches +
+                            ctx->batch_frames[ctx->num_batch_frames - 1];
+    for (int a=0; a < 3; ++a)
+        ctx->region[a] = get_ib(&b[a], lane);
+
+    unsigned count;
+    const Clause* clauses = context_clauses(ctx, &count);
+    for (unsigned c=0; c < count; ++c)
+        ctx->i[clauses[c].id] = get_ib(&b[3 + c], lane);
+}
+
+void pop_batch(EvalContext* ctx)
+{
+    if (ctx->num_batch_frames == 0)     return;
+
+    ctx->num_batch_frames--;
+    ctx->batches_size = ctx->batch_frames[ctx->num_batch_frames];
+}
+
+uint8_t active_axes(const EvalContext* ctx)
+{
+    unsigned count;
+    const Clause* clauses = context_clauses(ctx, &count);
+
+    uint8_t active = 0;
+    for (unsigned c=0; c < count; ++c) {
+        switch (clauses[c].op) {
+            case OP_X:  active |= (1 << 2); break;
+            case OP_Y:  active |= (1 << 1); break;
+            case OP_Z:  active |= (1 << 0); break;
+            case OP_AFFINE: {
+                const float* k = ctx->tape->affine + 4*clauses[c].row;
+                for (int a=0; a < 3; ++a)
+                    if (k[a] != 0)  active |= 1 << (2 - a);
+                break;
+            }
+            case OP_BOUNDS: {
+                const float* b = ctx->tape->boxes + 6*clauses[c].row;
+                for (int a=0; a < 3; ++a)
+                    if (isfinite(b[a]) || isfinite(b[a + 3]))
+                        active |= 1 << (2 - a);
+                break;
+            }
+            default: ;
+        }
+    }
+
+    // Tree axis a depends on every evaluation axis with a nonzero
+    // coefficient in row a of the transform.
+    if (ctx->has_transform) {
+        uint8_t mapped = 0;
+        for (int a=0; a < 3; ++a) {
+            if (!(active & (1 << (2 - a))))
+                continue;
+            for (int b=0; b < 3; ++b)
+                if (ctx->transform[a*4 + b] != 0)
+                    mapped |= 1 << (2 - b);
+        }
+        active = mapped;
+    }
+
+    return active;
+}
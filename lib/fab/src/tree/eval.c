@@ -1,215 +1,676 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 
-#include "fab/tree/tree.h"
+#include "fab/tree/context.h"
 #include "fab/tree/eval.h"
 
-#include "fab/tree/node/node.h"
-
+#include "fab/tree/math/math_a.h"
 #include "fab/tree/math/math_f.h"
 #include "fab/tree/math/math_i.h"
+#include "fab/tree/math/math_ib.h"
 #include "fab/tree/math/math_g.h"
 #include "fab/tree/math/math_r.h"
 
-float eval_f(MathTree* tree, const float x, const float y, const float z)
+// Process-wide default for new contexts (see set_affine_eval)
+static bool affine_default = false;
+
+void set_affine_eval(bool enable)
+{
+    __atomic_store_n(&affine_default, enable, __ATOMIC_RELAXED);
+}
+
+bool get_affine_eval(void)
+{
+    return __atomic_load_n(&affine_default, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns an affine clause's coefficients with respect to evaluation
+// coordinates, composing them with the context's transform if needed.
+static const float* affine_row(const EvalContext* ctx, const Clause* c,
+                               float out[4])
 {
-    Node* node = NULL;
-
-    for (unsigned level=0; level < tree->num_levels; ++level) {
-        for (unsigned n=0; n < tree->active[level]; ++n) {
-
-            node = tree->nodes[level][n];
-
-            float A = node->lhs ? node->lhs->results.f : 0,
-                  B = node->rhs ? node->rhs->results.f : 0;
-
-            switch (node->opcode) {
-                case OP_ADD:    node->results.f = add_f(A, B); break;
-                case OP_SUB:    node->results.f = sub_f(A, B); break;
-                case OP_MUL:    node->results.f = mul_f(A, B); break;
-                case OP_DIV:    node->results.f = div_f(A, B); break;
-                case OP_MIN:    node->results.f = min_f(A, B); break;
-                case OP_MAX:    node->results.f = max_f(A, B); break;
-                case OP_POW:    node->results.f = pow_f(A, B); break;
-                case OP_ATAN2:   node->results.f = atan2_f(A,B); break;
-
-                case OP_ABS:    node->results.f = abs_f(A); break;
-                case OP_SQUARE: node->results.f = square_f(A); break;
-                case OP_SQRT:   node->results.f = sqrt_f(A); break;
-                case OP_SIN:    node->results.f = sin_f(A); break;
-                case OP_COS:    node->results.f = cos_f(A); break;
-                case OP_TAN:    node->results.f = tan_f(A); break;
-                case OP_ASIN:   node->results.f = asin_f(A); break;
-                case OP_ACOS:   node->results.f = acos_f(A); break;
-                case OP_ATAN:   node->results.f = atan_f(A); break;
-                case OP_NEG:    node->results.f = neg_f(A); break;
-                case OP_EXP:    node->results.f = exp_f(A); break;
-
-                case OP_X:      node->results.f = X_f(x); break;
-                case OP_Y:      node->results.f = Y_f(y); break;
-                case OP_Z:      node->results.f = Z_f(z); break;
-
-                case OP_CONST:  break;
-                default:
-                    printf("Unknown opcode! %i\n", node->opcode);
+    const float* const k = ctx->tape->affine + 4*c->row;
+    if (!ctx->has_transform)
+        return k;
+
+    const float* const M = ctx->transform;
+    for (int j=0; j < 4; ++j)
+        out[j] = k[0]*M[j] + k[1]*M[4 + j] + k[2]*M[8 + j];
+    out[3] += k[3];
+    return out;
+}
+
+// Fills the context's transformed coordinate arrays from a region,
+// returning pointers to the X, Y, Z arrays in out.
+static void transform_r(EvalContext* ctx, const Region r, int count,
+                        const float* out[3])
+{
+    if (!ctx->has_transform) {
+        out[0] = r.X;
+        out[1] = r.Y;
+        out[2] = r.Z;
+        return;
+    }
+
+    for (int a=0; a < 3; ++a) {
+        out[a] = affine_r(ctx->transform + a*4, r.X, r.Y, r.Z,
+                          ctx->xyz + a*MIN_VOLUME, count);
+    }
+}
+
+// Loads a (transformed) coordinate array and its gradient.
+static void coord_g(const EvalContext* ctx, int axis, const float* v,
+                    derivative* R, int count)
+{
+    if (!ctx->has_transform) {
+        switch (axis) {
+            case 0: X_g(v, R, count); break;
+            case 1: Y_g(v, R, count); break;
+            case 2: Z_g(v, R, count); break;
+        }
+        return;
+    }
+
+    const float* const row = ctx->transform + axis*4;
+    for (int q=0; q < count; ++q)
+        R[q] = (derivative){ .v=v[q], .dx=row[0], .dy=row[1], .dz=row[2] };
+}
+
+// Loads the distance to a box (see box_f) and its gradient, which points
+// away from the box along the axis where the distance is largest.
+static void box_g(const EvalContext* ctx, const float* b,
+                  const float* xyz[3], derivative* R, int count)
+{
+    for (int q=0; q < count; ++q) {
+        int axis = 0;
+        float d = -INFINITY, s = 0;
+        for (int a=0; a < 3; ++a) {
+            const float v = xyz[a][q];
+            if (b[a] - v > d)       { d = b[a] - v; axis = a; s = -1; }
+            if (v - b[a + 3] > d)   { d = v - b[a + 3]; axis = a; s = 1; }
+        }
+
+        float g[3] = {0, 0, 0};
+        if (ctx->has_transform) {
+            const float* const row = ctx->transform + axis*4;
+            for (int a=0; a < 3; ++a)   g[a] = s * row[a];
+        } else {
+            g[axis] = s;
+        }
+        R[q] = (derivative){ .v=d, .dx=g[0], .dy=g[1], .dz=g[2] };
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+float eval_f(EvalContext* ctx, float x, float y, float z)
+{
+    float* const f = ctx->f;
+
+    if (ctx->has_transform) {
+        const float* const M = ctx->transform;
+        const float tx = M[0]*x + M[1]*y + M[2]*z  + M[3],
+                    ty = M[4]*x + M[5]*y + M[6]*z  + M[7],
+                    tz = M[8]*x + M[9]*y + M[10]*z + M[11];
+        x = tx;
+        y = ty;
+        z = tz;
+    }
+
+    unsigned count;
+    const Clause* c = context_clauses(ctx, &count);
+
+    for (const Clause* const end = c + count; c != end; ++c) {
+        const float A = f[c->a],
+                    B = f[c->b];
+        float* const R = &f[c->id];
+
+        switch (c->op) {
+            case OP_ADD:    *R = add_f(A, B); break;
+            case OP_SUB:    *R = sub_f(A, B); break;
+            case OP_MUL:    *R = mul_f(A, B); break;
+            case OP_DIV:    *R = div_f(A, B); break;
+            case OP_MIN:    *R = min_f(A, B); break;
+            case OP_MAX:    *R = max_f(A, B); break;
+            case OP_POW:    *R = pow_f(A, B); break;
+            case OP_MOD:    *R = mod_f(A, B); break;
+            case OP_REPEAT: *R = repeat_f(A, B); break;
+            case OP_ATAN2:  *R = atan2_f(A, B); break;
+
+            case OP_ABS:    *R = abs_f(A); break;
+            case OP_SQUARE: *R = square_f(A); break;
+            case OP_SQRT:   *R = sqrt_f(A); break;
+            case OP_SIN:    *R = sin_f(A); break;
+            case OP_COS:    *R = cos_f(A); break;
+            case OP_TAN:    *R = tan_f(A); break;
+            case OP_ASIN:   *R = asin_f(A); break;
+            case OP_ACOS:   *R = acos_f(A); break;
+            case OP_ATAN:   *R = atan_f(A); break;
+            case OP_NEG:    *R = neg_f(A); break;
+            case OP_EXP:    *R = exp_f(A); break;
+
+            case OP_X:      *R = X_f(x); break;
+            case OP_Y:      *R = Y_f(y); break;
+            case OP_Z:      *R = Z_f(z); break;
+            case OP_AFFINE:
+                *R = affine_f(ctx->tape->affine + 4*c->row, x, y, z);
+                break;
+            case OP_BOUNDS:
+                // Guards write the distance to the box and skip the
+                // node's subtree if we're outside of it
+                if (is_guard(c)) {
+                    *R = box_f(ctx->tape->boxes + 6*c->row, x, y, z);
+                    if (*R > 0)     c += c->b;
+                } else if (*R <= 0) {
+                    *R = A;
+                }
+                break;
+
+            case OP_CONST:  *R = c->value; break;
+            default:
+                printf("Unknown opcode! %i\n", c->op);
+        }
+    }
+    return f[ctx->tape->root];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Interval eval_i(EvalContext* ctx, Interval X, Interval Y, Interval Z)
+{
+    if (ctx->affine)    return eval_a(ctx, X, Y, Z);
+
+    Interval* const i = ctx->i;
+
+    // Affine clauses are evaluated on the untransformed box (with the
+    // transform folded into their coefficients), which gives tighter
+    // bounds than applying them to the transformed X, Y, Z intervals.
+    const Interval box[3] = {X, Y, Z};
+
+    if (ctx->has_transform) {
+        const float* const M = ctx->transform;
+        const Interval tx = affine_i(M,     X, Y, Z),
+                       ty = affine_i(M + 4, X, Y, Z),
+                       tz = affine_i(M + 8, X, Y, Z);
+        X = tx;
+        Y = ty;
+        Z = tz;
+    }
+
+    ctx->region[0] = X;
+    ctx->region[1] = Y;
+    ctx->region[2] = Z;
+
+    unsigned count;
+    const Clause* c = context_clauses(ctx, &count);
+
+    for (const Clause* const end = c + count; c != end; ++c) {
+        const Interval A = i[c->a],
+                       B = i[c->b];
+        Interval* const R = &i[c->id];
+
+        switch (c->op) {
+            case OP_ADD:    *R = add_i(A, B); break;
+            case OP_SUB:    *R = sub_i(A, B); break;
+            case OP_MUL:    *R = mul_i(A, B); break;
+            case OP_DIV:    *R = div_i(A, B); break;
+            case OP_MIN:    *R = min_i(A, B); break;
+            case OP_MAX:    *R = max_i(A, B); break;
+            case OP_POW:    *R = pow_i(A, B); break;
+            case OP_MOD:    *R = mod_i(A, B); break;
+            case OP_REPEAT: *R = repeat_i(A, B); break;
+            case OP_ATAN2:  *R = atan2_i(A, B); break;
+
+            case OP_ABS:    *R = abs_i(A); break;
+            case OP_SQUARE: *R = square_i(A); break;
+            case OP_SQRT:   *R = sqrt_i(A); break;
+            case OP_SIN:    *R = sin_i(A); break;
+            case OP_COS:    *R = cos_i(A); break;
+            case OP_TAN:    *R = tan_i(A); break;
+            case OP_ASIN:   *R = asin_i(A); break;
+            case OP_ACOS:   *R = acos_i(A); break;
+            case OP_ATAN:   *R = atan_i(A); break;
+            case OP_NEG:    *R = neg_i(A); break;
+            case OP_EXP:    *R = exp_i(A); break;
+
+            case OP_CONST:  *R = (Interval){ .lower=c->value,
+                                             .upper=c->value }; break;
+            case OP_X:      *R = X_i(X); break;
+            case OP_Y:      *R = Y_i(Y); break;
+            case OP_Z:      *R = Z_i(Z); break;
+            case OP_AFFINE: {
+                float k[4];
+                *R = affine_i(affine_row(ctx, c, k), box[0], box[1], box[2]);
+                break;
             }
+            case OP_BOUNDS:
+                if (is_guard(c)) {
+                    *R = box_i(ctx->tape->boxes + 6*c->row, X, Y, Z);
+                    if (R->lower > 0)   c += c->b;
+                } else if (R->upper <= 0) {
+                    *R = A;
+                } else if (R->lower <= 0) {
+                    *R = (Interval){ .lower=fmin(A.lower, 0),
+                                     .upper=fmax(A.upper, R->upper) };
+                }
+                break;
+            default:
+                printf("Unknown opcode! %i\n", c->op);
         }
     }
-    return tree->head->results.f;
+
+    return i[ctx->tape->root];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-Interval eval_i(MathTree* tree, const Interval X,
-                                const Interval Y,
-                                const Interval Z)
+// Evaluates a batch of boxes one at a time (used in affine mode), copying
+// each box's slots into the batch stack entry b.
+static void eval_i_lanes(EvalContext* ctx, const Interval* X,
+                         const Interval* Y, const Interval* Z,
+                         unsigned count, ibatch* b, Interval* out)
 {
-    Node* node = NULL;
-
-    for (unsigned level=0; level < tree->num_levels; ++level) {
-        for (unsigned n=0; n < tree->active[level]; ++n) {
-
-            node = tree->nodes[level][n];
-
-            Interval A = node->lhs ? node->lhs->results.i
-                                   : (Interval) {.upper=0, .lower=0},
-                     B = node->rhs ? node->rhs->results.i
-                                   : (Interval) {.upper=0, .lower=0};
-
-            switch (node->opcode) {
-                case OP_ADD:    node->results.i = add_i(A, B); break;
-                case OP_SUB:    node->results.i = sub_i(A, B); break;
-                case OP_MUL:    node->results.i = mul_i(A, B); break;
-                case OP_DIV:    node->results.i = div_i(A, B); break;
-                case OP_MIN:    node->results.i = min_i(A, B); break;
-                case OP_MAX:    node->results.i = max_i(A, B); break;
-                case OP_POW:    node->results.i = pow_i(A, B); break;
-                case OP_ATAN2:   node->results.i = atan2_i(A,B); break;
-
-                case OP_ABS:    node->results.i = abs_i(A); break;
-                case OP_SQUARE: node->results.i = square_i(A); break;
-                case OP_SQRT:   node->results.i = sqrt_i(A); break;
-                case OP_SIN:    node->results.i = sin_i(A); break;
-                case OP_COS:    node->results.i = cos_i(A); break;
-                case OP_TAN:    node->results.i = tan_i(A); break;
-                case OP_ASIN:   node->results.i = asin_i(A); break;
-                case OP_ACOS:   node->results.i = acos_i(A); break;
-                case OP_ATAN:   node->results.i = atan_i(A); break;
-                case OP_NEG:    node->results.i = neg_i(A); break;
-                case OP_EXP:    node->results.i = exp_i(A); break;
-
-                case OP_CONST:  break;
-                case OP_X:      node->results.i = X_i(X); break;
-                case OP_Y:      node->results.i = Y_i(Y); break;
-                case OP_Z:      node->results.i = Z_i(Z); break;
-                default:
-                    printf("Unknown opcode! %i\n", node->opcode);
+    unsigned n;
+    const Clause* const clauses = context_clauses(ctx, &n);
+
+    for (unsigned q=0; q < IBATCH; ++q) {
+        const unsigned lane = q < count ? q : 0;
+        const Interval result = eval_i(ctx, X[lane], Y[lane], Z[lane]);
+        if (q < count)  out[q] = result;
+
+        for (int a=0; a < 3; ++a)
+            set_ib(&b[a], q, ctx->region[a]);
+        for (unsigned c=0; c < n; ++c)
+            set_ib(&b[3 + c], q, ctx->i[clauses[c].id]);
+    }
+}
+
+void eval_i_batch(EvalContext* ctx, const Interval* X, const Interval* Y,
+                  const Interval* Z, unsigned count, Interval* out)
+{
+    unsigned n;
+    const Clause* const clauses = context_clauses(ctx, &n);
+    ibatch* const stored = push_batch(ctx, 3 + n);
+
+    if (ctx->affine) {
+        eval_i_lanes(ctx, X, Y, Z, count, stored, out);
+        return;
+    }
+
+    // Per-slot storage is set up on first use, with constants
+    // copied into every lane.
+    if (ctx->ib == NULL) {
+        const Tape* const tape = ctx->tape;
+        ctx->ib = malloc((tape->num_slots ? tape->num_slots : 1)
+                         * sizeof(ibatch));
+        for (unsigned k=0; k < tape->num_constants; ++k)
+            const_ib(tape->constants[k], &ctx->ib[k]);
+    }
+    ibatch* const ib = ctx->ib;
+
+    // Unused lanes repeat the first box
+    ibatch box[3], xyz[3];
+    for (unsigned q=0; q < IBATCH; ++q) {
+        const unsigned lane = q < count ? q : 0;
+        set_ib(&box[0], q, X[lane]);
+        set_ib(&box[1], q, Y[lane]);
+        set_ib(&box[2], q, Z[lane]);
+    }
+
+    if (ctx->has_transform) {
+        for (int a=0; a < 3; ++a)
+            affine_ib(ctx->transform + 4*a,
+                      &box[0], &box[1], &box[2], &xyz[a]);
+    } else {
+        for (int a=0; a < 3; ++a)
+            xyz[a] = box[a];
+    }
+
+    for (const Clause *c = clauses, *end = clauses + n; c != end; ++c) {
+        const ibatch *A = &ib[c->a],
+                     *B = &ib[c->b];
+        ibatch* const R = &ib[c->id];
+
+        switch (c->op) {
+            case OP_ADD:    add_ib(A, B, R); break;
+            case OP_SUB:    sub_ib(A, B, R); break;
+            case OP_MUL:    mul_ib(A, B, R); break;
+            case OP_DIV:    binary_ib(div_i, A, B, R); break;
+            case OP_MIN:    min_ib(A, B, R); break;
+            case OP_MAX:    max_ib(A, B, R); break;
+            case OP_POW:    binary_ib(pow_i, A, B, R); break;
+            case OP_MOD:    binary_ib(mod_i, A, B, R); break;
+            case OP_REPEAT: binary_ib(repeat_i, A, B, R); break;
+            case OP_ATAN2:  binary_ib(atan2_i, A, B, R); break;
+
+            case OP_ABS:    abs_ib(A, R); break;
+            case OP_SQUARE: square_ib(A, R); break;
+            case OP_SQRT:   sqrt_ib(A, R); break;
+            case OP_SIN:    unary_ib(sin_i, A, R); break;
+            case OP_COS:    unary_ib(cos_i, A, R); break;
+            case OP_TAN:    unary_ib(tan_i, A, R); break;
+            case OP_ASIN:   unary_ib(asin_i, A, R); break;
+            case OP_ACOS:   unary_ib(acos_i, A, R); break;
+            case OP_ATAN:   unary_ib(atan_i, A, R); break;
+            case OP_NEG:    neg_ib(A, R); break;
+            case OP_EXP:    unary_ib(exp_i, A, R); break;
+
+            case OP_CONST:  const_ib(c->value, R); break;
+            case OP_X:      *R = xyz[0]; break;
+            case OP_Y:      *R = xyz[1]; break;
+            case OP_Z:      *R = xyz[2]; break;
+            case OP_AFFINE: {
+                float k[4];
+                affine_ib(affine_row(ctx, c, k),
+                          &box[0], &box[1], &box[2], R);
+                break;
             }
+            case OP_BOUNDS: {
+                // Lanes are handled as in eval_i, but a guard only
+                // skips its subtree if every box is outside of it.
+                bool skip = is_guard(c);
+                for (unsigned q=0; q < IBATCH; ++q) {
+                    Interval r = get_ib(R, q);
+                    const Interval a = get_ib(A, q);
+                    if (is_guard(c)) {
+                        r = box_i(ctx->tape->boxes + 6*c->row,
+                                  get_ib(&xyz[0], q), get_ib(&xyz[1], q),
+                                  get_ib(&xyz[2], q));
+                        skip &= r.lower > 0;
+                    } else if (r.upper <= 0) {
+                        r = a;
+                    } else if (r.lower <= 0) {
+                        r = (Interval){ .lower=fmin(a.lower, 0),
+                                        .upper=fmax(a.upper, r.upper) };
+                    }
+                    set_ib(R, q, r);
+                }
+                if (skip)   c += c->b;
+                break;
+            }
+            default:
+                printf("Unknown opcode! %i\n", c->op);
         }
     }
 
-    return tree->head->results.i;
+    for (int a=0; a < 3; ++a)
+        stored[a] = xyz[a];
+    for (unsigned k=0; k < n; ++k)
+        stored[3 + k] = ib[clauses[k].id];
+
+    for (unsigned q=0; q < count; ++q)
+        out[q] = get_ib(&ib[ctx->tape->root], q);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-float* eval_r(MathTree* tree, const Region r)
+Interval eval_a(EvalContext* ctx, Interval X, Interval Y, Interval Z)
 {
-    Node* node = NULL;
-    int c = r.voxels;
-
-    for (unsigned level=0; level < tree->num_levels; ++level) {
-        for (unsigned n=0; n < tree->active[level]; ++n) {
-
-            node = tree->nodes[level][n];
-
-            float *A = node->lhs ? node->lhs->results.r  : NULL,
-                  *B = node->rhs ? node->rhs->results.r : NULL,
-                  *R = node->results.r;
-
-            switch (node->opcode) {
-                case OP_ADD:    add_r(A, B, R, c); break;
-                case OP_SUB:    sub_r(A, B, R, c); break;
-                case OP_MUL:    mul_r(A, B, R, c); break;
-                case OP_DIV:    div_r(A, B, R, c); break;
-                case OP_MIN:    min_r(A, B, R, c); break;
-                case OP_MAX:    max_r(A, B, R, c); break;
-                case OP_POW:    pow_r(A, B, R, c); break;
-                case OP_ATAN2:  atan2_r(A, B, R, c); break;
-
-                case OP_ABS:    abs_r(A, R, c); break;
-                case OP_SQUARE: square_r(A, R, c); break;
-                case OP_SQRT:   sqrt_r(A, R, c); break;
-                case OP_SIN:    sin_r(A, R, c); break;
-                case OP_COS:    cos_r(A, R, c); break;
-                case OP_TAN:    tan_r(A, R, c); break;
-                case OP_ASIN:   asin_r(A, R, c); break;
-                case OP_ACOS:   acos_r(A, R, c); break;
-                case OP_ATAN:   atan_r(A, R, c); break;
-                case OP_NEG:    neg_r(A, R, c); break;
-                case OP_EXP:    exp_r(A, R, c); break;
-
-                case OP_CONST:  break;
-                case OP_X:      X_r(r.X, R, c); break;
-                case OP_Y:      Y_r(r.Y, R, c); break;
-                case OP_Z:      Z_r(r.Z, R, c); break;
-                default:
-                    printf("Unknown opcode! %i\n", node->opcode);
+    Interval* const i = ctx->i;
+    aform* const a = ctx->a;
+
+    // Forms are taken over the untransformed box, so that transformed
+    // axes stay correlated with each other.
+    const Interval box[3] = {X, Y, Z};
+    const aform fbox[3] = {X_a(X), Y_a(Y), Z_a(Z)};
+    aform axes[3] = {fbox[0], fbox[1], fbox[2]};
+
+    if (ctx->has_transform) {
+        const float* const M = ctx->transform;
+        const Interval tx = affine_i(M,     X, Y, Z),
+                       ty = affine_i(M + 4, X, Y, Z),
+                       tz = affine_i(M + 8, X, Y, Z);
+        X = tx;
+        Y = ty;
+        Z = tz;
+        for (int q=0; q < 3; ++q)
+            axes[q] = affine_a(M + 4*q, fbox[0], fbox[1], fbox[2]);
+    }
+
+    ctx->region[0] = X;
+    ctx->region[1] = Y;
+    ctx->region[2] = Z;
+
+    unsigned count;
+    const Clause* c = context_clauses(ctx, &count);
+
+    for (const Clause* const end = c + count; c != end; ++c) {
+        const Interval A = i[c->a],
+                       B = i[c->b];
+        const aform FA = a[c->a],
+                    FB = a[c->b];
+        Interval* const R = &i[c->id];
+        aform* const F = &a[c->id];
+
+        // Clauses without an affine rule use interval arithmetic,
+        // leaving F with no correlations.
+        bool linear = true;
+        switch (c->op) {
+            case OP_ADD:    *R = add_i(A, B); *F = add_a(FA, FB); break;
+            case OP_SUB:    *R = sub_i(A, B); *F = sub_a(FA, FB); break;
+            case OP_MUL:    *R = mul_i(A, B); *F = mul_a(FA, FB); break;
+            case OP_DIV:    *R = div_i(A, B); *F = div_a(FA, FB); break;
+            case OP_MIN:    *R = min_i(A, B); *F = min_a(FA, FB); break;
+            case OP_MAX:    *R = max_i(A, B); *F = max_a(FA, FB); break;
+            case OP_POW:    *R = pow_i(A, B); linear = false; break;
+            case OP_MOD:    *R = mod_i(A, B); linear = false; break;
+            case OP_REPEAT: *R = repeat_i(A, B); linear = false; break;
+            case OP_ATAN2:  *R = atan2_i(A, B); linear = false; break;
+
+            case OP_ABS:    *R = abs_i(A); *F = abs_a(FA); break;
+            case OP_SQUARE: *R = square_i(A); *F = square_a(FA); break;
+            case OP_SQRT:   *R = sqrt_i(A); *F = sqrt_a(FA); break;
+            case OP_SIN:    *R = sin_i(A); linear = false; break;
+            case OP_COS:    *R = cos_i(A); linear = false; break;
+            case OP_TAN:    *R = tan_i(A); linear = false; break;
+            case OP_ASIN:   *R = asin_i(A); linear = false; break;
+            case OP_ACOS:   *R = acos_i(A); linear = false; break;
+            case OP_ATAN:   *R = atan_i(A); linear = false; break;
+            case OP_NEG:    *R = neg_i(A); *F = neg_a(FA); break;
+            case OP_EXP:    *R = exp_i(A); *F = exp_a(FA); break;
+
+            case OP_CONST:
+                *R = (Interval){ .lower=c->value, .upper=c->value };
+                *F = (aform){ .v=c->value, .dx=0, .dy=0, .dz=0, .err=0 };
+                break;
+            case OP_X:      *R = X_i(X); *F = axes[0]; break;
+            case OP_Y:      *R = Y_i(Y); *F = axes[1]; break;
+            case OP_Z:      *R = Z_i(Z); *F = axes[2]; break;
+            case OP_AFFINE: {
+                float k[4];
+                const float* const row = affine_row(ctx, c, k);
+                *R = affine_i(row, box[0], box[1], box[2]);
+                *F = affine_a(row, fbox[0], fbox[1], fbox[2]);
+                break;
             }
+            case OP_BOUNDS:
+                if (is_guard(c)) {
+                    *R = box_i(ctx->tape->boxes + 6*c->row, X, Y, Z);
+                    *F = aform_from_i(*R);
+                    if (R->lower > 0)   c += c->b;
+                } else if (R->upper <= 0) {
+                    *R = A;
+                    *F = FA;
+                } else if (R->lower <= 0) {
+                    *R = (Interval){ .lower=fmin(A.lower, 0),
+                                     .upper=fmax(A.upper, R->upper) };
+                    *F = aform_from_i(*R);
+                }
+                break;
+            default:
+                printf("Unknown opcode! %i\n", c->op);
+        }
+
+        if (!linear) {
+            *F = aform_from_i(*R);
+            continue;
         }
+
+        // Keep the tighter of the two bounds.  Forms that overflowed
+        // (or came from unbounded inputs) are replaced by the interval.
+        const Interval r = aform_range(*F);
+        R->lower = fmax(R->lower, r.lower);
+        R->upper = fmin(R->upper, r.upper);
+        if (!(r.upper - r.lower < INFINITY))
+            *F = aform_from_i(*R);
     }
 
-    return tree->head->results.r;
+    return i[ctx->tape->root];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-derivative* eval_g(MathTree* tree, const Region r)
+// Checks whether every point in an array is outside of a box
+static bool all_outside_r(const float* R, int count)
+{
+    for (int q=0; q < count; ++q)
+        if (R[q] <= 0)  return false;
+    return true;
+}
+
+float* eval_r(EvalContext* ctx, const Region r)
 {
-    Node* node = NULL;
-    int c = r.voxels;
-
-    for (unsigned level=0; level < tree->num_levels; ++level) {
-        for (unsigned n=0; n < tree->active[level]; ++n) {
-
-            node = tree->nodes[level][n];
-
-            derivative *A = (derivative*)(node->lhs ? node->lhs->results.r
-                                                    : NULL),
-                       *B = (derivative*)(node->rhs ? node->rhs->results.r
-                                                   : NULL),
-                       *R = (derivative*)(node->results.r);
-
-            switch (node->opcode) {
-                case OP_ADD:    add_g(A, B, R, c); break;
-                case OP_SUB:    sub_g(A, B, R, c); break;
-                case OP_MUL:    mul_g(A, B, R, c); break;
-                case OP_DIV:    div_g(A, B, R, c); break;
-                case OP_MIN:    min_g(A, B, R, c); break;
-                case OP_MAX:    max_g(A, B, R, c); break;
-                case OP_POW:    pow_g(A, B, R, c); break;
-                case OP_ATAN2:  atan2_g(A, B, R, c); break;
-
-                case OP_ABS:    abs_g(A, R, c); break;
-                case OP_SQUARE: square_g(A, R, c); break;
-                case OP_SQRT:   sqrt_g(A, R, c); break;
-                case OP_SIN:    sin_g(A, R, c); break;
-                case OP_COS:    cos_g(A, R, c); break;
-                case OP_TAN:    tan_g(A, R, c); break;
-                case OP_ASIN:   asin_g(A, R, c); break;
-                case OP_ACOS:   acos_g(A, R, c); break;
-                case OP_ATAN:   atan_g(A, R, c); break;
-                case OP_NEG:    neg_g(A, R, c); break;
-                case OP_EXP:    exp_g(A, R, c); break;
-
-                case OP_CONST:  break;
-                case OP_X:      X_g(r.X, R, c); break;
-                case OP_Y:      Y_g(r.Y, R, c); break;
-                case OP_Z:      Z_g(r.Z, R, c); break;
-                default:
-                    printf("Unknown opcode! %i\n", node->opcode);
+    float* const* const regs = ctx->r_ptr;
+    const int count = r.voxels;
+
+    const float* xyz[3];
+    transform_r(ctx, r, count, xyz);
+
+    unsigned n;
+    const Clause* c = context_clauses(ctx, &n);
+
+    for (const Clause* const end = c + n; c != end; ++c) {
+        const float *A = regs[c->ra],
+                    *B = regs[c->rb];
+        float* R = regs[c->out];
+
+        switch (c->op) {
+            case OP_ADD:    add_r(A, B, R, count); break;
+            case OP_SUB:    sub_r(A, B, R, count); break;
+            case OP_MUL:    mul_r(A, B, R, count); break;
+            case OP_DIV:    div_r(A, B, R, count); break;
+            case OP_MIN:    min_r(A, B, R, count); break;
+            case OP_MAX:    max_r(A, B, R, count); break;
+            case OP_POW:    pow_r(A, B, R, count); break;
+            case OP_MOD:    mod_r(A, B, R, count); break;
+            case OP_REPEAT: repeat_r(A, B, R, count); break;
+            case OP_ATAN2:  atan2_r(A, B, R, count); break;
+
+            case OP_ABS:    abs_r(A, R, count); break;
+            case OP_SQUARE: square_r(A, R, count); break;
+            case OP_SQRT:   sqrt_r(A, R, count); break;
+            case OP_SIN:    sin_r(A, R, count); break;
+            case OP_COS:    cos_r(A, R, count); break;
+            case OP_TAN:    tan_r(A, R, count); break;
+            case OP_ASIN:   asin_r(A, R, count); break;
+            case OP_ACOS:   acos_r(A, R, count); break;
+            case OP_ATAN:   atan_r(A, R, count); break;
+            case OP_NEG:    neg_r(A, R, count); break;
+            case OP_EXP:    exp_r(A, R, count); break;
+
+            case OP_CONST:
+                for (int q=0; q < count; ++q)   R[q] = c->value;
+                break;
+            case OP_X:      X_r(xyz[0], R, count); break;
+            case OP_Y:      Y_r(xyz[1], R, count); break;
+            case OP_Z:      Z_r(xyz[2], R, count); break;
+            case OP_AFFINE:
+                affine_r(ctx->tape->affine + 4*c->row,
+                         xyz[0], xyz[1], xyz[2], R, count);
+                break;
+            case OP_BOUNDS:
+                if (!is_guard(c)) {
+                    for (int q=0; q < count; ++q)
+                        R[q] = R[q] > 0 ? R[q] : A[q];
+                    break;
+                }
+                box_r(ctx->tape->boxes + 6*c->row,
+                      xyz[0], xyz[1], xyz[2], R, count);
+                if (all_outside_r(R, count))   c += c->b;
+                break;
+            default:
+                printf("Unknown opcode! %i\n", c->op);
+        }
+    }
+
+    return regs[ctx->tape->root_reg];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+derivative* eval_g(EvalContext* ctx, const Region r)
+{
+    derivative* const* const regs = ctx->g_ptr;
+    const int count = r.voxels;
+
+    const float* xyz[3];
+    transform_r(ctx, r, count, xyz);
+
+    unsigned n;
+    const Clause* c = context_clauses(ctx, &n);
+
+    for (const Clause* const end = c + n; c != end; ++c) {
+        const derivative *A = regs[c->ra],
+                         *B = regs[c->rb];
+        derivative* R = regs[c->out];
+
+        switch (c->op) {
+            case OP_ADD:    add_g(A, B, R, count); break;
+            case OP_SUB:    sub_g(A, B, R, count); break;
+            case OP_MUL:    mul_g(A, B, R, count); break;
+            case OP_DIV:    div_g(A, B, R, count); break;
+            case OP_MIN:    min_g(A, B, R, count); break;
+            case OP_MAX:    max_g(A, B, R, count); break;
+            case OP_POW:    pow_g(A, B, R, count); break;
+            case OP_MOD:    mod_g(A, B, R, count); break;
+            case OP_REPEAT: repeat_g(A, B, R, count); break;
+            case OP_ATAN2:  atan2_g(A, B, R, count); break;
+
+            case OP_ABS:    abs_g(A, R, count); break;
+            case OP_SQUARE: square_g(A, R, count); break;
+            case OP_SQRT:   sqrt_g(A, R, count); break;
+            case OP_SIN:    sin_g(A, R, count); break;
+            case OP_COS:    cos_g(A, R, count); break;
+            case OP_TAN:    tan_g(A, R, count); break;
+            case OP_ASIN:   asin_g(A, R, count); break;
+            case OP_ACOS:   acos_g(A, R, count); break;
+            case OP_ATAN:   atan_g(A, R, count); break;
+            case OP_NEG:    neg_g(A, R, count); break;
+            case OP_EXP:    exp_g(A, R, count); break;
+
+            case OP_CONST:
+                for (int q=0; q < count; ++q)
+                    R[q] = (derivative){ .v=c->value, .dx=0, .dy=0, .dz=0 };
+                break;
+            case OP_X:      coord_g(ctx, 0, xyz[0], R, count); break;
+            case OP_Y:      coord_g(ctx, 1, xyz[1], R, count); break;
+            case OP_Z:      coord_g(ctx, 2, xyz[2], R, count); break;
+            case OP_AFFINE: {
+                // Derivatives are taken with respect to evaluation
+                // coordinates, so use the composed coefficients.
+                float k[4];
+                affine_g(affine_row(ctx, c, k), r.X, r.Y, r.Z, R, count);
+                break;
+            }
+            case OP_BOUNDS: {
+                if (!is_guard(c)) {
+                    for (int q=0; q < count; ++q)
+                        if (R[q].v <= 0)    R[q] = A[q];
+                    break;
+                }
+                box_g(ctx, ctx->tape->boxes + 6*c->row, xyz, R, count);
+                int q = 0;
+                while (q < count && R[q].v > 0)     ++q;
+                if (q == count)     c += c->b;
+                break;
             }
+            default:
+                printf("Unknown opcode! %i\n", c->op);
         }
     }
 
-    return (derivative*)(tree->head->results.r);
+    return regs[ctx->tape->root_reg];
 }
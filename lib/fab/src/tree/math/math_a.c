@@ -0,0 +1,178 @@
+#include <float.h>
+#include <math.h>
+
+#include "fab/tree/math/math_a.h"
+#include "fab/tree/math/math_i.h"
+
+// Returns the largest possible deviation of A from its central value
+static float radius(aform A)
+{
+    return fabs(A.dx) + fabs(A.dy) + fabs(A.dz) + A.err;
+}
+
+// Returns k*A + offset, with extra added to the error term
+static aform scale(aform A, float k, float offset, float extra)
+{
+    return (aform){ .v=k*A.v + offset,
+                    .dx=k*A.dx, .dy=k*A.dy, .dz=k*A.dz,
+                    .err=fabs(k)*A.err + extra };
+}
+
+Interval aform_range(aform A)
+{
+    // Widened slightly to cover rounding in the forms' arithmetic
+    const float r = radius(A);
+    const float slack = FLT_EPSILON * (fabs(A.v) + r);
+    return (Interval){ .lower=A.v - r - slack, .upper=A.v + r + slack };
+}
+
+aform aform_from_i(Interval I)
+{
+    return (aform){ .v=(I.lower + I.upper) / 2, .dx=0, .dy=0, .dz=0,
+                    .err=(I.upper - I.lower) / 2 };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+aform add_a(aform A, aform B)
+{
+    return (aform){ .v=A.v + B.v, .dx=A.dx + B.dx, .dy=A.dy + B.dy,
+                    .dz=A.dz + B.dz, .err=A.err + B.err };
+}
+
+aform sub_a(aform A, aform B)
+{
+    return (aform){ .v=A.v - B.v, .dx=A.dx - B.dx, .dy=A.dy - B.dy,
+                    .dz=A.dz - B.dz, .err=A.err + B.err };
+}
+
+aform mul_a(aform A, aform B)
+{
+    // The product of the two deviations is the only nonlinear term
+    return (aform){ .v=A.v * B.v,
+                    .dx=A.v*B.dx + B.v*A.dx,
+                    .dy=A.v*B.dy + B.v*A.dy,
+                    .dz=A.v*B.dz + B.v*A.dz,
+                    .err=fabs(A.v)*B.err + fabs(B.v)*A.err +
+                         radius(A) * radius(B) };
+}
+
+// Min-range linear approximation of 1/A, for A that doesn't contain zero
+static aform recip_a(aform A)
+{
+    const Interval I = aform_range(A);
+    if (I.upper < 0)    return neg_a(recip_a(neg_a(A)));
+
+    // 1/x is convex and decreasing, so the secant offsets
+    // from the slope at the upper bound are largest at the lower bound.
+    const float slope = -1 / (I.upper * I.upper),
+                dmin = 2 / I.upper,
+                dmax = 1 / I.lower - slope * I.lower;
+    return scale(A, slope, (dmin + dmax) / 2, (dmax - dmin) / 2);
+}
+
+aform div_a(aform A, aform B)
+{
+    const Interval I = aform_range(B);
+    if (I.lower <= 0 && I.upper >= 0)
+        return aform_from_i(div_i(aform_range(A), I));
+    return mul_a(A, recip_a(B));
+}
+
+aform min_a(aform A, aform B)
+{
+    const Interval IA = aform_range(A), IB = aform_range(B);
+    if (IA.upper <= IB.lower)   return A;
+    if (IB.upper <= IA.lower)   return B;
+    return aform_from_i(min_i(IA, IB));
+}
+
+aform max_a(aform A, aform B)
+{
+    const Interval IA = aform_range(A), IB = aform_range(B);
+    if (IA.lower >= IB.upper)   return A;
+    if (IB.lower >= IA.upper)   return B;
+    return aform_from_i(max_i(IA, IB));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+aform abs_a(aform A)
+{
+    const Interval I = aform_range(A);
+    if (I.lower >= 0)   return A;
+    if (I.upper <= 0)   return neg_a(A);
+    return aform_from_i(abs_i(I));
+}
+
+aform square_a(aform A)
+{
+    // (v + d)^2 = v^2 + 2*v*d + d^2, where d^2 is in [0, r^2]
+    const float r = radius(A);
+    aform out = scale(A, 2*A.v, 0, 0);
+    out.v = A.v*A.v + r*r/2;
+    out.err += r*r/2;
+    return out;
+}
+
+aform sqrt_a(aform A)
+{
+    const Interval I = aform_range(A);
+    if (I.lower < 0 || I.upper <= 0)
+        return aform_from_i(sqrt_i(I));
+
+    // sqrt is concave and increasing, so use the slope at the upper bound;
+    // the offset from that line then increases across the range.
+    const float su = sqrt(I.upper),
+                slope = 1 / (2 * su),
+                dmin = sqrt(I.lower) - slope * I.lower,
+                dmax = su / 2;
+    return scale(A, slope, (dmin + dmax) / 2, (dmax - dmin) / 2);
+}
+
+aform neg_a(aform A)
+{
+    return (aform){ .v=-A.v, .dx=-A.dx, .dy=-A.dy, .dz=-A.dz, .err=A.err };
+}
+
+aform exp_a(aform A)
+{
+    // exp is convex and increasing, so use the slope at the lower bound
+    const Interval I = aform_range(A);
+    const float el = exp(I.lower),
+                dmin = el * (1 - I.lower),
+                dmax = exp(I.upper) - el * I.upper;
+    return scale(A, el, (dmin + dmax) / 2, (dmax - dmin) / 2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+aform X_a(Interval X)
+{
+    return (aform){ .v=(X.lower + X.upper) / 2, .dx=(X.upper - X.lower) / 2,
+                    .dy=0, .dz=0, .err=0 };
+}
+
+aform Y_a(Interval Y)
+{
+    return (aform){ .v=(Y.lower + Y.upper) / 2, .dx=0,
+                    .dy=(Y.upper - Y.lower) / 2, .dz=0, .err=0 };
+}
+
+aform Z_a(Interval Z)
+{
+    return (aform){ .v=(Z.lower + Z.upper) / 2, .dx=0, .dy=0,
+                    .dz=(Z.upper - Z.lower) / 2, .err=0 };
+}
+
+aform affine_a(const float* k, aform X, aform Y, aform Z)
+{
+    const aform in[3] = {X, Y, Z};
+    aform out = { .v=k[3], .dx=0, .dy=0, .dz=0, .err=0 };
+    for (int a=0; a < 3; ++a) {
+        // Zero coefficients are skipped, as in affine_i
+        if (k[a] != 0)
+            out = add_a(out, scale(in[a], k[a], 0, 0));
+    }
+    return out;
+}
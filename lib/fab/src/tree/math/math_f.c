@@ -7,6 +7,8 @@ extern inline float div_f(float A, float B);
 extern inline float min_f(float A, float B);
 extern inline float max_f(float A, float B);
 extern inline float pow_f(float A, float B);
+extern inline float mod_f(float A, float B);
+extern inline float repeat_f(float A, float B);
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -29,3 +31,6 @@ extern inline float exp_f(float A);
 extern inline float X_f(float X);
 extern inline float Y_f(float Y);
 extern inline float Z_f(float Z);
+
+extern inline float affine_f(const float* k, float X, float Y, float Z);
+extern inline float box_f(const float* b, float X, float Y, float Z);
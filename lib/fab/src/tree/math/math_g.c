@@ -2,10 +2,12 @@
 #include <math.h>
 
 #include "fab/tree/math/math_g.h"
+#include "fab/tree/math/math_f.h"
+#include "fab/tree/math/math_simd.h"
 
-derivative* add_g(const derivative* restrict A,
-                  const derivative* restrict B,
-                  derivative* restrict R, int c)
+derivative* add_g_scalar(const derivative* restrict A,
+                         const derivative* restrict B,
+                         derivative* restrict R, int c)
 {
     for (int q = 0; q < c; ++q)
     {
@@ -17,9 +19,9 @@ derivative* add_g(const derivative* restrict A,
     return R;
 }
 
-derivative* sub_g(const derivative* restrict A,
-                  const derivative* restrict B,
-                  derivative* restrict R, int c)
+derivative* sub_g_scalar(const derivative* restrict A,
+                         const derivative* restrict B,
+                         derivative* restrict R, int c)
 {
     for (int q = 0; q < c; ++q)
     {
@@ -31,9 +33,9 @@ derivative* sub_g(const derivative* restrict A,
     return R;
 }
 
-derivative* mul_g(const derivative* restrict A,
-                  const derivative* restrict B,
-                  derivative* restrict R, int c)
+derivative* mul_g_scalar(const derivative* restrict A,
+                         const derivative* restrict B,
+                         derivative* restrict R, int c)
 {
     for (int q = 0; q < c; ++q)
     {
@@ -46,9 +48,9 @@ derivative* mul_g(const derivative* restrict A,
     return R;
 }
 
-derivative* div_g(const derivative* restrict A,
-                  const derivative* restrict B,
-                  derivative* restrict R, int c)
+derivative* div_g_scalar(const derivative* restrict A,
+                         const derivative* restrict B,
+                         derivative* restrict R, int c)
 {
     for (int q = 0; q < c; ++q)
     {
@@ -63,9 +65,9 @@ derivative* div_g(const derivative* restrict A,
     return R;
 }
 
-derivative* min_g(const derivative* restrict A,
-                  const derivative* restrict B,
-                  derivative* restrict R, int c)
+derivative* min_g_scalar(const derivative* restrict A,
+                         const derivative* restrict B,
+                         derivative* restrict R, int c)
 {
     for (int q = 0; q < c; ++q)
     {
@@ -86,9 +88,9 @@ derivative* min_g(const derivative* restrict A,
     return R;
 }
 
-derivative* max_g(const derivative* restrict A,
-                  const derivative* restrict B,
-                  derivative* restrict R, int c)
+derivative* max_g_scalar(const derivative* restrict A,
+                         const derivative* restrict B,
+                         derivative* restrict R, int c)
 {
     for (int q = 0; q < c; ++q)
     {
@@ -109,9 +111,9 @@ derivative* max_g(const derivative* restrict A,
     return R;
 }
 
-derivative* pow_g(const derivative* restrict A,
-                  const derivative* restrict B,
-                  derivative* restrict R, int c)
+derivative* pow_g_scalar(const derivative* restrict A,
+                         const derivative* restrict B,
+                         derivative* restrict R, int c)
 {
     for (int q = 0; q < c; ++q)
     {
@@ -130,14 +132,48 @@ derivative* pow_g(const derivative* restrict A,
     return R;
 }
 
-derivative* atan2_g(const derivative* A, const derivative* B, derivative* R, int c) {
+derivative* mod_g(const derivative* restrict A,
+                  const derivative* restrict B,
+                  derivative* restrict R, int c)
+{
+    for (int q = 0; q < c; ++q)
+    {
+        // R = A - k*B, where k = floor(A / B) is piecewise constant
+        R[q].v = mod_f(A[q].v, B[q].v);
+        const float k = round((A[q].v - R[q].v) / B[q].v);
+        R[q].dx = A[q].dx - k*B[q].dx;
+        R[q].dy = A[q].dy - k*B[q].dy;
+        R[q].dz = A[q].dz - k*B[q].dz;
+    }
+    return R;
+}
+
+derivative* repeat_g(const derivative* restrict A,
+                     const derivative* restrict B,
+                     derivative* restrict R, int c)
+{
+    for (int q = 0; q < c; ++q)
+    {
+        // The cell index is piecewise constant, so only A contributes
+        R[q].v = repeat_f(A[q].v, B[q].v);
+        R[q].dx = A[q].dx;
+        R[q].dy = A[q].dy;
+        R[q].dz = A[q].dz;
+    }
+    return R;
+}
+
+derivative* atan2_g_scalar(const derivative* restrict A,
+                           const derivative* restrict B,
+                           derivative* restrict R, int c)
+{
     for (int q = 0; q < c; ++q)
     {
         R[q].v = atan2(A[q].v, B[q].v);
         const float d = pow(A[q].v, 2) + pow(B[q].v, 2);
-        R[q].dx = (-A[q].dx*B[q].v + B[q].dx*A[q].v) / d;
-        R[q].dy = (-A[q].dy*B[q].v + B[q].dy*A[q].v) / d;
-        R[q].dz = (-A[q].dz*B[q].v + B[q].dz*A[q].v) / d;
+        R[q].dx = (A[q].dx*B[q].v - B[q].dx*A[q].v) / d;
+        R[q].dy = (A[q].dy*B[q].v - B[q].dy*A[q].v) / d;
+        R[q].dz = (A[q].dz*B[q].v - B[q].dz*A[q].v) / d;
     }
 
     return R;
@@ -145,8 +181,8 @@ derivative* atan2_g(const derivative* A, const derivative* B, derivative* R, int
 
 ////////////////////////////////////////////////////////////////////////////////
 
-derivative* abs_g(const derivative* restrict A,
-                  derivative* restrict R, int c)
+derivative* abs_g_scalar(const derivative* restrict A,
+                         derivative* restrict R, int c)
 {
     for (int q=0; q < c; ++q)
     {
@@ -168,8 +204,8 @@ derivative* abs_g(const derivative* restrict A,
     return R;
 }
 
-derivative* square_g(const derivative* restrict A,
-                     derivative* restrict R, int c)
+derivative* square_g_scalar(const derivative* restrict A,
+                            derivative* restrict R, int c)
 {
     for (int q = 0; q < c; ++q)
     {
@@ -184,8 +220,8 @@ derivative* square_g(const derivative* restrict A,
     return R;
 }
 
-derivative* sqrt_g(const derivative* restrict A,
-                   derivative* restrict R, int c)
+derivative* sqrt_g_scalar(const derivative* restrict A,
+                          derivative* restrict R, int c)
 {
     for (int q = 0; q < c; ++q)
         if (A[q].v < 0)
@@ -206,8 +242,8 @@ derivative* sqrt_g(const derivative* restrict A,
     return R;
 }
 
-derivative* sin_g(const derivative* restrict A,
-                  derivative* restrict R, int c)
+derivative* sin_g_scalar(const derivative* restrict A,
+                         derivative* restrict R, int c)
 {
     for (int q = 0; q < c; ++q)
     {
@@ -220,8 +256,8 @@ derivative* sin_g(const derivative* restrict A,
     return R;
 }
 
-derivative* cos_g(const derivative* restrict A,
-                  derivative* restrict R, int c)
+derivative* cos_g_scalar(const derivative* restrict A,
+                         derivative* restrict R, int c)
 {
     for (int q = 0; q < c; ++q)
     {
@@ -234,8 +270,8 @@ derivative* cos_g(const derivative* restrict A,
     return R;
 }
 
-derivative* tan_g(const derivative* restrict A,
-                  derivative* restrict R, int c)
+derivative* tan_g_scalar(const derivative* restrict A,
+                         derivative* restrict R, int c)
 {
     for (int q = 0; q < c; ++q)
     {
@@ -248,8 +284,8 @@ derivative* tan_g(const derivative* restrict A,
     return R;
 }
 
-derivative* asin_g(const derivative* restrict A,
-                   derivative* restrict R, int c)
+derivative* asin_g_scalar(const derivative* restrict A,
+                          derivative* restrict R, int c)
 {
     for (int q = 0; q < c; ++q)
     {
@@ -272,8 +308,8 @@ derivative* asin_g(const derivative* restrict A,
     return R;
 }
 
-derivative* acos_g(const derivative* restrict A,
-                   derivative* restrict R, int c)
+derivative* acos_g_scalar(const derivative* restrict A,
+                          derivative* restrict R, int c)
 {
     for (int q = 0; q < c; ++q)
     {
@@ -296,8 +332,8 @@ derivative* acos_g(const derivative* restrict A,
     return R;
 }
 
-derivative* atan_g(const derivative* restrict A,
-                   derivative* restrict R, int c)
+derivative* atan_g_scalar(const derivative* restrict A,
+                          derivative* restrict R, int c)
 {
     for (int q = 0; q < c; ++q)
     {
@@ -310,8 +346,8 @@ derivative* atan_g(const derivative* restrict A,
     return R;
 }
 
-derivative* neg_g(const derivative* restrict A,
-                   derivative* restrict R, int c)
+derivative* neg_g_scalar(const derivative* restrict A,
+                          derivative* restrict R, int c)
 {
     for (int q=0; q < c; ++q)
     {
@@ -323,8 +359,8 @@ derivative* neg_g(const derivative* restrict A,
     return R;
 }
 
-derivative* exp_g(const derivative* restrict A,
-                   derivative* restrict R, int c)
+derivative* exp_g_scalar(const derivative* restrict A,
+                          derivative* restrict R, int c)
 {
     for (int q = 0; q < c; ++q)
     {
@@ -339,6 +375,42 @@ derivative* exp_g(const derivative* restrict A,
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Public functions forward to the active kernel table
+#define DUAL(name) \
+derivative* name(const derivative* A, const derivative* B, \
+                 derivative* R, int c)                     \
+{                                                          \
+    return math_kernels->name(A, B, R, c);                 \
+}
+
+#define SINGLE(name) \
+derivative* name(const derivative* A, derivative* R, int c) \
+{                                                           \
+    return math_kernels->name(A, R, c);                     \
+}
+
+DUAL(add_g);
+DUAL(sub_g);
+DUAL(mul_g);
+DUAL(div_g);
+DUAL(min_g);
+DUAL(max_g);
+DUAL(pow_g);
+DUAL(atan2_g);
+SINGLE(abs_g);
+SINGLE(square_g);
+SINGLE(sqrt_g);
+SINGLE(sin_g);
+SINGLE(cos_g);
+SINGLE(tan_g);
+SINGLE(asin_g);
+SINGLE(acos_g);
+SINGLE(atan_g);
+SINGLE(neg_g);
+SINGLE(exp_g);
+
+////////////////////////////////////////////////////////////////////////////////
+
 derivative* X_g(const float* restrict X,
                 derivative* restrict R, int c)
 {
@@ -377,3 +449,17 @@ derivative* Z_g(const float* restrict Z,
     }
     return R;
 }
+
+derivative* affine_g(const float* k, const float* restrict X,
+                     const float* restrict Y, const float* restrict Z,
+                     derivative* restrict R, int c)
+{
+    for (int q = 0; q < c; ++q)
+    {
+        R[q].v = k[0]*X[q] + k[1]*Y[q] + k[2]*Z[q] + k[3];
+        R[q].dx = k[0];
+        R[q].dy = k[1];
+        R[q].dz = k[2];
+    }
+    return R;
+}
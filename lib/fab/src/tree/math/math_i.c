@@ -92,6 +92,47 @@ Interval pow_i(Interval A, Interval B)
     return i;
 }
 
+Interval mod_i(Interval A, Interval B)
+{
+    // With a fixed modulus, the result is a shifted copy of A
+    // unless A crosses a multiple of B.
+    if (B.lower == B.upper && B.lower != 0) {
+        const float k = floor(A.lower / B.lower);
+        if (isfinite(k) && k == floor(A.upper / B.lower))
+            return (Interval){ .lower = A.lower - k*B.lower,
+                               .upper = A.upper - k*B.lower };
+    }
+
+    // Otherwise, the result is somewhere between 0 and B
+    const float m = fmax(fabs(B.lower), fabs(B.upper));
+    return (Interval){ .lower = B.lower > 0 ? 0 : -m,
+                       .upper = B.upper < 0 ? 0 : m };
+}
+
+Interval repeat_i(Interval A, Interval B)
+{
+    // The result is monotonic in B, so it's enough to check both ends.
+    const float counts[2] = {B.lower, B.upper};
+    Interval i = { .lower = INFINITY, .upper = -INFINITY };
+
+    for (int b=0; b < 2; ++b) {
+        const float lo = fmin(fmax(floor(A.lower + 0.5f), 0), counts[b]),
+                    hi = fmin(fmax(floor(A.upper + 0.5f), 0), counts[b]);
+
+        // Within a single cell, A is only shifted.  Otherwise, interior
+        // cells span [-0.5, 0.5] and the ends of A may stick out of the
+        // first and last cells.
+        float L = A.lower - lo, U = A.upper - hi;
+        if (lo != hi) {
+            L = fmin(L, -0.5);
+            U = fmax(U, 0.5);
+        }
+        i.lower = fmin(i.lower, L);
+        i.upper = fmax(i.upper, U);
+    }
+    return i;
+}
+
 Interval atan2_i(Interval A, Interval B)
 {
     //FIXME: CHECK FOR RIGHTER INTERVAL
@@ -270,3 +311,39 @@ Interval Y_i(Interval Y)
 
 Interval Z_i(Interval Z)
 { return Z; }
+
+Interval box_i(const float* b, Interval X, Interval Y, Interval Z)
+{
+    const Interval in[3] = {X, Y, Z};
+    Interval out = { .lower=-INFINITY, .upper=-INFINITY };
+    for (int a=0; a < 3; ++a) {
+        const float lo = b[a], hi = b[a + 3];
+
+        // Each axis's term is V-shaped, with its minimum of (lo - hi) / 2
+        // at the box's center.  The terms are independent, so the bounds
+        // of their maximum are exact.
+        out.upper = fmax(out.upper, fmax(lo - in[a].lower, in[a].upper - hi));
+        out.lower = fmax(out.lower, fmax(fmax(lo - in[a].upper,
+                                              in[a].lower - hi),
+                                         (lo - hi) / 2));
+    }
+    return out;
+}
+
+Interval affine_i(const float* k, Interval X, Interval Y, Interval Z)
+{
+    const Interval in[3] = {X, Y, Z};
+    Interval out = { .lower=k[3], .upper=k[3] };
+    for (int a=0; a < 3; ++a) {
+        // Zero coefficients are skipped, so that unbounded axes
+        // which don't matter don't produce NaNs.
+        if (k[a] > 0) {
+            out.lower += k[a] * in[a].lower;
+            out.upper += k[a] * in[a].upper;
+        } else if (k[a] < 0) {
+            out.lower += k[a] * in[a].upper;
+            out.upper += k[a] * in[a].lower;
+        }
+    }
+    return out;
+}
@@ -0,0 +1,157 @@
+#include <math.h>
+#include <stdbool.h>
+
+#include "fab/tree/math/math_ib.h"
+
+// Every loop below runs over exactly IBATCH lanes (with branch-free
+// bodies), so that the compiler can turn it into a few vector operations.
+
+void add_ib(const ibatch* A, const ibatch* B, ibatch* R)
+{
+    for (int q=0; q < IBATCH; ++q) {
+        R->lower[q] = A->lower[q] + B->lower[q];
+        R->upper[q] = A->upper[q] + B->upper[q];
+    }
+}
+
+void sub_ib(const ibatch* A, const ibatch* B, ibatch* R)
+{
+    for (int q=0; q < IBATCH; ++q) {
+        const float lo = A->lower[q] - B->upper[q],
+                    hi = A->upper[q] - B->lower[q];
+        R->lower[q] = lo;
+        R->upper[q] = hi;
+    }
+}
+
+void mul_ib(const ibatch* A, const ibatch* B, ibatch* R)
+{
+    for (int q=0; q < IBATCH; ++q) {
+        const float c1 = A->lower[q] * B->lower[q],
+                    c2 = A->lower[q] * B->upper[q],
+                    c3 = A->upper[q] * B->lower[q],
+                    c4 = A->upper[q] * B->upper[q];
+        R->lower[q] = fminf(fminf(c1, c2), fminf(c3, c4));
+        R->upper[q] = fmaxf(fmaxf(c1, c2), fmaxf(c3, c4));
+    }
+}
+
+void min_ib(const ibatch* A, const ibatch* B, ibatch* R)
+{
+    for (int q=0; q < IBATCH; ++q) {
+        const float lo = A->lower[q] < B->lower[q] ? A->lower[q] : B->lower[q],
+                    hi = A->upper[q] < B->upper[q] ? A->upper[q] : B->upper[q];
+        R->lower[q] = lo;
+        R->upper[q] = hi;
+    }
+}
+
+void max_ib(const ibatch* A, const ibatch* B, ibatch* R)
+{
+    for (int q=0; q < IBATCH; ++q) {
+        const float lo = A->lower[q] > B->lower[q] ? A->lower[q] : B->lower[q],
+                    hi = A->upper[q] > B->upper[q] ? A->upper[q] : B->upper[q];
+        R->lower[q] = lo;
+        R->upper[q] = hi;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void abs_ib(const ibatch* A, ibatch* R)
+{
+    for (int q=0; q < IBATCH; ++q) {
+        const float l = fabsf(A->lower[q]), u = fabsf(A->upper[q]);
+        const float lo = A->lower[q] < 0 ? 0 : fminf(l, u);
+        R->lower[q] = lo;
+        R->upper[q] = fmaxf(l, u);
+    }
+}
+
+void square_ib(const ibatch* A, ibatch* R)
+{
+    for (int q=0; q < IBATCH; ++q) {
+        const float l = A->lower[q] * A->lower[q],
+                    u = A->upper[q] * A->upper[q];
+        const bool straddles = A->upper[q] > 0 && A->lower[q] < 0;
+        R->lower[q] = straddles ? 0 : fminf(u, l);
+        R->upper[q] = fmaxf(u, l);
+    }
+}
+
+void sqrt_ib(const ibatch* A, ibatch* R)
+{
+    for (int q=0; q < IBATCH; ++q) {
+        const float lo = A->lower[q] <= 0 ? 0 : sqrtf(A->lower[q]),
+                    hi = A->upper[q] <= 0 ? 0 : sqrtf(A->upper[q]);
+        R->lower[q] = lo;
+        R->upper[q] = hi;
+    }
+}
+
+void neg_ib(const ibatch* A, ibatch* R)
+{
+    for (int q=0; q < IBATCH; ++q) {
+        const float lo = -A->upper[q], hi = -A->lower[q];
+        R->lower[q] = lo;
+        R->upper[q] = hi;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void binary_ib(Interval (*f)(Interval, Interval),
+               const ibatch* A, const ibatch* B, ibatch* R)
+{
+    for (int q=0; q < IBATCH; ++q)
+        set_ib(R, q, f(get_ib(A, q), get_ib(B, q)));
+}
+
+void unary_ib(Interval (*f)(Interval), const ibatch* A, ibatch* R)
+{
+    for (int q=0; q < IBATCH; ++q)
+        set_ib(R, q, f(get_ib(A, q)));
+}
+
+void const_ib(float v, ibatch* R)
+{
+    for (int q=0; q < IBATCH; ++q) {
+        R->lower[q] = v;
+        R->upper[q] = v;
+    }
+}
+
+void affine_ib(const float* k, const ibatch* X, const ibatch* Y,
+               const ibatch* Z, ibatch* R)
+{
+    const ibatch* const in[3] = {X, Y, Z};
+    const_ib(k[3], R);
+    for (int a=0; a < 3; ++a) {
+        // Zero coefficients are skipped, as in affine_i
+        const float s = k[a];
+        if (s > 0) {
+            for (int q=0; q < IBATCH; ++q) {
+                R->lower[q] += s * in[a]->lower[q];
+                R->upper[q] += s * in[a]->upper[q];
+            }
+        } else if (s < 0) {
+            for (int q=0; q < IBATCH; ++q) {
+                R->lower[q] += s * in[a]->upper[q];
+                R->upper[q] += s * in[a]->lower[q];
+            }
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Interval get_ib(const ibatch* A, unsigned lane)
+{
+    return (Interval){ .lower=A->lower[lane], .upper=A->upper[lane] };
+}
+
+void set_ib(ibatch* A, unsigned lane, Interval I)
+{
+    A->lower[lane] = I.lower;
+    A->upper[lane] = I.upper;
+}
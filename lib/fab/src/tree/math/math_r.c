@@ -3,14 +3,21 @@
 
 #include "fab/tree/math/math_r.h"
 #include "fab/tree/math/math_f.h"
+#include "fab/tree/math/math_simd.h"
 
+// Each operation gets a scalar reference kernel (name_scalar) and a
+// public function that forwards to the active kernel table.
 #define DUAL(name, fn) \
-float* name(const float* restrict A, const float* restrict B,   \
-         float* restrict R, int c)                              \
+float* name##_scalar(const float* restrict A, const float* restrict B,  \
+                     float* restrict R, int c)                          \
 {                                                               \
     for (int q=0; q < c; ++q)                                   \
         R[q] = fn(A[q], B[q]);                                  \
     return R; \
+}                                                               \
+float* name(const float* A, const float* B, float* R, int c)    \
+{                                                               \
+    return math_kernels->name(A, B, R, c);                      \
 }
 
 DUAL(add_r, add_f);
@@ -22,14 +29,36 @@ DUAL(max_r, max_f);
 DUAL(pow_r, pow_f);
 DUAL(atan2_r, atan2_f);
 
+// Domain repetition runs once per clause (rather than once per repeated
+// copy), so it isn't worth a slot in the SIMD kernel tables.
+float* mod_r(const float* restrict A, const float* restrict B,
+             float* restrict R, int c)
+{
+    for (int q=0; q < c; ++q)
+        R[q] = mod_f(A[q], B[q]);
+    return R;
+}
+
+float* repeat_r(const float* restrict A, const float* restrict B,
+                float* restrict R, int c)
+{
+    for (int q=0; q < c; ++q)
+        R[q] = repeat_f(A[q], B[q]);
+    return R;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 #define SINGLE(name, fn) \
-float* name(const float* restrict A, float* restrict R, int c)  \
+float* name##_scalar(const float* restrict A, float* restrict R, int c) \
 {                                                               \
     for (int q=0; q < c; ++q)                                   \
         R[q] = fn(A[q]);                                        \
     return R; \
+}                                                               \
+float* name(const float* A, float* R, int c)                    \
+{                                                               \
+    return math_kernels->name(A, R, c);                         \
 }
 
 SINGLE(abs_r, abs_f);
@@ -63,3 +92,35 @@ float* Z_r(const float* restrict Z, float* R, int c)
     memcpy(R, Z, c*sizeof(float));
     return R;
 }
+
+float* affine_r(const float* k, const float* restrict X,
+                const float* restrict Y, const float* restrict Z,
+                float* restrict R, int c)
+{
+    const float a = k[0], b = k[1], d = k[2], e = k[3];
+    for (int q=0; q < c; ++q)
+        R[q] = a*X[q] + b*Y[q] + d*Z[q] + e;
+    return R;
+}
+
+float* box_r(const float* b, const float* restrict X,
+             const float* restrict Y, const float* restrict Z,
+             float* restrict R, int c)
+{
+    // Axis by axis (skipping unbounded axes), so that each loop vectorizes
+    const float* const in[3] = {X, Y, Z};
+    for (int q=0; q < c; ++q)
+        R[q] = -INFINITY;
+
+    for (int a=0; a < 3; ++a) {
+        const float lo = b[a], hi = b[a + 3];
+        if (lo == -INFINITY && hi == INFINITY)  continue;
+
+        const float* restrict P = in[a];
+        for (int q=0; q < c; ++q) {
+            const float d = lo - P[q] > P[q] - hi ? lo - P[q] : P[q] - hi;
+            R[q] = d > R[q] ? d : R[q];
+        }
+    }
+    return R;
+}
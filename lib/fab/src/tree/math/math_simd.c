@@ -0,0 +1,104 @@
+#include <stddef.h>
+
+#include "fab/tree/math/math_simd.h"
+
+#define KERNELS(suffix) \
+    add_r##suffix, sub_r##suffix, mul_r##suffix, div_r##suffix,     \
+    min_r##suffix, max_r##suffix, pow_r##suffix, atan2_r##suffix,   \
+    abs_r##suffix, square_r##suffix, sqrt_r##suffix, sin_r##suffix, \
+    cos_r##suffix, tan_r##suffix, asin_r##suffix, acos_r##suffix,   \
+    atan_r##suffix, neg_r##suffix, exp_r##suffix,                   \
+    add_g##suffix, sub_g##suffix, mul_g##suffix, div_g##suffix,     \
+    min_g##suffix, max_g##suffix, pow_g##suffix, atan2_g##suffix,   \
+    abs_g##suffix, square_g##suffix, sqrt_g##suffix, sin_g##suffix, \
+    cos_g##suffix, tan_g##suffix, asin_g##suffix, acos_g##suffix,   \
+    atan_g##suffix, neg_g##suffix, exp_g##suffix
+
+static const MathKernels scalar_kernels = { SIMD_SCALAR, KERNELS(_scalar) };
+
+// The SIMD tables are only compiled in on x86 targets, where CMake
+// builds each backend's source file with the matching -m flags.
+#ifdef FAB_SIMD_X86
+extern const MathKernels math_kernels_sse42;
+extern const MathKernels math_kernels_avx2;
+extern const MathKernels math_kernels_avx512;
+#endif
+
+const MathKernels* math_kernels = &scalar_kernels;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const MathKernels* kernels_for(SimdBackend b)
+{
+    switch (b)
+    {
+        case SIMD_SCALAR:   return &scalar_kernels;
+#ifdef FAB_SIMD_X86
+        case SIMD_SSE42:    return &math_kernels_sse42;
+        case SIMD_AVX2:     return &math_kernels_avx2;
+        case SIMD_AVX512:   return &math_kernels_avx512;
+#endif
+        default:            return NULL;
+    }
+}
+
+bool simd_available(SimdBackend b)
+{
+    if (kernels_for(b) == NULL)
+        return false;
+
+#ifdef FAB_SIMD_X86
+    __builtin_cpu_init();
+    switch (b)
+    {
+        case SIMD_SCALAR:   return true;
+        case SIMD_SSE42:    return __builtin_cpu_supports("sse4.2");
+        case SIMD_AVX2:     return __builtin_cpu_supports("avx2") &&
+                                   __builtin_cpu_supports("fma");
+        case SIMD_AVX512:   return __builtin_cpu_supports("avx512f");
+        default:            return false;
+    }
+#else
+    return b == SIMD_SCALAR;
+#endif
+}
+
+SimdBackend simd_detect(void)
+{
+    for (int b=LAST_SIMD_BACKEND - 1; b > SIMD_SCALAR; --b)
+        if (simd_available(b))
+            return b;
+    return SIMD_SCALAR;
+}
+
+bool simd_select(SimdBackend b)
+{
+    if (!simd_available(b))
+        return false;
+    math_kernels = kernels_for(b);
+    return true;
+}
+
+SimdBackend simd_backend(void)
+{
+    return math_kernels->backend;
+}
+
+const char* simd_backend_name(SimdBackend b)
+{
+    switch (b)
+    {
+        case SIMD_SCALAR:   return "scalar";
+        case SIMD_SSE42:    return "sse4.2";
+        case SIMD_AVX2:     return "avx2";
+        case SIMD_AVX512:   return "avx512";
+        default:            return "unknown";
+    }
+}
+
+// Pick the best available backend before anything gets evaluated.
+__attribute__((constructor))
+static void simd_init(void)
+{
+    simd_select(simd_detect());
+}
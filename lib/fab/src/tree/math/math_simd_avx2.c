@@ -0,0 +1,62 @@
+#include "fab/tree/math/math_simd.h"
+
+// AVX2 backend: eight floats per vector.  CMake builds this file with
+// -mavx2 -mfma on x86 targets; elsewhere it compiles to nothing.
+#ifdef __AVX2__
+
+#include <immintrin.h>
+
+#define W 8
+typedef __m256  V;
+typedef __m256i VI;
+typedef __m256  VM;
+
+#define VSET1       _mm256_set1_ps
+#define VLOAD       _mm256_loadu_ps
+#define VSTORE      _mm256_storeu_ps
+#define VADD        _mm256_add_ps
+#define VSUB        _mm256_sub_ps
+#define VMUL        _mm256_mul_ps
+#define VDIV        _mm256_div_ps
+#define VMIN        _mm256_min_ps
+#define VMAX        _mm256_max_ps
+#define VSQRT       _mm256_sqrt_ps
+#define VFLOOR      _mm256_floor_ps
+#define VAND        _mm256_and_ps
+#define VANDNOT     _mm256_andnot_ps
+#define VOR         _mm256_or_ps
+#define VXOR        _mm256_xor_ps
+
+#define VLT(a, b)   _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define VLE(a, b)   _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define VGT(a, b)   _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define VEQ(a, b)   _mm256_cmp_ps(a, b, _CMP_EQ_OQ)
+#define VUNORD(a, b) _mm256_cmp_ps(a, b, _CMP_UNORD_Q)
+#define VSEL(m, a, b)   _mm256_blendv_ps(a, b, m)
+#define VM_OR       _mm256_or_ps
+#define VM_ANY(m)   (_mm256_movemask_ps(m) != 0)
+
+#define VI_SET1     _mm256_set1_epi32
+#define VI_CVTT     _mm256_cvttps_epi32
+#define VI_TOF      _mm256_cvtepi32_ps
+#define VI_ADD      _mm256_add_epi32
+#define VI_SUB      _mm256_sub_epi32
+#define VI_AND      _mm256_and_si256
+#define VI_ANDNOT   _mm256_andnot_si256
+#define VI_OR       _mm256_or_si256
+#define VI_SLLI     _mm256_slli_epi32
+#define VI_SRLI     _mm256_srli_epi32
+#define VI_EQ(a, b) _mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b))
+#define VI_AS_V     _mm256_castsi256_ps
+#define V_AS_VI     _mm256_castps_si256
+
+#define VUNPACKLO   _mm256_unpacklo_ps
+#define VUNPACKHI   _mm256_unpackhi_ps
+#define VSHUFFLE    _mm256_shuffle_ps
+
+#define KERNEL_BACKEND  SIMD_AVX2
+#define KERNEL_TABLE    math_kernels_avx2
+
+#include "math_simd_impl.h"
+
+#endif
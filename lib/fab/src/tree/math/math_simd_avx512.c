@@ -0,0 +1,68 @@
+#include "fab/tree/math/math_simd.h"
+
+// AVX-512 backend: sixteen floats per vector, with comparisons producing
+// k-masks.  Only AVX-512F instructions are used.  CMake builds this file
+// with -mavx512f on x86 targets; elsewhere it compiles to nothing.
+#ifdef __AVX512F__
+
+#include <immintrin.h>
+
+#define W 16
+typedef __m512  V;
+typedef __m512i VI;
+typedef __mmask16 VM;
+
+#define VSET1       _mm512_set1_ps
+#define VLOAD       _mm512_loadu_ps
+#define VSTORE      _mm512_storeu_ps
+#define VADD        _mm512_add_ps
+#define VSUB        _mm512_sub_ps
+#define VMUL        _mm512_mul_ps
+#define VDIV        _mm512_div_ps
+#define VMIN        _mm512_min_ps
+#define VMAX        _mm512_max_ps
+#define VSQRT       _mm512_sqrt_ps
+#define VFLOOR(a)   _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | \
+                                            _MM_FROUND_NO_EXC)
+
+// AVX-512F has no float bitwise ops, so go through the integer domain
+#define BITWISE(op, a, b) \
+    _mm512_castsi512_ps(op(_mm512_castps_si512(a), _mm512_castps_si512(b)))
+#define VAND(a, b)      BITWISE(_mm512_and_si512, a, b)
+#define VANDNOT(a, b)   BITWISE(_mm512_andnot_si512, a, b)
+#define VOR(a, b)       BITWISE(_mm512_or_si512, a, b)
+#define VXOR(a, b)      BITWISE(_mm512_xor_si512, a, b)
+
+#define VLT(a, b)   _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ)
+#define VLE(a, b)   _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ)
+#define VGT(a, b)   _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ)
+#define VEQ(a, b)   _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ)
+#define VUNORD(a, b) _mm512_cmp_ps_mask(a, b, _CMP_UNORD_Q)
+#define VSEL(m, a, b)   _mm512_mask_blend_ps(m, a, b)
+#define VM_OR(a, b) ((VM)((a) | (b)))
+#define VM_ANY(m)   ((m) != 0)
+
+#define VI_SET1     _mm512_set1_epi32
+#define VI_CVTT     _mm512_cvttps_epi32
+#define VI_TOF      _mm512_cvtepi32_ps
+#define VI_ADD      _mm512_add_epi32
+#define VI_SUB      _mm512_sub_epi32
+#define VI_AND      _mm512_and_si512
+#define VI_ANDNOT   _mm512_andnot_si512
+#define VI_OR       _mm512_or_si512
+#define VI_SLLI     _mm512_slli_epi32
+#define VI_SRLI     _mm512_srli_epi32
+#define VI_EQ       _mm512_cmpeq_epi32_mask
+#define VI_AS_V     _mm512_castsi512_ps
+#define V_AS_VI     _mm512_castps_si512
+
+#define VUNPACKLO   _mm512_unpacklo_ps
+#define VUNPACKHI   _mm512_unpackhi_ps
+#define VSHUFFLE    _mm512_shuffle_ps
+
+#define KERNEL_BACKEND  SIMD_AVX512
+#define KERNEL_TABLE    math_kernels_avx512
+
+#include "math_simd_impl.h"
+
+#endif
@@ -0,0 +1,694 @@
+/*  Shared body for the SIMD kernel tables.
+ *
+ *  This file is included once by each backend (math_simd_sse.c, etc),
+ *  after the backend has defined:
+ *      W                       vector width in floats
+ *      V, VI, VM               float, int32 and comparison-mask types
+ *      VSET1, VLOAD, VSTORE, VADD, VSUB, VMUL, VDIV, VMIN, VMAX,
+ *      VSQRT, VFLOOR, VAND, VANDNOT, VOR, VXOR
+ *      VLT, VLE, VGT, VEQ, VUNORD      comparisons returning VM
+ *      VSEL(m, a, b)           per-lane (m ? b : a)
+ *      VM_OR, VM_ANY           mask helpers
+ *      VI_SET1, VI_CVTT, VI_TOF, VI_ADD, VI_SUB, VI_AND, VI_ANDNOT,
+ *      VI_OR, VI_SLLI, VI_SRLI, VI_EQ, VI_AS_V, V_AS_VI
+ *      VUNPACKLO, VUNPACKHI, VSHUFFLE  (used for the in-lane 4x4 transpose)
+ *      KERNEL_BACKEND          SimdBackend enum value
+ *      KERNEL_TABLE            name of the exported MathKernels table
+ *
+ *  Transcendental functions use Cephes-style single-precision polynomials.
+ *  Any block that contains an input outside a polynomial's valid range
+ *  (or a NaN / infinity) is handed to the scalar kernel, so edge cases
+ *  behave exactly like the scalar backend.
+ */
+
+#include <float.h>
+#include <math.h>
+
+#include "fab/tree/math/math_simd.h"
+#include "fab/tree/math/math_defines.h"
+
+#define VC(x) VSET1((float)(x))
+
+////////////////////////////////////////////////////////////////////////////////
+// Elementary helpers
+
+static inline V v_abs(V x)  { return VANDNOT(VC(-0.0f), x); }
+static inline V v_sign(V x) { return VAND(VC(-0.0f), x); }
+
+static inline VM v_nonfinite(V x)
+{
+    return VM_OR(VUNORD(x, x), VEQ(v_abs(x), VC(INFINITY)));
+}
+
+// min/max with the NaN handling of fmin and fmax
+static inline V v_fmin(V a, V b)
+{
+    return VSEL(VUNORD(b, b), VMIN(a, b), a);
+}
+
+static inline V v_fmax(V a, V b)
+{
+    return VSEL(VUNORD(b, b), VMAX(a, b), a);
+}
+
+static inline V v_madd(V a, V b, V c)
+{
+    return VADD(VMUL(a, b), c);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Transcendentals
+
+// Valid for |x| <= 8192
+static inline void v_sincos(V x, V* s, V* c)
+{
+    V sign_sin = v_sign(x);
+    x = v_abs(x);
+
+    // Octant index, rounded up to an even number
+    VI j = VI_CVTT(VMUL(x, VC(1.27323954473516)));
+    j = VI_AND(VI_ADD(j, VI_SET1(1)), VI_SET1(~1));
+    const V y = VI_TOF(j);
+
+    const V swap_sin = VI_AS_V(VI_SLLI(VI_AND(j, VI_SET1(4)), 29));
+    const V sign_cos = VI_AS_V(VI_SLLI(
+                VI_ANDNOT(VI_SUB(j, VI_SET1(2)), VI_SET1(4)), 29));
+    const VM poly = VI_EQ(VI_AND(j, VI_SET1(2)), VI_SET1(0));
+    sign_sin = VXOR(sign_sin, swap_sin);
+
+    // Extended-precision range reduction
+    x = v_madd(y, VC(-0.78515625), x);
+    x = v_madd(y, VC(-2.4187564849853515625e-4), x);
+    x = v_madd(y, VC(-3.77489497744594108e-8), x);
+
+    const V z = VMUL(x, x);
+
+    V yc = VC(2.443315711809948e-5);
+    yc = v_madd(yc, z, VC(-1.388731625493765e-3));
+    yc = v_madd(yc, z, VC(4.166664568298827e-2));
+    yc = VMUL(VMUL(yc, z), z);
+    yc = VSUB(yc, VMUL(z, VC(0.5)));
+    yc = VADD(yc, VC(1));
+
+    V ys = VC(-1.9515295891e-4);
+    ys = v_madd(ys, z, VC(8.3321608736e-3));
+    ys = v_madd(ys, z, VC(-1.6666654611e-1));
+    ys = v_madd(VMUL(ys, z), x, x);
+
+    *s = VXOR(VSEL(poly, yc, ys), sign_sin);
+    *c = VXOR(VSEL(poly, ys, yc), sign_cos);
+}
+
+static inline VM v_sincos_bad(V x)
+{
+    return VM_OR(VUNORD(x, x), VGT(v_abs(x), VC(8192)));
+}
+
+// Valid for -87 <= x <= 88
+static inline V v_exp(V x)
+{
+    const V fx = VFLOOR(v_madd(x, VC(1.44269504088896341), VC(0.5)));
+    x = VSUB(x, VMUL(fx, VC(0.693359375)));
+    x = VSUB(x, VMUL(fx, VC(-2.12194440e-4)));
+
+    const V z = VMUL(x, x);
+    V y = VC(1.9875691500e-4);
+    y = v_madd(y, x, VC(1.3981999507e-3));
+    y = v_madd(y, x, VC(8.3334519073e-3));
+    y = v_madd(y, x, VC(4.1665795894e-2));
+    y = v_madd(y, x, VC(1.6666665459e-1));
+    y = v_madd(y, x, VC(5.0000001201e-1));
+    y = VADD(v_madd(y, z, x), VC(1));
+
+    // Build 2^fx directly in the exponent bits
+    const VI n = VI_SLLI(VI_ADD(VI_CVTT(fx), VI_SET1(127)), 23);
+    return VMUL(y, VI_AS_V(n));
+}
+
+static inline VM v_exp_bad(V x)
+{
+    return VM_OR(VUNORD(x, x), VM_OR(VLT(x, VC(-87)), VGT(x, VC(88))));
+}
+
+// Valid for finite, normal x > 0
+static inline V v_log(V x)
+{
+    const VI i = V_AS_VI(x);
+    V e = VI_TOF(VI_SUB(VI_SRLI(i, 23), VI_SET1(126)));
+    x = VI_AS_V(VI_OR(VI_AND(i, VI_SET1(0x007fffff)),
+                      VI_SET1(0x3f000000)));
+
+    // Shift the mantissa into [sqrt(1/2), sqrt(2)) - 1
+    const VM m = VLT(x, VC(0.707106781186547524));
+    e = VSEL(m, e, VSUB(e, VC(1)));
+    x = VSUB(VADD(x, VSEL(m, VC(0), x)), VC(1));
+
+    const V z = VMUL(x, x);
+    V y = VC(7.0376836292e-2);
+    y = v_madd(y, x, VC(-1.1514610310e-1));
+    y = v_madd(y, x, VC(1.1676998740e-1));
+    y = v_madd(y, x, VC(-1.2420140846e-1));
+    y = v_madd(y, x, VC(1.4249322787e-1));
+    y = v_madd(y, x, VC(-1.6668057665e-1));
+    y = v_madd(y, x, VC(2.0000714765e-1));
+    y = v_madd(y, x, VC(-2.4999993993e-1));
+    y = v_madd(y, x, VC(3.3333331174e-1));
+    y = VMUL(VMUL(y, x), z);
+
+    y = v_madd(e, VC(-2.12194440e-4), y);
+    y = VSUB(y, VMUL(z, VC(0.5)));
+    return v_madd(e, VC(0.693359375), VADD(x, y));
+}
+
+static inline VM v_log_bad(V x)
+{
+    return VM_OR(v_nonfinite(x), VLT(x, VC(FLT_MIN)));
+}
+
+static inline V v_atan(V x)
+{
+    const V sign = v_sign(x);
+    x = v_abs(x);
+
+    const VM big = VGT(x, VC(2.414213562373095));
+    const VM mid = VGT(x, VC(0.4142135623730950));
+
+    V y0 = VSEL(mid, VC(0), VC(M_PI / 4));
+    y0 = VSEL(big, y0, VC(M_PI_2));
+    const V xm = VDIV(VSUB(x, VC(1)), VADD(x, VC(1)));
+    const V xb = VDIV(VC(-1), x);
+    x = VSEL(big, VSEL(mid, x, xm), xb);
+
+    const V z = VMUL(x, x);
+    V y = VC(8.05374449538e-2);
+    y = v_madd(y, z, VC(-1.38776856032e-1));
+    y = v_madd(y, z, VC(1.99777106478e-1));
+    y = v_madd(y, z, VC(-3.33329491539e-1));
+    y = v_madd(VMUL(y, z), x, x);
+
+    return VXOR(VADD(y, y0), sign);
+}
+
+// atan2 is evaluated as atan(a / b) plus a quadrant offset; zeros and
+// infinities (which need signed-zero handling) go to the scalar kernel.
+static inline V v_atan2(V a, V b)
+{
+    const V q = v_atan(VDIV(a, b));
+    const V offset = VSEL(VLT(b, VC(0)), VC(0), VOR(VC(M_PI), v_sign(a)));
+    return VADD(q, offset);
+}
+
+static inline VM v_atan2_bad(V a, V b)
+{
+    return VM_OR(VM_OR(v_nonfinite(a), v_nonfinite(b)),
+                 VM_OR(VEQ(a, VC(0)), VEQ(b, VC(0))));
+}
+
+// asin polynomial, valid for 0 <= a <= 0.5
+static inline V v_asin_core(V a)
+{
+    const V z = VMUL(a, a);
+    V y = VC(4.2163199048e-2);
+    y = v_madd(y, z, VC(2.4181311049e-2));
+    y = v_madd(y, z, VC(4.5470025998e-2));
+    y = v_madd(y, z, VC(7.4953002686e-2));
+    y = v_madd(y, z, VC(1.6666752422e-1));
+    return v_madd(VMUL(y, z), a, a);
+}
+
+// Valid for -1 <= x <= 1
+static inline V v_asin(V x)
+{
+    const V sign = v_sign(x);
+    const V a = v_abs(x);
+    const VM big = VGT(a, VC(0.5));
+
+    const V small = v_asin_core(VSEL(big, a, VC(0)));
+    V large = v_asin_core(VSQRT(VMUL(VC(0.5), VSUB(VC(1), a))));
+    large = VSUB(VC(M_PI_2), VADD(large, large));
+
+    return VXOR(VSEL(big, small, large), sign);
+}
+
+// Valid for -1 <= x <= 1
+static inline V v_acos(V x)
+{
+    const VM pos = VGT(x, VC(0.5));
+    const VM neg = VLT(x, VC(-0.5));
+
+    // Middle range: pi/2 - asin(x)
+    const V a = v_abs(x);
+    const V mid = VSUB(VC(M_PI_2),
+            VXOR(v_asin_core(VSEL(VGT(a, VC(0.5)), a, VC(0))), v_sign(x)));
+
+    // Outer ranges: 2*asin(sqrt((1 -+ x) / 2))
+    V s = v_asin_core(VSQRT(VMUL(VC(0.5), VSUB(VC(1), a))));
+    s = VADD(s, s);
+
+    V out = VSEL(pos, mid, s);
+    return VSEL(neg, out, VSUB(VC(M_PI), s));
+}
+
+static inline V v_clamp_unit(V x)
+{
+    return VMIN(VMAX(x, VC(-1)), VC(1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Value kernels (per-vector bodies for math_r)
+
+static inline V add_v(V a, V b)    { return VADD(a, b); }
+static inline V sub_v(V a, V b)    { return VSUB(a, b); }
+static inline V mul_v(V a, V b)    { return VMUL(a, b); }
+static inline V div_v(V a, V b)    { return VDIV(a, b); }
+static inline V min_v(V a, V b)    { return v_fmin(a, b); }
+static inline V max_v(V a, V b)    { return v_fmax(a, b); }
+static inline V atan2_v(V a, V b)  { return v_atan2(a, b); }
+
+static inline VM pow_bad(V a, V b)
+{
+    return VM_OR(VM_OR(v_log_bad(a), v_nonfinite(b)),
+                 v_exp_bad(VMUL(b, v_log(a))));
+}
+static inline V pow_v(V a, V b)    { return v_exp(VMUL(b, v_log(a))); }
+
+static inline V abs_v(V a)         { return v_abs(a); }
+static inline V square_v(V a)      { return VMUL(a, a); }
+static inline V neg_v(V a)         { return VXOR(a, VC(-0.0f)); }
+static inline V atan_v(V a)        { return v_atan(a); }
+
+static inline V sqrt_v(V a)
+{
+    return VSEL(VLT(a, VC(0)), VSQRT(a), VC(0));
+}
+
+static inline V sin_v(V a) { V s, c; v_sincos(a, &s, &c); return s; }
+static inline V cos_v(V a) { V s, c; v_sincos(a, &s, &c); return c; }
+static inline V tan_v(V a) { V s, c; v_sincos(a, &s, &c); return VDIV(s, c); }
+
+static inline VM asin_bad(V a)     { return VUNORD(a, a); }
+static inline V asin_v(V a)        { return v_asin(v_clamp_unit(a)); }
+static inline V acos_v(V a)        { return v_acos(v_clamp_unit(a)); }
+
+static inline V exp_v(V a)         { return v_exp(a); }
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Kernels that are exact for every input
+#define DUAL_R(name) \
+static float* name##_r_simd(const float* A, const float* B,             \
+                            float* R, int c)                            \
+{                                                                       \
+    int q = 0;                                                          \
+    for (; q + W <= c; q += W)                                          \
+        VSTORE(R + q, name##_v(VLOAD(A + q), VLOAD(B + q)));            \
+    name##_r_scalar(A + q, B + q, R + q, c - q);                        \
+    return R;                                                           \
+}
+
+#define SINGLE_R(name) \
+static float* name##_r_simd(const float* A, float* R, int c)           \
+{                                                                       \
+    int q = 0;                                                          \
+    for (; q + W <= c; q += W)                                          \
+        VSTORE(R + q, name##_v(VLOAD(A + q)));                          \
+    name##_r_scalar(A + q, R + q, c - q);                               \
+    return R;                                                           \
+}
+
+// Kernels that fall back to scalar code for blocks with awkward inputs
+#define DUAL_R_CHECKED(name, bad) \
+static float* name##_r_simd(const float* A, const float* B,             \
+                            float* R, int c)                            \
+{                                                                       \
+    int q = 0;                                                          \
+    for (; q + W <= c; q += W)                                          \
+    {                                                                   \
+        const V a = VLOAD(A + q), b = VLOAD(B + q);                     \
+        if (VM_ANY(bad(a, b)))                                          \
+            name##_r_scalar(A + q, B + q, R + q, W);                    \
+        else                                                            \
+            VSTORE(R + q, name##_v(a, b));                              \
+    }                                                                   \
+    name##_r_scalar(A + q, B + q, R + q, c - q);                        \
+    return R;                                                           \
+}
+
+#define SINGLE_R_CHECKED(name, bad) \
+static float* name##_r_simd(const float* A, float* R, int c)           \
+{                                                                       \
+    int q = 0;                                                          \
+    for (; q + W <= c; q += W)                                          \
+    {                                                                   \
+        const V a = VLOAD(A + q);                                       \
+        if (VM_ANY(bad(a)))                                             \
+            name##_r_scalar(A + q, R + q, W);                           \
+        else                                                            \
+            VSTORE(R + q, name##_v(a));                                 \
+    }                                                                   \
+    name##_r_scalar(A + q, R + q, c - q);                               \
+    return R;                                                           \
+}
+
+DUAL_R(add)
+DUAL_R(sub)
+DUAL_R(mul)
+DUAL_R(div)
+DUAL_R(min)
+DUAL_R(max)
+DUAL_R_CHECKED(pow, pow_bad)
+DUAL_R_CHECKED(atan2, v_atan2_bad)
+
+SINGLE_R(abs)
+SINGLE_R(square)
+SINGLE_R(sqrt)
+SINGLE_R_CHECKED(sin, v_sincos_bad)
+SINGLE_R_CHECKED(cos, v_sincos_bad)
+SINGLE_R_CHECKED(tan, v_sincos_bad)
+SINGLE_R_CHECKED(asin, asin_bad)
+SINGLE_R_CHECKED(acos, asin_bad)
+SINGLE_R(atan)
+SINGLE_R(neg)
+SINGLE_R_CHECKED(exp, v_exp_bad)
+
+////////////////////////////////////////////////////////////////////////////////
+// Derivative kernels
+//
+// A block of W derivatives is loaded as four vectors and transposed
+// within each 128-bit lane, giving vectors of v, dx, dy, and dz.  Lanes
+// end up permuted across the block, which is harmless because every
+// operation is elementwise; the same transpose puts them back on store.
+
+#define TRANSPOSE4(r0, r1, r2, r3) \
+{                                                   \
+    const V t0 = VUNPACKLO(r0, r1);                 \
+    const V t1 = VUNPACKLO(r2, r3);                 \
+    const V t2 = VUNPACKHI(r0, r1);                 \
+    const V t3 = VUNPACKHI(r2, r3);                 \
+    r0 = VSHUFFLE(t0, t1, 0x44);                    \
+    r1 = VSHUFFLE(t0, t1, 0xEE);                    \
+    r2 = VSHUFFLE(t2, t3, 0x44);                    \
+    r3 = VSHUFFLE(t2, t3, 0xEE);                    \
+}
+
+static inline void load_g(const derivative* D, V d[4])
+{
+    const float* f = (const float*)D;
+    d[0] = VLOAD(f);
+    d[1] = VLOAD(f + W);
+    d[2] = VLOAD(f + 2*W);
+    d[3] = VLOAD(f + 3*W);
+    TRANSPOSE4(d[0], d[1], d[2], d[3]);
+}
+
+static inline void store_g(derivative* D, V d[4])
+{
+    float* f = (float*)D;
+    TRANSPOSE4(d[0], d[1], d[2], d[3]);
+    VSTORE(f, d[0]);
+    VSTORE(f + W, d[1]);
+    VSTORE(f + 2*W, d[2]);
+    VSTORE(f + 3*W, d[3]);
+}
+
+// Multiplies the three partials by a common factor
+static inline void scale_g(const V a[4], V s, V r[4])
+{
+    r[1] = VMUL(a[1], s);
+    r[2] = VMUL(a[2], s);
+    r[3] = VMUL(a[3], s);
+}
+
+static inline void divide_g(const V a[4], V d, V r[4])
+{
+    r[1] = VDIV(a[1], d);
+    r[2] = VDIV(a[2], d);
+    r[3] = VDIV(a[3], d);
+}
+
+static inline void select_g(VM m, const V a[4], const V b[4], V r[4])
+{
+    for (int i=0; i < 4; ++i)
+        r[i] = VSEL(m, a[i], b[i]);
+}
+
+static inline void add_gv(const V a[4], const V b[4], V r[4])
+{
+    for (int i=0; i < 4; ++i)
+        r[i] = VADD(a[i], b[i]);
+}
+
+static inline void sub_gv(const V a[4], const V b[4], V r[4])
+{
+    for (int i=0; i < 4; ++i)
+        r[i] = VSUB(a[i], b[i]);
+}
+
+static inline void mul_gv(const V a[4], const V b[4], V r[4])
+{
+    r[0] = VMUL(a[0], b[0]);
+    for (int i=1; i < 4; ++i)
+        r[i] = VADD(VMUL(a[0], b[i]), VMUL(b[0], a[i]));
+}
+
+static inline void div_gv(const V a[4], const V b[4], V r[4])
+{
+    r[0] = VDIV(a[0], b[0]);
+    const V p = VMUL(b[0], b[0]);
+    for (int i=1; i < 4; ++i)
+        r[i] = VDIV(VSUB(VMUL(b[0], a[i]), VMUL(a[0], b[i])), p);
+}
+
+static inline void min_gv(const V a[4], const V b[4], V r[4])
+{
+    const VM m = VLT(a[0], b[0]);
+    select_g(m, b, a, r);
+    r[0] = v_fmin(a[0], b[0]);
+}
+
+static inline void max_gv(const V a[4], const V b[4], V r[4])
+{
+    const VM m = VLE(b[0], a[0]);
+    select_g(m, b, a, r);
+    r[0] = v_fmax(a[0], b[0]);
+}
+
+static inline VM pow_g_bad(const V a[4], const V b[4])
+{
+    const V la = v_log(a[0]);
+    return VM_OR(VM_OR(v_log_bad(a[0]), v_nonfinite(b[0])),
+                 VM_OR(v_exp_bad(VMUL(b[0], la)),
+                       v_exp_bad(VMUL(VSUB(b[0], VC(1)), la))));
+}
+
+static inline void pow_gv(const V a[4], const V b[4], V r[4])
+{
+    const V la = v_log(a[0]);
+    r[0] = v_exp(VMUL(b[0], la));
+
+    const V p = v_exp(VMUL(VSUB(b[0], VC(1)), la));
+    const V m = VMUL(a[0], la);
+    for (int i=1; i < 4; ++i)
+        r[i] = VMUL(p, VADD(VMUL(b[0], a[i]), VMUL(m, b[i])));
+}
+
+static inline VM atan2_g_bad(const V a[4], const V b[4])
+{
+    return v_atan2_bad(a[0], b[0]);
+}
+
+static inline void atan2_gv(const V a[4], const V b[4], V r[4])
+{
+    r[0] = v_atan2(a[0], b[0]);
+    const V d = VADD(VMUL(a[0], a[0]), VMUL(b[0], b[0]));
+    for (int i=1; i < 4; ++i)
+        r[i] = VDIV(VSUB(VMUL(a[i], b[0]), VMUL(b[i], a[0])), d);
+}
+
+static inline void abs_gv(const V a[4], V r[4])
+{
+    r[0] = v_abs(a[0]);
+    scale_g(a, VSEL(VLT(a[0], VC(0)), VC(1), VC(-1)), r);
+}
+
+static inline void square_gv(const V a[4], V r[4])
+{
+    r[0] = VMUL(a[0], a[0]);
+    scale_g(a, VADD(a[0], a[0]), r);
+}
+
+static inline void sqrt_gv(const V a[4], V r[4])
+{
+    const VM neg = VLT(a[0], VC(0));
+    const V s = VSQRT(a[0]);
+    divide_g(a, VADD(s, s), r);
+    for (int i=1; i < 4; ++i)
+        r[i] = VSEL(neg, r[i], VC(0));
+    r[0] = VSEL(neg, s, VC(0));
+}
+
+static inline VM sincos_g_bad(const V a[4]) { return v_sincos_bad(a[0]); }
+
+static inline void sin_gv(const V a[4], V r[4])
+{
+    V s, c;
+    v_sincos(a[0], &s, &c);
+    r[0] = s;
+    scale_g(a, c, r);
+}
+
+static inline void cos_gv(const V a[4], V r[4])
+{
+    V s, c;
+    v_sincos(a[0], &s, &c);
+    r[0] = c;
+    scale_g(a, neg_v(s), r);
+}
+
+static inline void tan_gv(const V a[4], V r[4])
+{
+    V s, c;
+    v_sincos(a[0], &s, &c);
+    r[0] = VDIV(s, c);
+    divide_g(a, VMUL(c, c), r);
+}
+
+// 1 - a^2, factored to avoid cancellation as |a| approaches 1
+static inline V one_minus_square(V a)
+{
+    return VMUL(VSUB(VC(1), a), VADD(VC(1), a));
+}
+
+static inline VM asin_g_bad(const V a[4]) { return asin_bad(a[0]); }
+
+static inline void asin_gv(const V a[4], V r[4])
+{
+    const VM out = VM_OR(VLT(a[0], VC(-1)), VGT(a[0], VC(1)));
+    r[0] = v_asin(v_clamp_unit(a[0]));
+    divide_g(a, VSQRT(one_minus_square(a[0])), r);
+    for (int i=0; i < 4; ++i)
+        r[i] = VSEL(out, r[i], VC(0));
+}
+
+static inline void acos_gv(const V a[4], V r[4])
+{
+    const VM out = VM_OR(VLT(a[0], VC(-1)), VGT(a[0], VC(1)));
+    r[0] = v_acos(v_clamp_unit(a[0]));
+    divide_g(a, neg_v(VSQRT(one_minus_square(a[0]))), r);
+    for (int i=0; i < 4; ++i)
+        r[i] = VSEL(out, r[i], VC(0));
+}
+
+static inline void atan_gv(const V a[4], V r[4])
+{
+    r[0] = v_atan(a[0]);
+    divide_g(a, v_madd(a[0], a[0], VC(1)), r);
+}
+
+static inline void neg_gv(const V a[4], V r[4])
+{
+    for (int i=0; i < 4; ++i)
+        r[i] = neg_v(a[i]);
+}
+
+static inline VM exp_g_bad(const V a[4]) { return v_exp_bad(a[0]); }
+
+static inline void exp_gv(const V a[4], V r[4])
+{
+    r[0] = v_exp(a[0]);
+    scale_g(a, r[0], r);
+}
+
+static inline VM never_dual_g(const V a[4], const V b[4])
+{
+    (void)a; (void)b;
+    return VLT(VC(0), VC(0));
+}
+
+static inline VM never_single_g(const V a[4])
+{
+    (void)a;
+    return VLT(VC(0), VC(0));
+}
+
+#define DUAL_G(name, bad) \
+static derivative* name##_g_simd(const derivative* A, const derivative* B, \
+                                 derivative* R, int c)                  \
+{                                                                       \
+    int q = 0;                                                          \
+    for (; q + W <= c; q += W)                                          \
+    {                                                                   \
+        V a[4], b[4], r[4];                                             \
+        load_g(A + q, a);                                               \
+        load_g(B + q, b);                                               \
+        if (VM_ANY(bad(a, b)))                                          \
+            name##_g_scalar(A + q, B + q, R + q, W);                    \
+        else                                                            \
+        {                                                               \
+            name##_gv(a, b, r);                                         \
+            store_g(R + q, r);                                          \
+        }                                                               \
+    }                                                                   \
+    name##_g_scalar(A + q, B + q, R + q, c - q);                        \
+    return R;                                                           \
+}
+
+#define SINGLE_G(name, bad) \
+static derivative* name##_g_simd(const derivative* A,                   \
+                                 derivative* R, int c)                  \
+{                                                                       \
+    int q = 0;                                                          \
+    for (; q + W <= c; q += W)                                          \
+    {                                                                   \
+        V a[4], r[4];                                                   \
+        load_g(A + q, a);                                               \
+        if (VM_ANY(bad(a)))                                             \
+            name##_g_scalar(A + q, R + q, W);                           \
+        else                                                            \
+        {                                                               \
+            name##_gv(a, r);                                            \
+            store_g(R + q, r);                                          \
+        }                                                               \
+    }                                                                   \
+    name##_g_scalar(A + q, R + q, c - q);                               \
+    return R;                                                           \
+}
+
+DUAL_G(add, never_dual_g)
+DUAL_G(sub, never_dual_g)
+DUAL_G(mul, never_dual_g)
+DUAL_G(div, never_dual_g)
+DUAL_G(min, never_dual_g)
+DUAL_G(max, never_dual_g)
+DUAL_G(pow, pow_g_bad)
+DUAL_G(atan2, atan2_g_bad)
+
+SINGLE_G(abs, never_single_g)
+SINGLE_G(square, never_single_g)
+SINGLE_G(sqrt, never_single_g)
+SINGLE_G(sin, sincos_g_bad)
+SINGLE_G(cos, sincos_g_bad)
+SINGLE_G(tan, sincos_g_bad)
+SINGLE_G(asin, asin_g_bad)
+SINGLE_G(acos, asin_g_bad)
+SINGLE_G(atan, never_single_g)
+SINGLE_G(neg, never_single_g)
+SINGLE_G(exp, exp_g_bad)
+
+////////////////////////////////////////////////////////////////////////////////
+
+const MathKernels KERNEL_TABLE = {
+    KERNEL_BACKEND,
+
+    add_r_simd, sub_r_simd, mul_r_simd, div_r_simd,
+    min_r_simd, max_r_simd, pow_r_simd, atan2_r_simd,
+    abs_r_simd, square_r_simd, sqrt_r_simd, sin_r_simd,
+    cos_r_simd, tan_r_simd, asin_r_simd, acos_r_simd,
+    atan_r_simd, neg_r_simd, exp_r_simd,
+
+    add_g_simd, sub_g_simd, mul_g_simd, div_g_simd,
+    min_g_simd, max_g_simd, pow_g_simd, atan2_g_simd,
+    abs_g_simd, square_g_simd, sqrt_g_simd, sin_g_simd,
+    cos_g_simd, tan_g_simd, asin_g_simd, acos_g_simd,
+    atan_g_simd, neg_g_simd, exp_g_simd,
+};
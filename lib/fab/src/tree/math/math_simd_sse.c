@@ -0,0 +1,62 @@
+#include "fab/tree/math/math_simd.h"
+
+// SSE4.2 backend: four floats per vector.  CMake builds this file with
+// -msse4.2 on x86 targets; elsewhere it compiles to nothing.
+#ifdef __SSE4_2__
+
+#include <nmmintrin.h>
+
+#define W 4
+typedef __m128  V;
+typedef __m128i VI;
+typedef __m128  VM;
+
+#define VSET1       _mm_set1_ps
+#define VLOAD       _mm_loadu_ps
+#define VSTORE      _mm_storeu_ps
+#define VADD        _mm_add_ps
+#define VSUB        _mm_sub_ps
+#define VMUL        _mm_mul_ps
+#define VDIV        _mm_div_ps
+#define VMIN        _mm_min_ps
+#define VMAX        _mm_max_ps
+#define VSQRT       _mm_sqrt_ps
+#define VFLOOR      _mm_floor_ps
+#define VAND        _mm_and_ps
+#define VANDNOT     _mm_andnot_ps
+#define VOR         _mm_or_ps
+#define VXOR        _mm_xor_ps
+
+#define VLT         _mm_cmplt_ps
+#define VLE         _mm_cmple_ps
+#define VGT         _mm_cmpgt_ps
+#define VEQ         _mm_cmpeq_ps
+#define VUNORD      _mm_cmpunord_ps
+#define VSEL(m, a, b)   _mm_blendv_ps(a, b, m)
+#define VM_OR       _mm_or_ps
+#define VM_ANY(m)   (_mm_movemask_ps(m) != 0)
+
+#define VI_SET1     _mm_set1_epi32
+#define VI_CVTT     _mm_cvttps_epi32
+#define VI_TOF      _mm_cvtepi32_ps
+#define VI_ADD      _mm_add_epi32
+#define VI_SUB      _mm_sub_epi32
+#define VI_AND      _mm_and_si128
+#define VI_ANDNOT   _mm_andnot_si128
+#define VI_OR       _mm_or_si128
+#define VI_SLLI     _mm_slli_epi32
+#define VI_SRLI     _mm_srli_epi32
+#define VI_EQ(a, b) _mm_castsi128_ps(_mm_cmpeq_epi32(a, b))
+#define VI_AS_V     _mm_castsi128_ps
+#define V_AS_VI     _mm_castps_si128
+
+#define VUNPACKLO   _mm_unpacklo_ps
+#define VUNPACKHI   _mm_unpackhi_ps
+#define VSHUFFLE    _mm_shuffle_ps
+
+#define KERNEL_BACKEND  SIMD_SSE42
+#define KERNEL_TABLE    math_kernels_sse42
+
+#include "math_simd_impl.h"
+
+#endif
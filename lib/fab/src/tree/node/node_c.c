@@ -46,7 +46,7 @@ Node* binary_n(Node* lhs, Node* rhs, float (*f)(float, float), Opcode op)
     };
 
     if (constant) {
-        fill_results(n, (*f)(lhs->results.f, rhs->results.f));
+        n->value = (*f)(lhs->value, rhs->value);
     }
 
     return n;
@@ -61,6 +61,9 @@ Node* min_n(Node* lhs, Node* rhs) { return binary_n(lhs, rhs, min_f, OP_MIN); }
 Node* max_n(Node* lhs, Node* rhs) { return binary_n(lhs, rhs, max_f, OP_MAX); }
 Node* pow_n(Node* lhs, Node* rhs) { return binary_n(lhs, rhs, pow_f, OP_POW); }
 
+Node* mod_n(Node* lhs, Node* rhs) { return binary_n(lhs, rhs, mod_f, OP_MOD); }
+Node* repeat_n(Node* lhs, Node* rhs) { return binary_n(lhs, rhs, repeat_f, OP_REPEAT); }
+
 Node* atan2_n(Node* a, Node* b) {return binary_n(a, b, atan2_f, OP_ATAN2); }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -81,7 +84,7 @@ Node* unary_n(Node* arg, float (*f)(float), Opcode op)
     };
 
     if (constant) {
-        fill_results(n, (*f)(arg->results.f));
+        n->value = (*f)(arg->value);
     }
     return n;
 }
@@ -96,7 +99,7 @@ Node* asin_n(Node* child) { return unary_n(child, asin_f, OP_ASIN); }
 Node* acos_n(Node* child) { return unary_n(child, acos_f, OP_ACOS); }
 Node* atan_n(Node* child) { return unary_n(child, atan_f, OP_ATAN); }
 Node* neg_n(Node* child) { return unary_n(child, neg_f, OP_NEG); }
-Node* exp_n(Node* child) { return unary_n(child, abs_f, OP_EXP); }
+Node* exp_n(Node* child) { return unary_n(child, exp_f, OP_EXP); }
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -120,7 +123,29 @@ Node* constant_n(float value)
 {
     Node* n = nonary_n(OP_CONST);
     n->flags = NODE_CONSTANT;
-    fill_results(n, value);
+    n->value = value;
+    return n;
+}
+
+Node* affine_n(const float* k)
+{
+    Node* n = nonary_n(OP_AFFINE);
+    memcpy(n->affine, k, sizeof(n->affine));
+    return n;
+}
+
+Node* bounds_n(Node* arg, const float* box)
+{
+    Node* n = malloc(sizeof(Node));
+    *n = (Node) {
+        .opcode     = OP_BOUNDS,
+        .rank       = 1 + arg->rank,
+        .flags      = 0,
+        .lhs        = arg,
+        .rhs        = NULL,
+        .clone_address = NULL,
+    };
+    memcpy(n->box, box, sizeof(n->box));
     return n;
 }
 
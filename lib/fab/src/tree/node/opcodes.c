@@ -8,6 +8,8 @@ const char* OPCODE_NAMES[] = {
     "OP_MIN",
     "OP_MAX",
     "OP_POW",
+    "OP_MOD",
+    "OP_REPEAT",
 
     "OP_ABS",
     "OP_SQUARE",
@@ -25,6 +27,8 @@ const char* OPCODE_NAMES[] = {
     "OP_X",
     "OP_Y",
     "OP_Z",
+    "OP_AFFINE",
+    "OP_BOUNDS",
     "OP_CONST",
 
     "LAST_OP"
@@ -39,6 +43,8 @@ const char* dot_symbol(Opcode op) {
         case OP_MIN:    return "min";
         case OP_MAX:    return "max";
         case OP_POW:    return "pow";
+        case OP_MOD:    return "mod";
+        case OP_REPEAT: return "repeat";
         case OP_ABS:    return "abs";
         case OP_SQUARE: return "square";
         case OP_SQRT:   return "sqrt";
@@ -54,6 +60,8 @@ const char* dot_symbol(Opcode op) {
         case OP_X:      return "X";
         case OP_Y:      return "Y";
         case OP_Z:      return "Z";
+        case OP_AFFINE: return "affine";
+        case OP_BOUNDS: return "bounds";
         case OP_CONST:  return "C";
         default:        return "";
     }
@@ -66,6 +74,8 @@ const char* dot_color(Opcode op) {
         case OP_MUL:
         case OP_DIV:
         case OP_POW:
+        case OP_MOD:
+        case OP_REPEAT:
         case OP_ABS:
         case OP_SQUARE:
         case OP_SQRT:
@@ -81,10 +91,12 @@ const char* dot_color(Opcode op) {
         case OP_MIN:
         case OP_MAX:
         case OP_NEG:
+        case OP_BOUNDS:
             return "dodgerblue";
         case OP_X:
         case OP_Y:
         case OP_Z:
+        case OP_AFFINE:
             return "red";
         case OP_CONST:
             return "green";
@@ -108,6 +120,8 @@ int dot_fontsize(Opcode op) {
         case OP_MIN:
         case OP_MAX:
         case OP_POW:
+        case OP_MOD:
+        case OP_REPEAT:
         case OP_ABS:
         case OP_SQUARE:
         case OP_SQRT:
@@ -119,8 +133,41 @@ int dot_fontsize(Opcode op) {
         case OP_ATAN:
         case OP_ATAN2:
         case OP_EXP:
+        case OP_AFFINE:
+        case OP_BOUNDS:
             return 14;
         default:
             return 0;
     }
 }
+
+int opcode_arity(Opcode op) {
+    switch (op) {
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_MIN:
+        case OP_MAX:
+        case OP_POW:
+        case OP_MOD:
+        case OP_REPEAT:
+        case OP_ATAN2:
+            return 2;
+        case OP_ABS:
+        case OP_SQUARE:
+        case OP_SQRT:
+        case OP_SIN:
+        case OP_COS:
+        case OP_TAN:
+        case OP_ASIN:
+        case OP_ACOS:
+        case OP_ATAN:
+        case OP_NEG:
+        case OP_EXP:
+        case OP_BOUNDS:
+            return 1;
+        default:
+            return 0;
+    }
+}
@@ -81,6 +81,28 @@ static void pow_p(Node* n, FILE* f)
     fprintf(f, ")");
 }
 
+static void mod_p(Node* n, FILE* f)
+{
+    fprintf(f, "mod");
+    base_p(n, f);
+    fprintf(f, "(");
+    fprint_node(n->lhs, f);
+    fprintf(f, ", ");
+    fprint_node(n->rhs, f);
+    fprintf(f, ")");
+}
+
+static void repeat_p(Node* n, FILE* f)
+{
+    fprintf(f, "repeat");
+    base_p(n, f);
+    fprintf(f, "(");
+    fprint_node(n->lhs, f);
+    fprintf(f, ", ");
+    fprint_node(n->rhs, f);
+    fprintf(f, ")");
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 static void square_p(Node* n, FILE* f)
@@ -184,7 +206,23 @@ static void exp_p(Node* n, FILE* f)
 
 static void constant_p(Node* n, FILE* f)
 {
-    fprintf(f, "%.3g", n->results.f);
+    fprintf(f, "%.3g", n->value);
+}
+
+static void affine_p(Node* n, FILE* f)
+{
+    fprintf(f, "(%.3g*X + %.3g*Y + %.3g*Z + %.3g)",
+            n->affine[0], n->affine[1], n->affine[2], n->affine[3]);
+}
+
+static void bounds_p(Node* n, FILE* f)
+{
+    fprintf(f, "bounds[%.3g, %.3g, %.3g, %.3g, %.3g, %.3g]",
+            n->box[0], n->box[1], n->box[2], n->box[3], n->box[4], n->box[5]);
+    base_p(n, f);
+    fprintf(f, "(");
+    fprint_node(n->lhs, f);
+    fprintf(f, ")");
 }
 
 static void X_p(Node* n, FILE* f)
@@ -229,6 +267,8 @@ void fprint_node(Node* n, FILE* f)
         case OP_MIN:    min_p(n, f); break;
         case OP_MAX:    max_p(n, f); break;
         case OP_POW:    pow_p(n, f); break;
+        case OP_MOD:    mod_p(n, f); break;
+        case OP_REPEAT: repeat_p(n, f); break;
 
         case OP_SQUARE: square_p(n, f); break;
         case OP_SQRT:   sqrt_p(n, f); break;
@@ -246,6 +286,8 @@ void fprint_node(Node* n, FILE* f)
         case OP_X:      X_p(n, f); break;
         case OP_Y:      Y_p(n, f); break;
         case OP_Z:      Z_p(n, f); break;
+        case OP_AFFINE: affine_p(n, f); break;
+        case OP_BOUNDS: bounds_p(n, f); break;
         default:
             fprintf(f, "Unknown opcode!: %i\n", n->opcode);
     }
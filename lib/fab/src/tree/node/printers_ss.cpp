@@ -59,6 +59,22 @@ static std::string pow_pss(Node* n)
     return ss.str();
 }
 
+static std::string mod_pss(Node* n)
+{
+    std::stringstream ss;
+    ss << "mod(" << print_node_ss(n->lhs) << ", "
+              << print_node_ss(n->rhs) << ")";
+    return ss.str();
+}
+
+static std::string repeat_pss(Node* n)
+{
+    std::stringstream ss;
+    ss << "repeat(" << print_node_ss(n->lhs) << ", "
+              << print_node_ss(n->rhs) << ")";
+    return ss.str();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 static std::string square_pss(Node* n)
@@ -136,7 +152,24 @@ static std::string exp_pss(Node* n)
 static std::string constant_pss(Node* n)
 {
     std::stringstream ss;
-    ss << n->results.f;
+    ss << n->value;
+    return ss.str();
+}
+
+static std::string affine_pss(Node* n)
+{
+    std::stringstream ss;
+    ss << "(" << n->affine[0] << "*X+" << n->affine[1] << "*Y+"
+              << n->affine[2] << "*Z+" << n->affine[3] << ")";
+    return ss.str();
+}
+
+static std::string bounds_pss(Node* n)
+{
+    std::stringstream ss;
+    ss << "bounds(" << n->box[0] << ", " << n->box[1] << ", " << n->box[2]
+       << ", " << n->box[3] << ", " << n->box[4] << ", " << n->box[5]
+       << ", " << print_node_ss(n->lhs) << ")";
     return ss.str();
 }
 
@@ -170,6 +203,8 @@ std::string print_node_ss(Node* n)
         case OP_MIN:    return min_pss(n);
         case OP_MAX:    return max_pss(n);
         case OP_POW:    return pow_pss(n);
+        case OP_MOD:    return mod_pss(n);
+        case OP_REPEAT: return repeat_pss(n);
 
         case OP_SQUARE: return square_pss(n);
         case OP_SQRT:   return sqrt_pss(n);
@@ -186,6 +221,8 @@ std::string print_node_ss(Node* n)
         case OP_X:      return X_pss(n);
         case OP_Y:      return Y_pss(n);
         case OP_Z:      return Z_pss(n);
+        case OP_AFFINE: return affine_pss(n);
+        case OP_BOUNDS: return bounds_pss(n);
         default:
             return "Unknown opcode!";
     }
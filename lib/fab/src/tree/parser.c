@@ -30,10 +30,12 @@
 #include <math.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "fab/tree/tree.h"
 #include "fab/tree/parser.h"
 #include "fab/tree/v2parser.h"
+#include "fab/tree/simplify.h"
 
 #include "fab/tree/node/node.h"
 #include "fab/tree/node/opcodes.h"
@@ -41,31 +43,22 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 
-/** @brief Recursively sets the flag of nodes to contain NODE_IN_TREE */
+/** @brief Sets NODE_IN_TREE on every cached node reachable from head */
 static
-void flag_in_tree(Node* n);
+void flag_in_tree(NodeCache* c, Node* head);
 
-/*  Counts the number of nodes in this list with NODE_IN_TREE in their flags
- */
-static
-unsigned count_list_nodes(NodeList* list);
-
-/* Destructively converts a list into an array of nodes, only copying nodes
- * with NODE_IN_TREE set in their flags.
- */
-static
-unsigned flatten_list(NodeList* list, Node** array);
-
-/*  Destructively loads the cache into a tree,
-    freeing linked lists as we go.  Returns number of nodes copied.
+/*  Destructively loads the cache into a tree, freeing nodes that
+    aren't in the tree as we go.
 */
 static
 struct MathTree_* cache_to_tree(NodeCache* c);
 
-
-/** @brief Frees a NodeCache */
+/*  Rebuilds long chains of min, max, add, and mul nodes as balanced
+    trees, returning the new head.  Nodes must be flagged with
+    NODE_IN_TREE; flags are left stale afterwards.
+*/
 static
-void free_node_cache(NodeCache* const c);
+Node* rebalance(NodeCache* c, Node* head);
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -73,8 +66,7 @@ void free_node_cache(NodeCache* const c);
 MathTree* parse(const char* input)
 {
     // Create a cache in which nodes will be stored
-    NodeCache* cache = malloc(sizeof(NodeCache));
-    *cache = (NodeCache){ .levels=0, .constants=NULL };
+    NodeCache* cache = new_node_cache();
     Node *head = NULL;
 
     // Throw X, Y, and Z nodes into the cache
@@ -90,179 +82,437 @@ MathTree* parse(const char* input)
         return NULL;
     }
 
+    return build_tree(cache, head);
+}
+
+NodeCache* new_node_cache(void)
+{
+    NodeCache* cache = malloc(sizeof(NodeCache));
+    *cache = (NodeCache){ .levels=0, .nodes=NULL, .count=0, .capacity=0,
+                          .table=NULL, .table_size=0,
+                          .simplify=get_simplify(), .simplified=0 };
+    return cache;
+}
+
+MathTree* build_tree(NodeCache* const cache, Node* head)
+{
+    flag_in_tree(cache, head);
+    if (cache->simplify) {
+        head = rebalance(cache, head);
+        for (unsigned i=0; i < cache->count; ++i)
+            cache->nodes[i]->flags &= ~NODE_IN_TREE;
+        flag_in_tree(cache, head);
+    }
+
     // Pack the cache into a MathTree data structure
-    flag_in_tree(head);
     MathTree* T = cache_to_tree(cache);
+    add_simplified_nodes(cache->simplified);
     T->head = head;
+    finalize_tree(T);
 
     free_node_cache(cache);
     return T;
 }
 
 static
-void flag_in_tree(Node* n)
+void flag_in_tree(NodeCache* c, Node* head)
+{
+    // Children are always cached before their parents, so a single
+    // backwards pass reaches every node (without deep recursion).
+    head->flags |= NODE_IN_TREE;
+    for (unsigned i=c->count; i-- > 0;) {
+        Node* n = c->nodes[i];
+        if (!(n->flags & NODE_IN_TREE))
+            continue;
+        if (n->lhs) n->lhs->flags |= NODE_IN_TREE;
+        if (n->rhs) n->rhs->flags |= NODE_IN_TREE;
+    }
+}
+
+static
+bool is_chain_op(Opcode op)
 {
-    if (n == NULL)  return;
-    if (n->flags & NODE_IN_TREE)    return;
+    return op == OP_MIN || op == OP_MAX || op == OP_ADD || op == OP_MUL;
+}
 
-    n->flags |= NODE_IN_TREE;
-    flag_in_tree(n->lhs);
-    flag_in_tree(n->rhs);
+// Returns a copy of n with new children (which aren't constant)
+static
+Node* with_children(const Node* n, Node* lhs, Node* rhs)
+{
+    Node* out = malloc(sizeof(Node));
+    *out = *n;
+    out->lhs = lhs;
+    out->rhs = rhs;
+    out->flags = n->flags & ~NODE_IN_TREE;
+    out->rank = 1 + (rhs && rhs->rank > lhs->rank ? rhs->rank : lhs->rank);
+    return out;
 }
 
+// Binary min-heap of chain operands, ordered by rank (then by position,
+// so that the result doesn't depend on the heap's internal order)
+typedef struct {
+    Node* node;
+    int rank;
+    unsigned order;
+} HeapItem;
 
-Node* get_cached_node(NodeCache* const cache, Node* const n)
+static
+bool heap_less(const HeapItem* a, const HeapItem* b)
 {
-    if (n == NULL)  return NULL;
+    return a->rank < b->rank || (a->rank == b->rank && a->order < b->order);
+}
 
-    // Special case for constants: search through the constants
-    // list for any that match the target node's value.
-    if (n->flags & NODE_CONSTANT) {
-        NodeList** next = &(cache->constants);
-        while (*next) {
-            if ((**next).node->results.f == n->results.f) {
-                // Only free this node if it isn't the same as the match
-                if (n != (**next).node) free(n);
-                return (**next).node;
-            }
-            next = &(**next).next;
+static
+void heap_push(HeapItem* heap, unsigned* size, HeapItem item)
+{
+    unsigned i = (*size)++;
+    while (i && heap_less(&item, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = item;
+}
+
+static
+HeapItem heap_pop(HeapItem* heap, unsigned* size)
+{
+    const HeapItem top = heap[0];
+    const HeapItem last = heap[--*size];
+    unsigned i = 0;
+    while (2*i + 1 < *size) {
+        unsigned c = 2*i + 1;
+        if (c + 1 < *size && heap_less(&heap[c + 1], &heap[c]))
+            c++;
+        if (!heap_less(&heap[c], &last))
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    if (*size)  heap[i] = last;
+    return top;
+}
+
+static
+Node* chain_n(Opcode op, Node* a, Node* b)
+{
+    switch (op) {
+        case OP_MIN:    return min_n(a, b);
+        case OP_MAX:    return max_n(a, b);
+        case OP_ADD:    return add_n(a, b);
+        default:        return mul_n(a, b);
+    }
+}
+
+/*  Combines a chain's operands with op, always joining the two of lowest
+ *  rank (which gives the shallowest possible tree).  If out is NULL, no
+ *  nodes are built and only the resulting rank is returned.  */
+static
+int combine(NodeCache* c, Opcode op, const HeapItem* items, unsigned count,
+            HeapItem* heap, Node** out)
+{
+    unsigned size = 0;
+    for (unsigned k=0; k < count; ++k)
+        heap_push(heap, &size, items[k]);
+
+    unsigned order = count;
+    while (size > 1) {
+        const HeapItem a = heap_pop(heap, &size);
+        const HeapItem b = heap_pop(heap, &size);
+        HeapItem r = { .node=NULL, .order=order++,
+                       .rank=1 + (a.rank > b.rank ? a.rank : b.rank) };
+        if (out) {
+            r.node = get_cached_node(c, chain_n(op, a.node, b.node));
+            r.rank = r.node->rank;
         }
-        // If we didn't find it, then allocate a new node at the
-        // end of the linked list and return it.
-        *next  = malloc(sizeof(NodeList));
-        **next = (NodeList){ .node=n, .next=NULL };
-        return n;
+        heap_push(heap, &size, r);
     }
+    if (out)    *out = heap[0].node;
+    return heap[0].rank;
+}
 
-    // Expand the cache if we don't have enough slots
-    if (n->rank >= cache->levels) {
-        cache->nodes = realloc(cache->nodes,
-                                (n->rank+1)*sizeof(NodeList*)*LAST_OP);
-        // And NULL out any cache levels that are empty.
-        for (int i=cache->levels; i <= n->rank; ++i) {
-            for (int o=0; o < LAST_OP; ++o) {
-                cache->nodes[i][o] = NULL;
-            }
+static
+Node* rebalance(NodeCache* c, Node* head)
+{
+    const unsigned count = c->count ? c->count : 1;
+    unsigned* uses = calloc(count, sizeof(unsigned));
+    unsigned* seen = calloc(count, sizeof(unsigned));
+    Opcode* parent_op = malloc(count * sizeof(Opcode));
+    Node** replaced = calloc(count, sizeof(Node*));
+
+    // Nodes are numbered (through their slot field) in insertion order,
+    // and we count how many in-tree parents each one has.
+    for (unsigned i=0; i < c->count; ++i) {
+        c->nodes[i]->slot = i;
+        replaced[i] = c->nodes[i];
+    }
+    for (unsigned i=0; i < c->count; ++i) {
+        const Node* n = c->nodes[i];
+        if (!(n->flags & NODE_IN_TREE))
+            continue;
+        Node* const children[2] = {n->lhs, n->rhs};
+        for (int k=0; k < 2; ++k) {
+            if (!children[k])   continue;
+            uses[children[k]->slot]++;
+            parent_op[children[k]->slot] = n->opcode;
         }
-        cache->levels = n->rank + 1;
     }
 
-    // Fly through the linked list, comparing child pointers
-    NodeList** next = &(cache->nodes[n->rank][n->opcode]);
-    while (*next) {
-        // If we've found a match, free the target and return the match
-        if ((**next).node->lhs == n->lhs && (**next).node->rhs == n->rhs) {
+    unsigned capacity = 64;
+    Node** stack = malloc(capacity * sizeof(Node*));
+    HeapItem* items = malloc(capacity * sizeof(HeapItem));
+    HeapItem* heap = malloc(capacity * sizeof(HeapItem));
+
+    // Children come before their parents, so each node's children have
+    // already been rebuilt by the time we reach it.
+    for (unsigned i=0; i < c->count; ++i) {
+        Node* n = c->nodes[i];
+        if (!(n->flags & NODE_IN_TREE) || !n->lhs)
+            continue;
+
+        // Interior links of a chain are handled by the chain's root
+        if (is_chain_op(n->opcode) &&
+            uses[i] == 1 && parent_op[i] == n->opcode)
+            continue;
+
+        if (is_chain_op(n->opcode)) {
+            // Collect the chain's operands, looking through links that
+            // aren't used anywhere else.  Min and max are idempotent, so
+            // repeated operands only need to appear once.
+            const bool idempotent = n->opcode == OP_MIN ||
+                                    n->opcode == OP_MAX;
+            unsigned size = 0, depth = 0;
+            bool changed = false;
+            stack[depth++] = n;
+            while (depth) {
+                if (depth + 2 > capacity || size + 2 > capacity) {
+                    capacity *= 2;
+                    stack = realloc(stack, capacity * sizeof(Node*));
+                    items = realloc(items, capacity * sizeof(HeapItem));
+                    heap = realloc(heap, capacity * sizeof(HeapItem));
+                }
+
+                Node* m = stack[--depth];
+                if (m == n || (m->opcode == n->opcode && uses[m->slot] == 1)) {
+                    stack[depth++] = m->rhs;
+                    stack[depth++] = m->lhs;
+                } else if (!idempotent || seen[m->slot] != i + 1) {
+                    seen[m->slot] = i + 1;
+                    Node* r = replaced[m->slot];
+                    changed |= r != m;
+                    items[size] = (HeapItem){
+                        .node=r, .rank=r->rank, .order=size };
+                    size++;
+                }
+            }
 
-            // Only free this node if it isn't the same as the match.
-            if (n != (**next).node) free(n);
-            return (**next).node;
+            // Rebuild the chain if that makes it shallower (or if its
+            // interior links would otherwise point to stale operands)
+            if (changed || (size > 2 &&
+                combine(c, n->opcode, items, size, heap, NULL) < n->rank))
+            {
+                combine(c, n->opcode, items, size, heap, &replaced[i]);
+                continue;
+            }
         }
-        next = &(**next).next;
+
+        // Otherwise, update the node if its children were rebuilt
+        Node* const lhs = replaced[n->lhs->slot];
+        Node* const rhs = n->rhs ? replaced[n->rhs->slot] : NULL;
+        if (lhs != n->lhs || rhs != n->rhs)
+            replaced[i] = get_cached_node(c, with_children(n, lhs, rhs));
     }
-    // If we've made it to the end of the list, then extend the list
-    // with the provided node.
-    *next  = malloc(sizeof(NodeList));
-    **next = (NodeList){ .node=n, .next=NULL };
 
-    return n;
+    head = replaced[head->slot];
+
+    free(uses);
+    free(seen);
+    free(parent_op);
+    free(replaced);
+    free(stack);
+    free(items);
+    free(heap);
+    return head;
 }
 
+
+// Hashes a node by opcode and child pointers, or by the bit pattern
+// of its value (or coefficients) if it's a constant (or affine).
+// Bounded nodes are hashed by child alone, and compared by box as well.
 static
-unsigned count_list_nodes(NodeList* list)
+uint64_t hash_node(const Node* n)
 {
-    unsigned count = 0;
-    while (list) {
-        if (list->node->flags & NODE_IN_TREE) {
-            ++count;
-        }
-        list = list->next;
+    uint64_t h;
+    if (n->flags & NODE_CONSTANT) {
+        uint32_t bits;
+        memcpy(&bits, &n->value, sizeof(bits));
+        h = bits;
+    } else if (n->opcode == OP_AFFINE) {
+        uint32_t bits[4];
+        memcpy(bits, n->affine, sizeof(bits));
+        h = ((uint64_t)bits[0] << 32 | bits[1]) * 0x9E3779B97F4A7C15ull ^
+            ((uint64_t)bits[2] << 32 | bits[3]) * 0xC2B2AE3D27D4EB4Full;
+    } else {
+        h = (uint64_t)(uintptr_t)n->lhs * 0x9E3779B97F4A7C15ull ^
+            (uint64_t)(uintptr_t)n->rhs * 0xC2B2AE3D27D4EB4Full;
     }
-    return count;
+    h ^= (uint64_t)n->opcode * 0x165667B19E3779F9ull;
+
+    // Final mixing step from splitmix64
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 27;
+    return h;
 }
 
 static
-unsigned flatten_list(NodeList* list, Node** array)
+bool same_node(const Node* a, const Node* b)
 {
-    unsigned count = 0;
-    while (list) {
-        if (list->node->flags & NODE_IN_TREE) {
-            ++count;
-            *(array++) = list->node;
-        } else {
-            free(list->node);
-        }
-        NodeList* prev = list;
-        list = list->next;
-        free(prev);
-    }
-    return count;
+    if (a->opcode != b->opcode)
+        return false;
+    if (a->flags & NODE_CONSTANT)
+        return (b->flags & NODE_CONSTANT) &&
+               !memcmp(&a->value, &b->value, sizeof(a->value));
+    if (a->opcode == OP_AFFINE)
+        return !memcmp(a->affine, b->affine, sizeof(a->affine));
+    if (a->opcode == OP_BOUNDS)
+        return a->lhs == b->lhs && !memcmp(a->box, b->box, sizeof(a->box));
+    return !(b->flags & NODE_CONSTANT) &&
+           a->lhs == b->lhs && a->rhs == b->rhs;
 }
 
+// Returns the table slot that either holds a node equal to n
+// or is the empty slot where it should be inserted.
 static
-void free_list(NodeList* list)
+unsigned find_slot(const NodeCache* cache, const Node* n)
 {
-    while (list)
+    const unsigned mask = cache->table_size - 1;
+    unsigned slot = hash_node(n) & mask;
+    while (cache->table[slot] &&
+           !same_node(cache->nodes[cache->table[slot] - 1], n))
     {
-        free(list->node);
-        NodeList* prev = list;
-        list = list->next;
-        free(prev);
+        slot = (slot + 1) & mask;
     }
+    return slot;
 }
 
+// Doubles the hash table's size (keeping it at most half full).
 static
-MathTree* cache_to_tree(NodeCache* c)
+void grow_table(NodeCache* cache)
 {
-    // Count the number of constants in the tree
-    const unsigned num_constants = count_list_nodes(c->constants);
+    free(cache->table);
+    cache->table_size = cache->table_size ? cache->table_size * 2 : 64;
+    cache->table = calloc(cache->table_size, sizeof(unsigned));
 
-    // Create the tree
-    MathTree* const tree = new_tree(c->levels, num_constants);
+    for (unsigned i=0; i < cache->count; ++i)
+        cache->table[find_slot(cache, cache->nodes[i])] = i + 1;
+}
 
-    // Copy over the constant nodes
-    flatten_list(c->constants, tree->constants);
-    c->constants = NULL;
+Node* get_cached_node(NodeCache* const cache, Node* const n)
+{
+    if (n == NULL)  return NULL;
 
-    for (int level=0; level < c->levels; level++) {
+    if (2 * (cache->count + 1) > cache->table_size)
+        grow_table(cache);
 
-        // Count up all of the nodes at this level
-        {
-            unsigned count = 0;
-            for (int op=0; op < LAST_OP; ++op) {
-                count += count_list_nodes(c->nodes[level][op]);
-            }
+    // If we've found a match, free the target and return the match
+    const unsigned slot = find_slot(cache, n);
+    if (cache->table[slot]) {
+        Node* const match = cache->nodes[cache->table[slot] - 1];
 
-            // Allocate space in the tree for these nodes
-            tree->nodes[level] = malloc(count*sizeof(Node*));
-        }
+        // Only free this node if it isn't the same as the match.
+        if (n != match) free(n);
+        return match;
+    }
 
-        Node** index = tree->nodes[level];
-        for (int op=0; op < LAST_OP; ++op) {
-            const unsigned count = flatten_list(
-                    c->nodes[level][op], index);
-            index += count;
-            tree->active[level] += count;
-            c->nodes[level][op] = NULL;
+    // New nodes are simplified before being stored.  The result is either
+    // already cached (if it's a descendant of n) or a brand-new node.
+    if (cache->simplify) {
+        Node* const s = simplify_node(n);
+        if (s != n) {
+            free(n);
+            cache->simplified++;
+            return get_cached_node(cache, s);
         }
     }
 
-    return tree;
-}
+    // Otherwise, store the new node
+    if (cache->count == cache->capacity) {
+        cache->capacity = cache->capacity ? cache->capacity * 2 : 64;
+        cache->nodes = realloc(cache->nodes,
+                               cache->capacity * sizeof(Node*));
+    }
+    cache->nodes[cache->count] = n;
+    cache->table[slot] = ++cache->count;
 
+    if (!(n->flags & NODE_CONSTANT) && n->rank >= cache->levels)
+        cache->levels = n->rank + 1;
+
+    return n;
+}
 
 static
-void free_node_cache(NodeCache* const c)
+MathTree* cache_to_tree(NodeCache* c)
 {
-    // Free the linked list of constants
-    free_list(c->constants);
+    // Count up in-tree nodes by level and opcode.  Nodes that were
+    // simplified away may have been cached at higher ranks than anything
+    // in the tree, so the number of levels is found here as well.
+    unsigned num_constants = 0;
+    int levels = 0;
+    unsigned* offsets = calloc(c->levels ? c->levels * LAST_OP : 1,
+                               sizeof(unsigned));
+    for (unsigned i=0; i < c->count; ++i) {
+        const Node* n = c->nodes[i];
+        if (!(n->flags & NODE_IN_TREE))
+            continue;
+        if (n->flags & NODE_CONSTANT) {
+            num_constants++;
+        } else {
+            offsets[n->rank * LAST_OP + n->opcode]++;
+            if (n->rank >= levels)
+                levels = n->rank + 1;
+        }
+    }
+
+    // Create the tree
+    MathTree* const tree = new_tree(levels, num_constants);
 
-    // Free the linked lists of nodes
-    for (int level=0; level < c->levels; level++) {
+    // Nodes are stored sorted by opcode within each level, so convert
+    // counts into offsets and allocate space for each level.
+    for (int level=0; level < levels; level++) {
+        unsigned count = 0;
         for (int op=0; op < LAST_OP; ++op) {
-            free_list(c->nodes[level][op]);
+            const unsigned n = offsets[level * LAST_OP + op];
+            offsets[level * LAST_OP + op] = count;
+            count += n;
         }
+        tree->nodes[level] = malloc(count*sizeof(Node*));
+        tree->active[level] = count;
     }
 
+    // Copy over nodes (in insertion order), freeing unused ones.
+    unsigned constant = 0;
+    for (unsigned i=0; i < c->count; ++i) {
+        Node* n = c->nodes[i];
+        if (!(n->flags & NODE_IN_TREE))
+            free(n);
+        else if (n->flags & NODE_CONSTANT)
+            tree->constants[constant++] = n;
+        else
+            tree->nodes[n->rank][offsets[n->rank * LAST_OP + n->opcode]++] = n;
+    }
+    c->count = 0;
+
+    free(offsets);
+    return tree;
+}
+
+
+void free_node_cache(NodeCache* const c)
+{
+    for (unsigned i=0; i < c->count; ++i)
+        free(c->nodes[i]);
+
     free(c->nodes);
+    free(c->table);
     free(c);
 }
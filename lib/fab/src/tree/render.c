@@ -7,115 +7,168 @@
 
 #include "fab/tree/eval.h"
 #include "fab/tree/tree.h"
+#include "fab/tree/context.h"
 #include "fab/tree/render.h"
 #include "fab/tree/math/math_g.h"
 #include "fab/tree/node/node.h"
 
+#include "fab/util/pyramid.h"
 #include "fab/util/switches.h"
 
-/*  region8
+// Side length (in pixels) of the blocks that render16_seeded_ctx
+// checks for empty space above the seeded surface.
+#define SEED_BLOCK 8
+
+// Number of voxels checked around each guess, centered on the
+// guessed voxel (since a coarser render may be off by a voxel).
+#define SEED_PROBES 3
+
+/*  region_z
  *
  *  Renders a tree pixel-by-pixel into a given region,
  *  using the eval_r function to find an array of results in
- *  a single pass through the tree.
+ *  a single pass through the tree.  Depths are shifted right
+ *  by 'shift' bits before being written to the pyramid.
  *
  */
 static
-void region8(MathTree* tree, Region region, uint8_t** img);
+void region_z(EvalContext* ctx, Region region, DepthPyramid* depth,
+              unsigned shift);
 
-/*  region16
+/*  render_z
  *
- *  Renders a tree pixel-by-pixel into a given region,
- *  using the eval_r function to find an array of results in
- *  a single pass through the tree.
+ *  Recursively renders a region into a depth pyramid, culling
+ *  subregions that are entirely behind pixels that are already lit.
+ *
+ */
+static
+void render_z(EvalContext* ctx, Region region, DepthPyramid* depth,
+              unsigned shift, volatile int* halt, void (*callback)());
+
+/*  top_layer
+ *
+ *  Returns the topmost layer of voxels in a region.  If the tree doesn't
+ *  depend on Z, this layer lights each column exactly as the whole
+ *  region would.
  *
  */
 static
-void region16(MathTree* tree, Region region, uint16_t** img);
+Region top_layer(Region region)
+{
+    const unsigned k = region.nk - 1;
+    region.kmin += k;
+    region.nk = 1;
+    region.voxels = region.ni * region.nj;
+    region.Z += k;
+    region.L += k;
+    return region;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
-void render8(MathTree* tree, Region region,
-             uint8_t** img, volatile int* halt,
-             void (*callback)())
+static
+void render_z(EvalContext* ctx, Region region, DepthPyramid* depth,
+              unsigned shift, volatile int* halt, void (*callback)())
 {
     // Special interrupt system, set asynchronously by on high
     if (*halt)  return;
 
+    // Pre-emptively halt evaluation if all the points in this
+    // region are already light.
+    const uint16_t L = region.L[region.nk] >> shift;
+    if (pyramid_covered(depth, region.imin, region.jmin,
+                        region.ni, region.nj, L))
+        return;
+
     // Render pixel-by-pixel if we're below a certain size.
     if (region.voxels > 0 && region.voxels < MIN_VOLUME) {
         if (callback)   (*callback)();
-        region8(tree, region, img);
+        region_z(ctx, region, depth, shift);
         return;
     }
 
-
-    // Pre-emptively halt evaluation if all the points in this
-    // region are already light.
-    uint8_t L = region.L[region.nk] >> 8;
-    bool cull = true;
-    for (unsigned row = region.jmin; cull && row < region.jmin + region.nj; ++row) {
-        for (unsigned col = region.imin; cull && col < region.imin + region.ni; ++col) {
-            if (L > img[row][col]) {
-                cull = false;
-                break;
-            }
-        }
-    }
-    if (cull) return;
-
     Interval X = {region.X[0], region.X[region.ni]},
              Y = {region.Y[0], region.Y[region.nj]},
              Z = {region.Z[0], region.Z[region.nk]};
 
-    Interval result = eval_i(tree, X, Y, Z);
+    Interval result = eval_i(ctx, X, Y, Z);
 
     // If we're inside the object, fill with color.
     if (result.upper < 0) {
-        for (unsigned row = region.jmin; row < region.jmin + region.nj; ++row) {
-            for (unsigned col = region.imin; col < region.imin + region.ni; ++col) {
-                if (L > img[row][col])  img[row][col] = L;
-            }
-        }
+        pyramid_fill(depth, region.imin, region.jmin,
+                     region.ni, region.nj, L);
     }
 
     // In unambiguous cases, return immediately
     if (result.upper < 0 || result.lower >= 0)  return;
 
 #if PRUNE
-    disable_nodes(tree);
-    disable_nodes_binary(tree);
+    disable_nodes(ctx);
+    disable_nodes_binary(ctx);
 #endif
 
+    // If the (pruned) tree doesn't depend on Z, then only the top layer
+    // needs to be rendered, and Z is never subdivided.
+    if (region.nk > 1 && !(active_axes(ctx) & 1)) {
+        render_z(ctx, top_layer(region), depth, shift, halt, callback);
+    }
+
     // Subdivide and recurse if we're not at voxel size.
-    if (region.ni*region.nj*region.nk > 1) {
+    else if (region.ni*region.nj*region.nk > 1) {
         Region A, B;
 
         bisect(region, &A, &B);
 
-        render8(tree, B, img, halt, callback);
-        render8(tree, A, img, halt, callback);
+        render_z(ctx, B, depth, shift, halt, callback);
+        render_z(ctx, A, depth, shift, halt, callback);
     }
 
 #if PRUNE
-    enable_nodes(tree);
+    enable_nodes(ctx);
 #endif
 
 }
 
+void render8_ctx(EvalContext* ctx, Region region,
+                 uint8_t** img, volatile int* halt,
+                 void (*callback)())
+{
+    DepthPyramid* depth = new_pyramid(region.imin, region.jmin,
+                                      region.ni, region.nj);
+    pyramid_load8(depth, img);
+    render_z(ctx, region, depth, 8, halt, callback);
+    pyramid_store8(depth, img);
+    free_pyramid(depth);
+}
+
+void render8(MathTree* tree, Region region,
+             uint8_t** img, volatile int* halt,
+             void (*callback)())
+{
+    EvalContext* ctx = new_context(tree);
+    render8_ctx(ctx, region, img, halt, callback);
+    free_context(ctx);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 static
-void region8(MathTree* tree, Region region, uint8_t** img)
+void region_z(EvalContext* ctx, Region region, DepthPyramid* depth,
+              unsigned shift)
 {
-    float *X = malloc(region.voxels*sizeof(float)),
-          *Y = malloc(region.voxels*sizeof(float)),
-          *Z = malloc(region.voxels*sizeof(float));
+    float X[MIN_VOLUME], Y[MIN_VOLUME], Z[MIN_VOLUME];
+
+    // Axes that the (pruned) tree doesn't depend on are sampled once,
+    // and the results are copied across the rest of the region.
+    const uint8_t active = active_axes(ctx);
+    if (!(active & 1))  region = top_layer(region);
+    const unsigned ni = (active & 4) ? region.ni : 1,
+                   nj = (active & 2) ? region.nj : 1;
 
     // Copy the X, Y, Z vectors into a flattened matrix form.
     int q = 0;
     for (int k = region.nk - 1; k >= 0; --k) {
-        for (unsigned j = 0; j < region.nj; ++j) {
-            for (unsigned i = 0; i < region.ni; ++i) {
+        for (unsigned j = 0; j < nj; ++j) {
+            for (unsigned i = 0; i < ni; ++i) {
                 X[q] = region.X[i];
                 Y[q] = region.Y[j];
                 Z[q] = region.Z[k];
@@ -123,37 +176,48 @@ void region8(MathTree* tree, Region region, uint8_t** img)
             }
         }
     }
-    region.X = X;
-    region.Y = Y;
-    region.Z = Z;
 
-    float* result = eval_r(tree, region);
+    Region samples = region;
+    samples.X = X;
+    samples.Y = Y;
+    samples.Z = Z;
+    samples.voxels = q;
 
-    // Free the allocated matrices
-    free(X);
-    free(Y);
-    free(Z);
+    const float* result = eval_r(ctx, samples);
 
+    // Find the highest lit voxel in each sampled column, then
+    // copy the whole region into the pyramid at once.
+    uint16_t lit[MIN_VOLUME] = {0};
+    bool any = false;
     for (int k = region.nk - 1; k >= 0; --k) {
-        uint8_t L = region.L[k+1] >> 8;
-
-        for (unsigned j = 0; j < region.nj; ++j) {
-            int row = j + region.jmin;
-
-            for (unsigned i = 0; i < region.ni; ++i) {
-                int col = i + region.imin;
-
-               if (*(result++) < 0 && img[row][col] < L) {
-                    img[row][col] = L;
-                }
+        const uint16_t L = region.L[k+1] >> shift;
+        for (unsigned p = 0; p < ni*nj; ++p) {
+            if (*(result++) < 0 && lit[p] < L) {
+                lit[p] = L;
+                any = true;
+            }
+        }
+    }
+    if (!any)   return;
+
+    if (ni < region.ni || nj < region.nj) {
+        // Spread the sampled columns out, starting from the end so that
+        // samples aren't overwritten before they're copied.
+        for (int j = region.nj - 1; j >= 0; --j) {
+            for (int i = region.ni - 1; i >= 0; --i) {
+                lit[j*region.ni + i] = lit[(nj > 1 ? j : 0)*ni +
+                                           (ni > 1 ? i : 0)];
             }
         }
     }
+    pyramid_write_rect(depth, region.imin, region.jmin,
+                       region.ni, region.nj, lit);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void get_normals8(MathTree* tree,
+static
+void get_normals8(EvalContext* ctx,
                   float* restrict X, float* restrict Y, float* restrict Z,
                   unsigned count, float (*normals)[3])
 {
@@ -163,7 +227,7 @@ void get_normals8(MathTree* tree,
     dummy.Z = Z;
     dummy.voxels = count;
 
-    derivative* result = eval_g(tree, dummy);
+    derivative* result = eval_g(ctx, dummy);
 
     // Calculate normals and copy over.
     for (unsigned i=0; i < count; ++i)
@@ -194,12 +258,8 @@ void shade_pixels8(unsigned count, float (*normals)[3],
 
 void shaded8(struct MathTree_ *tree, Region region, uint16_t **depth,
              uint8_t (**out)[3], volatile int *halt,
-             void (*callback)())
+             void (*callback)(), const float* M)
 {
-    // Load the correct partial derivatives for constants
-    for (unsigned i=0; i < tree->num_constants; ++i)
-        fill_results_g(tree->constants[i], tree->constants[i]->results.f);
-
     float *X = malloc(MIN_VOLUME*sizeof(float)),
           *Y = malloc(MIN_VOLUME*sizeof(float)),
           *Z = malloc(MIN_VOLUME*sizeof(float));
@@ -209,6 +269,9 @@ void shaded8(struct MathTree_ *tree, Region region, uint16_t **depth,
 
     float (*normals)[3] = malloc(MIN_VOLUME*sizeof(float[3]));
 
+    EvalContext* ctx = new_context(tree);
+    set_transform(ctx, M);
+
     unsigned count = 0;
     for (unsigned j=0; j < region.nj && !*halt; ++j)
     {
@@ -232,7 +295,7 @@ void shaded8(struct MathTree_ *tree, Region region, uint16_t **depth,
             if (count == MIN_VOLUME/4 ||
                     (count && j == region.nj - 1 && i == region.ni - 1))
             {
-                get_normals8(tree, X, Y, Z, count, normals);
+                get_normals8(ctx, X, Y, Z, count, normals);
                 shade_pixels8(count, normals, is, js, out);
                 count = 0;
             }
@@ -247,126 +310,220 @@ void shaded8(struct MathTree_ *tree, Region region, uint16_t **depth,
     free(js);
 
     free(normals);
-
-    // Switch back to normal values for constants array
-    for (unsigned i=0; i < tree->num_constants; ++i)
-        fill_results(tree->constants[i], tree->constants[i]->results.f);
+    free_context(ctx);
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
+void render16_ctx(EvalContext* ctx, Region region,
+                  uint16_t** img, volatile int* halt,
+                  void (*callback)())
+{
+    DepthPyramid* depth = new_pyramid(region.imin, region.jmin,
+                                      region.ni, region.nj);
+    pyramid_load16(depth, img);
+    render_z(ctx, region, depth, 0, halt, callback);
+    pyramid_store16(depth, img);
+    free_pyramid(depth);
+}
+
 void render16(MathTree* tree, Region region,
               uint16_t** img, volatile int* halt,
               void (*callback)())
 {
-    // Special interrupt system, set asynchronously by on high
-    if (*halt)  return;
+    EvalContext* ctx = new_context(tree);
+    render16_ctx(ctx, region, img, halt, callback);
+    free_context(ctx);
+}
 
-    // Render pixel-by-pixel if we're below a certain size.
-    if (region.voxels > 0 && region.voxels < MIN_VOLUME) {
-        if (callback)
-            (*callback)();
-        region16(tree, region, img);
-        return;
-    }
+////////////////////////////////////////////////////////////////////////////////
 
-    // Pre-emptively halt evaluation if all the points in this
-    // region are already light.
-    uint16_t L = region.L[region.nk];
-    bool cull = true;
-    for (unsigned row = region.jmin; cull && row < region.jmin + region.nj; ++row) {
-        for (unsigned col = region.imin; cull && col < region.imin + region.ni; ++col) {
-            if (L > img[row][col]) {
-                cull = false;
-                break;
-            }
-        }
-    }
-    if (cull) return;
+static
+void check_seeds(EvalContext* ctx, float* X, float* Y, float* Z,
+                 unsigned count, uint16_t** pixels, const uint16_t* Ls)
+{
+    Region dummy;
+    dummy.X = X;
+    dummy.Y = Y;
+    dummy.Z = Z;
+    dummy.voxels = count;
 
-    Interval X = {region.X[0], region.X[region.ni]},
-             Y = {region.Y[0], region.Y[region.nj]},
-             Z = {region.Z[0], region.Z[region.nk]};
+    const float* result = eval_r(ctx, dummy);
+    for (unsigned a=0; a < count; ++a) {
+        if (result[a] < 0 && *pixels[a] < Ls[a])    *pixels[a] = Ls[a];
+    }
+}
 
-    Interval result = eval_i(tree, X, Y, Z);
+// Returns the largest index k such that L[k] <= v (or 0)
+static
+unsigned find_layer(const Region region, uint16_t v)
+{
+    unsigned lo = 0, hi = region.nk;
+    while (lo < hi) {
+        const unsigned mid = (lo + hi + 1) / 2;
+        if (region.L[mid] <= v)     lo = mid;
+        else                        hi = mid - 1;
+    }
+    return lo;
+}
 
-    // If we're inside the object, fill with color.
-    if (result.upper < 0) {
-        for (unsigned row = region.jmin; row < region.jmin + region.nj; ++row) {
-            for (unsigned col = region.imin; col < region.imin + region.ni; ++col) {
-                if (L > img[row][col])  img[row][col] = L;
-            }
+/*  prove_block
+ *
+ *  Tries to prove that the space above the highest seed in a block of
+ *  pixels (i0 to i1, j0 to j1 in region coordinates) is empty, in which
+ *  case pixels at that seed are marked in exact.  Blocks that are left
+ *  with pixels at other depths are split into quarters and tried again,
+ *  so that dark pixels beside a lit wall can still be marked.
+ */
+static
+void prove_block(EvalContext* ctx, Region region, uint16_t** img,
+                 uint8_t* exact, unsigned i0, unsigned i1,
+                 unsigned j0, unsigned j1)
+{
+    uint16_t top = 0;
+    bool any = false, mixed = false;
+    for (unsigned j=j0; j < j1; ++j) {
+        const uint16_t* row = img[region.jmin + j] + region.imin;
+        for (unsigned i=i0; i < i1; ++i) {
+            if (exact[j*region.ni + i])     continue;
+            if (any && row[i] != top)       mixed = true;
+            if (!any || row[i] > top)       top = row[i];
+            any = true;
         }
     }
+    if (!any)   return;
+
+    // Check every voxel sample above the top seed
+    const unsigned k = top ? find_layer(region, top) : 0;
+    bool empty = (k >= region.nk);
+    if (!empty) {
+        Interval x = {region.X[i0], region.X[i1 - 1]},
+                 y = {region.Y[j0], region.Y[j1 - 1]},
+                 z = {region.Z[k], region.Z[region.nk - 1]};
+        empty = eval_i(ctx, x, y, z).lower >= 0;
+    }
 
-    // In unambiguous cases, return immediately
-    if (result.upper < 0 || result.lower >= 0)  return;
-
-#if PRUNE
-    disable_nodes(tree);
-    disable_nodes_binary(tree);
-#endif
-
-    // Subdivide and recurse if we're not at voxel size.
-    if (region.ni*region.nj*region.nk > 1) {
-        Region A, B;
-        bisect(region, &A, &B);
-
-        render16(tree, B, img, halt, callback);
-        render16(tree, A, img, halt, callback);
+    if (empty) {
+        for (unsigned j=j0; j < j1; ++j) {
+            const uint16_t* row = img[region.jmin + j] + region.imin;
+            for (unsigned i=i0; i < i1; ++i)
+                if (row[i] == top)  exact[j*region.ni + i] = 1;
+        }
     }
 
-#if PRUNE
-    enable_nodes(tree);
-#endif
+    if (!mixed || (i1 - i0 == 1 && j1 - j0 == 1))   return;
 
+    const unsigned im = i1 - i0 > 1 ? (i0 + i1) / 2 : i1,
+                   jm = j1 - j0 > 1 ? (j0 + j1) / 2 : j1;
+    prove_block(ctx, region, img, exact, i0, im, j0, jm);
+    if (im < i1)    prove_block(ctx, region, img, exact, im, i1, j0, jm);
+    if (jm < j1)    prove_block(ctx, region, img, exact, i0, im, jm, j1);
+    if (im < i1 && jm < j1)
+        prove_block(ctx, region, img, exact, im, i1, jm, j1);
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
+/*  seed_region
+ *
+ *  Replaces each guessed depth in img with the depth of the highest
+ *  filled voxel among those around the guess (or zero if none are).
+ *
+ *  Then, block by block, marks the pixels whose depths are proven to
+ *  be final in exact (see prove_block).
+ *
+ */
 static
-void region16(MathTree* tree, Region region, uint16_t** img)
+void seed_region(EvalContext* ctx, Region region, uint16_t** img,
+                 uint8_t* exact, volatile int* halt)
 {
-    float *X = malloc(region.voxels*sizeof(float)),
-          *Y = malloc(region.voxels*sizeof(float)),
-          *Z = malloc(region.voxels*sizeof(float));
+    float *X = malloc(MIN_VOLUME*sizeof(float)),
+          *Y = malloc(MIN_VOLUME*sizeof(float)),
+          *Z = malloc(MIN_VOLUME*sizeof(float));
 
-    // Copy the X, Y, Z vectors into a flattened matrix form.
-    int q = 0;
-    for (int k = region.nk - 1; k >= 0; --k) {
-        for (unsigned j = 0; j < region.nj; ++j) {
-            for (unsigned i = 0; i < region.ni; ++i) {
-                X[q] = region.X[i];
-                Y[q] = region.Y[j];
-                Z[q] = region.Z[k];
-                q++;
+    uint16_t** pixels = malloc(MIN_VOLUME*sizeof(uint16_t*));
+    uint16_t* Ls = malloc(MIN_VOLUME*sizeof(uint16_t));
+
+    unsigned count = 0;
+    for (unsigned j=0; j < region.nj && !*halt; ++j) {
+        uint16_t* row = img[region.jmin + j] + region.imin;
+
+        for (unsigned i=0; i < region.ni; ++i) {
+            if (!row[i])    continue;
+
+            // Pixels stay dark unless one of the voxels
+            // near the guess is found to be filled.
+            const unsigned k = find_layer(region, row[i]);
+            row[i] = 0;
+
+            for (unsigned p=0; p < SEED_PROBES; ++p) {
+                if (k + p < SEED_PROBES / 2 + 1 ||
+                    k + p - SEED_PROBES / 2 - 1 >= region.nk)
+                    continue;
+                const unsigned v = k + p - SEED_PROBES / 2 - 1;
+                X[count] = region.X[i];
+                Y[count] = region.Y[j];
+                Z[count] = region.Z[v];
+                Ls[count] = region.L[v + 1];
+                pixels[count] = &row[i];
+
+                if (++count == MIN_VOLUME) {
+                    check_seeds(ctx, X, Y, Z, count, pixels, Ls);
+                    count = 0;
+                }
             }
         }
     }
-    region.X = X;
-    region.Y = Y;
-    region.Z = Z;
 
-    float* result = eval_r(tree, region);
+    if (count)
+        check_seeds(ctx, X, Y, Z, count, pixels, Ls);
 
-    // Free the allocated matrices
     free(X);
     free(Y);
     free(Z);
 
-    for (int k = region.nk - 1; k >= 0; --k) {
-        uint16_t L = region.L[k+1];
-
-        for (unsigned j = 0; j < region.nj; ++j) {
-            int row = j + region.jmin;
+    free(pixels);
+    free(Ls);
 
-            for (unsigned i = 0; i < region.ni; ++i) {
-                int col = i + region.imin;
+    for (unsigned j0=0; j0 < region.nj && !*halt; j0 += SEED_BLOCK) {
+        const unsigned j1 = j0 + SEED_BLOCK < region.nj
+                          ? j0 + SEED_BLOCK : region.nj;
+        for (unsigned i0=0; i0 < region.ni; i0 += SEED_BLOCK) {
+            const unsigned i1 = i0 + SEED_BLOCK < region.ni
+                              ? i0 + SEED_BLOCK : region.ni;
+            prove_block(ctx, region, img, exact, i0, i1, j0, j1);
+        }
+    }
+}
 
-               if (*(result++) < 0 && img[row][col] < L) {
-                    img[row][col] = L;
-                }
+void render16_seeded_ctx(EvalContext* ctx, Region region,
+                         uint16_t** img, volatile int* halt,
+                         void (*callback)())
+{
+    uint8_t* exact = calloc(region.ni * region.nj, sizeof(uint8_t));
+    uint16_t* saved = malloc(region.ni * region.nj * sizeof(uint16_t));
+
+    seed_region(ctx, region, img, exact, halt);
+
+    // Pixels with known depths are hidden from the renderer by
+    // making them as bright as possible, then restored afterwards.
+    for (unsigned j=0; j < region.nj; ++j) {
+        uint16_t* row = img[region.jmin + j] + region.imin;
+        for (unsigned i=0; i < region.ni; ++i) {
+            if (exact[j*region.ni + i]) {
+                saved[j*region.ni + i] = row[i];
+                row[i] = UINT16_MAX;
             }
         }
     }
+
+    render16_ctx(ctx, region, img, halt, callback);
+
+    for (unsigned j=0; j < region.nj; ++j) {
+        uint16_t* row = img[region.jmin + j] + region.imin;
+        for (unsigned i=0; i < region.ni; ++i) {
+            if (exact[j*region.ni + i])     row[i] = saved[j*region.ni + i];
+        }
+    }
+
+    free(exact);
+    free(saved);
 }
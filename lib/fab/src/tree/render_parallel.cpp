@@ -0,0 +1,71 @@
+#include <vector>
+
+#include "fab/tree/render.h"
+#include "fab/tree/context.h"
+#include "fab/tree/tree.h"
+#include "fab/util/region.h"
+#include "fab/util/workpool.h"
+
+// Number of tiles per worker: more tiles means better load balancing
+// (since some tiles are much more expensive than others), at the cost
+// of more top-level interval evaluations.
+static const unsigned TILES_PER_WORKER = 16;
+
+template <typename T>
+static void render_parallel(
+        MathTree* tree, Region region, T** img, volatile int* halt,
+        void (*callback)(), unsigned threads, const float* M,
+        void (*render)(EvalContext*, Region, T**, volatile int*, void (*)()))
+{
+    WorkPool pool(threads);
+
+    // Tiles are split along X and Y only, so each pixel belongs to exactly
+    // one tile and workers never write to the same part of the image.
+    std::vector<Region> tiles(pool.size() * TILES_PER_WORKER);
+    tiles.resize(split_xy(region, &tiles[0], tiles.size()));
+
+    // Contexts are created lazily, since not every worker may get a tile
+    std::vector<EvalContext*> contexts(pool.size(), nullptr);
+
+    pool.run(tiles.size(), [&](unsigned t, unsigned w)
+    {
+        if (*halt)
+            return;
+        if (!contexts[w])
+        {
+            contexts[w] = new_context(tree);
+            set_transform(contexts[w], M);
+        }
+        render(contexts[w], tiles[t], img, halt, callback);
+    });
+
+    for (auto c : contexts)
+        free_context(c);
+}
+
+void render8_parallel(MathTree* tree, Region region,
+                      uint8_t** img, volatile int* halt,
+                      void (*callback)(), unsigned threads,
+                      const float* M)
+{
+    render_parallel(tree, region, img, halt, callback, threads, M,
+                    render8_ctx);
+}
+
+void render16_parallel(MathTree* tree, Region region,
+                       uint16_t** img, volatile int* halt,
+                       void (*callback)(), unsigned threads,
+                       const float* M)
+{
+    render_parallel(tree, region, img, halt, callback, threads, M,
+                    render16_ctx);
+}
+
+void render16_seeded_parallel(MathTree* tree, Region region,
+                              uint16_t** img, volatile int* halt,
+                              void (*callback)(), unsigned threads,
+                              const float* M)
+{
+    render_parallel(tree, region, img, halt, callback, threads, M,
+                    render16_seeded_ctx);
+}
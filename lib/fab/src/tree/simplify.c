@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "fab/tree/simplify.h"
+#include "fab/tree/node/node.h"
+#include "fab/tree/node/opcodes.h"
+
+// Process-wide settings and counters (accessed atomically, since trees
+// may be built from several threads at once).
+static bool simplify_enabled = true;
+static unsigned long simplify_count = 0;
+
+static
+bool is_constant(const Node* n, float value)
+{
+    return (n->flags & NODE_CONSTANT) && n->value == value;
+}
+
+// If n is X, Y, Z, an affine node, or a constant, stores its coefficients
+// {a, b, c, d} (so that it's equal to a*X + b*Y + c*Z + d) and returns true.
+static
+bool affine_terms(const Node* n, float k[4])
+{
+    memset(k, 0, 4 * sizeof(float));
+    switch (n->opcode) {
+        case OP_X:      k[0] = 1; return true;
+        case OP_Y:      k[1] = 1; return true;
+        case OP_Z:      k[2] = 1; return true;
+        case OP_CONST:  k[3] = n->value; return true;
+        case OP_AFFINE: memcpy(k, n->affine, 4 * sizeof(float)); return true;
+        default:        return false;
+    }
+}
+
+// Returns a node for the affine expression k, which is a plain axis
+// or constant if possible (or NULL if the coefficients aren't finite).
+static
+Node* affine_node(const float k[4])
+{
+    for (int i=0; i < 4; ++i)
+        if (!isfinite(k[i]))    return NULL;
+
+    if (k[0] == 0 && k[1] == 0 && k[2] == 0)
+        return constant_n(k[3]);
+
+    if (k[3] == 0) {
+        if (k[0] == 1 && k[1] == 0 && k[2] == 0)   return X_n();
+        if (k[0] == 0 && k[1] == 1 && k[2] == 0)   return Y_n();
+        if (k[0] == 0 && k[1] == 0 && k[2] == 1)   return Z_n();
+    }
+    return affine_n(k);
+}
+
+/*  Fuses an arithmetic node whose operands are affine in X, Y, and Z
+ *  (e.g. the remapped coordinates of a moved, scaled, and rotated shape)
+ *  into a single OP_AFFINE node.  Returns n if that isn't possible.  */
+static
+Node* fuse_affine(Node* n)
+{
+    float a[4], b[4], k[4];
+    const bool has_a = affine_terms(n->lhs, a);
+    const bool has_b = n->rhs && affine_terms(n->rhs, b);
+    Node* out = NULL;
+
+    switch (n->opcode) {
+        case OP_ADD:
+            if (!has_a || !has_b)   break;
+            for (int i=0; i < 4; ++i)   k[i] = a[i] + b[i];
+            out = affine_node(k);
+            break;
+        case OP_SUB:
+            if (!has_a || !has_b)   break;
+            for (int i=0; i < 4; ++i)   k[i] = a[i] - b[i];
+            out = affine_node(k);
+            break;
+        case OP_MUL:
+            // Exactly one side is constant (otherwise it would be folded)
+            if (has_a && (n->rhs->flags & NODE_CONSTANT)) {
+                for (int i=0; i < 4; ++i)   k[i] = a[i] * n->rhs->value;
+                out = affine_node(k);
+            } else if (has_b && (n->lhs->flags & NODE_CONSTANT)) {
+                for (int i=0; i < 4; ++i)   k[i] = b[i] * n->lhs->value;
+                out = affine_node(k);
+            }
+            break;
+        case OP_DIV:
+            if (has_a && (n->rhs->flags & NODE_CONSTANT)) {
+                for (int i=0; i < 4; ++i)   k[i] = a[i] / n->rhs->value;
+                out = affine_node(k);
+            }
+            break;
+        case OP_NEG:
+            if (!has_a)     break;
+            for (int i=0; i < 4; ++i)   k[i] = -a[i];
+            out = affine_node(k);
+            break;
+        default:
+            break;
+    }
+    return out ? out : n;
+}
+
+Node* simplify_node(Node* n)
+{
+    Node* const a = n->lhs;
+    Node* const b = n->rhs;
+
+    switch (n->opcode) {
+        case OP_ADD:
+            if (is_constant(b, 0))  return a;
+            if (is_constant(a, 0))  return b;
+            break;
+        case OP_SUB:
+            if (is_constant(b, 0))  return a;
+            break;
+        case OP_MUL:
+            if (is_constant(b, 1))  return a;
+            if (is_constant(a, 1))  return b;
+            break;
+        case OP_DIV:
+        case OP_POW:
+            if (is_constant(b, 1))  return a;
+            break;
+        case OP_MIN:
+        case OP_MAX:
+            // Children are deduplicated, so identical subtrees
+            // have identical pointers.
+            if (a == b)             return a;
+            break;
+
+        case OP_NEG:
+            if (a->opcode == OP_NEG)    return a->lhs;
+            break;
+        case OP_ABS:
+            if (a->opcode == OP_ABS ||
+                a->opcode == OP_SQUARE) return a;
+            if (a->opcode == OP_NEG)    return abs_n(a->lhs);
+            break;
+        case OP_SQUARE:
+            if (a->opcode == OP_NEG ||
+                a->opcode == OP_ABS)    return square_n(a->lhs);
+            break;
+        case OP_SQRT:
+            if (a->opcode == OP_SQUARE) return abs_n(a->lhs);
+            break;
+
+        case OP_MOD:
+        case OP_REPEAT:
+        case OP_SIN:
+        case OP_COS:
+        case OP_TAN:
+        case OP_ASIN:
+        case OP_ACOS:
+        case OP_ATAN:
+        case OP_ATAN2:
+        case OP_EXP:
+        case OP_X:
+        case OP_Y:
+        case OP_Z:
+        case OP_AFFINE:
+        case OP_BOUNDS:
+        case OP_CONST:
+        case LAST_OP:
+            return n;
+    }
+    return fuse_affine(n);
+}
+
+void set_simplify(bool enable)
+{
+    __atomic_store_n(&simplify_enabled, enable, __ATOMIC_RELAXED);
+}
+
+bool get_simplify(void)
+{
+    return __atomic_load_n(&simplify_enabled, __ATOMIC_RELAXED);
+}
+
+unsigned long simplified_nodes(void)
+{
+    return __atomic_load_n(&simplify_count, __ATOMIC_RELAXED);
+}
+
+void add_simplified_nodes(unsigned count)
+{
+    __atomic_fetch_add(&simplify_count, count, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,368 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "fab/tree/tape.h"
+#include "fab/tree/tree.h"
+#include "fab/tree/node/node.h"
+#include "fab/tree/math/math_g.h"
+#include "fab/util/switches.h"
+
+#define NO_SLOT UINT_MAX
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*  State used while flattening a tree.  During flattening, each node's
+ *  slot field holds a temporary index (constants keep their own slots),
+ *  which is used to look up per-node data here.  */
+typedef struct Flattener_ {
+    Tape* tape;
+    unsigned count;     // Clauses written so far
+    unsigned slots;     // Slots assigned so far (after the constants)
+    unsigned rows;      // Affine rows written so far
+    unsigned boxes;     // Boxes written so far
+
+    unsigned* slot_of;  // Assigned slot, or NO_SLOT if not yet written
+    unsigned* parents;  // Number of in-tree parents
+    unsigned* local;    // Parents within the current bounded subtree
+    unsigned* stamp;    // Bounded subtree that last visited the node
+    unsigned round;
+} Flattener;
+
+static void emit_bounds(Flattener* F, Node* b);
+
+static bool emitted(const Flattener* F, const Node* n)
+{
+    return F->slot_of[n->slot] != NO_SLOT;
+}
+
+// Writes a single clause for n, whose children have been written
+static void emit_clause(Flattener* F, Node* n)
+{
+    const unsigned slot = F->tape->num_constants + F->slots++;
+    F->slot_of[n->slot] = slot;
+
+    const unsigned a = n->lhs ? F->slot_of[n->lhs->slot] : slot;
+    const unsigned b = n->rhs ? F->slot_of[n->rhs->slot] : a;
+    Clause* c = &F->tape->clauses[F->count++];
+    *c = (Clause){ .op=n->opcode, .id=slot, .a=a, .b=b };
+
+    // Affine clauses refer to their own row of coefficients
+    if (n->opcode == OP_AFFINE) {
+        memcpy(F->tape->affine + 4*F->rows, n->affine, sizeof(n->affine));
+        c->row = F->rows++;
+    }
+}
+
+/*  Walks the tree depth-first from n, writing one clause per node (in
+ *  post-order).  Depth-first ordering keeps the number of simultaneously-live
+ *  values (and so array registers) small.
+ */
+static void emit(Flattener* F, Node* root)
+{
+    if (emitted(F, root))   return;
+
+    typedef struct { Node* node; bool expanded; } Entry;
+    unsigned capacity = 64;
+    Entry* stack = malloc(capacity * sizeof(Entry));
+    unsigned depth = 0;
+
+    stack[depth++] = (Entry){ .node=root, .expanded=false };
+    while (depth) {
+        if (depth + 2 > capacity) {
+            capacity *= 2;
+            stack = realloc(stack, capacity * sizeof(Entry));
+        }
+
+        Entry* e = &stack[depth - 1];
+        Node* n = e->node;
+
+        if (emitted(F, n)) {
+            --depth;
+        } else if (n->opcode == OP_BOUNDS) {
+            --depth;
+            emit_bounds(F, n);
+        } else if (!e->expanded) {
+            e->expanded = true;
+            if (n->rhs && !emitted(F, n->rhs))
+                stack[depth++] = (Entry){ .node=n->rhs, .expanded=false };
+            if (n->lhs && !emitted(F, n->lhs))
+                stack[depth++] = (Entry){ .node=n->lhs, .expanded=false };
+        } else {
+            --depth;
+            emit_clause(F, n);
+        }
+    }
+
+    free(stack);
+}
+
+/*  Writes a bounded node as a guard, the clauses that only it uses, and
+ *  the clause that computes its value.
+ *
+ *  A node is used only by b if all of its parents are, so we visit b's
+ *  unwritten descendants with parents before children and count how many
+ *  of each node's parents qualify.  Descendants that are also used
+ *  elsewhere are written before the guard, so skipping never leaves
+ *  a value unset.
+ */
+static void emit_bounds(Flattener* F, Node* b)
+{
+    const unsigned round = ++F->round;
+
+    // Collect b's unwritten descendants in post-order
+    unsigned size = 0, capacity = 64, depth = 0;
+    Node** order = malloc(capacity * sizeof(Node*));
+    Node** stack = malloc(capacity * sizeof(Node*));
+    bool* expanded = malloc(capacity * sizeof(bool));
+
+    if (!emitted(F, b->lhs)) {
+        F->stamp[b->lhs->slot] = round;
+        stack[depth] = b->lhs;
+        expanded[depth++] = false;
+    }
+    while (depth) {
+        if (depth + 2 > capacity || size + 1 > capacity) {
+            capacity *= 2;
+            order = realloc(order, capacity * sizeof(Node*));
+            stack = realloc(stack, capacity * sizeof(Node*));
+            expanded = realloc(expanded, capacity * sizeof(bool));
+        }
+
+        Node* n = stack[depth - 1];
+        if (expanded[depth - 1]) {
+            --depth;
+            order[size++] = n;
+            continue;
+        }
+        expanded[depth - 1] = true;
+
+        F->local[n->slot] = 0;
+        Node* const children[2] = {n->rhs, n->lhs};
+        for (int i=0; i < 2; ++i) {
+            Node* c = children[i];
+            if (c && !emitted(F, c) && F->stamp[c->slot] != round) {
+                F->stamp[c->slot] = round;
+                stack[depth] = c;
+                expanded[depth++] = false;
+            }
+        }
+    }
+
+    // Count parents that are only used by b (in reverse post-order, so
+    // that every parent is finished before its children), then write
+    // every descendant that's used elsewhere.
+    unsigned shared = 0;
+    if (size) F->local[b->lhs->slot] = 1;
+    for (unsigned i=size; i-- > 0;) {
+        Node* n = order[i];
+        if (F->local[n->slot] == F->parents[n->slot]) {
+            if (n->lhs && !emitted(F, n->lhs)) F->local[n->lhs->slot]++;
+            if (n->rhs && !emitted(F, n->rhs)) F->local[n->rhs->slot]++;
+        } else {
+            stack[shared++] = n;
+        }
+    }
+    for (unsigned i=shared; i-- > 0;)
+        emit(F, stack[i]);
+
+    free(order);
+    free(stack);
+    free(expanded);
+
+    // Write the guard, the rest of b's subtree, and b itself
+    Tape* const tape = F->tape;
+    const unsigned slot = tape->num_constants + F->slots++;
+    const unsigned row = F->boxes++;
+    const unsigned guard = F->count++;
+    memcpy(tape->boxes + 6*row, b->box, sizeof(b->box));
+
+    emit(F, b->lhs);
+
+    const unsigned a = F->slot_of[b->lhs->slot];
+    tape->clauses[F->count] = (Clause){
+        .op=OP_BOUNDS, .id=slot, .a=a, .b=a, .row=row };
+    tape->clauses[guard] = (Clause){
+        .op=OP_BOUNDS, .id=slot, .a=slot, .b=F->count - guard, .row=row };
+    F->count++;
+    F->slot_of[b->slot] = slot;
+}
+
+/*  Writes every node in the tree into the tape's clause list, returning
+ *  the number of clauses (one per node, plus a guard per bounded node).
+ */
+static unsigned flatten(const MathTree* tree, Tape* tape, unsigned num_nodes)
+{
+    const unsigned nc = tree->num_constants;
+    const unsigned total = nc + num_nodes;
+    Flattener F = {
+        .tape = tape,
+        .slot_of = malloc(total * sizeof(unsigned)),
+        .parents = calloc(total, sizeof(unsigned)),
+        .local = malloc(total * sizeof(unsigned)),
+        .stamp = calloc(total, sizeof(unsigned)),
+    };
+
+    // Give every node a temporary index and count its parents
+    for (unsigned c=0; c < nc; ++c)
+        F.slot_of[c] = c;
+
+    unsigned index = nc;
+    for (unsigned level=0; level < tree->num_levels; ++level) {
+        for (unsigned n=0; n < tree->active[level]; ++n) {
+            Node* node = tree->nodes[level][n];
+            node->slot = index;
+            F.slot_of[index++] = NO_SLOT;
+        }
+    }
+    for (unsigned level=0; level < tree->num_levels; ++level) {
+        for (unsigned n=0; n < tree->active[level]; ++n) {
+            const Node* node = tree->nodes[level][n];
+            if (node->lhs)  F.parents[node->lhs->slot]++;
+            if (node->rhs)  F.parents[node->rhs->slot]++;
+        }
+    }
+
+    emit(&F, tree->head);
+
+    // Replace temporary indices with the real slots
+    for (unsigned level=0; level < tree->num_levels; ++level) {
+        for (unsigned n=0; n < tree->active[level]; ++n) {
+            Node* node = tree->nodes[level][n];
+            node->slot = F.slot_of[node->slot];
+        }
+    }
+
+    free(F.slot_of);
+    free(F.parents);
+    free(F.local);
+    free(F.stamp);
+    return F.count;
+}
+
+/*  Assigns array registers to every clause, recycling a register once
+ *  the last clause that reads it has run.  A clause's output register is
+ *  allocated before its operands are released, so it never aliases them.
+ */
+static unsigned allocate_registers(Tape* tape, unsigned count)
+{
+    Clause* const clauses = tape->clauses;
+    const unsigned nc = tape->num_constants;
+
+    unsigned* last_use = malloc(tape->num_slots * sizeof(unsigned));
+    unsigned* reg_of = malloc(tape->num_slots * sizeof(unsigned));
+    unsigned* free_regs = malloc((count + 1) * sizeof(unsigned));
+    unsigned num_free = 0;
+    unsigned next_reg = nc;
+
+    for (unsigned s=0; s < tape->num_slots; ++s) {
+        last_use[s] = NO_SLOT;
+        reg_of[s] = s < nc ? s : NO_SLOT;
+    }
+
+    for (unsigned k=0; k < count; ++k) {
+        if (opcode_arity(clauses[k].op) == 0 ||
+            is_guard(&clauses[k]))      continue;
+        last_use[clauses[k].a] = k;
+        last_use[clauses[k].b] = k;
+    }
+
+    for (unsigned k=0; k < count; ++k) {
+        Clause* c = &clauses[k];
+
+        // A bounded node's register is claimed by its guard, which
+        // writes the distance to the box there.
+        if (c->op == OP_BOUNDS && !is_guard(c)) {
+            c->out = reg_of[c->id];
+        } else {
+            c->out = num_free ? free_regs[--num_free] : next_reg++;
+            reg_of[c->id] = c->out;
+        }
+
+        if (opcode_arity(c->op) == 0 || is_guard(c)) {
+            c->ra = c->rb = c->out;
+            continue;
+        }
+
+        c->ra = reg_of[c->a];
+        c->rb = reg_of[c->b];
+
+        if (c->a >= nc && last_use[c->a] == k)
+            free_regs[num_free++] = c->ra;
+        if (c->b != c->a && c->b >= nc && last_use[c->b] == k)
+            free_regs[num_free++] = c->rb;
+    }
+
+    tape->root_reg = reg_of[tape->root];
+
+    free(last_use);
+    free(reg_of);
+    free(free_regs);
+
+    return next_reg;
+}
+
+Tape* build_tape(const MathTree* tree)
+{
+    // Give constants the first few slots
+    unsigned num_nodes = 0;
+    unsigned num_affine = 0;
+    unsigned num_bounds = 0;
+    for (unsigned level=0; level < tree->num_levels; ++level) {
+        for (unsigned n=0; n < tree->active[level]; ++n) {
+            const Opcode op = tree->nodes[level][n]->opcode;
+            if (op == OP_AFFINE)    num_affine++;
+            if (op == OP_BOUNDS)    num_bounds++;
+        }
+        num_nodes += tree->active[level];
+    }
+    for (unsigned c=0; c < tree->num_constants; ++c) {
+        tree->constants[c]->slot = c;
+    }
+
+    const unsigned nc = tree->num_constants;
+    Tape* tape = malloc(sizeof(Tape));
+    *tape = (Tape){
+        .num_slots = nc + num_nodes,
+        .num_constants = nc,
+        .clauses = malloc((num_nodes + num_bounds + 1) * sizeof(Clause)),
+        .constants = malloc((nc ? nc : 1) * sizeof(float)),
+        .affine = malloc((num_affine ? num_affine : 1) * 4 * sizeof(float)),
+        .boxes = malloc((num_bounds ? num_bounds : 1) * 6 * sizeof(float)),
+        .r_const = malloc((size_t)nc * MIN_VOLUME * sizeof(float)),
+        .g_const = malloc((size_t)nc * MIN_VOLUME/4 * sizeof(derivative)),
+    };
+
+    tape->num_clauses = flatten(tree, tape, num_nodes);
+    tape->root = tree->head->slot;
+    tape->num_registers = allocate_registers(tape, tape->num_clauses);
+
+    for (unsigned c=0; c < nc; ++c) {
+        const float v = tree->constants[c]->value;
+        tape->constants[c] = v;
+
+        float* r = tape->r_const + (size_t)c*MIN_VOLUME;
+        for (int q=0; q < MIN_VOLUME; ++q)
+            r[q] = v;
+
+        derivative* g = tape->g_const + (size_t)c*MIN_VOLUME/4;
+        for (int q=0; q < MIN_VOLUME/4; ++q)
+            g[q] = (derivative){ .v=v, .dx=0, .dy=0, .dz=0 };
+    }
+
+    return tape;
+}
+
+void free_tape(Tape* tape)
+{
+    if (tape == NULL)   return;
+
+    free(tape->clauses);
+    free(tape->constants);
+    free(tape->affine);
+    free(tape->boxes);
+    free(tape->r_const);
+    free(tape->g_const);
+    free(tape);
+}
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <memory>
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -8,16 +9,26 @@
 
 #include "fab/tree/triangulate.h"
 #include "fab/tree/triangulate/mesher.h"
+#include "fab/tree/triangulate/dual_mesher.h"
 
 #include "fab/tree/tree.h"
+#include "fab/tree/eval.h"
+#include "fab/tree/context.h"
+#include "fab/util/switches.h"
+#include "fab/util/workpool.h"
+
+// Number of blocks per worker: more blocks means better load balancing,
+// at the cost of more merging at the end.
+static const unsigned BLOCKS_PER_WORKER = 16;
 
 // Finds an array of vertices (as x,y,z float triplets).
 // Sets *count to the number of vertices returned.
 void triangulate(MathTree* tree, const Region r,
                  bool detect_edges, volatile int* halt,
-                 float** const verts, unsigned* const count)
+                 float** const verts, unsigned* const count,
+                 float tolerance)
 {
-    Mesher t(tree, detect_edges, halt);
+    Mesher t(tree, detect_edges, halt, tolerance);
 
     // Top-level call to the recursive triangulation function.
     t.triangulate_region(r);
@@ -25,3 +36,99 @@ void triangulate(MathTree* tree, const Region r,
     // Copy data from tristate struct to output pointers.
     *verts = t.get_verts(count);
 }
+
+// Walks the region in the same order as Mesher::triangulate_region,
+// storing (in order) the non-empty regions at the given depth.
+//
+// Recursion stops early at regions that are small enough to be loaded as
+// a single packed chunk, since the Mesher only flushes its triangles at
+// the end of each packed chunk and we want every block to be meshed
+// exactly as it would be in the serial walk.
+static void collect_blocks(EvalContext* ctx, const Region& r, unsigned depth,
+                           std::vector<Region>* blocks)
+{
+    auto interval = eval_i(ctx, (Interval){r.X[0], r.X[r.ni]},
+                                (Interval){r.Y[0], r.Y[r.nj]},
+                                (Interval){r.Z[0], r.Z[r.nk]});
+    if (interval.lower > 0 || interval.upper < 0)
+        return;
+
+    const unsigned voxels = (r.ni+1) * (r.nj+1) * (r.nk+1);
+    if (depth == 0 || r.voxels <= 1 || voxels < MIN_VOLUME)
+    {
+        blocks->push_back(r);
+        return;
+    }
+
+    // The Mesher evaluates extrusions as prisms, without subdividing Z, so
+    // they're kept in a single block to match the serial walk.
+    if (r.nk > 1)
+    {
+        disable_nodes(ctx);
+        const bool extruded = !(active_axes(ctx) & 1);
+        enable_nodes(ctx);
+        if (extruded)
+        {
+            blocks->push_back(r);
+            return;
+        }
+    }
+
+    Region octants[8];
+    const uint8_t split = octsect(r, octants);
+    for (int i=0; i < 8; ++i)
+        if (split & (1 << i))
+            collect_blocks(ctx, octants[i], depth - 1, blocks);
+}
+
+void triangulate_parallel(MathTree* tree, const Region r,
+                          bool detect_edges, volatile int* halt,
+                          float** const verts, unsigned* const count,
+                          unsigned threads, float tolerance)
+{
+    WorkPool pool(threads);
+    if (pool.size() == 1)
+    {
+        triangulate(tree, r, detect_edges, halt, verts, count, tolerance);
+        return;
+    }
+
+    // Pick a depth that gives enough blocks to keep every worker busy
+    unsigned depth = 1;
+    while ((1u << (3 * depth)) < pool.size() * BLOCKS_PER_WORKER)
+        depth++;
+
+    std::vector<Region> blocks;
+    {
+        EvalContext* ctx = new_context(tree);
+        collect_blocks(ctx, r, depth, &blocks);
+        free_context(ctx);
+    }
+
+    std::vector<std::unique_ptr<Mesher>> meshers(blocks.size());
+    pool.run(blocks.size(), [&](unsigned b, unsigned)
+    {
+        meshers[b].reset(new Mesher(tree, detect_edges, halt, tolerance));
+        meshers[b]->triangulate_region(blocks[b]);
+    });
+
+    // Stitch the blocks back together in walk order (which also snaps
+    // together the vertices on their shared faces)
+    Mesher merged(tree, detect_edges, halt);
+    for (auto& m : meshers)
+    {
+        merged.append(*m);
+        m.reset();
+    }
+
+    *verts = merged.get_verts(count);
+}
+
+void triangulate_dual(MathTree* tree, const Region r, volatile int* halt,
+                      float** const verts, unsigned* const count,
+                      float tolerance)
+{
+    DualMesher t(tree, halt, tolerance);
+    t.triangulate_region(r);
+    *verts = t.get_verts(count);
+}
@@ -0,0 +1,586 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "fab/tree/triangulate/dual_mesher.h"
+
+#include "fab/tree/tree.h"
+#include "fab/tree/eval.h"
+#include "fab/tree/context.h"
+#include "fab/tree/math/math_g.h"
+#include "fab/tree/math/math_ib.h"
+#include "fab/util/switches.h"
+
+#if IBATCH < 8
+#error "IBATCH must hold every octant of a region."
+#endif
+
+// Singular values of a QEF's matrix that are smaller than this (relative
+// to the largest) are treated as zero, so that the vertex is only moved
+// away from the mass point in directions that the planes constrain.
+static const double SVD_THRESHOLD = 0.1;
+
+Qef::Qef()
+    : ata(Eigen::Matrix3d::Zero()), atb(Eigen::Vector3d::Zero()), btb(0),
+      mass(Vec3f::Zero()), count(0)
+{
+    // Nothing to do here
+}
+
+void Qef::add(const Vec3f& p, const Vec3f& n)
+{
+    const double b = n.dot(p);
+    ata += n * n.transpose();
+    atb += n * b;
+    btb += b * b;
+    mass += p;
+    count++;
+}
+
+Qef& Qef::operator+=(const Qef& other)
+{
+    ata += other.ata;
+    atb += other.atb;
+    btb += other.btb;
+    mass += other.mass;
+    count += other.count;
+    return *this;
+}
+
+Vec3f Qef::solve() const
+{
+    // Solve relative to the mass point, so that the pseudo-inverse leaves
+    // poorly-constrained directions at the mass point.
+    const Vec3f center = mass / count;
+
+    Eigen::JacobiSVD<Eigen::Matrix3d> svd(
+            ata, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    svd.setThreshold(SVD_THRESHOLD);
+    return center + svd.solve(atb - ata * center);
+}
+
+double Qef::error(const Vec3f& p) const
+{
+    return p.dot(ata * p) - 2 * p.dot(atb) + btb;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+DualMesher::DualMesher(MathTree* tree, volatile int* halt, float tolerance)
+    : tree(tree), ctx(new_context(tree)), halt(halt),
+      tolerance(tolerance), max_error(tolerance),
+      data(new float[MIN_VOLUME]),
+      X(new float[MIN_VOLUME]),
+      Y(new float[MIN_VOLUME]),
+      Z(new float[MIN_VOLUME])
+{
+    // Nothing to do here
+}
+
+DualMesher::~DualMesher()
+{
+    for (auto ptr : {data, X, Y, Z})
+        delete [] ptr;
+    free_context(ctx);
+}
+
+void DualMesher::triangulate_region(const Region& r)
+{
+    // Early abort if the halt flag is set
+    if (*halt)
+        return;
+
+    // Without a tolerance, collapsed vertices must stay within 1% of the
+    // smallest voxel dimension of their planes.
+    if (tolerance <= 0)
+        max_error = std::min(std::min((r.X[r.ni] - r.X[0]) / r.ni,
+                                      (r.Y[r.nj] - r.Y[0]) / r.nj),
+                                      (r.Z[r.nk] - r.Z[0]) / r.nk) / 100;
+
+    // Do a round of interval evaluation to skip empty regions.
+    auto interval = eval_i(ctx, (Interval){r.X[0], r.X[r.ni]},
+                                (Interval){r.Y[0], r.Y[r.nj]},
+                                (Interval){r.Z[0], r.Z[r.nk]});
+    if (interval.lower > 0 || interval.upper < 0)
+        return;
+
+    triangulate_ambiguous(r);
+}
+
+void DualMesher::triangulate_ambiguous(const Region& r)
+{
+    // Early abort if the halt flag is set
+    if (*halt)
+        return;
+
+    // This region's interval results are in the context (from either
+    // triangulate_region or select_batch), so prune the tree with them.
+    disable_nodes(ctx);
+
+    // Once we can evaluate every corner in this region with a single
+    // eval_r call, mesh it as a block.
+    if ((r.ni+1) * (r.nj+1) * (r.nk+1) < MIN_VOLUME)
+    {
+        mesh_block(r);
+    }
+    // Otherwise, subdivide and recurse, evaluating every octant in a
+    // single pass to skip empty ones.
+    else
+    {
+        Region octants[8];
+        const uint8_t split = octsect(r, octants);
+
+        Interval X[8], Y[8], Z[8], out[8];
+        int lanes[8];
+        unsigned count = 0;
+        for (int i=0; i < 8; ++i)
+        {
+            if (split & (1 << i))
+            {
+                const Region& o = octants[i];
+                X[count] = (Interval){o.X[0], o.X[o.ni]};
+                Y[count] = (Interval){o.Y[0], o.Y[o.nj]};
+                Z[count] = (Interval){o.Z[0], o.Z[o.nk]};
+                lanes[count++] = i;
+            }
+        }
+
+        eval_i_batch(ctx, X, Y, Z, count, out);
+        for (unsigned q=0; q < count; ++q)
+        {
+            if (out[q].lower > 0 || out[q].upper < 0)
+                continue;
+            select_batch(ctx, q);
+            triangulate_ambiguous(octants[lanes[q]]);
+        }
+        pop_batch(ctx);
+    }
+
+    enable_nodes(ctx);
+}
+
+void DualMesher::mesh_block(const Region& r)
+{
+    block = r;
+
+    // Evaluate every corner in the block, in the same order as the
+    // Mesher's packed data.
+    Region packed = r;
+    packed.X = X;
+    packed.Y = Y;
+    packed.Z = Z;
+    packed.voxels = (r.ni+1) * (r.nj+1) * (r.nk+1);
+
+    unsigned q = 0;
+    for (unsigned k=0; k <= r.nk; ++k)
+        for (unsigned j=0; j <= r.nj; ++j)
+            for (unsigned i=0; i <= r.ni; ++i)
+            {
+                X[q] = r.X[i];
+                Y[q] = r.Y[j];
+                Z[q] = r.Z[k];
+                q++;
+            }
+    memcpy(data, eval_r(ctx, packed), packed.voxels * sizeof(float));
+
+    // Find every edge that the surface crosses
+    const unsigned n[3] = {r.ni, r.nj, r.nk};
+    const unsigned stride[3] = {1, r.ni + 1, (r.ni + 1) * (r.nj + 1)};
+    std::vector<unsigned> edges;
+    for (unsigned k=0; k <= r.nk; ++k)
+        for (unsigned j=0; j <= r.nj; ++j)
+            for (unsigned i=0; i <= r.ni; ++i)
+            {
+                const unsigned p[3] = {i, j, k};
+                const unsigned c = i + j * stride[1] + k * stride[2];
+                for (int a=0; a < 3; ++a)
+                    if (p[a] < n[a] &&
+                        (data[c] < 0) != (data[c + stride[a]] < 0))
+                        edges.push_back(c * 3 + a);
+            }
+    if (edges.empty())
+        return;
+
+    std::vector<Vec3f> pos, norm;
+    find_crossings(edges, &pos, &norm);
+
+    // Add each crossing to the QEFs of the voxels around its edge
+    qefs.assign(r.voxels, Qef());
+    for (unsigned e=0; e < edges.size(); ++e)
+    {
+        const unsigned c = edges[e] / 3;
+        const unsigned a = edges[e] % 3;
+        const unsigned p[3] = {c % stride[1], (c / stride[1]) % (r.nj + 1),
+                               c / stride[2]};
+
+        // The edge is shared by voxels on either side of it along the
+        // other two axes (where they're in the block).
+        for (int v=0; v < 4; ++v)
+        {
+            unsigned w[3] = {p[0], p[1], p[2]};
+            bool valid = true;
+            for (int s=0; s < 2; ++s)
+            {
+                const unsigned b = (a + 1 + s) % 3;
+                if (v & (1 << s))
+                    valid &= w[b]-- > 0;
+                else
+                    valid &= w[b] < n[b];
+            }
+            if (valid)
+                qefs[w[0] + w[1] * r.ni + w[2] * r.ni * r.nj].add(
+                        pos[e], norm[e]);
+        }
+    }
+
+    Cluster c;
+    if (collapse(r, &c) && !c.voxels.empty())
+        add_vertex(r, c);
+}
+
+void DualMesher::find_crossings(const std::vector<unsigned>& edges,
+                                std::vector<Vec3f>* pos,
+                                std::vector<Vec3f>* norm)
+{
+    const unsigned stride[3] = {1, block.ni + 1,
+                                (block.ni + 1) * (block.nj + 1)};
+
+    // Position of a corner in the block, by its index in data
+    auto corner = [&](unsigned c)
+    {
+        return Vec3f(block.X[c % stride[1]],
+                     block.Y[(c / stride[1]) % (block.nj + 1)],
+                     block.Z[c / stride[2]]);
+    };
+
+    // Bisect until the remaining interval is within the collapse
+    // tolerance (which is 1% of a voxel, or seven steps, by default).
+    const Vec3f size = corner(stride[1] + stride[2] + 1) - corner(0);
+    const double longest = size.maxCoeff();
+    const int iterations = std::max(1, std::min(24,
+            (int)ceil(log2(longest / max_error))));
+
+    pos->resize(edges.size());
+    norm->resize(edges.size());
+
+    Region dummy;
+    dummy.X = X;
+    dummy.Y = Y;
+    dummy.Z = Z;
+
+    for (size_t start=0; start < edges.size(); start += MIN_VOLUME)
+    {
+        const unsigned count = std::min<size_t>(edges.size() - start,
+                                                MIN_VOLUME);
+
+        // Orient every edge so that it runs from inside to outside
+        Vec3f v0[count], v1[count];
+        for (unsigned i=0; i < count; ++i)
+        {
+            const unsigned c = edges[start + i] / 3;
+            const unsigned d = c + stride[edges[start + i] % 3];
+            v0[i] = corner(data[c] < 0 ? c : d);
+            v1[i] = corner(data[c] < 0 ? d : c);
+        }
+
+        float p[count];
+        for (unsigned i=0; i < count; ++i)
+            p[i] = 0.5;
+        float step = 0.25;
+
+        dummy.voxels = count;
+        for (int iteration=0; iteration < iterations; ++iteration)
+        {
+            for (unsigned i=0; i < count; ++i)
+            {
+                X[i] = v0[i][0] * (1 - p[i]) + v1[i][0] * p[i];
+                Y[i] = v0[i][1] * (1 - p[i]) + v1[i][1] * p[i];
+                Z[i] = v0[i][2] * (1 - p[i]) + v1[i][2] * p[i];
+            }
+            const float* out = eval_r(ctx, dummy);
+
+            for (unsigned i=0; i < count; ++i)
+                if      (out[i] < 0)    p[i] += step;
+                else if (out[i] > 0)    p[i] -= step;
+            step /= 2;
+        }
+
+        for (unsigned i=0; i < count; ++i)
+            (*pos)[start + i] = v0[i] * (1 - p[i]) + v1[i] * p[i];
+    }
+
+    // Find normals from the gradient at each crossing
+    for (size_t start=0; start < edges.size(); start += MIN_VOLUME/4)
+    {
+        const unsigned count = std::min<size_t>(edges.size() - start,
+                                                MIN_VOLUME/4);
+        for (unsigned i=0; i < count; ++i)
+        {
+            X[i] = (*pos)[start + i][0];
+            Y[i] = (*pos)[start + i][1];
+            Z[i] = (*pos)[start + i][2];
+        }
+        dummy.voxels = count;
+
+        const derivative* out = eval_g(ctx, dummy);
+        for (unsigned i=0; i < count; ++i)
+        {
+            const Vec3f g(out[i].dx, out[i].dy, out[i].dz);
+            const double norm_ = g.norm();
+            (*norm)[start + i] = norm_ ? Vec3f(g / norm_) : g;
+        }
+    }
+}
+
+bool DualMesher::collapse(const Region& r, Cluster* out)
+{
+    const uint32_t i = r.imin - block.imin,
+                   j = r.jmin - block.jmin,
+                   k = r.kmin - block.kmin;
+
+    // Single voxels are clusters of their own (if the surface passes
+    // through them).
+    if (r.voxels == 1)
+    {
+        const uint8_t mask = corners(i, j, k);
+        if (mask != 0 && mask != 0xff)
+        {
+            out->qef = qefs[i + j * block.ni + k * block.ni * block.nj];
+            out->voxels.push_back({{r.imin, r.jmin, r.kmin}});
+        }
+        return true;
+    }
+
+    Region octants[8];
+    Cluster children[8];
+    bool collapsed[8] = {false};
+    bool all = true;
+
+    const uint8_t split = octsect(r, octants);
+    for (int o=0; o < 8; ++o)
+        if (split & (1 << o))
+            all &= (collapsed[o] = collapse(octants[o], &children[o]));
+
+    if (all && is_simple(r))
+    {
+        for (int o=0; o < 8; ++o)
+        {
+            out->qef += children[o].qef;
+            out->voxels.insert(out->voxels.end(),
+                               children[o].voxels.begin(),
+                               children[o].voxels.end());
+        }
+        if (out->voxels.empty())
+            return true;
+
+        // Only collapse if the combined vertex stays in this region and
+        // is close enough to every plane.
+        const Vec3f v = out->qef.solve();
+        const bool contained =
+            v[0] >= r.X[0] && v[0] <= r.X[r.ni] &&
+            v[1] >= r.Y[0] && v[1] <= r.Y[r.nj] &&
+            v[2] >= r.Z[0] && v[2] <= r.Z[r.nk];
+        if (contained && out->qef.error(v) <=
+                out->qef.count * max_error * max_error)
+            return true;
+    }
+
+    // Give each collapsed child its own vertex
+    for (int o=0; o < 8; ++o)
+        if (collapsed[o] && !children[o].voxels.empty())
+            add_vertex(octants[o], children[o]);
+    return false;
+}
+
+bool DualMesher::is_simple(const Region& r) const
+{
+    // Lattice points that split the region into octants, as local
+    // coordinates in the block (matching octsect, which only splits axes
+    // that are more than one voxel across)
+    const unsigned base[3] = {r.imin - block.imin, r.jmin - block.jmin,
+                              r.kmin - block.kmin};
+    const unsigned n[3] = {r.ni, r.nj, r.nk};
+    unsigned pts[3][3];
+    unsigned count[3];
+    for (int a=0; a < 3; ++a)
+    {
+        pts[a][0] = base[a];
+        if (n[a] > 1)
+        {
+            pts[a][1] = base[a] + n[a] / 2;
+            pts[a][2] = base[a] + n[a];
+            count[a] = 3;
+        }
+        else
+        {
+            pts[a][1] = base[a] + n[a];
+            count[a] = 2;
+        }
+    }
+
+    bool corner[8];
+    for (int c=0; c < 8; ++c)
+        corner[c] = inside(pts[0][(c & 4) ? count[0] - 1 : 0],
+                           pts[1][(c & 2) ? count[1] - 1 : 0],
+                           pts[2][(c & 1) ? count[2] - 1 : 0]);
+
+    // The coarse cell must be manifold: its inside corners and its outside
+    // corners must each be connected along the cell's edges.
+    for (int s=0; s < 2; ++s)
+    {
+        uint8_t target = 0;
+        for (int c=0; c < 8; ++c)
+            if (corner[c] == (bool)s)
+                target |= 1 << c;
+        if (!target)
+            continue;
+
+        uint8_t reached = target & -target;
+        uint8_t prev = 0;
+        while (reached != prev)
+        {
+            prev = reached;
+            for (int c=0; c < 8; ++c)
+                if (reached & (1 << c))
+                    for (int b : {1, 2, 4})
+                        reached |= target & (1 << (c ^ b));
+        }
+        if (reached != target)
+            return false;
+    }
+
+    // Every split point on an edge, face, or in the middle of the coarse
+    // cell must agree with at least one of the corners of that edge, face,
+    // or cell (so collapsing can't add or remove a piece of surface).
+    for (unsigned a=0; a < count[0]; ++a)
+        for (unsigned b=0; b < count[1]; ++b)
+            for (unsigned c=0; c < count[2]; ++c)
+            {
+                const unsigned p[3] = {a, b, c};
+                bool mid = false;
+                for (int axis=0; axis < 3; ++axis)
+                    mid |= count[axis] == 3 && p[axis] == 1;
+                if (!mid)
+                    continue;
+
+                const bool s = inside(pts[0][a], pts[1][b], pts[2][c]);
+                bool agrees = false;
+                for (int q=0; q < 8; ++q)
+                {
+                    bool matches = true;
+                    for (int axis=0; axis < 3; ++axis)
+                    {
+                        const bool upper = q & (4 >> axis);
+                        if (p[axis] == 0)
+                            matches &= !upper;
+                        else if (p[axis] == count[axis] - 1)
+                            matches &= upper;
+                    }
+                    agrees |= matches && corner[q] == s;
+                }
+                if (!agrees)
+                    return false;
+            }
+
+    return true;
+}
+
+void DualMesher::add_vertex(const Region& r, const Cluster& c)
+{
+    // Keep the vertex inside of its region, so that the mesh can't fold
+    // over itself where the QEF's minimum lies outside of the cluster.
+    Vec3f v = c.qef.solve();
+    v[0] = std::max<double>(r.X[0], std::min<double>(r.X[r.ni], v[0]));
+    v[1] = std::max<double>(r.Y[0], std::min<double>(r.Y[r.nj], v[1]));
+    v[2] = std::max<double>(r.Z[0], std::min<double>(r.Z[r.nk], v[2]));
+
+    const uint32_t id = vertices.size();
+    vertices.push_back(v);
+    for (const auto& voxel : c.voxels)
+    {
+        cells[voxel] = (Cell){id, corners(voxel[0] - block.imin,
+                                          voxel[1] - block.jmin,
+                                          voxel[2] - block.kmin)};
+        order.push_back(voxel);
+    }
+}
+
+bool DualMesher::inside(uint32_t i, uint32_t j, uint32_t k) const
+{
+    return data[i + j * (block.ni + 1) +
+                k * (block.ni + 1) * (block.nj + 1)] < 0;
+}
+
+uint8_t DualMesher::corners(uint32_t i, uint32_t j, uint32_t k) const
+{
+    uint8_t mask = 0;
+    for (int c=0; c < 8; ++c)
+        if (inside(i + ((c & 4) ? 1 : 0),
+                   j + ((c & 2) ? 1 : 0),
+                   k + ((c & 1) ? 1 : 0)))
+            mask |= 1 << c;
+    return mask;
+}
+
+float* DualMesher::get_verts(unsigned* count)
+{
+    std::vector<std::array<uint32_t, 3>> triangles;
+
+    // Each crossed edge becomes a quad between the vertices of the four
+    // voxels around it.  Every edge is found from the voxel for which it
+    // runs from corner 0 to corner 4, 2, or 1, so that it's only used once.
+    for (const auto& voxel : order)
+    {
+        const Cell& cell = cells[voxel];
+        for (int a=0; a < 3; ++a)
+        {
+            const bool start = cell.inside & 1;
+            if (start == (bool)(cell.inside & (1 << (4 >> a))))
+                continue;
+
+            // Voxels around the edge, counter-clockwise about +a
+            const int b = (a + 1) % 3, c = (a + 2) % 3;
+            if (voxel[b] == 0 || voxel[c] == 0)
+                continue;
+            uint32_t quad[4];
+            bool found = true;
+            for (int q=0; q < 4 && found; ++q)
+            {
+                auto v = voxel;
+                v[b] -= (q == 1 || q == 2);
+                v[c] -= (q == 2 || q == 3);
+                auto n = cells.find(v);
+                if (n == cells.end())
+                    found = false;
+                else
+                    quad[q] = n->second.vertex;
+            }
+            if (!found)
+                continue;
+
+            // The surface's normal points from inside to outside
+            if (!start)
+                std::swap(quad[1], quad[3]);
+
+            // Split the quad into two triangles, skipping any that are
+            // degenerate because their voxels were collapsed together.
+            for (auto t : {std::array<uint32_t, 3>{{quad[0], quad[1], quad[2]}},
+                           std::array<uint32_t, 3>{{quad[0], quad[2], quad[3]}}})
+                if (t[0] != t[1] && t[1] != t[2] && t[2] != t[0])
+                    triangles.push_back(t);
+        }
+    }
+
+    // There are 9 floats in each triangle
+    *count = triangles.size() * 9;
+
+    float* out = (float*)malloc(sizeof(float) * (*count));
+
+    unsigned i = 0;
+    for (const auto& t : triangles)
+        for (auto v : t)
+            for (int j=0; j < 3; ++j)
+                out[i++] = vertices[v][j];
+
+    return out;
+}
@@ -1,16 +1,25 @@
 #include <iostream>
-#include <set>
+#include <algorithm>
+#include <cmath>
+#include <unordered_set>
 
 #include "fab/tree/triangulate/mesher.h"
 
 #include "fab/tree/tree.h"
 #include "fab/tree/eval.h"
+#include "fab/tree/context.h"
+#include "fab/tree/math/math_g.h"
+#include "fab/tree/math/math_ib.h"
 #include "fab/util/switches.h"
 
 #if MIN_VOLUME < 60
 #error "MIN_VOLUME is below minimum for meshing implementation."
 #endif
 
+#if IBATCH < 8
+#error "IBATCH must hold every octant of a region."
+#endif
+
 /*
  *  When feature detection is enabled, the Mesher implements the algorithm from
  *
@@ -49,9 +58,12 @@ static const int EDGE_MAP[16][2][3][2] = {
     {{{-1,-1}, {-1,-1}, {-1,-1}}, {{-1,-1}, {-1,-1}, {-1,-1}}}, // 3210
 };
 
-Mesher::Mesher(MathTree* tree, bool detect_edges, volatile int* halt)
-    : tree(tree), detect_edges(detect_edges), halt(halt),
+Mesher::Mesher(MathTree* tree, bool detect_edges, volatile int* halt,
+               float tolerance)
+    : tree(tree), ctx(new_context(tree)),
+      detect_edges(detect_edges), halt(halt), tolerance(tolerance),
       data(new float[MIN_VOLUME]), has_data(false),
+      prism(false), prism_top(0), prism_z(NULL),
       X(new float[MIN_VOLUME]),
       Y(new float[MIN_VOLUME]),
       Z(new float[MIN_VOLUME]),
@@ -61,7 +73,7 @@ Mesher::Mesher(MathTree* tree, bool detect_edges, volatile int* halt)
       nx(new float[MIN_VOLUME]),
       ny(new float[MIN_VOLUME]),
       nz(new float[MIN_VOLUME]),
-      voxel_start(triangles.end())
+      voxel_start(0), voxel_end(0), fan_start(0)
 {
     // Nothing to do here
 }
@@ -70,77 +82,40 @@ Mesher::~Mesher()
 {
     for (auto ptr : {data, X, Y, Z, ex, ey, ez, nx, ny, nz})
         delete [] ptr;
+    free_context(ctx);
 }
 
 
-// Estimate the normals of a set of points.
-std::list<Vec3f> Mesher::get_normals(const std::list<Vec3f>& points)
+// Finds normals from the gradient at each point.
+std::vector<Vec3f> Mesher::get_normals(const std::vector<Vec3f>& points)
 {
-    // Find epsilon as the single shortest side length divided by 10.
-    float epsilon = INFINITY;
-    auto j = points.begin();
-    j++;
-    for (auto i = points.begin(); j != points.end(); ++i, ++j)
-    {
-        if (j != points.end())
-        {
-            auto d = *j - *i;
-            epsilon = fmin(epsilon, d.norm() / 100.0f);
-        }
-    }
+    std::vector<Vec3f> normals;
+    normals.reserve(points.size());
 
-    // We'll be evaluating a dummy region to numerically estimate gradients
     Region dummy;
-    dummy.voxels = points.size() * 7;
-    if (dummy.voxels >= MIN_VOLUME)
-        std::cerr << "Error: too many normals to calculate at once!"
-                  << std::endl;
     dummy.X = nx;
     dummy.Y = ny;
     dummy.Z = nz;
 
-    // Load position data into the dummy region
-    int i=0;
-    for (auto v : points)
-    {
-        dummy.X[i]   = v[0];
-        dummy.X[i+1] = v[0] + epsilon;
-        dummy.X[i+2] = v[0];
-        dummy.X[i+3] = v[0];
-        dummy.X[i+4] = v[0] - epsilon;
-        dummy.X[i+5] = v[0];
-        dummy.X[i+6] = v[0];
-
-        dummy.Y[i]   = v[1];
-        dummy.Y[i+1] = v[1];
-        dummy.Y[i+2] = v[1] + epsilon;
-        dummy.Y[i+3] = v[1];
-        dummy.Y[i+4] = v[1];
-        dummy.Y[i+5] = v[1] - epsilon;
-        dummy.Y[i+6] = v[1];
-
-        dummy.Z[i]   = v[2];
-        dummy.Z[i+1] = v[2];
-        dummy.Z[i+2] = v[2];
-        dummy.Z[i+3] = v[2] + epsilon;
-        dummy.Z[i+4] = v[2];
-        dummy.Z[i+5] = v[2];
-        dummy.Z[i+6] = v[2] - epsilon;
-        i += 7;
-    }
-
-    float* out = eval_r(tree, dummy);
-
-    // Extract normals from the evaluated data.
-    std::list<Vec3f> normals;
-    i = 0;
-    for (auto v : points)
-    {
-        const float dx = (out[i+1] - out[i]) - (out[i+4] - out[i]);
-        const float dy = (out[i+2] - out[i]) - (out[i+5] - out[i]);
-        const float dz = (out[i+3] - out[i]) - (out[i+6] - out[i]);
-        normals.push_back(Vec3f(dx, dy, dz).normalized());
-        i += 7;
+    for (size_t start=0; start < points.size(); start += MIN_VOLUME/4)
+    {
+        const unsigned count = std::min<size_t>(points.size() - start,
+                                                MIN_VOLUME/4);
+        for (unsigned i=0; i < count; ++i)
+        {
+            dummy.X[i] = points[start + i][0];
+            dummy.Y[i] = points[start + i][1];
+            dummy.Z[i] = points[start + i][2];
+        }
+        dummy.voxels = count;
+
+        const derivative* out = eval_g(ctx, dummy);
+        for (unsigned i=0; i < count; ++i)
+        {
+            const Vec3f g(out[i].dx, out[i].dy, out[i].dz);
+            const double norm = g.norm();
+            normals.push_back(norm ? Vec3f(g / norm) : g);
+        }
     }
 
     return normals;
@@ -153,65 +128,60 @@ void Mesher::push_swappable_triangle(Triangle t)
     auto found = swappable.find(t.ab_());
     if (found != swappable.end())
     {
-        found->second->b = t.c;
-        t.b = found->second->c;
+        Triangle& partner = triangles[found->second];
+        partner.b = t.c;
+        t.b = partner.c;
         triangles.push_back(t);
         swappable.erase(found);
     }
     else
     {
+        // Store the index of the new triangle.
+        swappable[t.ba_()] = triangles.size();
         triangles.push_back(t);
-
-        // Store an iterator pointing to the new triangle.
-        auto itr = triangles.end();
-        itr--;
-        swappable[t.ba_()] = itr;
     }
-
-    // Adjust voxel_end so that it points to the first new triangle.
-    if (voxel_end == triangles.end())
-        voxel_end--;
 }
 
 std::list<Vec3f> Mesher::get_contour()
 {
     // Find all of the singular edges in this fan
     // (edges that aren't shared between multiple triangles).
-    std::set<std::array<float, 6>> valid_edges;
-    for (auto itr=voxel_start; itr != voxel_end; ++itr)
+    std::unordered_set<std::array<float, 6>, KeyHash> valid_edges;
+    for (size_t i=voxel_start; i < voxel_end; ++i)
     {
-        if (valid_edges.count(itr->ba_()))
-            valid_edges.erase(itr->ba_());
+        const Triangle& t = triangles[i];
+        if (valid_edges.count(t.ba_()))
+            valid_edges.erase(t.ba_());
         else
-            valid_edges.insert(itr->ab_());
+            valid_edges.insert(t.ab_());
 
-        if (valid_edges.count(itr->cb_()))
-            valid_edges.erase(itr->cb_());
+        if (valid_edges.count(t.cb_()))
+            valid_edges.erase(t.cb_());
         else
-            valid_edges.insert(itr->bc_());
+            valid_edges.insert(t.bc_());
 
-        if (valid_edges.count(itr->ac_()))
-            valid_edges.erase(itr->ac_());
+        if (valid_edges.count(t.ac_()))
+            valid_edges.erase(t.ac_());
         else
-            valid_edges.insert(itr->ca_());
+            valid_edges.insert(t.ca_());
     }
 
-    std::set<std::array<float, 3>> in_fan;
+    std::unordered_set<std::array<float, 3>, KeyHash> in_fan;
 
-    std::list<Vec3f> contour = {voxel_start->a};
-    in_fan.insert(voxel_start->a_());
-    in_fan.insert(voxel_start->b_());
-    in_fan.insert(voxel_start->c_());
+    std::list<Vec3f> contour = {triangles[voxel_start].a};
+    in_fan.insert(triangles[voxel_start].a_());
+    in_fan.insert(triangles[voxel_start].b_());
+    in_fan.insert(triangles[voxel_start].c_());
 
     fan_start = voxel_start;
     voxel_start++;
 
     while (contour.size() == 1 || contour.front() != contour.back())
     {
-        std::list<Triangle>::iterator itr;
-        for (itr=fan_start; itr != voxel_end; ++itr)
+        size_t i;
+        for (i=fan_start; i < voxel_end; ++i)
         {
-            const auto& t = *itr;
+            const auto& t = triangles[i];
             if (contour.back() == t.a && valid_edges.count(t.ab_()))
             {
                 contour.push_back(t.b);
@@ -230,48 +200,27 @@ std::list<Vec3f> Mesher::get_contour()
                 break;
             }
         }
-        // If we broke out of the loop (meaning itr is pointing to a relevant
+        // If we broke out of the loop (meaning i is the index of a relevant
         // triangle which should be moved forward to before voxel_start), then
-        // push the list around and update iterators appropriately.
-        if (itr != voxel_end)
+        // move it into the fan.
+        if (i < voxel_end)
         {
-            in_fan.insert(itr->a_());
-            in_fan.insert(itr->b_());
-            in_fan.insert(itr->c_());
-
-            if (itr == voxel_start)
-            {
-                voxel_start++;
-            }
-            else if (itr != fan_start)
-            {
-                const Triangle t = *itr;
-                triangles.insert(voxel_start, t);
-                itr = triangles.erase(itr);
-                itr--;
-            }
+            in_fan.insert(triangles[i].a_());
+            in_fan.insert(triangles[i].b_());
+            in_fan.insert(triangles[i].c_());
+            move_to_fan(i);
         }
     }
 
     // Special case to catch triangles that are part of a particular fan but
     // don't have any edges in the contour (which can happen!).
-    for (auto itr=voxel_start;  itr != voxel_end; ++itr)
+    for (size_t i=voxel_start; i < voxel_end; ++i)
     {
-        if (in_fan.count(itr->a_()) &&
-            in_fan.count(itr->b_()) &&
-            in_fan.count(itr->c_()))
+        if (in_fan.count(triangles[i].a_()) &&
+            in_fan.count(triangles[i].b_()) &&
+            in_fan.count(triangles[i].c_()))
         {
-            if (itr == voxel_start)
-            {
-                voxel_start++;
-            }
-            else if (itr != fan_start)
-            {
-                const Triangle t = *itr;
-                triangles.insert(voxel_start, t);
-                itr = triangles.erase(itr);
-                itr--;
-            }
+            move_to_fan(i);
         }
     }
 
@@ -280,11 +229,53 @@ std::list<Vec3f> Mesher::get_contour()
     return contour;
 }
 
-void Mesher::check_feature()
+void Mesher::move_to_fan(size_t i)
+{
+    auto begin = triangles.begin();
+    if (i >= voxel_start)
+    {
+        std::rotate(begin + voxel_start, begin + i, begin + i + 1);
+        voxel_start++;
+    }
+    else if (i != fan_start)
+    {
+        std::rotate(begin + i, begin + i + 1, begin + voxel_start);
+    }
+}
+
+void Mesher::check_features()
 {
-    auto contour = get_contour();
-    const auto normals = get_normals(contour);
+    struct Fan {
+        std::list<Vec3f> contour;
+        size_t start;
+        size_t end;
+    };
+
+    // Pull each fan out of the voxel, collecting their contours' points
+    // so that normals can be found in as few passes as possible.
+    std::vector<Fan> fans;
+    std::vector<Vec3f> points;
+    while (voxel_start < voxel_end)
+    {
+        auto contour = get_contour();
+        points.insert(points.end(), contour.begin(), contour.end());
+        fans.push_back((Fan){contour, fan_start, voxel_start});
+    }
+
+    const auto normals = get_normals(points);
+    auto n = normals.begin();
+    for (const auto& f : fans)
+    {
+        const auto end = n + f.contour.size();
+        check_feature(f.contour, std::list<Vec3f>(n, end), f.start, f.end);
+        n = end;
+    }
+}
 
+void Mesher::check_feature(std::list<Vec3f> contour,
+                           const std::list<Vec3f>& normals,
+                           size_t start, size_t end)
+{
     // Find the largest cone and the normals that enclose
     // the largest angle as n0, n1.
     float theta = 1;
@@ -355,7 +346,9 @@ void Mesher::check_feature()
     const Vec3f new_pt = svd.solve(B) + center;
 
     // Erase this triangle fan, as we'll be inserting a vertex in the center.
-    triangles.erase(fan_start, voxel_start);
+    // (the triangles are dropped when the list is compacted, so that
+    // indices stored in swappable stay valid until then).
+    erased.push_back(std::make_pair(start, end));
 
     // Construct a new triangle fan.
     contour.push_back(contour.front());
@@ -368,68 +361,147 @@ void Mesher::check_feature()
     }
 }
 
-void Mesher::remove_dupes()
+std::vector<std::array<uint32_t, 3>> Mesher::vertex_ids() const
 {
-    std::map<std::array<float, 3>, size_t> verts;
-    std::set<std::array<size_t, 3>> tris;
-    size_t vertex_id = 0;
+    std::unordered_map<std::array<float, 3>, uint32_t, KeyHash> verts;
+    verts.reserve(triangles.size());
+
+    std::vector<std::array<uint32_t, 3>> out;
+    out.reserve(triangles.size());
 
-    for (auto itr=triangles.begin(); itr != triangles.end(); ++itr)
+    for (const auto& t : triangles)
     {
-        std::array<size_t, 3> t;
+        std::array<uint32_t, 3> ids;
         int i=0;
-        // For each vertex, find whether it's already in our vertex
-        // set.  Create an array t with vertex indicies.
-        for (auto v : {itr->a_(), itr->b_(), itr->c_()})
+        for (auto v : {t.a_(), t.b_(), t.c_()})
+            ids[i++] = verts.insert(std::make_pair(v, verts.size()))
+                            .first->second;
+        out.push_back(ids);
+    }
+    return out;
+}
+
+void Mesher::compact()
+{
+    if (erased.empty())
+        return;
+
+    // Number of triangles erased before the start of each range
+    std::vector<size_t> before(erased.size());
+    size_t total = 0;
+    for (unsigned r=0; r < erased.size(); ++r)
+    {
+        before[r] = total;
+        total += erased[r].second - erased[r].first;
+    }
+
+    for (auto& s : swappable)
+    {
+        const auto next = std::upper_bound(
+                erased.begin(), erased.end(), std::make_pair(s.second, s.second),
+                [](const std::pair<size_t, size_t>& a,
+                   const std::pair<size_t, size_t>& b)
+                { return a.first < b.first; });
+        if (next != erased.begin())
         {
-            auto k = verts.find(v);
-            if (k != verts.end())
-            {
-                t[i++] = k->second;
-            }
-            else
-            {
-                verts[v] = vertex_id;
-                t[i++] = vertex_id;
-                vertex_id++;
-            }
+            const size_t r = next - erased.begin() - 1;
+            s.second -= before[r] + erased[r].second - erased[r].first;
         }
+    }
+
+    size_t out = 0, in = 0;
+    for (const auto& e : erased)
+    {
+        while (in < e.first)
+            triangles[out++] = triangles[in++];
+        in = e.second;
+    }
+    while (in < triangles.size())
+        triangles[out++] = triangles[in++];
+    triangles.resize(out);
+    erased.clear();
+
+    voxel_start = voxel_end = fan_start = triangles.size();
+}
 
-        // Check to see if there are any other triangles that use these
-        // three vertices; if so, delete this triangle.
+void Mesher::remove_dupes(std::vector<std::array<uint32_t, 3>>* ids)
+{
+    // Sort triangles by their set of three vertices (then by index), so
+    // that duplicates are next to each other.
+    std::vector<std::pair<std::array<uint32_t, 3>, size_t>> sorted;
+    sorted.reserve(triangles.size());
+    for (size_t i=0; i < triangles.size(); ++i)
+    {
+        auto t = (*ids)[i];
         std::sort(t.begin(), t.end());
-        if (tris.count(t))
-        {
-            itr = triangles.erase(itr);
-            itr--;
-        }
-        else
+        sorted.push_back(std::make_pair(t, i));
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    // Keep the first triangle that uses each set of three vertices.
+    std::vector<bool> keep(triangles.size(), false);
+    for (size_t i=0; i < sorted.size(); ++i)
+        if (i == 0 || sorted[i].first != sorted[i - 1].first)
+            keep[sorted[i].second] = true;
+
+    size_t out = 0;
+    for (size_t i=0; i < triangles.size(); ++i)
+    {
+        if (keep[i])
         {
-            tris.insert(t);
+            triangles[out] = triangles[i];
+            (*ids)[out++] = (*ids)[i];
         }
     }
+    triangles.resize(out);
+    ids->resize(out);
 }
 
-void Mesher::prune_flags()
+void Mesher::prune_flags(const std::vector<std::array<uint32_t, 3>>& ids)
 {
-    std::set<std::array<float, 6>> edges;
-    for (auto t : triangles)
+    // Store every edge as its pair of vertex IDs (smaller first), along
+    // with its triangle's index and whether it runs from the smaller ID
+    // to the larger one.  Sorting then groups each edge's uses together.
+    std::vector<std::pair<uint64_t, uint32_t>> edges;
+    edges.reserve(triangles.size() * 3);
+    for (uint32_t i=0; i < ids.size(); ++i)
     {
-        edges.insert(t.ab_());
-        edges.insert(t.bc_());
-        edges.insert(t.ca_());
+        for (int e=0; e < 3; ++e)
+        {
+            const uint32_t a = ids[i][e], b = ids[i][(e + 1) % 3];
+            const uint64_t key = (static_cast<uint64_t>(std::min(a, b)) << 32)
+                               | std::max(a, b);
+            edges.push_back(std::make_pair(key, (i << 1) | (a < b)));
+        }
     }
+    std::sort(edges.begin(), edges.end());
 
-    for (auto itr=triangles.begin(); itr != triangles.end(); ++itr)
+    // An edge is connected if it's used in both directions (edges that
+    // start and end at the same vertex count as both).  Drop triangles
+    // with edges that aren't.
+    std::vector<bool> keep(triangles.size(), true);
+    for (size_t start=0, end; start < edges.size(); start = end)
     {
-        if (!edges.count(itr->ba_()) ||
-            !edges.count(itr->cb_()) ||
-            !edges.count(itr->ac_()))
+        bool forward = false, reverse = false;
+        for (end = start; end < edges.size() &&
+                          edges[end].first == edges[start].first; ++end)
         {
-            itr = triangles.erase(itr);
-            itr--;
+            const bool degenerate = (edges[end].first >> 32) ==
+                                    (edges[end].first & 0xffffffff);
+            forward |= (edges[end].second & 1) || degenerate;
+            reverse |= !(edges[end].second & 1) || degenerate;
         }
+
+        if (!(forward && reverse))
+            for (size_t i=start; i < end; ++i)
+                keep[edges[i].second >> 1] = false;
     }
+
+    size_t out = 0;
+    for (size_t i=0; i < triangles.size(); ++i)
+        if (keep[i])
+            triangles[out++] = triangles[i];
+    triangles.resize(out);
 }
 
 // Loads a vertex into the vertex list.
@@ -441,12 +513,6 @@ void Mesher::push_vert(const float x, const float y, const float z)
     {
         triangles.push_back(Triangle(triangle[0], triangle[1], triangle[2]));
         triangle.clear();
-
-        // If this is the first triangle being constructed (or voxel_start has
-        // just been cleared), store an iterator to this triangle so that we
-        // know where the next triangle fan begins.
-        if (voxel_start == triangles.end())
-            voxel_start--;
     }
 }
 
@@ -456,19 +522,22 @@ void Mesher::push_vert(const float x, const float y, const float z)
 bool Mesher::load_packed(const Region& r)
 {
     // Only load the packed matrix if we have few enough voxels.
-    const unsigned voxels = (r.ni+1) * (r.nj+1) * (r.nk+1);
+    // Prisms only need one layer, since the function doesn't change
+    // between the bottom and top of each column.
+    const unsigned layers = prism ? 1 : r.nk + 1;
+    const unsigned voxels = (r.ni+1) * (r.nj+1) * layers;
     if (voxels >= MIN_VOLUME)
         return false;
 
     // We've already run interval evaluation for this region
     // (at the beginning of triangulate_region), so here we'll
     // just disable inactive nodes.
-    disable_nodes(tree);
+    disable_nodes(ctx);
 
     // Flatten a 3D region into a 1D list of points that
     // touches every point in the region, one by one.
     int q = 0;
-    for (unsigned k=0; k <= r.nk; ++k) {
+    for (unsigned k=0; k < layers; ++k) {
         for (unsigned j=0; j <= r.nj; ++j) {
             for (unsigned i=0; i <= r.ni; ++i) {
                 X[q] = r.X[i];
@@ -493,7 +562,7 @@ bool Mesher::load_packed(const Region& r)
     packed.voxels = voxels;
 
     // Run eval_r and copy the data out
-    memcpy(data, eval_r(tree, packed), voxels * sizeof(float));
+    memcpy(data, eval_r(ctx, packed), voxels * sizeof(float));
     has_data = true;
 
     return true;
@@ -501,7 +570,7 @@ bool Mesher::load_packed(const Region& r)
 
 void Mesher::unload_packed()
 {
-    enable_nodes(tree);
+    enable_nodes(ctx);
     has_data = false;
 }
 
@@ -518,7 +587,7 @@ bool Mesher::get_corner_data(const Region& r, float d[8])
             (r.imin - packed.imin + ((i & 4) ? r.ni : 0)) +
             (r.jmin - packed.jmin + ((i & 2) ? r.nj : 0))
                 * (packed.ni+1) +
-            (r.kmin - packed.kmin + ((i & 1) ? r.nk : 0))
+            (r.kmin - packed.kmin + ((i & 1) && !prism ? r.nk : 0))
                 * (packed.ni+1) * (packed.nj+1);
 
         d[i] = data[index];
@@ -553,7 +622,7 @@ void Mesher::eval_zero_crossings(Vec3f* v0, Vec3f* v1, unsigned count)
             dummy.Y[i] = v0[i][1] * (1 - p[i]) + v1[i][1] * p[i];
             dummy.Z[i] = v0[i][2] * (1 - p[i]) + v1[i][2] * p[i];
         }
-        float* out = eval_r(tree, dummy);
+        float* out = eval_r(ctx, dummy);
 
         for (unsigned i=0; i < count; i++)
             if      (out[i] < 0)    p[i] += step;
@@ -563,95 +632,249 @@ void Mesher::eval_zero_crossings(Vec3f* v0, Vec3f* v1, unsigned count)
     }
 }
 
+void Mesher::eval_zero_crossings_illinois(Vec3f* v0, Vec3f* v1,
+                                          float* d0, float* d1, unsigned count)
+{
+    // Each edge's root is kept bracketed between a and b (as fractions of
+    // the way from v0 to v1), where the function's values are fa < 0 and
+    // fb >= 0.  side records which end moved last: if the same end moves
+    // twice in a row, the other end's value is halved so that it doesn't
+    // get stuck (which is what makes this the Illinois method).
+    float a[count], b[count], fa[count], fb[count], p[count], len[count];
+    int8_t side[count];
+
+    // Indices of edges that haven't converged yet
+    unsigned active[count];
+    unsigned n = 0;
+
+    for (unsigned i=0; i < count; ++i)
+    {
+        a[i] = 0;
+        b[i] = 1;
+        fa[i] = d0[i];
+        fb[i] = d1[i];
+        p[i] = -d0[i] / (d1[i] - d0[i]);
+        len[i] = (v1[i] - v0[i]).norm();
+        side[i] = 0;
+
+        // If v1 is on the surface, then it's the root (which is common
+        // when the surface is aligned to the voxel grid).
+        if (len[i] > tolerance && d1[i] != 0)
+            active[n++] = i;
+    }
+
+    Region dummy;
+    dummy.X = ex;
+    dummy.Y = ey;
+    dummy.Z = ez;
+
+    // Every iteration evaluates the active edges' next guesses, packed
+    // together at the start of the buffers.
+    for (int iteration=0; n && iteration < 32; ++iteration)
+    {
+        for (unsigned j=0; j < n; ++j)
+        {
+            const unsigned i = active[j];
+
+            // False position step, falling back to bisection if it doesn't
+            // land strictly inside of the bracket.
+            float t = a[i] - fa[i] * (b[i] - a[i]) / (fb[i] - fa[i]);
+            if (!(t > a[i] && t < b[i]))
+                t = (a[i] + b[i]) / 2;
+            p[i] = t;
+
+            dummy.X[j] = v0[i][0] * (1 - t) + v1[i][0] * t;
+            dummy.Y[j] = v0[i][1] * (1 - t) + v1[i][1] * t;
+            dummy.Z[j] = v0[i][2] * (1 - t) + v1[i][2] * t;
+        }
+        dummy.voxels = n;
+        float* out = eval_r(ctx, dummy);
+
+        unsigned m = 0;
+        for (unsigned j=0; j < n; ++j)
+        {
+            const unsigned i = active[j];
+            if (out[j] < 0)
+            {
+                a[i] = p[i];
+                fa[i] = out[j];
+                if (side[i] < 0)
+                    fb[i] /= 2;
+                side[i] = -1;
+            }
+            else if (out[j] > 0)
+            {
+                b[i] = p[i];
+                fb[i] = out[j];
+                if (side[i] > 0)
+                    fa[i] /= 2;
+                side[i] = 1;
+            }
+            else
+            {
+                a[i] = b[i] = p[i];
+            }
+
+            if ((b[i] - a[i]) * len[i] > tolerance)
+                active[m++] = i;
+        }
+        n = m;
+    }
+
+    // Keep vertices at least as far from the edge's ends as the binary
+    // search would, so that vertices on different edges never coincide
+    // (e.g. when the surface passes through a corner).
+    for (unsigned i=0; i < count; ++i)
+    {
+        const float t = fmin(fmax(p[i], 1/512.0f), 511/512.0f);
+        ex[i] = v0[i][0] * (1 - t) + v1[i][0] * t;
+        ey[i] = v0[i][1] * (1 - t) + v1[i][1] * t;
+        ez[i] = v0[i][2] * (1 - t) + v1[i][2] * t;
+    }
+}
+
 // Flushes out a queue of interpolation commands
 void Mesher::flush_queue()
 {
     Vec3f low[MIN_VOLUME];
     Vec3f high[MIN_VOLUME];
+    float d0[MIN_VOLUME];
+    float d1[MIN_VOLUME];
 
-    // Go through the list, saving a list of vertex pairs on which
-    // interpolation should be run into low and high.
-    unsigned count=0;
-    for (auto c : queue)
+    // Find the zero crossings that have been requested since the last
+    // flush, then store their positions in the edge cache.
+    const unsigned count = pending.size();
+    for (unsigned i=0; i < count; ++i)
     {
-        if (c.cmd == InterpolateCommand::INTERPOLATE)
-        {
-            low[count] = c.v0;
-            high[count] = c.v1;
-            count++;
-        }
+        low[i] = pending[i].v0;
+        high[i] = pending[i].v1;
+        d0[i] = pending[i].d0;
+        d1[i] = pending[i].d1;
     }
 
-    if (count)
+    if (count && tolerance > 0)
+        eval_zero_crossings_illinois(low, high, d0, d1, count);
+    else if (count)
         eval_zero_crossings(low, high, count);
 
+    for (unsigned i=0; i < count; ++i)
+        pending[i].crossing->pos = Vec3f(ex[i], ey[i], ez[i]);
+    pending.clear();
+
+    // Record where crossings on the region's faces ended up (for append)
+    for (const auto& f : new_face_crossings)
+    {
+        const Vec3f& v = f.second->pos;
+        face_crossings[f.first] = {{float(v[0]), float(v[1]), float(v[2])}};
+    }
+    new_face_crossings.clear();
+
     // Next, go through and actually load vertices
-    // (either directly or from the cache)
-    count = 0;
     for (auto c : queue)
     {
-        if (c.cmd == InterpolateCommand::INTERPOLATE)
-        {
-            push_vert(ex[count], ey[count], ez[count]);
-            count++;
-        }
-        else if (c.cmd == InterpolateCommand::CACHED)
+        if (c.cmd == InterpolateCommand::VERTEX)
         {
-            unsigned i = c.cached;
-            push_vert(ex[i], ey[i], ez[i]);
+            const Vec3f& v = c.crossing->pos;
+            push_vert(v[0], v[1], v[2]);
         }
         else if (c.cmd == InterpolateCommand::END_OF_VOXEL)
         {
             if (detect_edges)
             {
-                // Clear voxel_end
-                // (it will be reset when the next triangle is pushed)
-                voxel_end = triangles.end();
-
-                // Then, iterate until no more features are found in
-                // the current voxel.
-                while (voxel_start != voxel_end &&
-                       voxel_start != triangles.end())
-                {
-                    check_feature();
-                }
-
-                // Clear voxel_start
-                // (it will be reset when the next triangle is pushed)
-                voxel_start = triangles.end();
+                // Mark the end of this voxel's triangles
+                // (new fans are added after voxel_end)
+                voxel_end = triangles.size();
+
+                // Then, check every fan in the current voxel for features.
+                check_features();
+
+                // Clear voxel_start, so that the next voxel's
+                // triangles begin at the end of the list.
+                voxel_start = triangles.size();
             }
         }
     }
     queue.clear();
+
+    // Drop crossings that no other voxel will ask for
+    for (const auto& k : retired)
+        edges.erase(k);
+    retired.clear();
 }
 
-// Schedule an interpolate calculation in the queue.
-void Mesher::interpolate_between(const Vec3f& v0, const Vec3f& v1)
+// Schedule a vertex in the queue, finding its edge's zero crossing in
+// the cache or scheduling an interpolate calculation.
+void Mesher::interpolate_between(const Region& r, const float* const d,
+                                 uint8_t v0, uint8_t v1)
 {
-    InterpolateCommand next = (InterpolateCommand){
-        .cmd=InterpolateCommand::INTERPOLATE, .v0=v0, .v1=v1};
-
-    // Walk through the list, looking for duplicates.
-    // If we find the same operation, then switch to a CACHED lookup instead.
-    unsigned count = 0;
-    for (auto c : queue)
+    EdgeCrossing*& found = voxel_edges[v0][v1];
+    if (found == NULL)
     {
-        if (c.cmd == InterpolateCommand::INTERPOLATE)
+        // Find the lattice coordinates of each end of the edge.
+        std::array<uint32_t, 3> a, b;
+        for (int i=0; i < 2; ++i)
         {
-            if ((v0 == c.v0 && v1 == c.v1) || (v0 == c.v1 && v1 == c.v0))
-            {
-                next.cmd = InterpolateCommand::CACHED;
-                next.cached = count;
-            }
-            count++;
+            const uint8_t v = i ? v1 : v0;
+            auto& p = i ? b : a;
+            p[0] = r.imin + ((v & 4) ? 1 : 0);
+            p[1] = r.jmin + ((v & 2) ? 1 : 0);
+            p[2] = r.kmin + ((v & 1) ? 1 : 0);
+        }
+        if (b < a)
+            std::swap(a, b);
+        const EdgeKey key = {{a[0], a[1], a[2], b[0], b[1], b[2]}};
+
+        auto inserted = edges.insert(std::make_pair(key, EdgeCrossing()));
+        found = &inserted.first->second;
+        if (inserted.second)
+        {
+            found->uses = edge_users(key);
+            pending.push_back((PendingCrossing){
+                    .crossing=found,
+                    .v0={(v0 & 4) ? r.X[1] : r.X[0],
+                         (v0 & 2) ? r.Y[1] : r.Y[0],
+                         (v0 & 1) ? r.Z[1] : r.Z[0]},
+                    .v1={(v1 & 4) ? r.X[1] : r.X[0],
+                         (v1 & 2) ? r.Y[1] : r.Y[0],
+                         (v1 & 1) ? r.Z[1] : r.Z[0]},
+                    .d0=d[v0], .d1=d[v1]});
+            if (on_face(key))
+                new_face_crossings.push_back(std::make_pair(key, found));
         }
+
+        if (--found->uses == 0)
+            retired.push_back(key);
+
+        voxel_edges[v1][v0] = found;
     }
 
-    queue.push_back(next);
-    if (next.cmd == InterpolateCommand::INTERPOLATE && count + 1 == MIN_VOLUME)
-        flush_queue();
+    queue.push_back((InterpolateCommand){
+            .cmd=InterpolateCommand::VERTEX, .crossing=found});
+}
+
+uint8_t Mesher::edge_users(const EdgeKey& k) const
+{
+    // Along each axis that the edge doesn't run along, there may be
+    // voxels on either side of it (unless it's on the region's boundary).
+    uint8_t users = 1;
+    for (int a=0; a < 3; ++a)
+    {
+        if (k[a] == k[a + 3])
+            users *= (k[a] > lattice[a]) + (k[a] < lattice[a + 3]);
+    }
+    return users;
 }
 
+bool Mesher::on_face(const EdgeKey& k) const
+{
+    for (int a=0; a < 3; ++a)
+    {
+        if (k[a] == k[a + 3] &&
+            (k[a] == lattice[a] || k[a] == lattice[a + 3]))
+            return true;
+    }
+    return false;
+}
 
 void Mesher::triangulate_tet(const Region& r, const float* const d,
                              const int t)
@@ -677,19 +900,19 @@ void Mesher::triangulate_tet(const Region& r, const float* const d,
             const uint8_t v0 = vertices[EDGE_MAP[lookup][i][v][0]];
             const uint8_t v1 = vertices[EDGE_MAP[lookup][i][v][1]];
 
-            interpolate_between(
-                        (Vec3f){(v0 & 4) ? r.X[1] : r.X[0],
-                                (v0 & 2) ? r.Y[1] : r.Y[0],
-                                (v0 & 1) ? r.Z[1] : r.Z[0]},
-                        (Vec3f){(v1 & 4) ? r.X[1] : r.X[0],
-                                (v1 & 2) ? r.Y[1] : r.Y[0],
-                                (v1 & 1) ? r.Z[1] : r.Z[0]});
+            interpolate_between(r, d, v0, v1);
         }
     }
 }
 
 void Mesher::triangulate_voxel(const Region& r, const float* const d)
 {
+    // A voxel has 19 edges (including diagonals), any of which may need
+    // a new zero crossing, so make sure that they'll fit in the buffers.
+    if (pending.size() + 19 > MIN_VOLUME)
+        flush_queue();
+    memset(voxel_edges, 0, sizeof(voxel_edges));
+
     for (int t=0; t < 6; ++t)
         triangulate_tet(r, d, t);
 }
@@ -701,12 +924,52 @@ void Mesher::triangulate_region(const Region& r)
         return;
 
     // Do a round of interval evaluation to skip empty regions.
-    auto interval = eval_i(tree, (Interval){r.X[0], r.X[r.ni]},
-                                 (Interval){r.Y[0], r.Y[r.nj]},
-                                 (Interval){r.Z[0], r.Z[r.nk]});
+    auto interval = eval_i(ctx, (Interval){r.X[0], r.X[r.ni]},
+                                (Interval){r.Y[0], r.Y[r.nj]},
+                                (Interval){r.Z[0], r.Z[r.nk]});
     if (interval.lower > 0 || interval.upper < 0)
         return;
 
+    // Store the lattice bounds, which are used to count how many voxels
+    // share each edge.
+    lattice = {{r.imin, r.jmin, r.kmin,
+                r.imin + r.ni, r.jmin + r.nj, r.kmin + r.nk}};
+
+    triangulate_ambiguous(r);
+}
+
+void Mesher::triangulate_ambiguous(const Region& r)
+{
+    // Early abort if the halt flag is set
+    if (*halt)
+        return;
+
+    // If the pruned tree doesn't depend on Z, this region is part of an
+    // extrusion.  Flatten it into a single layer of voxels that span its
+    // full height, so that it's meshed as prisms without subdividing Z.
+    if (!has_data && !prism && r.nk > 1)
+    {
+        disable_nodes(ctx);
+        if (!(active_axes(ctx) & 1))
+        {
+            float z[2] = {r.Z[0], r.Z[r.nk]};
+            Region flat = r;
+            flat.nk = 1;
+            flat.voxels = r.ni * r.nj;
+            flat.Z = z;
+
+            prism = true;
+            prism_top = r.kmin + r.nk;
+            prism_z = r.Z;
+            triangulate_ambiguous(flat);
+            prism = false;
+
+            enable_nodes(ctx);
+            return;
+        }
+        enable_nodes(ctx);
+    }
+
     // If we can calculate all of the points in this region with a single
     // eval_r call, then do so.  This large chunk will be used in future
     // recursive calls to make things more efficient.
@@ -716,14 +979,41 @@ void Mesher::triangulate_region(const Region& r)
     else
         loaded_data = false;
 
-    // If we have greater than one voxel, subdivide and recurse.
+    // If we have greater than one voxel, subdivide and recurse,
+    // evaluating every octant in a single pass to skip empty ones.
     if (r.voxels > 1)
     {
         Region octants[8];
         const uint8_t split = octsect(r, octants);
+
+        Interval X[8], Y[8], Z[8], out[8];
+        int lanes[8];
+        unsigned count = 0;
         for (int i=0; i < 8; ++i)
+        {
             if (split & (1 << i))
-                triangulate_region(octants[i]);
+            {
+                const Region& o = octants[i];
+                X[count] = (Interval){o.X[0], o.X[o.ni]};
+                Y[count] = (Interval){o.Y[0], o.Y[o.nj]};
+                Z[count] = (Interval){o.Z[0], o.Z[o.nk]};
+                lanes[count++] = i;
+            }
+        }
+
+        eval_i_batch(ctx, X, Y, Z, count, out);
+        for (unsigned q=0; q < count; ++q)
+        {
+            if (out[q].lower > 0 || out[q].upper < 0)
+                continue;
+
+            // load_packed prunes the tree based on the octant's results,
+            // so they need to be in the context's slots.
+            if (!has_data)
+                select_batch(ctx, q);
+            triangulate_ambiguous(octants[lanes[q]]);
+        }
+        pop_batch(ctx);
     }
     else
     {
@@ -733,13 +1023,26 @@ void Mesher::triangulate_region(const Region& r)
 
         if (get_corner_data(r, d))
         {
-            // Triangulate this particular voxel
-            triangulate_voxel(r, d);
+            // A prism is triangulated one layer of the lattice at a time
+            // (with the same corner values in every layer), so that its
+            // vertices line up with neighbouring voxels that were
+            // subdivided in Z.
+            Region voxel = r;
+            const uint32_t top = prism ? prism_top : r.kmin + 1;
+            for (voxel.kmin = r.kmin; voxel.kmin < top; ++voxel.kmin)
+            {
+                if (prism)
+                    voxel.Z = prism_z + (voxel.kmin - r.kmin);
+
+                // Triangulate this particular voxel
+                triangulate_voxel(voxel, d);
 
-            // Mark that a voxel has ended
-            // (which triggers mesh refinment)
-            queue.push_back((InterpolateCommand){
-                    .cmd=InterpolateCommand::END_OF_VOXEL});
+                // Mark that a voxel has ended
+                // (which triggers mesh refinment)
+                queue.push_back((InterpolateCommand){
+                        .cmd=InterpolateCommand::END_OF_VOXEL,
+                        .crossing=NULL});
+            }
         }
     }
 
@@ -756,10 +1059,12 @@ void Mesher::triangulate_region(const Region& r)
 
 float* Mesher::get_verts(unsigned* count)
 {
+    compact();
     if (detect_edges)
     {
-        remove_dupes();
-        prune_flags();
+        auto ids = vertex_ids();
+        remove_dupes(&ids);
+        prune_flags(ids);
     }
 
     // There are 9 floats in each triangle
@@ -768,10 +1073,84 @@ float* Mesher::get_verts(unsigned* count)
     float* out = (float*)malloc(sizeof(float) * (*count));
 
     unsigned i = 0;
-    for (auto t : triangles)
-        for (auto v : {t.a, t.b, t.c})
+    for (const auto& t : triangles)
+        for (auto v : {&t.a, &t.b, &t.c})
             for (int j=0; j < 3; ++j)
-                out[i++] = v[j];
+                out[i++] = (*v)[j];
 
     return out;
 }
+
+void Mesher::append(Mesher& other)
+{
+    other.compact();
+    if (other.triangles.empty())
+    {
+        other.swappable.clear();
+        return;
+    }
+
+    // Snap other's copies of crossings on our shared faces to ours (which
+    // the serial walk would have found first), matching vertices by their
+    // exact position.
+    std::unordered_map<std::array<float, 3>, std::array<float, 3>, KeyHash>
+        snapped;
+    for (const auto& f : other.face_crossings)
+    {
+        auto found = face_crossings.insert(f);
+        if (!found.second && found.first->second != f.second)
+            snapped[f.second] = found.first->second;
+    }
+    other.face_crossings.clear();
+
+    if (!snapped.empty())
+    {
+        for (auto& t : other.triangles)
+        {
+            for (Vec3f* v : {&t.a, &t.b, &t.c})
+            {
+                auto found = snapped.find({{float((*v)[0]), float((*v)[1]),
+                                            float((*v)[2])}});
+                if (found != snapped.end())
+                    *v = Vec3f(found->second[0], found->second[1],
+                               found->second[2]);
+            }
+        }
+    }
+
+    // Triangles that are still waiting for a swap partner
+    std::vector<bool> waiting(other.triangles.size(), false);
+    for (const auto& s : other.swappable)
+        waiting[s.second] = true;
+    other.swappable.clear();
+
+    // Indices of our triangles are unchanged by appending to the list
+    const size_t start = triangles.size();
+    if (voxel_start == start)
+        voxel_start += other.triangles.size();
+    triangles.insert(triangles.end(), other.triangles.begin(),
+                     other.triangles.end());
+    std::vector<Triangle>().swap(other.triangles);
+
+    // Replay unmatched swappable triangles (in the order in which they
+    // were created) against our own set of unmatched triangles.
+    for (size_t i=0; i < waiting.size(); ++i)
+    {
+        if (!waiting[i])
+            continue;
+
+        Triangle& t = triangles[start + i];
+        auto found = swappable.find(t.ab_());
+        if (found != swappable.end())
+        {
+            Triangle& partner = triangles[found->second];
+            partner.b = t.c;
+            t.b = partner.c;
+            swappable.erase(found);
+        }
+        else
+        {
+            swappable[t.ba_()] = start + i;
+        }
+    }
+}
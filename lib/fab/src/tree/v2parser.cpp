@@ -46,6 +46,9 @@ bool v2parse(Node **result, const char* input, Node* X, Node* Y, Node *Z, NodeCa
     locals->Xnode = X;
     locals->Ynode = Y;
     locals->Znode = Z;
+    locals->rootX = X;
+    locals->rootY = Y;
+    locals->rootZ = Z;
     locals->cache = cache;
     locals->nodestack = new std::stack<Node*>();
 
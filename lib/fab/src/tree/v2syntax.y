@@ -71,13 +71,42 @@ v1_expr(E) 			::= V1MAP v1_assignment_exprs v1_expr(O).
 				environment->nodestack->pop();
 			}
 
-v1_expr(E)	::= V1PLUS v1_expr(L) v1_expr(R). 			{	E = CACHED(add_n(L, R)); 	}
+// A bounded shape: six constant sides {xmin, ymin, zmin, xmax, ymax, zmax}
+// (with _ for an infinite side), then the shape.  Boxes are in the string's
+// outer coordinates, so they're dropped inside maps that move an axis.
+v1_expr(E)			::= V1BOUNDS v1_assignment_expr(X0) v1_assignment_expr(Y0) v1_assignment_expr(Z0) v1_assignment_expr(X1) v1_assignment_expr(Y1) v1_assignment_expr(Z1) v1_expr(O).
+			{
+				const Node* sides[6] = {X0, Y0, Z0, X1, Y1, Z1};
+				float box[6];
+				for (int i=0; i < 6; ++i)
+				{
+					if (!sides[i])
+						box[i] = i < 3 ? -INFINITY : INFINITY;
+					else if (sides[i]->opcode == OP_CONST)
+						box[i] = sides[i]->value;
+					else
+						environment->valid = false;
+				}
+
+				if (environment->valid &&
+					environment->Xnode == environment->rootX &&
+					environment->Ynode == environment->rootY &&
+					environment->Znode == environment->rootZ)
+					E = CACHED(bounds_n(O, box));
+				else
+					E = O;
+			}
+
+v1_expr(E)	::= V1PLUS v1_expr(L) v1_expr(R).			{	E = CACHED(add_n(L, R)); 	}
 v1_expr(E)	::= V1MINUS v1_expr(L) v1_expr(R).			{	E = CACHED(sub_n(L, R)); 	}
 v1_expr(E)	::= V1MUL v1_expr(L) v1_expr(R).  			{	E = CACHED(mul_n(L, R)); 	}
 v1_expr(E)	::= V1DIV v1_expr(L) v1_expr(R).  			{	E = CACHED(div_n(L, R)); 	}
 v1_expr(E)	::= V1MIN v1_expr(L) v1_expr(R).  			{	E = CACHED(min_n(L, R)); 	}
 v1_expr(E)	::= V1MAX v1_expr(L) v1_expr(R).  			{	E = CACHED(max_n(L, R)); 	}
 v1_expr(E)	::= V1POW v1_expr(L) v1_expr(R).  			{	E = CACHED(pow_n(L, R)); 	}
+v1_expr(E)	::= V1MOD v1_expr(L) v1_expr(R).  			{	E = CACHED(mod_n(L, R)); 	}
+v1_expr(E)	::= V1REPEAT v1_expr(L) v1_expr(R).			{	E = CACHED(repeat_n(L, R)); 	}
+v1_expr(E)	::= V1ATAN2 v1_expr(L) v1_expr(R).			{	E = CACHED(atan2_n(L, R)); 	}
 
 v1_expr(E)	::= V1SIN v1_expr(O).   				{	E = CACHED(sin_n(O)); 	}
 v1_expr(E)	::= V1COS v1_expr(O).   				{	E = CACHED(cos_n(O)); 	}
@@ -122,6 +151,8 @@ expr(E)		::= MIN LPAREN expr(L) COMMA expr(R) RPAREN.		{	E = CACHED(min_n(L, R))
 expr(E)		::= MAX LPAREN expr(L) COMMA expr(R) RPAREN.	{	E = CACHED(max_n(L, R)); 	}
 expr(E)		::= POW LPAREN expr(L) COMMA expr(R) RPAREN.	{	E = CACHED(pow_n(L, R)); 	}
 expr(E)		::= ATAN2 LPAREN expr(A) COMMA expr(B) RPAREN.	{	E = CACHED(atan2_n(A, B)); 	}
+expr(E)		::= MOD LPAREN expr(L) COMMA expr(R) RPAREN.	{	E = CACHED(mod_n(L, R)); 	}
+expr(E)		::= REPEAT LPAREN expr(L) COMMA expr(R) RPAREN.	{	E = CACHED(repeat_n(L, R)); 	}
 
 expr(E)		::= SIN LPAREN expr(O) RPAREN.			{	E = CACHED(sin_n(O)); 	}
 expr(E)		::= COS LPAREN expr(O) RPAREN.			{	E = CACHED(cos_n(O)); 	}
@@ -2,11 +2,12 @@
 #include <cmath>
 
 #include "fab/types/bounds.h"
+#include "fab/types/parse_cache.h"
 #include "fab/fab.h"
 
 #include "fab/tree/tree.h"
-#include "fab/tree/parser.h"
 #include "fab/tree/eval.h"
+#include "fab/tree/context.h"
 #include "fab/util/interval.h"
 
 Bounds::Bounds()
@@ -42,35 +43,26 @@ Bounds Bounds::map(Transform t) const
 
     if (t.x_reverse.length())
     {
-        MathTree* tree = parse(t.x_reverse.c_str());
-        if (tree == NULL)
-        {
-            throw fab::ParseError();
-        }
-        x_out = eval_i(tree, x, y, z);
-        free_tree(tree);
+        auto tree = ParseCache::instance().get(t.x_reverse).tree;
+        EvalContext* ctx = new_context(tree.get());
+        x_out = eval_i(ctx, x, y, z);
+        free_context(ctx);
     }
 
     if (t.y_reverse.length())
     {
-        MathTree* tree = parse(t.y_reverse.c_str());
-        if (tree == NULL)
-        {
-            throw fab::ParseError();
-        }
-        y_out = eval_i(tree, x, y, z);
-        free_tree(tree);
+        auto tree = ParseCache::instance().get(t.y_reverse).tree;
+        EvalContext* ctx = new_context(tree.get());
+        y_out = eval_i(ctx, x, y, z);
+        free_context(ctx);
     }
 
     if (t.z_reverse.length())
     {
-        MathTree* tree = parse(t.z_reverse.c_str());
-        if (tree == NULL)
-        {
-            throw fab::ParseError();
-        }
-        z_out = eval_i(tree, x, y, z);
-        free_tree(tree);
+        auto tree = ParseCache::instance().get(t.z_reverse).tree;
+        EvalContext* ctx = new_context(tree.get());
+        z_out = eval_i(ctx, x, y, z);
+        free_context(ctx);
     }
 
     return Bounds(x_out.lower, y_out.lower, z_out.lower,
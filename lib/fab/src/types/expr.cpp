@@ -0,0 +1,557 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "fab/types/expr.h"
+
+#include "fab/tree/tree.h"
+#include "fab/tree/parser.h"
+#include "fab/tree/node/node.h"
+
+namespace
+{
+
+typedef std::array<float, 6> Box;
+
+const Box everywhere = {{-INFINITY, -INFINITY, -INFINITY,
+                          INFINITY,  INFINITY,  INFINITY}};
+
+struct Key
+{
+    Opcode op;
+    uint32_t bits[6];   // Value of a constant or box of a bounded node
+    const Expr* lhs;
+    const Expr* rhs;
+
+    bool operator==(const Key& other) const
+    {
+        return op == other.op && !memcmp(bits, other.bits, sizeof(bits)) &&
+               lhs == other.lhs && rhs == other.rhs;
+    }
+};
+
+struct KeyHash
+{
+    size_t operator()(const Key& k) const
+    {
+        size_t h = std::hash<const void*>()(k.lhs);
+        h = h * 31 + std::hash<const void*>()(k.rhs);
+        for (auto b : k.bits)
+            h = h * 31 + b;
+        h = h * 31 + k.op;
+        return h;
+    }
+};
+
+Key make_key(Opcode op, float value, const float* box,
+             const Expr* lhs, const Expr* rhs)
+{
+    Key k = {op, {0, 0, 0, 0, 0, 0}, lhs, rhs};
+    if (op == OP_CONST)
+        memcpy(k.bits, &value, sizeof(value));
+    else if (op == OP_BOUNDS)
+        memcpy(k.bits, box, sizeof(k.bits));
+    return k;
+}
+
+// The intern table is leaked on purpose, so that expressions that outlive
+// static destruction (e.g. held by Python objects) can still remove
+// themselves safely.
+std::mutex& table_mutex()
+{
+    static std::mutex* m = new std::mutex;
+    return *m;
+}
+
+std::unordered_map<Key, std::weak_ptr<const Expr>, KeyHash>& table()
+{
+    static auto* t =
+        new std::unordered_map<Key, std::weak_ptr<const Expr>, KeyHash>;
+    return *t;
+}
+
+// Makes a (not yet cached) Node for an expression, given its children.
+Node* make_node(const Expr* e, Node* a, Node* b)
+{
+    switch (e->op)
+    {
+        case OP_ADD:    return add_n(a, b);
+        case OP_SUB:    return sub_n(a, b);
+        case OP_MUL:    return mul_n(a, b);
+        case OP_DIV:    return div_n(a, b);
+        case OP_MIN:    return min_n(a, b);
+        case OP_MAX:    return max_n(a, b);
+        case OP_POW:    return pow_n(a, b);
+        case OP_MOD:    return mod_n(a, b);
+        case OP_REPEAT: return repeat_n(a, b);
+        case OP_ATAN2:  return atan2_n(a, b);
+
+        case OP_ABS:    return abs_n(a);
+        case OP_SQUARE: return square_n(a);
+        case OP_SQRT:   return sqrt_n(a);
+        case OP_SIN:    return sin_n(a);
+        case OP_COS:    return cos_n(a);
+        case OP_TAN:    return tan_n(a);
+        case OP_ASIN:   return asin_n(a);
+        case OP_ACOS:   return acos_n(a);
+        case OP_ATAN:   return atan_n(a);
+        case OP_NEG:    return neg_n(a);
+        case OP_EXP:    return exp_n(a);
+
+        case OP_X:      return X_n();
+        case OP_Y:      return Y_n();
+        case OP_Z:      return Z_n();
+        case OP_CONST:  return constant_n(e->value);
+        case OP_BOUNDS: return bounds_n(a, e->box.data());
+
+        // Affine nodes are only made by simplification,
+        // so expressions never contain them.
+        case OP_AFFINE:
+        case LAST_OP:   break;
+    }
+    return NULL;
+}
+
+// Calls f(e) on every node reachable from root, children before parents
+// and each node exactly once.  Iterative, since union chains can be deep.
+template <typename F>
+void post_order(const Expr* root, F f)
+{
+    std::unordered_map<const Expr*, bool> seen;
+    std::vector<std::pair<const Expr*, bool>> todo = {{root, false}};
+
+    while (!todo.empty())
+    {
+        const Expr* e = todo.back().first;
+        const bool expanded = todo.back().second;
+        todo.pop_back();
+
+        if (expanded)
+        {
+            f(e);
+            continue;
+        }
+        if (!seen.insert({e, true}).second)
+            continue;
+
+        todo.push_back({e, true});
+        if (e->rhs)
+            todo.push_back({e->rhs.get(), false});
+        if (e->lhs)
+            todo.push_back({e->lhs.get(), false});
+    }
+}
+
+bool is_infinite(const Box& b)
+{
+    for (int a=0; a < 3; ++a)
+        if (!std::isinf(b[a]) || !std::isinf(b[a + 3]))
+            return false;
+    return true;
+}
+
+Box intersect(const Box& a, const Box& b)
+{
+    Box out;
+    for (int i=0; i < 3; ++i)
+    {
+        out[i] = fmax(a[i], b[i]);
+        out[i + 3] = fmin(a[i + 3], b[i + 3]);
+    }
+    return out;
+}
+
+Box merge(const Box& a, const Box& b)
+{
+    Box out;
+    for (int i=0; i < 3; ++i)
+    {
+        out[i] = fmin(a[i], b[i]);
+        out[i + 3] = fmax(a[i + 3], b[i + 3]);
+    }
+    return out;
+}
+
+// Returns true if any node reachable from root is bounded
+bool has_bounds(const Expr* root)
+{
+    bool found = false;
+    post_order(root, [&](const Expr* e) { found |= e->op == OP_BOUNDS; });
+    return found;
+}
+
+// Rebuilds a node with new children
+Expr::Ptr rebuild(const Expr* e, Expr::Ptr lhs, Expr::Ptr rhs)
+{
+    if (!lhs)
+        return e->shared_from_this();
+    else if (e->op == OP_BOUNDS)
+        return Expr::bounded(lhs, e->box.data());
+    else if (!rhs)
+        return Expr::unary(e->op, lhs);
+    else
+        return Expr::binary(e->op, lhs, rhs);
+}
+
+/*  An operand of a union, along with a box outside of which it's empty.
+ *  Since a union is empty wherever it's bounded, each operand is also
+ *  empty outside of the boxes of the unions that contain it.  */
+struct Leaf
+{
+    const Expr* expr;
+    Box box;
+};
+
+// Collects the operands of a cluster of unions, looking through
+// bounds on nested unions.
+std::vector<Leaf> union_leaves(const Expr* root)
+{
+    std::vector<Leaf> leaves;
+    std::unordered_set<const Expr*> seen;
+    std::vector<Leaf> todo = {{root, everywhere}};
+
+    while (!todo.empty())
+    {
+        const Leaf t = todo.back();
+        todo.pop_back();
+
+        const Expr* e = t.expr;
+        if (!seen.insert(e).second)
+            continue;
+
+        if (e->op == OP_BOUNDS && e->lhs->op == OP_MIN)
+        {
+            todo.push_back({e->lhs.get(), intersect(t.box, e->box)});
+        }
+        else if (e->op == OP_MIN)
+        {
+            todo.push_back({e->rhs.get(), t.box});
+            todo.push_back({e->lhs.get(), t.box});
+        }
+        else
+        {
+            leaves.push_back({e, e->op == OP_BOUNDS ? intersect(t.box, e->box)
+                                                    : t.box});
+        }
+    }
+    return leaves;
+}
+
+struct Item
+{
+    Expr::Ptr expr;
+    Box box;
+    float center[3];
+};
+
+// Builds a bounding volume hierarchy over items [begin, end), splitting
+// at the median along the axis where their centers are most spread out.
+Expr::Ptr build_bvh(std::vector<Item>& items, size_t begin, size_t end,
+                    Box* box)
+{
+    if (end - begin == 1)
+    {
+        *box = items[begin].box;
+        return Expr::bounded(items[begin].expr, box->data());
+    }
+
+    int axis = -1;
+    float spread = 0;
+    for (int a=0; a < 3; ++a)
+    {
+        float lo = INFINITY, hi = -INFINITY;
+        for (size_t i=begin; i < end; ++i)
+        {
+            lo = fmin(lo, items[i].center[a]);
+            hi = fmax(hi, items[i].center[a]);
+        }
+        if (hi - lo > spread)
+        {
+            spread = hi - lo;
+            axis = a;
+        }
+    }
+
+    const size_t mid = (begin + end) / 2;
+    if (axis != -1)
+        std::nth_element(items.begin() + begin, items.begin() + mid,
+                         items.begin() + end,
+                         [=](const Item& a, const Item& b)
+                         { return a.center[axis] < b.center[axis]; });
+
+    Box lbox, rbox;
+    auto lhs = build_bvh(items, begin, mid, &lbox);
+    auto rhs = build_bvh(items, mid, end, &rbox);
+    *box = merge(lbox, rbox);
+    return Expr::bounded(Expr::binary(OP_MIN, lhs, rhs), box->data());
+}
+
+// Rebuilds a cluster of unions, given the rebuilt operands
+Expr::Ptr build_union(const std::vector<Leaf>& leaves,
+                      const std::unordered_map<const Expr*, Expr::Ptr>& out)
+{
+    std::vector<Item> bounded;
+    Expr::Ptr result;
+
+    for (const auto& leaf : leaves)
+    {
+        auto e = out.at(leaf.expr);
+        if (is_infinite(leaf.box))
+        {
+            result = result ? Expr::binary(OP_MIN, result, e) : e;
+            continue;
+        }
+
+        // Infinite sides are ignored when picking the center
+        Item item = {e, leaf.box, {0, 0, 0}};
+        for (int a=0; a < 3; ++a)
+        {
+            const float lo = leaf.box[a], hi = leaf.box[a + 3];
+            item.center[a] = std::isinf(lo) ? (std::isinf(hi) ? 0 : hi)
+                           : std::isinf(hi) ? lo : (lo + hi) / 2;
+        }
+        bounded.push_back(item);
+    }
+
+    if (!bounded.empty())
+    {
+        Box box;
+        auto bvh = build_bvh(bounded, 0, bounded.size(), &box);
+        result = result ? Expr::binary(OP_MIN, result, bvh) : bvh;
+    }
+    return result;
+}
+
+// Rebuilds every cluster of unions in the expression as a bounding
+// volume hierarchy.  Like post_order, this is iterative; the children
+// of a union are the operands of its cluster.
+Expr::Ptr balance(const Expr* root)
+{
+    std::unordered_map<const Expr*, Expr::Ptr> out;
+    std::unordered_map<const Expr*, std::vector<Leaf>> clusters;
+    std::unordered_set<const Expr*> seen;
+    std::vector<std::pair<const Expr*, bool>> todo = {{root, false}};
+
+    while (!todo.empty())
+    {
+        const Expr* e = todo.back().first;
+        const bool expanded = todo.back().second;
+        todo.pop_back();
+
+        if (expanded)
+        {
+            if (e->op == OP_MIN)
+            {
+                out[e] = build_union(clusters.at(e), out);
+                clusters.erase(e);
+            }
+            else
+            {
+                out[e] = rebuild(e, e->lhs ? out.at(e->lhs.get()) : nullptr,
+                                    e->rhs ? out.at(e->rhs.get()) : nullptr);
+            }
+            continue;
+        }
+        if (!seen.insert(e).second)
+            continue;
+
+        todo.push_back({e, true});
+        if (e->op == OP_MIN)
+        {
+            auto& leaves = clusters[e] = union_leaves(e);
+            for (auto itr = leaves.rbegin(); itr != leaves.rend(); ++itr)
+                todo.push_back({itr->expr, false});
+        }
+        else
+        {
+            if (e->rhs)
+                todo.push_back({e->rhs.get(), false});
+            if (e->lhs)
+                todo.push_back({e->lhs.get(), false});
+        }
+    }
+
+    return out.at(root);
+}
+
+}   // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+Expr::Expr(Opcode op, float value, const float* box, Ptr lhs, Ptr rhs)
+    : op(op), value(value), lhs(lhs), rhs(rhs),
+      box(box ? Box{{box[0], box[1], box[2], box[3], box[4], box[5]}}
+              : everywhere)
+{
+    // Nothing to do here
+}
+
+Expr::~Expr()
+{
+    std::lock_guard<std::mutex> lock(table_mutex());
+
+    // The entry may have been replaced by a new node with the same key
+    // (if this one expired before we got here), so only erase it if
+    // it's expired.
+    auto itr = table().find(make_key(op, value, box.data(),
+                                     lhs.get(), rhs.get()));
+    if (itr != table().end() && itr->second.expired())
+        table().erase(itr);
+}
+
+Expr::Ptr Expr::intern(Opcode op, float value, const float* box,
+                       Ptr lhs, Ptr rhs)
+{
+    const Key key = make_key(op, value, box, lhs.get(), rhs.get());
+
+    std::lock_guard<std::mutex> lock(table_mutex());
+    auto& entry = table()[key];
+    if (auto found = entry.lock())
+        return found;
+
+    Ptr e(new Expr(op, op == OP_CONST ? value : 0,
+                   op == OP_BOUNDS ? box : nullptr, lhs, rhs));
+    entry = e;
+    return e;
+}
+
+Expr::Ptr Expr::constant(float value)
+{
+    return intern(OP_CONST, value, nullptr, nullptr, nullptr);
+}
+
+Expr::Ptr Expr::axis(Opcode op)
+{
+    return intern(op, 0, nullptr, nullptr, nullptr);
+}
+
+Expr::Ptr Expr::unary(Opcode op, Ptr arg)
+{
+    return intern(op, 0, nullptr, arg, nullptr);
+}
+
+Expr::Ptr Expr::binary(Opcode op, Ptr lhs, Ptr rhs)
+{
+    return intern(op, 0, nullptr, lhs, rhs);
+}
+
+Expr::Ptr Expr::bounded(Ptr arg, const float* box)
+{
+    Box b = {{box[0], box[1], box[2], box[3], box[4], box[5]}};
+    if (arg->op == OP_BOUNDS)
+    {
+        b = intersect(b, arg->box);
+        arg = arg->lhs;
+    }
+
+    if (is_infinite(b))
+        return arg;
+    return intern(OP_BOUNDS, 0, b.data(), arg, nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Expands an affine node into a sum of scaled axes
+static Expr::Ptr expand_affine(const float* k)
+{
+    const Opcode axes[3] = {OP_X, OP_Y, OP_Z};
+    Expr::Ptr out;
+
+    for (int a=0; a < 3; ++a)
+    {
+        if (k[a] == 0)
+            continue;
+
+        auto term = Expr::axis(axes[a]);
+        if (k[a] != 1)
+            term = Expr::binary(OP_MUL, term, Expr::constant(k[a]));
+        out = out ? Expr::binary(OP_ADD, out, term) : term;
+    }
+
+    if (k[3] != 0 || !out)
+        out = out ? Expr::binary(OP_ADD, out, Expr::constant(k[3]))
+                  : Expr::constant(k[3]);
+    return out;
+}
+
+Expr::Ptr Expr::fromTree(const MathTree* tree)
+{
+    std::unordered_map<const Node*, Ptr> exprs;
+
+    for (unsigned c=0; c < tree->num_constants; ++c)
+        exprs[tree->constants[c]] = constant(tree->constants[c]->value);
+
+    // Levels are sorted by rank, so children come before their parents.
+    for (unsigned level=0; level < tree->num_levels; ++level)
+    {
+        for (unsigned i=0; i < tree->active[level]; ++i)
+        {
+            const Node* n = tree->nodes[level][i];
+            if (n->opcode == OP_AFFINE)
+            {
+                exprs[n] = expand_affine(n->affine);
+                continue;
+            }
+            if (n->opcode == OP_BOUNDS)
+            {
+                exprs[n] = bounded(exprs.at(n->lhs), n->box);
+                continue;
+            }
+            exprs[n] = intern(n->opcode, 0, nullptr,
+                              n->lhs ? exprs.at(n->lhs) : nullptr,
+                              n->rhs ? exprs.at(n->rhs) : nullptr);
+        }
+    }
+
+    return exprs.at(tree->head);
+}
+
+MathTree* Expr::toTree() const
+{
+    NodeCache* cache = new_node_cache();
+    std::unordered_map<const Expr*, Node*> nodes;
+
+    const Ptr balanced = has_bounds(this) ? balance(this) : nullptr;
+    const Expr* root = balanced ? balanced.get() : this;
+
+    post_order(root, [&](const Expr* e)
+    {
+        nodes[e] = get_cached_node(cache, make_node(
+                e, e->lhs ? nodes.at(e->lhs.get()) : NULL,
+                   e->rhs ? nodes.at(e->rhs.get()) : NULL));
+    });
+
+    return build_tree(cache, nodes.at(root));
+}
+
+Expr::Ptr Expr::remap(Ptr x, Ptr y, Ptr z) const
+{
+    std::unordered_map<const Expr*, Ptr> out;
+    const bool moved = (x && x != axis(OP_X)) ||
+                       (y && y != axis(OP_Y)) ||
+                       (z && z != axis(OP_Z));
+
+    post_order(this, [&](const Expr* e)
+    {
+        Ptr self = e->shared_from_this();
+        if (e->op == OP_X)
+            out[e] = x ? x : self;
+        else if (e->op == OP_Y)
+            out[e] = y ? y : self;
+        else if (e->op == OP_Z)
+            out[e] = z ? z : self;
+        else if (!e->lhs)
+            out[e] = self;
+        else if (e->op == OP_BOUNDS && moved)
+            out[e] = out.at(e->lhs.get());
+        else
+            out[e] = rebuild(e, out.at(e->lhs.get()),
+                             e->rhs ? out.at(e->rhs.get()) : nullptr);
+    });
+
+    return out.at(this);
+}
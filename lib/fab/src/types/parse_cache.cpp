@@ -0,0 +1,152 @@
+#include "fab/fab.h"
+#include "fab/types/parse_cache.h"
+
+#include "fab/tree/tree.h"
+#include "fab/tree/tape.h"
+#include "fab/tree/parser.h"
+#include "fab/tree/node/node.h"
+#include "fab/tree/math/math_g.h"
+#include "fab/util/switches.h"
+
+// Checks whether a parsed tree has any bounded nodes
+static bool has_bounds(const MathTree* tree)
+{
+    for (unsigned level=0; level < tree->num_levels; ++level)
+        for (unsigned i=0; i < tree->active[level]; ++i)
+            if (tree->nodes[level][i]->opcode == OP_BOUNDS)
+                return true;
+    return false;
+}
+
+// Rough estimate of the memory used by a cached tree and its tape
+static size_t tree_bytes(const MathTree* tree)
+{
+    size_t nodes = tree->num_constants;
+    for (unsigned level=0; level < tree->num_levels; ++level)
+        nodes += tree->active[level];
+
+    return sizeof(MathTree) + sizeof(Tape) +
+           tree->num_levels * (sizeof(Node**) + sizeof(unsigned)) +
+           nodes * (sizeof(Node) + sizeof(Node*) + sizeof(Clause)) +
+           tree->num_constants * (sizeof(float) +
+                MIN_VOLUME * (sizeof(float) + sizeof(derivative)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ParseCache::ParseCache()
+    : cap(DEFAULT_CAPACITY), used(0), num_hits(0), num_misses(0)
+{
+    // Nothing to do here
+}
+
+ParseCache& ParseCache::instance()
+{
+    // Leaked so that Shapes destroyed during static destruction
+    // (e.g. by the Python interpreter) never see a dead cache.
+    static ParseCache* cache = new ParseCache;
+    return *cache;
+}
+
+ParseCache::Entry ParseCache::get(const std::string& math)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(math);
+        if (found != index.end())
+        {
+            num_hits++;
+            items.splice(items.begin(), items, found->second);
+            return found->second->entry;
+        }
+        num_misses++;
+    }
+
+    // Parse without holding the lock, so that threads parsing
+    // different strings don't wait for each other.
+    MathTree* tree = parse(math.c_str());
+    if (tree == NULL)
+        throw fab::ParseError();
+
+    Entry entry;
+    entry.expr = Expr::fromTree(tree);
+
+    // Bounded unions are rebuilt into the same hierarchy of boxes
+    // that Expr::toTree builds for combined Shapes.
+    if (has_bounds(tree))
+    {
+        free_tree(tree);
+        tree = entry.expr->toTree();
+    }
+    const size_t bytes = tree_bytes(tree) + 2 * math.size() + sizeof(Item);
+    entry.tree.reset(tree, free_tree);
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Another thread may have inserted this string while we were parsing
+    auto inserted = index.insert({math, items.end()});
+    if (!inserted.second)
+        return inserted.first->second->entry;
+
+    items.push_front({&inserted.first->first, entry, bytes});
+    inserted.first->second = items.begin();
+    used += bytes;
+    evict();
+
+    return entry;
+}
+
+void ParseCache::evict()
+{
+    while (used > cap && !items.empty())
+    {
+        used -= items.back().bytes;
+        index.erase(index.find(*items.back().math));
+        items.pop_back();
+    }
+}
+
+void ParseCache::setCapacity(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    cap = bytes;
+    evict();
+}
+
+void ParseCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    index.clear();
+    items.clear();
+    used = 0;
+}
+
+size_t ParseCache::capacity() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return cap;
+}
+
+size_t ParseCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return used;
+}
+
+size_t ParseCache::entries() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return items.size();
+}
+
+unsigned long ParseCache::hits() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return num_hits;
+}
+
+unsigned long ParseCache::misses() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return num_misses;
+}
@@ -1,16 +1,35 @@
 #include <boost/python.hpp>
 
+#include <cstdio>
 #include <cstdlib>
 #include <cmath>
+#include <mutex>
+#include <vector>
 
 #include "fab/fab.h"
 #include "fab/tree/tree.h"
-#include "fab/tree/parser.h"
 
 #include "fab/types/shape.h"
+#include "fab/types/parse_cache.h"
 
 using namespace boost::python;
 
+/*
+ *  Lazily-built parts of a Shape, shared between copies.
+ */
+struct Shape::Lazy
+{
+    /*  The math string is prefix followed by each part's math string
+     *  (unless has_math is already set)  */
+    std::string prefix;
+    std::vector<std::shared_ptr<Lazy>> parts;
+
+    std::mutex mutex;
+    bool has_math=false;
+    std::string math;
+    std::shared_ptr<MathTree> tree;
+};
+
 Shape::Shape(std::string math, Bounds bounds, int r, int g, int b)
     : Shape(math, bounds, int3(r,g,b))
 {
@@ -18,11 +37,69 @@ Shape::Shape(std::string math, Bounds bounds, int r, int g, int b)
 }
 
 Shape::Shape(std::string math, Bounds bounds, int3 color)
-    : math(math), bounds(bounds), tree(parse(math.c_str()), free_tree),
-      r(std::get<0>(color)), g(std::get<1>(color)), b(std::get<2>(color))
+    : bounds(bounds), r(std::get<0>(color)), g(std::get<1>(color)),
+      b(std::get<2>(color)), lazy(new Lazy)
+{
+    auto parsed = ParseCache::instance().get(math);
+
+    expr = parsed.expr;
+    lazy->has_math = true;
+    lazy->math = math;
+    lazy->tree = parsed.tree;
+}
+
+Shape::Shape(Expr::Ptr expr, Bounds bounds, std::string prefix,
+             std::initializer_list<const Shape*> parts)
+    : expr(expr), bounds(bounds), r(-1), g(-1), b(-1), lazy(new Lazy)
+{
+    lazy->prefix = prefix;
+    for (auto p : parts)
+        lazy->parts.push_back(p->lazy);
+}
+
+std::string Shape::getMath() const
+{
+    {
+        std::lock_guard<std::mutex> lock(lazy->mutex);
+        if (lazy->has_math)
+            return lazy->math;
+    }
+
+    // Walk the parts in order, without recursion (since chains of
+    // unions can be very deep).  Only the requested string is cached.
+    std::string out;
+    std::vector<Lazy*> todo = {lazy.get()};
+    while (!todo.empty())
+    {
+        Lazy* p = todo.back();
+        todo.pop_back();
+
+        {
+            std::lock_guard<std::mutex> lock(p->mutex);
+            if (p->has_math)
+            {
+                out += p->math;
+                continue;
+            }
+        }
+
+        out += p->prefix;
+        for (auto itr = p->parts.rbegin(); itr != p->parts.rend(); ++itr)
+            todo.push_back(itr->get());
+    }
+
+    std::lock_guard<std::mutex> lock(lazy->mutex);
+    lazy->math = out;
+    lazy->has_math = true;
+    return out;
+}
+
+std::shared_ptr<MathTree> Shape::getTree() const
 {
-    if (tree == NULL)
-        throw fab::ParseError();
+    std::lock_guard<std::mutex> lock(lazy->mutex);
+    if (!lazy->tree)
+        lazy->tree.reset(expr->toTree(), free_tree);
+    return lazy->tree;
 }
 
 object Shape::init(tuple args, dict kwargs)
@@ -115,7 +192,7 @@ object Shape::init(tuple args, dict kwargs)
 
 std::string Shape::repr() const
 {
-    std::string out = "fab.types.Shape('" + math + "'";
+    std::string out = "fab.types.Shape('" + getMath() + "'";
 
     // Special case for infinite (default) bounds
     if (bounds.xmin != -INFINITY || bounds.xmax != INFINITY ||
@@ -139,39 +216,81 @@ std::string Shape::repr() const
     return out + ")";
 }
 
+// Parses one coordinate of a Transform (returning null if it's empty)
+static Expr::Ptr parse_expr(const std::string& math)
+{
+    if (math.empty())
+        return nullptr;
+
+    return ParseCache::instance().get(math).expr;
+}
+
 Shape Shape::map(Transform t) const
 {
-    return Shape("m" + (t.x_forward.length() ? t.x_forward : "_")
+    return Shape(expr->remap(parse_expr(t.x_forward),
+                             parse_expr(t.y_forward),
+                             parse_expr(t.z_forward)),
+                 bounds.map(t),
+                 "m" + (t.x_forward.length() ? t.x_forward : "_")
                      + (t.y_forward.length() ? t.y_forward : "_")
-                     + (t.z_forward.length() ? t.z_forward : "_") + math,
-                 bounds.map(t));
+                     + (t.z_forward.length() ? t.z_forward : "_"),
+                 {this});
 }
 
 Shape operator~(const Shape& a)
 {
-    return Shape("n" + a.math);
+    return Shape(Expr::unary(OP_NEG, a.expr), Bounds(), "n", {&a});
 }
 
 
+// Writes one side of a box into a math string (exactly, so that parsing
+// the string gives back the same box)
+static std::string box_side(float v)
+{
+    if (std::isinf(v))
+        return "_";
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "f%.9g", v);
+    return buf;
+}
+
+Shape Shape::bounded() const
+{
+    const float box[6] = {bounds.xmin, bounds.ymin, bounds.zmin,
+                          bounds.xmax, bounds.ymax, bounds.zmax};
+    Expr::Ptr e = Expr::bounded(expr, box);
+    if (e == expr)
+        return *this;
+
+    std::string prefix = "B";
+    for (float v : box)
+        prefix += box_side(v);
+    return Shape(e, bounds, prefix, {this});
+}
+
 Shape operator&(const Shape& a, const Shape& b)
 {
-    return Shape("a" + a.math + b.math, Bounds(
+    const Shape A = a.bounded(), B = b.bounded();
+    return Shape(Expr::binary(OP_MAX, A.expr, B.expr), Bounds(
                      fmax(a.bounds.xmin, b.bounds.xmin),
                      fmax(a.bounds.ymin, b.bounds.ymin),
                      fmax(a.bounds.zmin, b.bounds.zmin),
                      fmin(a.bounds.xmax, b.bounds.xmax),
                      fmin(a.bounds.ymax, b.bounds.ymax),
-                     fmin(a.bounds.zmax, b.bounds.zmax)));
+                     fmin(a.bounds.zmax, b.bounds.zmax)),
+                 "a", {&A, &B});
 }
 
 Shape operator|(const Shape& a, const Shape& b)
 {
-    return Shape("i" + a.math + b.math, Bounds(
+    const Shape A = a.bounded(), B = b.bounded();
+    return Shape(Expr::binary(OP_MIN, A.expr, B.expr), Bounds(
                      fmin(a.bounds.xmin, b.bounds.xmin),
                      fmin(a.bounds.ymin, b.bounds.ymin),
                      fmin(a.bounds.zmin, b.bounds.zmin),
                      fmax(a.bounds.xmax, b.bounds.xmax),
                      fmax(a.bounds.ymax, b.bounds.ymax),
-                     fmax(a.bounds.zmax, b.bounds.zmax)));
-
+                     fmax(a.bounds.zmax, b.bounds.zmax)),
+                 "i", {&A, &B});
 }
@@ -0,0 +1,378 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fab/util/pyramid.h"
+
+// A half-open rectangle of pixels, relative to the pyramid's corner
+typedef struct Rect_ {
+    uint32_t x0, y0, x1, y1;
+} Rect;
+
+static inline uint16_t max16(uint16_t a, uint16_t b) { return a > b ? a : b; }
+static inline uint16_t min16(uint16_t a, uint16_t b) { return a < b ? a : b; }
+
+DepthPyramid* new_pyramid(uint32_t imin, uint32_t jmin,
+                          uint32_t ni, uint32_t nj)
+{
+    DepthPyramid* p = malloc(sizeof(DepthPyramid));
+    p->imin = imin;
+    p->jmin = jmin;
+    p->ni = ni;
+    p->nj = nj;
+
+    // Halve the base level until we're down to a single block
+    unsigned levels = 1;
+    size_t nodes = (size_t)ni * nj;
+    for (uint32_t w=ni, h=nj; w > 1 || h > 1; ++levels) {
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+        nodes += (size_t)w * h;
+    }
+    p->levels = levels;
+
+    p->w = malloc(levels * sizeof(uint32_t));
+    p->h = malloc(levels * sizeof(uint32_t));
+    p->depth = malloc(levels * sizeof(uint16_t*));
+    p->fill = malloc(levels * sizeof(uint16_t*));
+
+    // Every level's depths live in one array, and every level's
+    // fills (except for the base level, which has none) in another.
+    p->depth[0] = calloc(nodes ? nodes : 1, sizeof(uint16_t));
+    p->fill[0] = NULL;
+    uint16_t* fills = (levels > 1)
+        ? calloc(nodes - (size_t)ni * nj, sizeof(uint16_t)) : NULL;
+
+    p->w[0] = ni;
+    p->h[0] = nj;
+    for (unsigned n=1; n < levels; ++n) {
+        p->w[n] = (p->w[n-1] + 1) / 2;
+        p->h[n] = (p->h[n-1] + 1) / 2;
+        p->depth[n] = p->depth[n-1] + (size_t)p->w[n-1] * p->h[n-1];
+        p->fill[n] = (n == 1) ? fills
+                              : p->fill[n-1] + (size_t)p->w[n-1] * p->h[n-1];
+    }
+
+    return p;
+}
+
+void free_pyramid(DepthPyramid* p)
+{
+    if (!p)     return;
+
+    free(p->depth[0]);
+    if (p->levels > 1)  free(p->fill[1]);
+
+    free(p->w);
+    free(p->h);
+    free(p->depth);
+    free(p->fill);
+    free(p);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns the minimum depth of a block's children (excluding its own fill)
+static
+uint16_t min_children(const DepthPyramid* p, unsigned n, uint32_t i, uint32_t j)
+{
+    const uint32_t w = p->w[n-1];
+    const uint32_t h = p->h[n-1];
+    const uint16_t* d = p->depth[n-1];
+
+    uint16_t out = d[2*j*w + 2*i];
+    if (2*i + 1 < w)    out = min16(out, d[2*j*w + 2*i + 1]);
+    if (2*j + 1 < h) {
+        out = min16(out, d[(2*j + 1)*w + 2*i]);
+        if (2*i + 1 < w)    out = min16(out, d[(2*j + 1)*w + 2*i + 1]);
+    }
+    return out;
+}
+
+// Rebuilds every level above the base (clearing pending fills)
+static
+void rebuild(DepthPyramid* p)
+{
+    for (unsigned n=1; n < p->levels; ++n) {
+        for (uint32_t j=0; j < p->h[n]; ++j) {
+            for (uint32_t i=0; i < p->w[n]; ++i) {
+                p->depth[n][j*p->w[n] + i] = min_children(p, n, i, j);
+                p->fill[n][j*p->w[n] + i] = 0;
+            }
+        }
+    }
+}
+
+// Pushes every pending fill down to the base level
+static
+void flatten(DepthPyramid* p)
+{
+    for (unsigned n=p->levels - 1; n > 0; --n) {
+        const uint32_t w = p->w[n-1];
+        const uint32_t h = p->h[n-1];
+
+        for (uint32_t j=0; j < p->h[n]; ++j) {
+            for (uint32_t i=0; i < p->w[n]; ++i) {
+                const uint16_t f = p->fill[n][j*p->w[n] + i];
+                if (!f)     continue;
+                p->fill[n][j*p->w[n] + i] = 0;
+
+                for (uint32_t cj=2*j; cj < 2*j + 2 && cj < h; ++cj) {
+                    for (uint32_t ci=2*i; ci < 2*i + 2 && ci < w; ++ci) {
+                        uint16_t* d = &p->depth[n-1][cj*w + ci];
+                        *d = max16(*d, f);
+                        if (n > 1) {
+                            uint16_t* c = &p->fill[n-1][cj*w + ci];
+                            *c = max16(*c, f);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void pyramid_load8(DepthPyramid* p, uint8_t** img)
+{
+    for (uint32_t j=0; j < p->nj; ++j)
+        for (uint32_t i=0; i < p->ni; ++i)
+            p->depth[0][j*p->ni + i] = img[p->jmin + j][p->imin + i];
+    rebuild(p);
+}
+
+void pyramid_load16(DepthPyramid* p, uint16_t** img)
+{
+    for (uint32_t j=0; j < p->nj; ++j)
+        memcpy(&p->depth[0][j*p->ni], &img[p->jmin + j][p->imin],
+               p->ni * sizeof(uint16_t));
+    rebuild(p);
+}
+
+void pyramid_store8(DepthPyramid* p, uint8_t** img)
+{
+    flatten(p);
+    for (uint32_t j=0; j < p->nj; ++j)
+        for (uint32_t i=0; i < p->ni; ++i)
+            img[p->jmin + j][p->imin + i] = p->depth[0][j*p->ni + i];
+}
+
+void pyramid_store16(DepthPyramid* p, uint16_t** img)
+{
+    flatten(p);
+    for (uint32_t j=0; j < p->nj; ++j)
+        memcpy(&img[p->jmin + j][p->imin], &p->depth[0][j*p->ni],
+               p->ni * sizeof(uint16_t));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns the rectangle of pixels covered by a block, clipped to the image
+static
+Rect block_rect(const DepthPyramid* p, unsigned n, uint32_t i, uint32_t j)
+{
+    Rect b = {i << n, j << n, (i + 1) << n, (j + 1) << n};
+    if (b.x1 > p->ni)   b.x1 = p->ni;
+    if (b.y1 > p->nj)   b.y1 = p->nj;
+    return b;
+}
+
+static inline
+bool contains(const Rect outer, const Rect inner)
+{
+    return inner.x0 >= outer.x0 && inner.x1 <= outer.x1 &&
+           inner.y0 >= outer.y0 && inner.y1 <= outer.y1;
+}
+
+// Returns the range of blocks in level n - 1 that are children
+// of block (i, j) in level n and overlap the rectangle r.
+static
+Rect child_range(const DepthPyramid* p, unsigned n,
+                 uint32_t i, uint32_t j, const Rect r)
+{
+    const unsigned s = n - 1;
+    Rect c = {2*i, 2*j, 2*i + 2, 2*j + 2};
+    if (c.x1 > p->w[s])         c.x1 = p->w[s];
+    if (c.y1 > p->h[s])         c.y1 = p->h[s];
+    if (c.x0 < (r.x0 >> s))     c.x0 = r.x0 >> s;
+    if (c.y0 < (r.y0 >> s))     c.y0 = r.y0 >> s;
+    if (c.x1 > ((r.x1 - 1) >> s) + 1)   c.x1 = ((r.x1 - 1) >> s) + 1;
+    if (c.y1 > ((r.y1 - 1) >> s) + 1)   c.y1 = ((r.y1 - 1) >> s) + 1;
+    return c;
+}
+
+// Converts a rectangle in image coordinates to pyramid coordinates
+static inline
+Rect to_rect(const DepthPyramid* p, uint32_t imin, uint32_t jmin,
+             uint32_t ni, uint32_t nj)
+{
+    return (Rect){imin - p->imin, jmin - p->jmin,
+                  imin - p->imin + ni, jmin - p->jmin + nj};
+}
+
+// Finds the smallest block that contains the (non-empty) rectangle r,
+// storing its position and returning its level.
+static inline
+unsigned enclosing(const Rect r, uint32_t* i, uint32_t* j)
+{
+    // The block's level is the highest bit at which the
+    // rectangle's first and last pixels differ.
+    const uint32_t diff = (r.x0 ^ (r.x1 - 1)) | (r.y0 ^ (r.y1 - 1));
+    const unsigned n = diff ? 32 - __builtin_clz(diff) : 0;
+    *i = r.x0 >> n;
+    *j = r.y0 >> n;
+    return n;
+}
+
+// Returns the largest pending fill among a block's ancestors
+static
+uint16_t ancestor_fill(const DepthPyramid* p, unsigned n,
+                       uint32_t i, uint32_t j)
+{
+    uint16_t out = 0;
+    while (++n < p->levels) {
+        i /= 2;
+        j /= 2;
+        out = max16(out, p->fill[n][j*p->w[n] + i]);
+    }
+    return out;
+}
+
+// Recomputes the depths of a block's ancestors, stopping
+// as soon as one of them is unchanged.
+static
+void propagate(DepthPyramid* p, unsigned n, uint32_t i, uint32_t j)
+{
+    while (++n < p->levels) {
+        i /= 2;
+        j /= 2;
+        const uint32_t index = j*p->w[n] + i;
+        const uint16_t m = max16(p->fill[n][index], min_children(p, n, i, j));
+        if (m == p->depth[n][index])    break;
+        p->depth[n][index] = m;
+    }
+}
+
+static
+bool covered(const DepthPyramid* p, unsigned n, uint32_t i, uint32_t j,
+             const Rect r, uint16_t floor, uint16_t L)
+{
+    const uint32_t index = j*p->w[n] + i;
+    if (max16(p->depth[n][index], floor) >= L)  return true;
+
+    // If the block is entirely within the rectangle, then its
+    // minimum is also the minimum of some pixel in the rectangle.
+    if (n == 0 || contains(r, block_rect(p, n, i, j)))  return false;
+
+    floor = max16(floor, p->fill[n][index]);
+    const Rect c = child_range(p, n, i, j, r);
+    for (uint32_t cj=c.y0; cj < c.y1; ++cj)
+        for (uint32_t ci=c.x0; ci < c.x1; ++ci)
+            if (!covered(p, n - 1, ci, cj, r, floor, L))    return false;
+    return true;
+}
+
+bool pyramid_covered(const DepthPyramid* p, uint32_t imin, uint32_t jmin,
+                     uint32_t ni, uint32_t nj, uint16_t L)
+{
+    if (ni == 0 || nj == 0)     return true;
+
+    const Rect r = to_rect(p, imin, jmin, ni, nj);
+    uint32_t i, j;
+    const unsigned n = enclosing(r, &i, &j);
+
+    // Check the enclosing block on its own first, since it's
+    // often entirely lit (or exactly matches the rectangle).
+    if (p->depth[n][j*p->w[n] + i] >= L)    return true;
+    return covered(p, n, i, j, r, ancestor_fill(p, n, i, j), L);
+}
+
+static
+void fill(DepthPyramid* p, unsigned n, uint32_t i, uint32_t j,
+          const Rect r, uint16_t floor, uint16_t L)
+{
+    const uint32_t index = j*p->w[n] + i;
+    if (max16(p->depth[n][index], floor) >= L)  return;
+
+    // Blocks that are entirely filled are marked as such, leaving
+    // their children to be updated when the pyramid is stored.
+    if (n == 0 || contains(r, block_rect(p, n, i, j))) {
+        p->depth[n][index] = max16(p->depth[n][index], L);
+        if (n)  p->fill[n][index] = max16(p->fill[n][index], L);
+        return;
+    }
+
+    const uint16_t f = p->fill[n][index];
+    const Rect c = child_range(p, n, i, j, r);
+    for (uint32_t cj=c.y0; cj < c.y1; ++cj)
+        for (uint32_t ci=c.x0; ci < c.x1; ++ci)
+            fill(p, n - 1, ci, cj, r, max16(floor, f), L);
+    p->depth[n][index] = max16(f, min_children(p, n, i, j));
+}
+
+void pyramid_fill(DepthPyramid* p, uint32_t imin, uint32_t jmin,
+                  uint32_t ni, uint32_t nj, uint16_t L)
+{
+    if (ni == 0 || nj == 0)     return;
+
+    const Rect r = to_rect(p, imin, jmin, ni, nj);
+    uint32_t i, j;
+    const unsigned n = enclosing(r, &i, &j);
+    fill(p, n, i, j, r, ancestor_fill(p, n, i, j), L);
+    propagate(p, n, i, j);
+}
+
+void pyramid_write_rect(DepthPyramid* p, uint32_t imin, uint32_t jmin,
+                        uint32_t ni, uint32_t nj, const uint16_t* Ls)
+{
+    if (ni == 0 || nj == 0)     return;
+
+    Rect r = to_rect(p, imin, jmin, ni, nj);
+    for (uint32_t j=0; j < nj; ++j) {
+        uint16_t* d = &p->depth[0][(r.y0 + j)*p->ni + r.x0];
+        for (uint32_t i=0; i < ni; ++i)
+            d[i] = max16(d[i], Ls[j*ni + i]);
+    }
+
+    // Rebuild every block that overlaps the rectangle, level by
+    // level, up to the one that contains all of it.
+    uint32_t i, j;
+    const unsigned n = enclosing(r, &i, &j);
+    for (unsigned m=1; m <= n; ++m) {
+        r = (Rect){r.x0 / 2, r.y0 / 2, (r.x1 + 1) / 2, (r.y1 + 1) / 2};
+        for (uint32_t bj=r.y0; bj < r.y1; ++bj) {
+            for (uint32_t bi=r.x0; bi < r.x1; ++bi) {
+                const uint32_t index = bj*p->w[m] + bi;
+                p->depth[m][index] = max16(p->fill[m][index],
+                                           min_children(p, m, bi, bj));
+            }
+        }
+    }
+    propagate(p, n, i, j);
+}
+
+static
+void read_rect(const DepthPyramid* p, unsigned n, uint32_t i, uint32_t j,
+               const Rect r, uint16_t floor, uint16_t* out)
+{
+    if (n == 0) {
+        out[(j - r.y0)*(r.x1 - r.x0) + (i - r.x0)] =
+            max16(p->depth[0][j*p->ni + i], floor);
+        return;
+    }
+
+    floor = max16(floor, p->fill[n][j*p->w[n] + i]);
+    const Rect c = child_range(p, n, i, j, r);
+    for (uint32_t cj=c.y0; cj < c.y1; ++cj)
+        for (uint32_t ci=c.x0; ci < c.x1; ++ci)
+            read_rect(p, n - 1, ci, cj, r, floor, out);
+}
+
+void pyramid_read(const DepthPyramid* p, uint32_t imin, uint32_t jmin,
+                  uint32_t ni, uint32_t nj, uint16_t* out)
+{
+    if (ni == 0 || nj == 0)     return;
+
+    const Rect r = to_rect(p, imin, jmin, ni, nj);
+    uint32_t i, j;
+    const unsigned n = enclosing(r, &i, &j);
+    read_rect(p, n, i, j, r, ancestor_fill(p, n, i, j), out);
+}
@@ -2,7 +2,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-#include "fab/tree/tree.h"
+#include "fab/tree/context.h"
 #include "fab/tree/node/node.h"
 #include "fab/tree/node/opcodes.h"
 
@@ -186,11 +186,11 @@ uint8_t octsect(const Region R, Region* const out)
     return bits;
 }
 
-int octsect_active(const Region R, const MathTree* tree, Region* const out)
+int octsect_active(const Region R, const EvalContext* ctx, Region* const out)
 {
     out[0] = R;
     uint8_t bits = 1;
-    const uint8_t active = active_axes(tree);
+    const uint8_t active = active_axes(ctx);
 
     if (R.nk > 1 && (active & 1)) {
         bisect_z(out[0], out, out+1);
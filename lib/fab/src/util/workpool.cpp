@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <vector>
+
+#include "fab/util/workpool.h"
+
+namespace
+{
+
+// A block of task indices owned by one worker.
+struct TaskBlock
+{
+    std::mutex mutex;
+    unsigned lo;
+    unsigned hi;
+};
+
+// Pops a task from the back of a worker's own block.
+bool pop(TaskBlock& b, unsigned* task)
+{
+    std::lock_guard<std::mutex> lock(b.mutex);
+    if (b.lo == b.hi)
+        return false;
+    *task = --b.hi;
+    return true;
+}
+
+// Steals a task from the front of another worker's block.
+bool steal(TaskBlock& b, unsigned* task)
+{
+    std::lock_guard<std::mutex> lock(b.mutex);
+    if (b.lo == b.hi)
+        return false;
+    *task = b.lo++;
+    return true;
+}
+
+}   // namespace
+
+WorkPool::WorkPool(unsigned workers)
+    : workers(workers ? workers : std::thread::hardware_concurrency())
+{
+    // hardware_concurrency is allowed to return 0 if it can't tell
+    if (this->workers == 0)
+        this->workers = 1;
+}
+
+void WorkPool::run(unsigned count,
+                   const std::function<void(unsigned, unsigned)>& f) const
+{
+    const unsigned n = std::min(workers, count);
+    if (n <= 1)
+    {
+        for (unsigned t=0; t < count; ++t)
+            f(t, 0);
+        return;
+    }
+
+    std::vector<TaskBlock> blocks(n);
+    for (unsigned w=0; w < n; ++w)
+    {
+        blocks[w].lo = (count * w) / n;
+        blocks[w].hi = (count * (w + 1)) / n;
+    }
+
+    // No tasks are ever added, so once every block is empty the
+    // worker can exit.
+    auto work = [&](unsigned w)
+    {
+        unsigned task;
+        while (true)
+        {
+            if (pop(blocks[w], &task))
+            {
+                f(task, w);
+                continue;
+            }
+
+            bool stolen = false;
+            for (unsigned v=1; v < n && !stolen; ++v)
+                stolen = steal(blocks[(w + v) % n], &task);
+            if (!stolen)
+                break;
+            f(task, w);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned w=1; w < n; ++w)
+        threads.push_back(std::thread(work, w));
+    work(0);
+
+    for (auto& t : threads)
+        t.join();
+}
@@ -0,0 +1,251 @@
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include <catch/catch.hpp>
+
+#include "fab/tree/math/math_r.h"
+#include "fab/tree/math/math_g.h"
+#include "fab/tree/math/math_simd.h"
+
+// Number of samples per test; deliberately not a multiple of any
+// vector width so that the scalar tail is exercised as well.
+static const int N = 203;
+
+static float random_float(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / float(RAND_MAX));
+}
+
+// Fills an array with values in [lo, hi], sprinkling in
+// some of the awkward inputs that force a scalar fallback.
+static std::vector<float> samples(float lo, float hi)
+{
+    std::vector<float> out(N);
+    for (auto& f : out)
+        f = random_float(lo, hi);
+    out[5] = 0;
+    out[17] = -0.0f;
+    out[40] = NAN;
+    out[77] = INFINITY;
+    out[78] = -INFINITY;
+    out[120] = 1e4;
+    return out;
+}
+
+static bool matches(float a, float b, float tol)
+{
+    if (std::isnan(a) || std::isnan(b))
+        return std::isnan(a) && std::isnan(b);
+    if (std::isinf(a) || std::isinf(b))
+        return a == b;
+    return std::fabs(a - b) <= tol * std::fmax(1.0f, std::fabs(a));
+}
+
+struct DualCase { const char* name; dual_r fn; float lo, hi, tol; };
+struct SingleCase { const char* name; single_r fn; float lo, hi, tol; };
+
+static void check_r(SimdBackend b, const DualCase& c)
+{
+    srand(1);
+    std::vector<float> A = samples(c.lo, c.hi);
+    std::vector<float> B = samples(c.lo, c.hi);
+    std::vector<float> expected(N), actual(N);
+
+    simd_select(SIMD_SCALAR);
+    c.fn(A.data(), B.data(), expected.data(), N);
+    simd_select(b);
+    c.fn(A.data(), B.data(), actual.data(), N);
+
+    for (int i=0; i < N; ++i)
+    {
+        INFO(simd_backend_name(b) << " " << c.name << "(" << A[i] << ", "
+             << B[i] << "): " << expected[i] << " vs " << actual[i]);
+        CHECK(matches(expected[i], actual[i], c.tol));
+    }
+}
+
+static void check_r(SimdBackend b, const SingleCase& c)
+{
+    srand(1);
+    std::vector<float> A = samples(c.lo, c.hi);
+    std::vector<float> expected(N), actual(N);
+
+    simd_select(SIMD_SCALAR);
+    c.fn(A.data(), expected.data(), N);
+    simd_select(b);
+    c.fn(A.data(), actual.data(), N);
+
+    for (int i=0; i < N; ++i)
+    {
+        INFO(simd_backend_name(b) << " " << c.name << "(" << A[i] << "): "
+             << expected[i] << " vs " << actual[i]);
+        CHECK(matches(expected[i], actual[i], c.tol));
+    }
+}
+
+static std::vector<derivative> gsamples(float lo, float hi)
+{
+    std::vector<float> v = samples(lo, hi);
+    std::vector<derivative> out(N);
+    for (int i=0; i < N; ++i)
+        out[i] = {v[i], random_float(-2, 2), random_float(-2, 2), 0};
+    return out;
+}
+
+static bool matches(const derivative& a, const derivative& b, float tol)
+{
+    return matches(a.v, b.v, tol) && matches(a.dx, b.dx, tol) &&
+           matches(a.dy, b.dy, tol) && matches(a.dz, b.dz, tol);
+}
+
+struct DualCaseG { const char* name; dual_g fn; float lo, hi, tol; };
+struct SingleCaseG { const char* name; single_g fn; float lo, hi, tol; };
+
+static void check_g(SimdBackend b, const DualCaseG& c)
+{
+    srand(1);
+    std::vector<derivative> A = gsamples(c.lo, c.hi);
+    std::vector<derivative> B = gsamples(c.lo, c.hi);
+    std::vector<derivative> expected(N), actual(N);
+
+    simd_select(SIMD_SCALAR);
+    c.fn(A.data(), B.data(), expected.data(), N);
+    simd_select(b);
+    c.fn(A.data(), B.data(), actual.data(), N);
+
+    for (int i=0; i < N; ++i)
+    {
+        INFO(simd_backend_name(b) << " " << c.name << "(" << A[i].v << ", "
+             << B[i].v << ")");
+        CHECK(matches(expected[i], actual[i], c.tol));
+    }
+}
+
+static void check_g(SimdBackend b, const SingleCaseG& c)
+{
+    srand(1);
+    std::vector<derivative> A = gsamples(c.lo, c.hi);
+    std::vector<derivative> expected(N), actual(N);
+
+    simd_select(SIMD_SCALAR);
+    c.fn(A.data(), expected.data(), N);
+    simd_select(b);
+    c.fn(A.data(), actual.data(), N);
+
+    for (int i=0; i < N; ++i)
+    {
+        INFO(simd_backend_name(b) << " " << c.name << "(" << A[i].v << ")");
+        CHECK(matches(expected[i], actual[i], c.tol));
+    }
+}
+
+TEST_CASE("SIMD backends match scalar kernels")
+{
+    const SimdBackend original = simd_backend();
+
+    const DualCase r_dual[] = {
+        {"add", add_r, -10, 10, 0},
+        {"sub", sub_r, -10, 10, 0},
+        {"mul", mul_r, -10, 10, 0},
+        {"div", div_r, -10, 10, 0},
+        {"min", min_r, -10, 10, 0},
+        {"max", max_r, -10, 10, 0},
+        {"pow", pow_r, 0, 4, 1e-5},
+        {"atan2", atan2_r, -10, 10, 1e-6}};
+    const SingleCase r_single[] = {
+        {"abs", abs_r, -10, 10, 0},
+        {"square", square_r, -10, 10, 0},
+        {"sqrt", sqrt_r, -10, 10, 0},
+        {"sin", sin_r, -100, 100, 1e-6},
+        {"cos", cos_r, -100, 100, 1e-6},
+        {"tan", tan_r, -1.5, 1.5, 1e-5},
+        {"asin", asin_r, -1.5, 1.5, 1e-6},
+        {"acos", acos_r, -1.5, 1.5, 1e-6},
+        {"atan", atan_r, -10, 10, 1e-6},
+        {"neg", neg_r, -10, 10, 0},
+        {"exp", exp_r, -20, 20, 1e-6}};
+
+    const DualCaseG g_dual[] = {
+        {"add", add_g, -10, 10, 0},
+        {"sub", sub_g, -10, 10, 0},
+        {"mul", mul_g, -10, 10, 1e-6},
+        {"div", div_g, -10, 10, 1e-5},
+        {"min", min_g, -10, 10, 0},
+        {"max", max_g, -10, 10, 0},
+        {"pow", pow_g, 0, 4, 1e-5},
+        {"atan2", atan2_g, -10, 10, 1e-5}};
+    const SingleCaseG g_single[] = {
+        {"abs", abs_g, -10, 10, 0},
+        {"square", square_g, -10, 10, 1e-6},
+        {"sqrt", sqrt_g, -10, 10, 1e-6},
+        {"sin", sin_g, -100, 100, 1e-6},
+        {"cos", cos_g, -100, 100, 1e-6},
+        {"tan", tan_g, -1.5, 1.5, 1e-4},
+        {"asin", asin_g, -1.5, 1.5, 1e-5},
+        {"acos", acos_g, -1.5, 1.5, 1e-5},
+        {"atan", atan_g, -10, 10, 1e-6},
+        {"neg", neg_g, -10, 10, 0},
+        {"exp", exp_g, -20, 20, 1e-6}};
+
+    for (int b=SIMD_SCALAR + 1; b < LAST_SIMD_BACKEND; ++b)
+    {
+        const SimdBackend backend = SimdBackend(b);
+        if (!simd_available(backend))
+            continue;
+
+        for (const auto& c : r_dual)    check_r(backend, c);
+        for (const auto& c : r_single)  check_r(backend, c);
+        for (const auto& c : g_dual)    check_g(backend, c);
+        for (const auto& c : g_single)  check_g(backend, c);
+    }
+
+    simd_select(original);
+}
+
+TEST_CASE("atan2 derivatives")
+{
+    const SimdBackend original = simd_backend();
+
+    // atan2(y, x) with y and x varying along Y and X respectively,
+    // so its gradient is (-y, x) / (x^2 + y^2)
+    srand(1);
+    std::vector<derivative> A(N), B(N), R(N);
+    for (int i=0; i < N; ++i)
+    {
+        A[i] = {random_float(-10, 10), 0, 1, 0};
+        B[i] = {random_float(-10, 10), 1, 0, 0};
+    }
+
+    for (int b=SIMD_SCALAR; b < LAST_SIMD_BACKEND; ++b)
+    {
+        const SimdBackend backend = SimdBackend(b);
+        if (!simd_available(backend))
+            continue;
+
+        simd_select(backend);
+        atan2_g(A.data(), B.data(), R.data(), N);
+        for (int i=0; i < N; ++i)
+        {
+            const float d = A[i].v*A[i].v + B[i].v*B[i].v;
+            INFO(simd_backend_name(backend) << " atan2(" << A[i].v << ", "
+                 << B[i].v << ")");
+            CHECK(matches(R[i].dx, -A[i].v / d, 1e-5));
+            CHECK(matches(R[i].dy, B[i].v / d, 1e-5));
+            CHECK(R[i].dz == 0);
+        }
+    }
+
+    simd_select(original);
+}
+
+TEST_CASE("SIMD dispatch")
+{
+    REQUIRE(simd_available(SIMD_SCALAR));
+    REQUIRE(simd_available(simd_detect()));
+
+    const SimdBackend original = simd_backend();
+    REQUIRE(simd_select(SIMD_SCALAR));
+    REQUIRE(simd_backend() == SIMD_SCALAR);
+    REQUIRE(simd_select(original));
+}
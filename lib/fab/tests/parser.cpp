@@ -1,14 +1,28 @@
 #include <Python.h>
+#include <string>
 #include <catch/catch.hpp>
 
 #include "fab/fab.h"
 #include "fab/tree/tree.h"
 #include "fab/tree/parser.h"
+#include "fab/tree/simplify.h"
+#include "fab/tree/eval.h"
+#include "fab/tree/context.h"
+
+// Turns off simplification while in scope
+struct NoSimplify
+{
+    NoSimplify()    { set_simplify(false); }
+    ~NoSimplify()   { set_simplify(true); }
+};
 
 TEST_CASE("Basic parsing")
 {
     MathTree* t;
 
+    // These sections check the parser's own output
+    NoSimplify guard;
+
     SECTION("Parsing 'X'")
     {
         t = parse("X");
@@ -68,4 +82,133 @@ TEST_CASE("Basic parsing")
         t = parse(s.c_str());
         REQUIRE(t != nullptr);
     }
+
+    SECTION("Deduplicating a large expression")
+    {
+        // 1000 circles with 10 distinct radii, all centered at the origin
+        std::string s;
+        for (int i=0; i < 999; ++i)
+            s += "i";
+        for (int i=0; i < 1000; ++i)
+            s += "-r+qXqYf" + std::to_string(i % 10 + 1);
+
+        t = parse(s.c_str());
+        REQUIRE(t != nullptr);
+        REQUIRE(t->num_constants == 10);
+        REQUIRE(t->active[0] == 2);     // X, Y
+        REQUIRE(t->active[1] == 2);     // X^2, Y^2
+        REQUIRE(t->active[2] == 1);     // X^2 + Y^2
+        REQUIRE(t->active[4] == 10);    // One per radius
+        free_tree(t);
+    }
+}
+
+TEST_CASE("Simplification")
+{
+    MathTree* t;
+
+    SECTION("Identities")
+    {
+        const unsigned long before = simplified_nodes();
+        t = parse("*+Xf0f1");
+        REQUIRE(t != nullptr);
+        REQUIRE(t->num_levels == 1);
+        REQUIRE(t->num_constants == 0);
+        REQUIRE(t->head->opcode == OP_X);
+        REQUIRE(simplified_nodes() == before + 2);
+        free_tree(t);
+    }
+
+    SECTION("Nested unary operations")
+    {
+        t = parse("annXrqY");
+        REQUIRE(t != nullptr);
+        REQUIRE(t->num_levels == 3);
+        REQUIRE(t->active[1] == 1);
+        REQUIRE(t->nodes[1][0]->opcode == OP_ABS);
+        free_tree(t);
+    }
+
+    SECTION("Constant folding")
+    {
+        t = parse("pX*f2xf0");
+        REQUIRE(t != nullptr);
+        REQUIRE(t->num_constants == 1);
+        REQUIRE(t->constants[0]->value == 2);
+        free_tree(t);
+    }
+
+    SECTION("Disabled")
+    {
+        set_simplify(false);
+        t = parse("*+Xf0f1");
+        set_simplify(true);
+
+        REQUIRE(t != nullptr);
+        REQUIRE(t->num_levels == 3);
+        free_tree(t);
+    }
+
+    SECTION("Rebalancing chains")
+    {
+        // Two chains of unions that share most of their links,
+        // and a chain of sums
+        std::string u, v, a;
+        for (int i=0; i < 63; ++i)
+            u += "i";
+        for (int i=0; i < 63; ++i)
+            u += "-Xf" + std::to_string(i % 48);
+        v = u + "-Xf99";
+        u += "-Xf63";
+        for (int i=0; i < 31; ++i)
+            a += "+";
+        for (int i=0; i < 32; ++i)
+            a += "s*Xf" + std::to_string(i + 1);
+
+        for (auto math : {"a" + u + v, a})
+        {
+            MathTree* full;
+            {
+                NoSimplify n;
+                full = parse(math.c_str());
+            }
+            t = parse(math.c_str());
+            REQUIRE(t != nullptr);
+            REQUIRE(full != nullptr);
+            REQUIRE(t->num_levels < 12);
+            REQUIRE(full->num_levels > 32);
+
+            EvalContext* ca = new_context(t);
+            EvalContext* cb = new_context(full);
+            for (float x=-1; x <= 1; x += 0.125)
+                REQUIRE(eval_f(ca, x, 0, 0) ==
+                        Approx(eval_f(cb, x, 0, 0)).epsilon(1e-4));
+            free_context(ca);
+            free_context(cb);
+            free_tree(full);
+            free_tree(t);
+        }
+    }
+
+    SECTION("Matches unsimplified evaluation")
+    {
+        const char* math = "i-nn+Xf0/rqYf1ab*Zf1qnX";
+        set_simplify(false);
+        MathTree* full = parse(math);
+        set_simplify(true);
+        t = parse(math);
+        REQUIRE(t != nullptr);
+        REQUIRE(full != nullptr);
+        REQUIRE(t->num_levels < full->num_levels);
+
+        EvalContext* a = new_context(t);
+        EvalContext* b = new_context(full);
+        for (float x=-1; x <= 1; x += 0.25)
+            for (float y=-1; y <= 1; y += 0.25)
+                REQUIRE(eval_f(a, x, y, x*y) == eval_f(b, x, y, x*y));
+        free_context(a);
+        free_context(b);
+        free_tree(full);
+        free_tree(t);
+    }
 }
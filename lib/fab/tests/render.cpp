@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include <catch/catch.hpp>
+
+#include "fab/tree/tree.h"
+#include "fab/tree/context.h"
+#include "fab/tree/eval.h"
+#include "fab/tree/parser.h"
+#include "fab/tree/render.h"
+#include "fab/util/pyramid.h"
+#include "fab/util/region.h"
+
+#include "util.h"
+
+TEST_CASE("Parallel rendering")
+{
+    // Union of two spheres
+    MathTree* t = parse("i-r++q-Xf0.3qYqZf0.5-r++q+Xf0.4qYq-Zf0.2f0.3");
+    REQUIRE(t != nullptr);
+
+    const unsigned N = 96;
+    Region r = make_region(N);
+
+    std::vector<uint16_t> serial(N*N, 0), parallel(N*N, 0);
+    std::vector<uint16_t*> serial_rows(N), parallel_rows(N);
+    for (unsigned j=0; j < N; ++j)
+    {
+        serial_rows[j] = &serial[j*N];
+        parallel_rows[j] = &parallel[j*N];
+    }
+
+    int halt = 0;
+    render16(t, r, serial_rows.data(), &halt, NULL);
+
+    SECTION("Matches serial rendering")
+    {
+        for (unsigned threads : {1, 3, 8})
+        {
+            std::fill(parallel.begin(), parallel.end(), 0);
+            render16_parallel(t, r, parallel_rows.data(), &halt, NULL,
+                              threads, NULL);
+            REQUIRE(parallel == serial);
+        }
+    }
+
+    SECTION("Affine arithmetic")
+    {
+        // Tighter bounds only change how much work is done
+        set_affine_eval(true);
+        render16_parallel(t, r, parallel_rows.data(), &halt, NULL, 3, NULL);
+        set_affine_eval(false);
+        REQUIRE(parallel == serial);
+    }
+
+    SECTION("Halting")
+    {
+        halt = 1;
+        render16_parallel(t, r, parallel_rows.data(), &halt, NULL, 4, NULL);
+        REQUIRE(parallel == std::vector<uint16_t>(N*N, 0));
+    }
+
+    SECTION("Transformed rendering")
+    {
+        // Rotates by 90 degrees about Z, then shifts along Y
+        const float M[16] = { 0, -1, 0, 0,
+                              1,  0, 0, 0.25,
+                              0,  0, 1, 0,
+                              0,  0, 0, 1 };
+
+        // The same transform, applied by remapping the tree
+        MathTree* mapped = parse(
+                "mnY+Xf0.25Z"
+                "i-r++q-Xf0.3qYqZf0.5-r++q+Xf0.4qYq-Zf0.2f0.3");
+        REQUIRE(mapped != nullptr);
+        std::fill(serial.begin(), serial.end(), 0);
+        render16(mapped, r, serial_rows.data(), &halt, NULL);
+        free_tree(mapped);
+
+        render16_parallel(t, r, parallel_rows.data(), &halt, NULL, 3, M);
+        REQUIRE(parallel == serial);
+        REQUIRE(parallel != std::vector<uint16_t>(N*N, 0));
+    }
+
+    free_arrays(&r);
+    free_tree(t);
+}
+
+TEST_CASE("Depth pyramid")
+{
+    // An odd-sized image, offset from the origin, so that blocks are clipped
+    const unsigned NI = 37, NJ = 23;
+    std::vector<uint16_t> ref(NI*NJ), out(NI*NJ);
+    std::vector<uint16_t*> rows(NJ);
+    for (unsigned j=0; j < NJ; ++j)
+    {
+        rows[j] = &out[j*NI];
+        for (unsigned i=0; i < NI; ++i)
+            ref[j*NI + i] = (i * 7 + j * 13) % 50;
+    }
+    out = ref;
+
+    DepthPyramid* p = new_pyramid(3, 2, NI - 5, NJ - 4);
+    pyramid_load16(p, rows.data());
+
+    srand(0);
+    for (unsigned t=0; t < 2000; ++t)
+    {
+        const unsigned i = 3 + rand() % (NI - 5);
+        const unsigned j = 2 + rand() % (NJ - 4);
+        const unsigned ni = 1 + rand() % (NI - 2 - i);
+        const unsigned nj = 1 + rand() % (NJ - 2 - j);
+        const uint16_t L = rand() % 100;
+
+        bool covered = true;
+        for (unsigned y=j; y < j + nj; ++y)
+            for (unsigned x=i; x < i + ni; ++x)
+                covered &= ref[y*NI + x] >= L;
+        REQUIRE(pyramid_covered(p, i, j, ni, nj, L) == covered);
+        std::vector<uint16_t> read(ni*nj);
+        pyramid_read(p, i, j, ni, nj, read.data());
+        for (unsigned y=j; y < j + nj; ++y)
+            for (unsigned x=i; x < i + ni; ++x)
+                REQUIRE(read[(y - j)*ni + x - i] == ref[y*NI + x]);
+
+        if (t % 3 == 0)
+        {
+            pyramid_fill(p, i, j, ni, nj, L);
+            for (unsigned y=j; y < j + nj; ++y)
+                for (unsigned x=i; x < i + ni; ++x)
+                    ref[y*NI + x] = std::max(ref[y*NI + x], L);
+        }
+        else if (t % 3 == 1)
+        {
+            std::vector<uint16_t> Ls(ni*nj);
+            for (auto& v : Ls)
+                v = rand() % 100;
+            pyramid_write_rect(p, i, j, ni, nj, Ls.data());
+            for (unsigned y=j; y < j + nj; ++y)
+                for (unsigned x=i; x < i + ni; ++x)
+                    ref[y*NI + x] = std::max(ref[y*NI + x],
+                                             Ls[(y - j)*ni + x - i]);
+        }
+    }
+
+    // Pixels outside of the pyramid's rectangle are untouched
+    pyramid_store16(p, rows.data());
+    free_pyramid(p);
+    REQUIRE(out == ref);
+}
+
+TEST_CASE("Rendering over an existing image")
+{
+    MathTree* t = parse("i-r++q-Xf0.3qYqZf0.5-r++q+Xf0.4qYq-Zf0.2f0.3");
+    REQUIRE(t != nullptr);
+
+    const unsigned N = 64;
+    Region r = make_region(N);
+
+    std::vector<uint16_t> blank(N*N, 0), img(N*N);
+    std::vector<uint16_t*> blank_rows(N), img_rows(N);
+    for (unsigned j=0; j < N; ++j)
+    {
+        blank_rows[j] = &blank[j*N];
+        img_rows[j] = &img[j*N];
+        for (unsigned i=0; i < N; ++i)
+            img[j*N + i] = (i < N/2) ? 40000 : 0;
+    }
+
+    int halt = 0;
+    render16(t, r, blank_rows.data(), &halt, NULL);
+    render16(t, r, img_rows.data(), &halt, NULL);
+
+    for (unsigned j=0; j < N; ++j)
+        for (unsigned i=0; i < N; ++i)
+            REQUIRE(img[j*N + i] ==
+                    std::max<uint16_t>(blank[j*N + i], (i < N/2) ? 40000 : 0));
+
+    SECTION("8-bit rendering")
+    {
+        std::vector<uint8_t> img8(N*N, 0);
+        std::vector<uint8_t*> rows8(N);
+        for (unsigned j=0; j < N; ++j)
+            rows8[j] = &img8[j*N];
+        render8(t, r, rows8.data(), &halt, NULL);
+
+        for (unsigned k=0; k < N*N; ++k)
+            REQUIRE(img8[k] == blank[k] >> 8);
+    }
+
+    free_arrays(&r);
+    free_tree(t);
+}
+
+TEST_CASE("Extrusions")
+{
+    // Shapes that (within some regions) don't depend on one or more axes
+    const char* shapes[] = {
+        "aa-r+qXqYf0.7-Zf0.5-nZf0.5",   // Extruded circle
+        "a-Xf0.2-Zf0.3",                // Half-space, cut off in Z
+        "-r+qXqYf0.7",                  // Circle (infinite in Z)
+    };
+
+    const unsigned N = 48;
+    Region r = make_region(N);
+
+    for (const char* math : shapes)
+    {
+        MathTree* t = parse(math);
+        REQUIRE(t != nullptr);
+
+        std::vector<uint16_t> img(N*N, 0);
+        std::vector<uint16_t*> rows(N);
+        for (unsigned j=0; j < N; ++j)
+            rows[j] = &img[j*N];
+
+        int halt = 0;
+        render16(t, r, rows.data(), &halt, NULL);
+
+        // Each pixel is lit to the height of its highest filled voxel
+        EvalContext* ctx = new_context(t);
+        std::vector<uint16_t> expected(N*N, 0);
+        for (unsigned j=0; j < N; ++j)
+            for (unsigned i=0; i < N; ++i)
+                for (int k=N - 1; k >= 0; --k)
+                    if (eval_f(ctx, r.X[i], r.Y[j], r.Z[k]) < 0)
+                    {
+                        expected[j*N + i] = r.L[k + 1];
+                        break;
+                    }
+        free_context(ctx);
+
+        REQUIRE(img == expected);
+        REQUIRE(img != std::vector<uint16_t>(N*N, 0));
+        free_tree(t);
+    }
+
+    free_arrays(&r);
+}
+
+TEST_CASE("Seeding from a coarse render")
+{
+    MathTree* t = parse("i-r++q-Xf0.3qYqZf0.5-r++q+Xf0.4qYq-Zf0.2f0.3");
+    REQUIRE(t != nullptr);
+
+    // Renders the same volume at two resolutions
+    const unsigned N = 64;
+    Region coarse = make_region(N / 2);
+    Region fine = make_region(N);
+
+    std::vector<uint16_t> low(N*N/4, 0), full(N*N, 0), seeded(N*N);
+    std::vector<uint16_t*> low_rows(N/2), full_rows(N), seeded_rows(N);
+    for (unsigned j=0; j < N; ++j)
+    {
+        full_rows[j] = &full[j*N];
+        seeded_rows[j] = &seeded[j*N];
+        if (j < N/2)
+            low_rows[j] = &low[j*N/2];
+    }
+
+    int halt = 0;
+    render16(t, coarse, low_rows.data(), &halt, NULL);
+    render16(t, fine, full_rows.data(), &halt, NULL);
+
+    SECTION("Upsampled guesses")
+    {
+        for (unsigned j=0; j < N; ++j)
+            for (unsigned i=0; i < N; ++i)
+                seeded[j*N + i] = low[(j/2)*N/2 + i/2];
+        render16_seeded_parallel(t, fine, seeded_rows.data(), &halt, NULL,
+                                 3, NULL);
+        REQUIRE(seeded == full);
+    }
+
+    SECTION("Bad guesses")
+    {
+        srand(0);
+        for (auto& p : seeded)
+            p = (rand() % 2) ? rand() % 65536 : 0;
+        render16_seeded_parallel(t, fine, seeded_rows.data(), &halt, NULL,
+                                 3, NULL);
+        REQUIRE(seeded == full);
+    }
+
+    free_arrays(&coarse);
+    free_arrays(&fine);
+    free_tree(t);
+}
@@ -1,8 +1,17 @@
+#include <string>
+#include <vector>
+
 #include <catch/catch.hpp>
 
 #include "fab/fab.h"
 #include "fab/types/shape.h"
 #include "fab/types/transform.h"
+#include "fab/types/parse_cache.h"
+#include "fab/tree/parser.h"
+#include "fab/tree/tape.h"
+#include "fab/tree/context.h"
+#include "fab/tree/eval.h"
+#include "fab/util/region.h"
 
 TEST_CASE("Transforming a shape")
 {
@@ -10,7 +19,231 @@ TEST_CASE("Transforming a shape")
 
     // Apply a 2D transform to the shape
     Shape b = a.map(Transform("+Xf2.0","","",""));
-    REQUIRE(b.math == "m+Xf2.0__+Xf1.0");
+    REQUIRE(b.getMath() == "m+Xf2.0__+Xf1.0");
+}
+
+TEST_CASE("Combining shapes")
+{
+    Shape a("-r+qXqYf1", Bounds(-1, -1, 1, 1));
+    Shape b("-r+q-Xf1qYf1", Bounds(0, -1, 2, 1));
+
+    Shape c = a | b;
+    REQUIRE(c.getMath() == "iBf-1f-1_f1f1_" + a.getMath() +
+                            "Bf0f-1_f2f1_" + b.getMath());
+    REQUIRE(c.bounds.xmin == -1);
+    REQUIRE(c.bounds.xmax == 2);
+
+    Shape d = ~(a & b);
+    REQUIRE(d.getMath() == "naBf-1f-1_f1f1_" + a.getMath() +
+                             "Bf0f-1_f2f1_" + b.getMath());
+
+    // Identical expressions share a single node
+    REQUIRE(Shape("+Xf1").expr == Shape("+Xf1").expr);
+
+    // Operands are marked with their bounds
+    REQUIRE(c.expr->lhs->op == OP_BOUNDS);
+    REQUIRE(c.expr->lhs->lhs == a.expr);
+    REQUIRE(c.expr->lhs->box[3] == 1);
+
+    // Without bounds, the lazily-built tree matches the parsed math string
+    Shape e = Shape(a.getMath()) | Shape(b.getMath());
+    MathTree* t = parse(e.getMath().c_str());
+    REQUIRE(Expr::fromTree(t) == e.expr);
+    REQUIRE(e.getTree()->num_levels == t->num_levels);
+    free_tree(t);
+}
+
+TEST_CASE("Bounds in math strings")
+{
+    // A half-plane, which is cut off by its bounds when combined
+    Shape a("-Xf5", Bounds(-1, -1, 1, 1));
+    Shape b("-r+q-Xf10qYf1", Bounds(9, -1, 11, 1));
+    Shape c = a | b;
+
+    // Rebuilding the shape from its math string keeps the boxes
+    Shape r(c.getMath(), c.bounds);
+    REQUIRE(r.expr == c.expr);
+    REQUIRE(r.getTree()->num_levels == c.getTree()->num_levels);
+
+    // So does building a new shape around the string (here, an offset)
+    Shape o("-" + c.getMath() + "f0.1", c.bounds);
+    EvalContext* ctx = new_context(o.getTree().get());
+    REQUIRE(eval_f(ctx, 3, 0, 0) > 0);
+    REQUIRE(eval_f(ctx, 0, 0, 0) < 0);
+    REQUIRE(eval_f(ctx, 10, 0, 0) < 0);
+    free_context(ctx);
+
+    // Boxes are dropped inside of maps that move an axis, both from the
+    // expression and when parsing the math string
+    Shape m = c.map(Transform("+Xf1", "", "-Xf1", ""));
+    for (auto tree : {m.getTree(), Shape(m.getMath()).getTree()})
+    {
+        REQUIRE(tree->num_levels == m.getTree()->num_levels);
+        ctx = new_context(tree.get());
+        REQUIRE(eval_f(ctx, 3, 0, 0) == Approx(-1));
+        free_context(ctx);
+    }
+
+    Shape k = c.map(Transform("X", "", "X", ""));
+    REQUIRE(k.expr == c.expr);
+    REQUIRE(Shape(k.getMath()).expr == k.expr);
+
+    // Sides of a box must be constants
+    REQUIRE_THROWS_AS(Shape("BXf0_f1f1_-Xf5"), fab::ParseError);
+}
+
+TEST_CASE("Combining many shapes")
+{
+    // Long chains of unions shouldn't recurse through the whole chain,
+    // and are rebalanced when the tree is built
+    Shape s("-Xf0");
+    for (int i=1; i < 5000; ++i)
+        s = s | Shape("-Xf" + std::to_string(i));
+
+    REQUIRE(s.getTree()->num_levels == 14);
+    REQUIRE(s.getMath().substr(0, 3) == "iii");
+}
+
+TEST_CASE("Bounded unions")
+{
+    // A grid of small circles, each with tight bounds
+    const int n = 16;
+    std::vector<Shape> circles;
+    for (int i=0; i < n; ++i)
+        for (int j=0; j < n; ++j)
+            circles.push_back(Shape(
+                "-r+q-Xf" + std::to_string(i) + "q-Yf" +
+                std::to_string(j) + "f0.3",
+                Bounds(i - 0.3, j - 0.3, i + 0.3, j + 0.3)));
+
+    Shape s = circles[0];
+    for (unsigned i=1; i < circles.size(); ++i)
+        s = s | circles[i];
+
+    // The same union, without bounds
+    Shape u(circles[0].getMath());
+    for (unsigned i=1; i < circles.size(); ++i)
+        u = u | Shape(circles[i].getMath());
+    auto plain = u.getTree();
+    auto tree = s.getTree();
+    REQUIRE(tree->tape->num_clauses > plain->tape->num_clauses);
+
+    EvalContext* a = new_context(tree.get());
+    EvalContext* b = new_context(plain.get());
+
+    SECTION("Scalar")
+    {
+        for (float x=-1; x <= n; x += 0.0625)
+            for (float y=-1; y <= n; y += 0.25)
+                REQUIRE((eval_f(a, x, y, 0) < 0) == (eval_f(b, x, y, 0) < 0));
+    }
+
+    SECTION("Array")
+    {
+        float X[64], Y[64], Z[64];
+        for (int q=0; q < 64; ++q)
+        {
+            X[q] = 2.5 + (q % 8) * 0.15;
+            Y[q] = 4.5 + (q / 8) * 0.15;
+            Z[q] = 0;
+        }
+        Region r;
+        r.X = X;
+        r.Y = Y;
+        r.Z = Z;
+        r.voxels = 64;
+
+        float* fa = eval_r(a, r);
+        std::vector<float> out(fa, fa + 64);
+        float* fb = eval_r(b, r);
+        for (int q=0; q < 64; ++q)
+            REQUIRE((out[q] < 0) == (fb[q] < 0));
+    }
+
+    SECTION("Pruning")
+    {
+        unsigned full;
+        context_clauses(a, &full);
+
+        // Only one circle overlaps this region
+        const Interval r = eval_i(a, {2.6, 3.4}, {4.6, 5.4}, {0, 0});
+        REQUIRE(r.lower < 0);
+        REQUIRE(r.upper > 0);
+
+        disable_nodes(a);
+        unsigned pruned;
+        context_clauses(a, &pruned);
+        REQUIRE(pruned < full / 10);
+
+        REQUIRE(eval_f(a, 3, 5, 0) == Approx(-0.3));
+        REQUIRE(eval_f(a, 2.7, 4.7, 0) > 0);
+        enable_nodes(a);
+    }
+
+    SECTION("Batched intervals")
+    {
+        // Guards are only skipped for circles that miss every box
+        Interval X[4], Y[4], Z[4], out[4];
+        for (int q=0; q < 4; ++q)
+        {
+            X[q] = {2.6f + 0.4f*(q & 1), 3.0f + 0.4f*(q & 1)};
+            Y[q] = {4.6f + 0.4f*(q >> 1), 5.0f + 0.4f*(q >> 1)};
+            Z[q] = {0, 0};
+        }
+        eval_i_batch(a, X, Y, Z, 4, out);
+        for (int q=0; q < 4; ++q)
+        {
+            const Interval r = eval_i(b, X[q], Y[q], Z[q]);
+            REQUIRE((out[q].lower < 0) == (r.lower < 0));
+            REQUIRE((out[q].upper < 0) == (r.upper < 0));
+
+            select_batch(a, q);
+            disable_nodes(a);
+            REQUIRE(eval_f(a, 3, 5, 0) == Approx(-0.3));
+            enable_nodes(a);
+        }
+        pop_batch(a);
+    }
+
+    free_context(a);
+    free_context(b);
+}
+
+TEST_CASE("Parse cache")
+{
+    ParseCache& cache = ParseCache::instance();
+    cache.clear();
+    const unsigned long hits = cache.hits();
+    const unsigned long misses = cache.misses();
+
+    Shape a("-r+q-Xf0.5qYf0.25");
+    Shape b("-r+q-Xf0.5qYf0.25", Bounds(-1, -1, 1, 1));
+    REQUIRE(cache.misses() == misses + 1);
+    REQUIRE(cache.hits() == hits + 1);
+    REQUIRE(cache.entries() == 1);
+
+    // Shapes built from the same string share a tree
+    REQUIRE(a.getTree() == b.getTree());
+
+    SECTION("Eviction")
+    {
+        Shape c("+Xf2");
+        REQUIRE(cache.entries() == 2);
+
+        // Shrinking the cache drops the least-recently-used entries first
+        cache.get("-r+q-Xf0.5qYf0.25");
+        cache.setCapacity(cache.size() - 1);
+        REQUIRE(cache.entries() == 1);
+        REQUIRE(cache.get("-r+q-Xf0.5qYf0.25").tree == a.getTree());
+
+        cache.setCapacity(ParseCache::DEFAULT_CAPACITY);
+    }
+
+    SECTION("Failed parses aren't cached")
+    {
+        REQUIRE_THROWS_AS(cache.get("+X"), fab::ParseError);
+        REQUIRE(cache.entries() == 1);
+    }
 }
 
 TEST_CASE("Transforming bounds")
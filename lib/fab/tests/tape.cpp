@@ -0,0 +1,527 @@
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch/catch.hpp>
+
+#include "fab/tree/tree.h"
+#include "fab/tree/tape.h"
+#include "fab/tree/context.h"
+#include "fab/tree/eval.h"
+#include "fab/tree/parser.h"
+#include "fab/tree/simplify.h"
+#include "fab/tree/math/math_g.h"
+#include "fab/util/region.h"
+
+static unsigned active_clauses(EvalContext* ctx)
+{
+    unsigned count;
+    context_clauses(ctx, &count);
+    return count;
+}
+
+TEST_CASE("Tape evaluation")
+{
+    MathTree* t = parse("-r+qXqYf1");
+    REQUIRE(t != nullptr);
+    REQUIRE(t->tape != nullptr);
+    EvalContext* ctx = new_context(t);
+
+    SECTION("Scalar")
+    {
+        REQUIRE(eval_f(ctx, 3, 4, 0) == Approx(4));
+        REQUIRE(eval_f(ctx, 0, 0, 0) == Approx(-1));
+    }
+
+    SECTION("Interval")
+    {
+        Interval r = eval_i(ctx, Interval{0, 1}, Interval{0, 1},
+                                 Interval{0, 0});
+        REQUIRE(r.lower == Approx(-1));
+        REQUIRE(r.upper == Approx(0.414214));
+    }
+
+    SECTION("Array")
+    {
+        float X[] = {0, 3, 1}, Y[] = {0, 4, 0}, Z[] = {0, 0, 0};
+        Region r;
+        r.X = X;
+        r.Y = Y;
+        r.Z = Z;
+        r.voxels = 3;
+        float* out = eval_r(ctx, r);
+        REQUIRE(out[0] == Approx(-1));
+        REQUIRE(out[1] == Approx(4));
+        REQUIRE(out[2] == Approx(0));
+    }
+
+    free_context(ctx);
+    free_tree(t);
+}
+
+TEST_CASE("Tape pruning")
+{
+    // Union of two circles, centered at x = -2 and x = 2
+    MathTree* t = parse("i-r+q+Xf2qYf1-r+q-Xf2qYf1");
+    REQUIRE(t != nullptr);
+    EvalContext* ctx = new_context(t);
+    const unsigned full = active_clauses(ctx);
+
+    eval_i(ctx, Interval{1.5, 2.5}, Interval{-0.5, 0.5},
+                Interval{0, 0});
+    disable_nodes(ctx);
+    const unsigned pruned = active_clauses(ctx);
+    REQUIRE(pruned < full);
+
+    // Only the right-hand circle should remain in this region
+    REQUIRE(eval_f(ctx, 2, 0, 0) == Approx(-1));
+    REQUIRE(eval_f(ctx, 2.5, 0, 0) == Approx(-0.5));
+
+    SECTION("Nested pruning")
+    {
+        eval_i(ctx, Interval{1.9, 2.1}, Interval{-0.1, 0.1},
+                    Interval{0, 0});
+        disable_nodes(ctx);
+        disable_nodes_binary(ctx);
+        REQUIRE(active_clauses(ctx) < pruned);
+        REQUIRE(eval_f(ctx, 2, 0, 0) < 0);
+
+        enable_nodes(ctx);
+        REQUIRE(active_clauses(ctx) == pruned);
+    }
+
+    enable_nodes(ctx);
+    REQUIRE(active_clauses(ctx) == full);
+    REQUIRE(eval_f(ctx, -2, 0, 0) == Approx(-1));
+
+    free_context(ctx);
+    free_tree(t);
+}
+
+TEST_CASE("Sharing a tree between contexts")
+{
+    MathTree* t = parse("i-r+q+Xf2qYf1-r+q-Xf2qYf1");
+    REQUIRE(t != nullptr);
+
+    SECTION("Pruning is per-context")
+    {
+        EvalContext* a = new_context(t);
+        EvalContext* b = new_context(t);
+
+        eval_i(a, Interval{1.5, 2.5}, Interval{-0.5, 0.5}, Interval{0, 0});
+        disable_nodes(a);
+        REQUIRE(active_clauses(a) < active_clauses(b));
+        REQUIRE(eval_f(b, -2, 0, 0) == Approx(-1));
+
+        free_context(a);
+        free_context(b);
+    }
+
+    SECTION("Concurrent evaluation")
+    {
+        std::vector<int> ok(8, 0);
+        std::vector<std::thread> threads;
+        for (int n=0; n < 8; ++n)
+            threads.push_back(std::thread([&, n]() {
+                EvalContext* ctx = new_context(t);
+                const float x = n % 2 ? 2 : -2;
+                bool good = true;
+                for (int i=0; i < 1000; ++i)
+                {
+                    eval_i(ctx, Interval{x - 0.5f, x + 0.5f},
+                                Interval{-0.5, 0.5}, Interval{0, 0});
+                    disable_nodes(ctx);
+                    good &= eval_f(ctx, x, 0, 0) == Approx(-1);
+                    enable_nodes(ctx);
+                }
+                free_context(ctx);
+                ok[n] = good;
+            }));
+        for (auto& th : threads)
+            th.join();
+        for (int n=0; n < 8; ++n)
+            REQUIRE(ok[n]);
+    }
+
+    free_tree(t);
+}
+
+TEST_CASE("Affine fusion")
+{
+    // A circle that's been scaled, moved, and rotated by nested remaps
+    const char* math = "m-*Xf0.6*Yf0.8+*Xf0.8*Yf0.6_"
+                       "m*+Xf1f2-YX_"
+                       "-r+qXqYf1";
+
+    set_simplify(false);
+    MathTree* full = parse(math);
+    set_simplify(true);
+    MathTree* t = parse(math);
+    REQUIRE(full != nullptr);
+    REQUIRE(t != nullptr);
+
+    // The remapped coordinates should each be a single affine node
+    REQUIRE(t->active[0] == 2);
+    REQUIRE(t->nodes[0][0]->opcode == OP_AFFINE);
+    REQUIRE(t->nodes[0][1]->opcode == OP_AFFINE);
+    REQUIRE(t->tape->num_clauses < full->tape->num_clauses);
+
+    EvalContext* a = new_context(t);
+    EvalContext* b = new_context(full);
+
+    SECTION("Scalar")
+    {
+        for (float x=-1; x <= 1; x += 0.5)
+            for (float y=-1; y <= 1; y += 0.5)
+                REQUIRE(eval_f(a, x, y, 0) == Approx(eval_f(b, x, y, 0)));
+    }
+
+    SECTION("Interval")
+    {
+        const Interval X = {0, 0.5}, Y = {-0.25, 0.25}, Z = {0, 0};
+        const Interval ra = eval_i(a, X, Y, Z),
+                       rb = eval_i(b, X, Y, Z);
+        REQUIRE(ra.lower >= rb.lower);
+        REQUIRE(ra.upper <= rb.upper);
+        const float wa = ra.upper - ra.lower, wb = rb.upper - rb.lower;
+        REQUIRE(wa < wb);
+    }
+
+    SECTION("Array and derivatives")
+    {
+        // Compare with and without an extra view transform
+        const float M[16] = { 0, -1, 0, 0.5,
+                              1,  0, 0, 0.25,
+                              0,  0, 1, 0,
+                              0,  0, 0, 1 };
+        for (const float* T : {(const float*)nullptr, M})
+        {
+            set_transform(a, T);
+            set_transform(b, T);
+
+            float X[] = {0, 0.3, -1, 2}, Y[] = {0, 0.4, 0.5, -1},
+                  Z[] = {0, 0, 0, 0};
+            Region r;
+            r.X = X;
+            r.Y = Y;
+            r.Z = Z;
+            r.voxels = 4;
+
+            std::vector<float> fa(4), fb(4);
+            std::copy(eval_r(a, r), eval_r(a, r) + 4, fa.begin());
+            std::copy(eval_r(b, r), eval_r(b, r) + 4, fb.begin());
+
+            derivative* ga = eval_g(a, r);
+            std::vector<derivative> gs(ga, ga + 4);
+            derivative* gb = eval_g(b, r);
+            for (int q=0; q < 4; ++q)
+            {
+                REQUIRE(fa[q] == Approx(fb[q]));
+                REQUIRE(gs[q].v  == Approx(gb[q].v));
+                REQUIRE(gs[q].dx == Approx(gb[q].dx));
+                REQUIRE(gs[q].dy == Approx(gb[q].dy));
+                REQUIRE(gs[q].dz == Approx(gb[q].dz));
+            }
+        }
+    }
+
+    free_context(a);
+    free_context(b);
+    free_tree(full);
+    free_tree(t);
+}
+
+TEST_CASE("Domain repetition")
+{
+    // Four circles along X, as a clamped repetition and as a union
+    const char* repeated = "m+f0*f1R/-Xf0f1f3__-r+qXqYf0.3";
+    const char* unioned = "iii-r+qXqYf0.3-r+q-Xf1qYf0.3"
+                          "-r+q-Xf2qYf0.3-r+q-Xf3qYf0.3";
+
+    // Four circles around the origin, as a polar repetition and as a union
+    const char* polar = "m*r+qXqYc+%+AYXf0.785398f1.570796f-0.785398"
+                         "*r+qXqYs+%+AYXf0.785398f1.570796f-0.785398_"
+                         "-r+q-Xf1qYf0.2";
+    const char* rotated = "iii-r+q-Xf1qYf0.2-r+qXq-Yf1f0.2"
+                          "-r+q+Xf1qYf0.2-r+qXq+Yf1f0.2";
+
+    SECTION("Tree size doesn't depend on count")
+    {
+        MathTree* a = parse(repeated);
+        MathTree* b = parse("m+f0*f1R/-Xf0f1f99__-r+qXqYf0.3");
+        REQUIRE(a->tape->num_clauses == b->tape->num_clauses);
+        free_tree(a);
+        free_tree(b);
+    }
+
+    for (auto p : {std::make_pair(repeated, unioned),
+                   std::make_pair(polar, rotated)})
+    {
+        MathTree* ta = parse(p.first);
+        MathTree* tb = parse(p.second);
+        REQUIRE(ta != nullptr);
+        REQUIRE(tb != nullptr);
+        EvalContext* a = new_context(ta);
+        EvalContext* b = new_context(tb);
+
+        SECTION(std::string("Scalar: ") + p.first)
+        {
+            for (float x=-1.5; x <= 4; x += 0.125)
+                for (float y=-1.5; y <= 1.5; y += 0.125)
+                    REQUIRE(eval_f(a, x, y, 0) ==
+                            Approx(eval_f(b, x, y, 0)).epsilon(1e-4));
+        }
+
+        SECTION(std::string("Interval: ") + p.first)
+        {
+            // Boxes within a cell, across cells, and past the last cell
+            const Interval boxes[][2] = {{{0.1, 0.2}, {-0.1, 0.1}},
+                                         {{0.4, 2.2}, {0.2, 0.3}},
+                                         {{2.6, 5.0}, {-1.0, 1.0}},
+                                         {{-2.0, -0.5}, {-0.5, 1.5}}};
+            for (const auto& box : boxes)
+            {
+                const Interval r = eval_i(a, box[0], box[1], {0, 0});
+                for (int i=0; i <= 8; ++i)
+                    for (int j=0; j <= 8; ++j)
+                    {
+                        const float x = box[0].lower +
+                            i * (box[0].upper - box[0].lower) / 8;
+                        const float y = box[1].lower +
+                            j * (box[1].upper - box[1].lower) / 8;
+                        const float f = eval_f(a, x, y, 0);
+                        REQUIRE(f >= r.lower - 1e-5);
+                        REQUIRE(f <= r.upper + 1e-5);
+                    }
+            }
+        }
+
+        SECTION(std::string("Derivatives: ") + p.first)
+        {
+            float X[] = {0.1, 1.2, 2.7, -0.5, 3.5, 0.1},
+                  Y[] = {0.2, -0.1, 0.3, 0.9, -0.2, -0.9},
+                  Z[] = {0, 0, 0, 0, 0, 0};
+            Region r;
+            r.X = X;
+            r.Y = Y;
+            r.Z = Z;
+            r.voxels = 6;
+
+            derivative* ga = eval_g(a, r);
+            std::vector<derivative> gs(ga, ga + 6);
+            derivative* gb = eval_g(b, r);
+            for (int q=0; q < 6; ++q)
+            {
+                REQUIRE(gs[q].v  == Approx(gb[q].v).epsilon(1e-4));
+                REQUIRE(gs[q].dx == Approx(gb[q].dx).epsilon(1e-4));
+                REQUIRE(gs[q].dy == Approx(gb[q].dy).epsilon(1e-4));
+            }
+        }
+
+        free_context(a);
+        free_context(b);
+        free_tree(ta);
+        free_tree(tb);
+    }
+}
+
+TEST_CASE("Affine arithmetic")
+{
+    const char* shapes[] = {
+        "-*XX*f2*XY",                               // x*x - 2*x*y
+        "-r++qXqYqZf1",                             // Sphere
+        "m-*Xf0.6*Yf0.8+*Xf0.8*Yf0.6_-*XYf0.1",     // Rotated x*y
+        "i-r+qXqYf1-r+q-Xf0.5qYf1",                 // Union of circles
+        "-/f1+qXf1*xnbYf0.5",                       // Division and exp
+        "-s*Xf3Y",                                  // Interval-only sin
+    };
+    const Interval boxes[][3] = {{{1, 2}, {1, 2}, {0, 0}},
+                                 {{-0.5, 0.25}, {0.1, 0.3}, {-0.2, 0.2}},
+                                 {{0.3, 0.35}, {-1.2, -1.1}, {0.5, 0.6}},
+                                 {{-2, 2}, {-2, 2}, {-2, 2}}};
+
+    for (const char* math : shapes)
+    {
+        MathTree* t = parse(math);
+        REQUIRE(t != nullptr);
+        EvalContext* a = new_context(t);
+        EvalContext* b = new_context(t);
+        a->affine = true;
+        b->affine = false;
+
+        SECTION(std::string("Bounds: ") + math)
+        {
+            for (const auto& box : boxes)
+            {
+                const Interval ra = eval_i(a, box[0], box[1], box[2]),
+                               rb = eval_i(b, box[0], box[1], box[2]);
+
+                // Never looser than interval arithmetic
+                REQUIRE(ra.lower >= rb.lower);
+                REQUIRE(ra.upper <= rb.upper);
+
+                // Every sample is within the bounds
+                for (int i=0; i <= 6; ++i)
+                    for (int j=0; j <= 6; ++j)
+                        for (int k=0; k <= 6; ++k)
+                        {
+                            const float x = box[0].lower +
+                                i * (box[0].upper - box[0].lower) / 6;
+                            const float y = box[1].lower +
+                                j * (box[1].upper - box[1].lower) / 6;
+                            const float z = box[2].lower +
+                                k * (box[2].upper - box[2].lower) / 6;
+                            const float f = eval_f(a, x, y, z);
+                            REQUIRE(f >= ra.lower - 1e-5);
+                            REQUIRE(f <= ra.upper + 1e-5);
+                        }
+            }
+        }
+
+        free_context(a);
+        free_context(b);
+        free_tree(t);
+    }
+
+    SECTION("Correlated terms")
+    {
+        // On [1, 2] x [1, 2], x*x - 2*x*y is in [-7, 0]; interval
+        // arithmetic gives [-7, 2], since x*x and x*y are independent.
+        MathTree* t = parse("-*XX*f2*XY");
+        EvalContext* ctx = new_context(t);
+        ctx->affine = true;
+
+        const Interval r = eval_i(ctx, {1, 2}, {1, 2}, {0, 0});
+        REQUIRE(r.upper < 1);
+        REQUIRE(r.lower >= -7.001);
+
+        free_context(ctx);
+        free_tree(t);
+    }
+
+    SECTION("Transformed coordinates")
+    {
+        // A rotation mixes X and Y, which interval arithmetic then
+        // treats as independent when multiplying x by y.
+        MathTree* t = parse("*XY");
+        EvalContext* a = new_context(t);
+        EvalContext* b = new_context(t);
+        a->affine = true;
+        b->affine = false;
+
+        const float M[16] = { 0.6, -0.8, 0, 0,
+                              0.8,  0.6, 0, 0,
+                              0,    0,   1, 0,
+                              0,    0,   0, 1 };
+        set_transform(a, M);
+        set_transform(b, M);
+
+        const Interval X = {1, 2}, Y = {0, 1}, Z = {0, 0};
+        const Interval ra = eval_i(a, X, Y, Z),
+                       rb = eval_i(b, X, Y, Z);
+        const float wa = ra.upper - ra.lower, wb = rb.upper - rb.lower;
+        REQUIRE(wa < wb);
+
+        for (int i=0; i <= 8; ++i)
+            for (int j=0; j <= 8; ++j)
+            {
+                const float f = eval_f(a, 1 + i / 8.0f, j / 8.0f, 0);
+                REQUIRE(f >= ra.lower - 1e-5);
+                REQUIRE(f <= ra.upper + 1e-5);
+            }
+
+        free_context(a);
+        free_context(b);
+        free_tree(t);
+    }
+}
+
+TEST_CASE("Batched interval evaluation")
+{
+    // Union of two circles, centered at x = -2 and x = 2
+    MathTree* t = parse("i-r+q+Xf2qYf1-r+q-Xf2qYf1");
+    REQUIRE(t != nullptr);
+    EvalContext* a = new_context(t);
+    EvalContext* b = new_context(t);
+
+    // Octants of [-4, 4] x [-2, 2] x [-1, 1], with a few left out
+    Interval X[8], Y[8], Z[8], out[8];
+    const unsigned count = 6;
+    for (unsigned q=0; q < count; ++q)
+    {
+        X[q] = (q & 1) ? Interval{0, 4} : Interval{-4, 0};
+        Y[q] = (q & 2) ? Interval{0, 2} : Interval{-2, 0};
+        Z[q] = (q & 4) ? Interval{0, 1} : Interval{-1, 0};
+    }
+
+    SECTION("Matches eval_i")
+    {
+        const float M[16] = { 0.6, -0.8, 0, 0.5,
+                              0.8,  0.6, 0, 0,
+                              0,    0,   1, 0,
+                              0,    0,   0, 1 };
+        for (int transformed=0; transformed < 2; ++transformed)
+        {
+            if (transformed)
+            {
+                set_transform(a, M);
+                set_transform(b, M);
+            }
+            eval_i_batch(a, X, Y, Z, count, out);
+            for (unsigned q=0; q < count; ++q)
+            {
+                const Interval r = eval_i(b, X[q], Y[q], Z[q]);
+                REQUIRE(out[q].lower == r.lower);
+                REQUIRE(out[q].upper == r.upper);
+            }
+            pop_batch(a);
+        }
+    }
+
+    SECTION("Pruning a selected box")
+    {
+        eval_i_batch(a, X, Y, Z, count, out);
+        for (unsigned q=0; q < count; ++q)
+        {
+            select_batch(a, q);
+            disable_nodes(a);
+            eval_i(b, X[q], Y[q], Z[q]);
+            disable_nodes(b);
+
+            REQUIRE(active_clauses(a) == active_clauses(b));
+            for (float x=-4; x <= 4; x += 0.5)
+                REQUIRE(eval_f(a, x, 0.5, 0) == eval_f(b, x, 0.5, 0));
+
+            enable_nodes(a);
+            enable_nodes(b);
+        }
+        pop_batch(a);
+    }
+
+    SECTION("Nested batches")
+    {
+        eval_i_batch(a, X, Y, Z, count, out);
+        select_batch(a, 1);
+        disable_nodes(a);
+
+        // Evaluate the sub-octants of one box with the pruned clauses
+        Interval sx[2] = {{0, 2}, {2, 4}}, sy[2] = {{-2, 0}, {-2, 0}},
+                 sz[2] = {{-1, 0}, {-1, 0}}, sub[2];
+        eval_i_batch(a, sx, sy, sz, 2, sub);
+        for (unsigned q=0; q < 2; ++q)
+        {
+            const Interval r = eval_i(b, sx[q], sy[q], sz[q]);
+            REQUIRE(sub[q].lower == Approx(r.lower));
+            REQUIRE(sub[q].upper == Approx(r.upper));
+        }
+        pop_batch(a);
+
+        enable_nodes(a);
+        select_batch(a, 0);
+        pop_batch(a);
+    }
+
+    free_context(a);
+    free_context(b);
+    free_tree(t);
+}
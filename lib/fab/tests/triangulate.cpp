@@ -0,0 +1,357 @@
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#include <catch/catch.hpp>
+
+#include "fab/tree/tree.h"
+#include "fab/tree/parser.h"
+#include "fab/tree/triangulate.h"
+#include "fab/util/region.h"
+
+#include "util.h"
+
+static std::vector<float> mesh(MathTree* t, Region r, bool detect_edges,
+                               unsigned threads, float tolerance=0)
+{
+    int halt = 0;
+    float* verts;
+    unsigned count;
+
+    if (threads)
+        triangulate_parallel(t, r, detect_edges, &halt, &verts, &count,
+                             threads, tolerance);
+    else
+        triangulate(t, r, detect_edges, &halt, &verts, &count, tolerance);
+
+    std::vector<float> out(verts, verts + count);
+    free(verts);
+    return out;
+}
+
+// Counts the directed edges of a mesh that aren't used exactly once in
+// each direction (so a closed, consistently-wound mesh has none).
+static unsigned open_edges(const std::vector<float>& m)
+{
+    typedef std::vector<float> Vertex;
+    std::map<std::pair<Vertex, Vertex>, int> edges;
+    for (unsigned i=0; i < m.size(); i += 9)
+    {
+        for (int a=0; a < 3; ++a)
+        {
+            const int b = (a + 1) % 3;
+            const Vertex va(&m[i + 3*a], &m[i + 3*a + 3]);
+            const Vertex vb(&m[i + 3*b], &m[i + 3*b + 3]);
+            edges[std::make_pair(va, vb)]++;
+        }
+    }
+
+    unsigned open = 0;
+    for (const auto& e : edges)
+    {
+        auto reversed = edges.find(std::make_pair(e.first.second,
+                                                  e.first.first));
+        if (e.second != 1 || reversed == edges.end() ||
+            reversed->second != 1)
+        {
+            open++;
+        }
+    }
+    return open;
+}
+
+// Sum of signed tetrahedra between the origin and each triangle
+// (which is the volume enclosed by a closed mesh)
+static double volume(const std::vector<float>& m)
+{
+    double v = 0;
+    for (unsigned i=0; i < m.size(); i += 9)
+    {
+        const float* a = &m[i];
+        const float* b = a + 3;
+        const float* c = a + 6;
+        v += (a[0] * (b[1]*c[2] - b[2]*c[1]) -
+              a[1] * (b[0]*c[2] - b[2]*c[0]) +
+              a[2] * (b[0]*c[1] - b[1]*c[0])) / 6;
+    }
+    return v;
+}
+
+// Box from (-0.6, -0.5, -0.7) to (0.6, 0.5, 0.4), which doesn't line
+// up with the voxel grid
+static const char* box_math = "aaaaa-Xf0.6-nXf0.6-Yf0.5-nYf0.5-Zf0.4-nZf0.7";
+
+// Counts how many of the box's corners have a vertex near them
+static int box_corners(const std::vector<float>& m)
+{
+    int found = 0;
+    for (float x : {-0.6f, 0.6f})
+        for (float y : {-0.5f, 0.5f})
+            for (float z : {-0.7f, 0.4f})
+            {
+                bool near = false;
+                for (unsigned i=0; i < m.size() && !near; i += 3)
+                    near = fabs(m[i] - x) < 1e-3 &&
+                           fabs(m[i+1] - y) < 1e-3 &&
+                           fabs(m[i+2] - z) < 1e-3;
+                found += near;
+            }
+    return found;
+}
+
+TEST_CASE("Parallel triangulation")
+{
+    // Union of two spheres
+    MathTree* t = parse("i-r++q-Xf0.3qYqZf0.5-r++q+Xf0.4qYq-Zf0.2f0.3");
+    REQUIRE(t != nullptr);
+
+    const unsigned N = 40;
+    Region r = make_region(N);
+
+    for (bool detect_edges : {false, true})
+    {
+        auto serial = mesh(t, r, detect_edges, 0);
+        REQUIRE(!serial.empty());
+
+        for (unsigned threads : {2, 3, 8})
+            REQUIRE(mesh(t, r, detect_edges, threads) == serial);
+    }
+
+    free_arrays(&r);
+    free_tree(t);
+}
+
+TEST_CASE("Parallel seams")
+{
+    // Sphere with bumps in X and a bulge in Y, whose sin and exp may be
+    // evaluated with slightly different results in SIMD lanes and in the
+    // scalar tail (so blocks can disagree about vertices on their faces,
+    // especially when root-finding to a tolerance)
+    MathTree* t = parse("-r++qXqYqZ+f0.6+*f0.05s*f17X*f0.1xnqY");
+    REQUIRE(t != nullptr);
+
+    const unsigned N = 40;
+    Region r = make_region(N);
+
+    for (float tolerance : {0.0f, 1e-4f})
+    {
+        for (bool detect_edges : {false, true})
+        {
+            auto serial = mesh(t, r, detect_edges, 0, tolerance);
+            REQUIRE(!serial.empty());
+            REQUIRE(open_edges(serial) == 0);
+
+            for (unsigned threads : {2, 3, 8})
+            {
+                auto m = mesh(t, r, detect_edges, threads, tolerance);
+                REQUIRE(open_edges(m) == 0);
+
+                // Same triangles, with vertices no further apart than one
+                // step of the binary search
+                REQUIRE(m.size() == serial.size());
+                float error = 0;
+                for (unsigned i=0; i < m.size(); ++i)
+                    error = fmax(error, fabs(m[i] - serial[i]));
+                REQUIRE(error <= 2.0 / N / 256);
+            }
+        }
+    }
+
+    free_arrays(&r);
+    free_tree(t);
+}
+
+TEST_CASE("Shared edges")
+{
+    // Union of two spheres
+    MathTree* t = parse("i-r++q-Xf0.3qYqZf0.5-r++q+Xf0.4qYq-Zf0.2f0.3");
+    REQUIRE(t != nullptr);
+
+    const unsigned N = 40;
+    Region r = make_region(N);
+
+    // Vertices on each edge of the voxel grid are found once and shared
+    // between voxels, so every edge of the mesh should be used once in
+    // each direction.
+    auto m = mesh(t, r, false, 0);
+    REQUIRE(!m.empty());
+
+    REQUIRE(open_edges(m) == 0);
+
+    free_arrays(&r);
+    free_tree(t);
+}
+
+TEST_CASE("Feature detection")
+{
+    MathTree* t = parse(box_math);
+    REQUIRE(t != nullptr);
+
+    const unsigned N = 37;
+    Region r = make_region(N);
+
+    REQUIRE(box_corners(mesh(t, r, false, 0)) == 0);
+    REQUIRE(box_corners(mesh(t, r, true, 0)) == 8);
+
+    free_arrays(&r);
+    free_tree(t);
+}
+
+TEST_CASE("Root finding with a tolerance")
+{
+    // Sphere of radius 0.8
+    MathTree* t = parse("-r++qXqYqZf0.8");
+    REQUIRE(t != nullptr);
+
+    const unsigned N = 32;
+    Region r = make_region(N);
+
+    auto exact = mesh(t, r, false, 0);
+    REQUIRE(!exact.empty());
+
+    for (float tolerance : {1e-2f, 1e-4f})
+    {
+        auto m = mesh(t, r, false, 0, tolerance);
+
+        // Vertices are on the same edges, so the mesh has the same
+        // triangles (with slightly different positions).
+        REQUIRE(m.size() == exact.size());
+        REQUIRE(open_edges(m) == 0);
+        for (unsigned i=0; i < m.size(); i += 3)
+        {
+            const float rad = sqrt(pow(m[i], 2) + pow(m[i+1], 2) +
+                                   pow(m[i+2], 2));
+            REQUIRE(fabs(rad - 0.8) < tolerance + 1e-5);
+            REQUIRE(fabs(m[i] - exact[i]) < 2.0 / N / 256 + tolerance);
+        }
+
+        REQUIRE(mesh(t, r, false, 3, tolerance) == m);
+    }
+
+    free_arrays(&r);
+    free_tree(t);
+}
+
+TEST_CASE("Meshing extrusions")
+{
+    // Cylinder of radius 0.7, from z = -0.5 to 0.5
+    MathTree* t = parse("aa-r+qXqYf0.7-Zf0.5-nZf0.5");
+    REQUIRE(t != nullptr);
+
+    const unsigned N = 40;
+    Region r = make_region(N);
+
+    auto serial = mesh(t, r, false, 0);
+    REQUIRE(!serial.empty());
+
+    SECTION("Vertices are on the surface")
+    {
+        for (unsigned i=0; i < serial.size(); i += 3)
+        {
+            const float rad = sqrt(pow(serial[i], 2) + pow(serial[i+1], 2));
+            const float wall = fabs(rad - 0.7);
+            const float cap = fabs(fabs(serial[i+2]) - 0.5);
+            REQUIRE(std::min(wall, cap) < 0.01);
+        }
+    }
+
+    SECTION("Enclosed volume")
+    {
+        REQUIRE(fabs(volume(serial)) == Approx(M_PI * 0.49).epsilon(0.02));
+    }
+
+    SECTION("Parallel meshing")
+    {
+        for (unsigned threads : {2, 8})
+            REQUIRE(mesh(t, r, false, threads) == serial);
+    }
+
+    SECTION("Closed mesh")
+    {
+        // Columns that are meshed as prisms must line up with the voxels
+        // beside them that are subdivided in Z.
+        REQUIRE(open_edges(serial) == 0);
+        REQUIRE(open_edges(mesh(t, r, true, 0)) == 0);
+        REQUIRE(open_edges(mesh(t, r, false, 0, 1e-4)) == 0);
+    }
+
+    SECTION("Rotated box")
+    {
+        // Box rotated by 30 degrees about Z, from z = -0.5 to 0.5
+        MathTree* box = parse(
+                "aaaaa-+*f0.866X*f0.5Yf0.5-n+*f0.866X*f0.5Yf0.5"
+                "-+*f-0.5X*f0.866Yf0.4-n+*f-0.5X*f0.866Yf0.4"
+                "-Zf0.5-nZf0.5");
+        REQUIRE(box != nullptr);
+
+        auto m = mesh(box, r, false, 0);
+        REQUIRE(!m.empty());
+        REQUIRE(open_edges(m) == 0);
+        free_tree(box);
+    }
+
+    free_arrays(&r);
+    free_tree(t);
+}
+
+TEST_CASE("Dual contouring")
+{
+    const unsigned N = 37;
+    Region r = make_region(N);
+
+    auto dual = [&](MathTree* t)
+    {
+        int halt = 0;
+        float* verts;
+        unsigned count;
+        triangulate_dual(t, r, &halt, &verts, &count);
+
+        std::vector<float> out(verts, verts + count);
+        free(verts);
+        return out;
+    };
+
+    SECTION("Sphere")
+    {
+        MathTree* t = parse("-r++qXqYqZf0.8");
+        REQUIRE(t != nullptr);
+
+        auto m = dual(t);
+        REQUIRE(!m.empty());
+
+        for (unsigned i=0; i < m.size(); i += 3)
+        {
+            const float rad = sqrt(pow(m[i], 2) + pow(m[i+1], 2) +
+                                   pow(m[i+2], 2));
+            REQUIRE(fabs(rad - 0.8) < 0.01);
+        }
+
+        // The mesh is closed, with triangles wound the same way as the
+        // tetrahedral mesher's, and collapsing voxels on the smooth
+        // surface leaves it with fewer triangles.
+        auto tets = mesh(t, r, false, 0);
+        REQUIRE(volume(m) == Approx(volume(tets)).epsilon(0.01));
+        REQUIRE(m.size() < tets.size() / 2);
+
+        REQUIRE(open_edges(m) == 0);
+
+        free_tree(t);
+    }
+
+    SECTION("Box")
+    {
+        MathTree* t = parse(box_math);
+        REQUIRE(t != nullptr);
+
+        auto m = dual(t);
+        REQUIRE(volume(m) == Approx(1.2 * 1.0 * 1.1).epsilon(1e-3));
+
+        // Every corner gets a vertex from the QEF, without feature detection
+        REQUIRE(box_corners(m) == 8);
+
+        free_tree(t);
+    }
+
+    free_arrays(&r);
+}
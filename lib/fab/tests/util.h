@@ -0,0 +1,24 @@
+#ifndef TESTS_UTIL_H
+#define TESTS_UTIL_H
+
+#include <cstring>
+
+#include "fab/util/region.h"
+
+/*
+ *  Returns an N x N x N region from -1 to 1 on every axis, with its
+ *  arrays built (the caller frees them with free_arrays).
+ */
+inline Region make_region(unsigned N)
+{
+    Region r;
+    memset(&r, 0, sizeof(r));
+    r.ni = N;
+    r.nj = N;
+    r.nk = N;
+    r.voxels = N*N*N;
+    build_arrays(&r, -1, -1, -1, 1, 1, 1);
+    return r;
+}
+
+#endif
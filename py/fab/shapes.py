@@ -1,3 +1,4 @@
+import copy
 import math
 import functools
 import operator
@@ -49,7 +50,7 @@ def buffer(a):
 def set_color(a, r, g, b):
     """ Applies a given color to an input shape a and returns it.
     """
-    q = Shape(a.math, a.bounds)
+    q = copy.copy(a)
     q._r, q._g, q._b = r, g, b
     return q
 
@@ -522,6 +523,34 @@ def taper_x_y(part, x0, y0, y1, s0, s1):
 def iterate2d(part, i, j, dx, dy):
     return iterate3d(part, i, j, 1, dx, dy, 1)
 
+def _repeat_axis(part, axis, n, d):
+    """ Tiles a part n times along one axis (0, 1, or 2), with spacing d.
+
+        If the part fits in a single cell, the axis is folded with a
+        clamped repetition (so the tree doesn't grow with n); otherwise,
+        the copies overlap and are unioned explicitly.
+    """
+    if n == 1:
+        return part
+
+    b = part.bounds
+    lo, hi = [(b.xmin, b.xmax), (b.ymin, b.ymax), (b.zmin, b.zmax)][axis]
+    if math.isinf(lo) or math.isinf(hi) or d == 0 or hi - lo > abs(d):
+        return functools.reduce(operator.or_,
+                [move(part, *[a*d if q == axis else 0 for q in range(3)])
+                 for a in range(n)])
+
+    # X' = c + d*repeat((X - c)/d, n - 1), where c is the part's center
+    c = (lo + hi) / 2.
+    coords = ['_', '_', '_']
+    coords[axis] = '+f%(c)g*f%(d)gR/-%(A)sf%(c)gf%(d)gf%(m)g' % {
+            'c': c, 'd': d, 'A': 'XYZ'[axis], 'm': n - 1}
+
+    bounds = [b.xmin, b.ymin, b.zmin, b.xmax, b.ymax, b.zmax]
+    bounds[axis] += min(0, (n - 1)*d)
+    bounds[axis + 3] += max(0, (n - 1)*d)
+    return Shape('m' + ''.join(coords) + part.math, *bounds)
+
 @preserve_color
 def iterate3d(part, i, j, k, dx, dy, dz):
     """ Tiles a part in the X, Y, and Z directions.
@@ -529,11 +558,9 @@ def iterate3d(part, i, j, k, dx, dy, dz):
     if i < 1 or j < 1 or k < 1:
         raise ValueError("Invalid value for iteration")
 
-    #FIXME: if you try to do this all at once, segfault
-    xiterate = functools.reduce(operator.or_, [move(part, a*dx, 0, 0) for a in range(i)])
-    yiterate = functools.reduce(operator.or_, [move(xiterate, 0, b*dy, 0) for b in range(j)])
-    ziterate = functools.reduce(operator.or_, [move(yiterate, 0, 0, c*dz) for c in range(k)])
-    return ziterate
+    part = _repeat_axis(part, 0, i, dx)
+    part = _repeat_axis(part, 1, j, dy)
+    return _repeat_axis(part, 2, k, dz)
 
 @preserve_color
 def iterate_polar(part, x, y, n):
@@ -542,10 +569,44 @@ def iterate_polar(part, x, y, n):
 
     if n < 1:
         raise ValueError("Invalid count for iteration")
-
-    return functools.reduce(operator.or_,
-            [rotate(part, 360./n * i, x, y)
-             for i in range(n)])
+    elif n == 1:
+        return part
+
+    # Find the angular span of the part's bounding box about x,y.  If it
+    # fits in one sector, the angle is folded into that sector with a
+    # modulo (so the tree doesn't grow with n); otherwise, the copies
+    # overlap and are unioned explicitly.
+    b = part.bounds
+    corners = [(px - x, py - y) for px in (b.xmin, b.xmax)
+                                for py in (b.ymin, b.ymax)]
+    sector = 2*math.pi / n
+    if (any(math.isinf(c) for xy in corners for c in xy) or
+        (b.xmin <= x <= b.xmax and b.ymin <= y <= b.ymax)):
+        span = None
+    else:
+        center = math.atan2((b.ymin + b.ymax)/2. - y, (b.xmin + b.xmax)/2. - x)
+        angles = [math.atan2(math.sin(math.atan2(cy, cx) - center),
+                             math.cos(math.atan2(cy, cx) - center))
+                  for cx, cy in corners]
+        span = min(angles) + center, max(angles) + center
+
+    if span is None or span[1] - span[0] > sector:
+        return functools.reduce(operator.or_,
+                [rotate(part, 360./n * i, x, y)
+                 for i in range(n)])
+
+    # angle' = mod(angle - a0 + sector/2, sector) + a0 - sector/2,
+    # where a0 is the middle of the part's angular span
+    dx, dy = '-Xf%g' % x, '-Yf%g' % y
+    a0 = (span[0] + span[1]) / 2.
+    r = 'r+q%sq%s' % (dx, dy)
+    angle = '+%%+A%s%sf%g' % (dy, dx, sector/2 - a0) + \
+            'f%gf%g' % (sector, a0 - sector/2)
+
+    R = max(math.hypot(cx, cy) for cx, cy in corners)
+    return Shape('m+f%g*%sc%s' % (x, r, angle) +
+                 '+f%g*%ss%s' % (y, r, angle) + '_' + part.math,
+                 x - R, y - R, b.zmin, x + R, y + R, b.zmax)
 
 ################################################################################
 